@@ -0,0 +1,63 @@
+// animation.cpp
+#include "animation.h"
+
+bool Animation::add_effect(uint8_t row, uint8_t led, uint16_t period_ms, uint16_t on_ms, uint16_t phase_ms) {
+    if (effect_count >= ANIMATION_MAX_EFFECTS || row >= LED_MAX_ROWS || led >= LEDS_PER_ROW) {
+        return false;
+    }
+    if (period_ms < ANIMATION_MIN_PERIOD_MS) {
+        period_ms = ANIMATION_MIN_PERIOD_MS;
+    }
+    if (on_ms > period_ms) {
+        on_ms = period_ms;
+    }
+
+    LEDEffect& effect = effects[effect_count++];
+    effect.row = row;
+    effect.led = led;
+    effect.period_ms = period_ms;
+    effect.on_ms = on_ms;
+    effect.phase_ms = phase_ms % period_ms;
+    return true;
+}
+
+bool Animation::add_vehicle(uint8_t row, uint16_t position, uint16_t speed, uint16_t age_ms) {
+    if (vehicle_count >= ANIMATION_MAX_VEHICLES || row >= LED_MAX_ROWS ||
+        position >= LEDS_PER_ROW * ANIMATION_POSITION_ONE) {
+        return false;
+    }
+
+    Vehicle& vehicle = vehicles[vehicle_count++];
+    vehicle.row = row;
+    vehicle.position = position;
+    vehicle.speed = speed;
+    vehicle.age_ms = age_ms;
+    return true;
+}
+
+uint8_t Animation::vehicle_led(const Vehicle& vehicle, uint32_t now_ms) const {
+    // Signed: a server clock ahead of ours puts production in the future
+    int32_t elapsed_ms = (int32_t)(now_ms - produced_ms) + vehicle.age_ms;
+    if (elapsed_ms < 0) {
+        elapsed_ms = 0;
+    } else if (elapsed_ms > ANIMATION_MAX_EXTRAPOLATION_MS) {
+        elapsed_ms = ANIMATION_MAX_EXTRAPOLATION_MS;
+    }
+
+    // Never past the last stop of the row, the next report places it
+    uint64_t position = vehicle.position + (uint64_t)vehicle.speed * (uint32_t)elapsed_ms / 60000;
+    const uint64_t last = (LEDS_PER_ROW - 1) * ANIMATION_POSITION_ONE;
+    return (uint8_t)((position < last ? position : last) / ANIMATION_POSITION_ONE);
+}
+
+void Animation::render(uint32_t now_ms, Frame& out) const {
+    out = base;
+    for (uint8_t i = 0; i < effect_count; i++) {
+        const LEDEffect& effect = effects[i];
+        bool on = ((now_ms + effect.phase_ms) % effect.period_ms) < effect.on_ms;
+        out.set_led(effect.row, effect.led, on);
+    }
+    for (uint8_t i = 0; i < vehicle_count; i++) {
+        out.set_led(vehicles[i].row, vehicle_led(vehicles[i], now_ms), true);
+    }
+}
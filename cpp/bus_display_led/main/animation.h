@@ -0,0 +1,55 @@
+// animation.h
+#pragma once
+
+#include "frame.h"
+#include <cstdint>
+
+#define ANIMATION_MAX_EFFECTS 32
+#define ANIMATION_MIN_PERIOD_MS 40      // two display ticks, faster blinks would alias
+#define ANIMATION_MAX_VEHICLES 16
+#define ANIMATION_POSITION_ONE 256      // Vehicle::position units per LED
+#define ANIMATION_MAX_EXTRAPOLATION_MS 120000   // older reports are not advanced further
+
+// Per-LED blink: the LED is lit for on_ms out of every period_ms,
+// shifted by phase_ms. Two LEDs blinking in anti-phase read as a
+// vehicle moving between them.
+struct LEDEffect {
+    uint8_t row;
+    uint8_t led;
+    uint16_t period_ms;
+    uint16_t on_ms;
+    uint16_t phase_ms;
+};
+
+// Vehicle dead-reckoned along a row between updates. The row's LEDs are
+// the stops of one line in order; the vehicle is lit at the last stop it
+// passed, advancing at speed from where it was reported. The server leaves
+// its LED out of the base frame.
+struct Vehicle {
+    uint8_t row;
+    uint16_t position;      // ANIMATION_POSITION_ONE per LED, 0 = LED 1
+    uint16_t speed;         // position units per minute, 0 when stopped
+    uint16_t age_ms;        // report age when the frame was produced
+};
+
+// Static base frame plus a bounded set of effects and vehicles rendered on
+// top of it. Rendering is O(effects + vehicles) and never allocates.
+struct Animation {
+    Frame base;
+    LEDEffect effects[ANIMATION_MAX_EFFECTS];
+    uint8_t effect_count;
+    Vehicle vehicles[ANIMATION_MAX_VEHICLES];
+    uint8_t vehicle_count;
+    uint32_t produced_ms;   // when the frame was produced, on the render clock
+
+    Animation() : effect_count(0), vehicle_count(0), produced_ms(0) {}
+    explicit Animation(const Frame& frame) : base(frame), effect_count(0), vehicle_count(0), produced_ms(0) {}
+
+    bool is_static() const { return effect_count == 0 && vehicle_count == 0; }
+    bool add_effect(uint8_t row, uint8_t led, uint16_t period_ms, uint16_t on_ms, uint16_t phase_ms);
+    bool add_vehicle(uint8_t row, uint16_t position, uint16_t speed, uint16_t age_ms);
+    void render(uint32_t now_ms, Frame& out) const;
+
+    // LED a vehicle is shown at, now_ms on the render clock
+    uint8_t vehicle_led(const Vehicle& vehicle, uint32_t now_ms) const;
+};
@@ -0,0 +1,34 @@
+// board_pins.h
+#pragma once
+
+#include <cstdint>
+
+// GPIO Pin Definitions (trillet 1.x boards), GPIO numbers as GpioHal takes
+// them so the pin tables also build on the host
+#define CLOCK_PIN 18
+#define DATA_PIN 15
+#define LATCH_PIN 5
+#define RESET_PIN 19
+#define OE_PIN 2
+
+#define LED_MAX_CHAINS 8
+
+// Per-board pin table. Clock, latch, reset and OE are shared by all chains;
+// each chain has its own data pin so N chains shift in parallel.
+struct LEDPinConfig {
+    int clock;
+    int latch;
+    int reset;
+    int oe;
+    uint8_t chain_count;
+    int data[LED_MAX_CHAINS];
+};
+
+// Single chain, as routed on the trillet 1.1 / 1.2 PCBs
+inline constexpr LEDPinConfig BOARD_PINS_TRILLET_1 = {
+    CLOCK_PIN, LATCH_PIN, RESET_PIN, OE_PIN,
+    1, { DATA_PIN },
+};
+
+// Board built into this firmware
+inline constexpr const LEDPinConfig& BOARD_PINS = BOARD_PINS_TRILLET_1;
@@ -0,0 +1,299 @@
+// display_task.cpp
+#include "display_task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <ctime>
+
+const char* DisplayTask::TAG = "DISPLAY";
+
+DisplayTask::DisplayTask(LEDController& led_controller)
+    : led_controller_(led_controller), timeline_next_(0), timeline_published_at_(0),
+      level_(LED_DEFAULT_BRIGHTNESS), transition_ms_(DISPLAY_TRANSITION_MS), fade_ms_(0), fade_started_us_(0),
+      fade_until_us_(0), pending_published_at_(0), pending_apply_us_(0), task_handle_(nullptr),
+      running_(false) {
+    timeline_.count = 0;
+    memset(schedule_.hourly, LED_DEFAULT_BRIGHTNESS, sizeof(schedule_.hourly));
+    schedule_.default_level = LED_DEFAULT_BRIGHTNESS;
+}
+
+DisplayTask::~DisplayTask() {
+    stop();
+}
+
+bool DisplayTask::start() {
+    if (task_handle_) {
+        ESP_LOGW(TAG, "Display task already running");
+        return true;
+    }
+
+    running_ = true;
+    BaseType_t ret = xTaskCreatePinnedToCore(&task_entry, "display_task", DISPLAY_TASK_STACK_SIZE,
+                                             this, DISPLAY_TASK_PRIORITY, &task_handle_,
+                                             DISPLAY_TASK_CORE);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create display task");
+        running_ = false;
+        task_handle_ = nullptr;
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Display task started (%d ms cadence, core %d)", DISPLAY_TASK_PERIOD_MS, DISPLAY_TASK_CORE);
+    return true;
+}
+
+void DisplayTask::stop() {
+    if (!task_handle_) {
+        return;
+    }
+
+    running_ = false;
+
+    // Let the task finish its current cycle
+    vTaskDelay(pdMS_TO_TICKS(DISPLAY_TASK_PERIOD_MS * 2));
+    task_handle_ = nullptr;
+    ESP_LOGI(TAG, "Display task stopped");
+}
+
+bool DisplayTask::publish(const Frame& frame) {
+    return publish(Animation(frame));
+}
+
+bool DisplayTask::publish(const Animation& animation) {
+    return publish(animation, UPDATE_PATH_POLL, 0);
+}
+
+bool DisplayTask::publish(const Animation& animation, UpdatePath path, int64_t emitted_us) {
+    Update update;
+    update.animation = animation;
+    update.emitted_us = emitted_us;
+    update.path = path;
+    if (!mailbox_.publish(update, esp_timer_get_time())) {
+        ESP_LOGW(TAG, "Frame mailbox full, frame dropped");
+        return false;
+    }
+    return true;
+}
+
+bool DisplayTask::publish_timeline(const Timeline& timeline) {
+    if (!timeline_mailbox_.publish(timeline, esp_timer_get_time())) {
+        ESP_LOGW(TAG, "Timeline mailbox full, timeline dropped");
+        return false;
+    }
+    return true;
+}
+
+void DisplayTask::set_brightness(uint8_t level) {
+    BrightnessSchedule schedule;
+    memset(schedule.hourly, level, sizeof(schedule.hourly));
+    schedule.default_level = level;
+    set_brightness_schedule(schedule);
+}
+
+void DisplayTask::set_brightness_schedule(const BrightnessSchedule& schedule) {
+    schedule_mailbox_.publish(schedule, esp_timer_get_time());
+}
+
+void DisplayTask::set_topology(const DisplayTopology& topology) {
+    topology_mailbox_.publish(topology, esp_timer_get_time());
+}
+
+void DisplayTask::task_entry(void* param) {
+    DisplayTask* display = static_cast<DisplayTask*>(param);
+    display->run();
+    vTaskDelete(NULL);
+}
+
+void DisplayTask::run() {
+    int64_t published_at = 0;
+    bool animating = false;
+    TickType_t last_wake = xTaskGetTickCount();
+    TickType_t last_brightness_update = 0;
+
+    while (running_) {
+        DisplayTopology topology;
+        if (topology_mailbox_.take(topology) && led_controller_.set_topology(topology) && !fade_until_us_) {
+            // Re-latch what is on screen with the new layout, a transition
+            // latches with it anyway
+            show_current(esp_timer_get_time(), false, 0, 0);
+        }
+
+        int64_t timeline_at;
+        if (timeline_mailbox_.take(timeline_, &timeline_at)) {
+            timeline_next_ = 0;
+            timeline_published_at_ = timeline_at;
+        }
+
+        bool taken = false;
+        if (mailbox_.take(current_, &published_at)) {
+            taken = true;
+            if (published_at > timeline_published_at_) {
+                timeline_next_ = timeline_.count;   // superseded
+            }
+            // Vehicles advance from when the server produced the frame
+            current_.animation.produced_ms =
+                (uint32_t)((current_.emitted_us ? current_.emitted_us : published_at) / 1000);
+            animating = !current_.animation.is_static();
+            show_current(esp_timer_get_time(), true, published_at, 0);
+        }
+
+        if (apply_due_timeline_entry(esp_timer_get_time())) {
+            animating = !current_.animation.is_static();
+        } else if (fade_until_us_) {
+            if (esp_timer_get_time() >= fade_until_us_) {
+                finish_transition();
+            }
+        } else if (animating && !taken) {
+            // Effect steps are hard cuts, the controller drops unchanged frames
+            show_current(esp_timer_get_time(), false, 0, 0);
+        }
+
+        // The schedule waits for a running transition, which fades back to level_
+        if (!fade_until_us_ && (schedule_mailbox_.take(schedule_) ||
+            xTaskGetTickCount() - last_brightness_update >= pdMS_TO_TICKS(BRIGHTNESS_UPDATE_MS))) {
+            update_brightness();
+            last_brightness_update = xTaskGetTickCount();
+        }
+
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(DISPLAY_TASK_PERIOD_MS));
+    }
+}
+
+bool DisplayTask::apply_due_timeline_entry(int64_t now_us) {
+    // After a stall only the newest due frame is worth showing
+    int due = -1;
+    while (timeline_next_ < timeline_.count && timeline_.entries[timeline_next_].apply_us <= now_us) {
+        due = timeline_next_++;
+    }
+    if (due < 0) {
+        return false;
+    }
+
+    const Timeline::Entry& entry = timeline_.entries[due];
+    current_.animation = entry.animation;
+    current_.emitted_us = timeline_.emitted_us;
+    current_.path = timeline_.path;
+    current_.animation.produced_ms =
+        (uint32_t)((timeline_.emitted_us ? timeline_.emitted_us : timeline_published_at_) / 1000);
+    show_current(now_us, true, 0, entry.apply_us);
+    return true;
+}
+
+void DisplayTask::show_current(int64_t now_us, bool allow_transition, int64_t published_at, int64_t apply_us) {
+    if (fade_until_us_) {
+        // Joins the running transition, the frame it was for is superseded
+        pending_published_at_ = published_at;
+        pending_apply_us_ = apply_us;
+        return;
+    }
+
+    Frame frame;
+    current_.animation.render((uint32_t)(now_us / 1000), frame);
+    const uint32_t transition_ms = transition_ms_.load(std::memory_order_relaxed);
+    if (!allow_transition || transition_ms == 0 || level_ == 0 || led_controller_.is_latched(frame)) {
+        led_controller_.set_frame(frame);
+        record_latched(esp_timer_get_time(), 0, published_at, apply_us);
+        return;
+    }
+
+    // Fade out without waiting, the frame is latched on the first tick
+    // after it ended, rendered then
+    fade_ms_ = transition_ms / 2;
+    fade_started_us_ = now_us;
+    fade_until_us_ = now_us + (int64_t)fade_ms_ * 1000;
+    pending_published_at_ = published_at;
+    pending_apply_us_ = apply_us;
+    led_controller_.fade_to(0, fade_ms_, false);
+}
+
+void DisplayTask::finish_transition() {
+    Frame frame;
+    const int64_t now_us = esp_timer_get_time();
+    current_.animation.render((uint32_t)(now_us / 1000), frame);
+    led_controller_.set_frame(frame);
+    led_controller_.fade_to(level_, fade_ms_, false);
+    fade_until_us_ = 0;
+
+    const int64_t latched_us = esp_timer_get_time();
+    record_latched(latched_us, latched_us - fade_started_us_, pending_published_at_, pending_apply_us_);
+}
+
+void DisplayTask::record_latched(int64_t latched_us, int64_t faded_us, int64_t published_at, int64_t apply_us) {
+    // The fade is a chosen delay, not latency of the update path
+    const int64_t shown_us = latched_us - faded_us;
+    if (published_at) {
+        latency_.record(shown_us > published_at ? (uint32_t)(shown_us - published_at) : 0);
+        if (current_.emitted_us) {
+            // Server clock skew can put emission "after" the latch
+            int64_t end_to_end = shown_us - current_.emitted_us;
+            update_latency_[current_.path].record(end_to_end > 0 ? (uint32_t)end_to_end : 0);
+        }
+    }
+    if (apply_us) {
+        int64_t late_us = shown_us - apply_us;
+        timeline_lateness_.record(late_us > 0 ? (uint32_t)late_us : 0);
+    }
+}
+
+uint8_t DisplayTask::scheduled_level() const {
+    time_t now = time(nullptr);
+    if (now < 1600000000) {
+        return schedule_.default_level;  // clock not set yet
+    }
+
+    struct tm local;
+    localtime_r(&now, &local);
+    int from = schedule_.hourly[local.tm_hour];
+    int to = schedule_.hourly[(local.tm_hour + 1) % 24];
+    return (uint8_t)(from + (to - from) * local.tm_min / 60);
+}
+
+void DisplayTask::update_brightness() {
+    uint8_t level = scheduled_level();
+    if (level == level_) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Brightness %d -> %d", level_, level);
+    level_ = level;
+    led_controller_.fade_to(level, BRIGHTNESS_RAMP_MS, false);
+}
+
+void DisplayTask::LatencyCounter::record(uint32_t latency_us) {
+    const uint32_t count = frames.load(std::memory_order_relaxed) + 1;
+    total_us += latency_us;
+    avg_us.store((uint32_t)(total_us / count), std::memory_order_relaxed);
+    frames.store(count, std::memory_order_relaxed);
+
+    // Single writer, plain load/store is enough
+    if (latency_us < min_us.load(std::memory_order_relaxed)) {
+        min_us.store(latency_us, std::memory_order_relaxed);
+    }
+    if (latency_us > max_us.load(std::memory_order_relaxed)) {
+        max_us.store(latency_us, std::memory_order_relaxed);
+    }
+}
+
+DisplayTask::LatencyStats DisplayTask::LatencyCounter::read() const {
+    LatencyStats stats{};
+    stats.frames = frames.load(std::memory_order_relaxed);
+    stats.min_us = stats.frames ? min_us.load(std::memory_order_relaxed) : 0;
+    stats.max_us = max_us.load(std::memory_order_relaxed);
+    stats.avg_us = avg_us.load(std::memory_order_relaxed);
+    return stats;
+}
+
+DisplayTask::LatencyStats DisplayTask::get_latency_stats() const {
+    LatencyStats stats = latency_.read();
+    stats.dropped = mailbox_.overwritten();
+    return stats;
+}
+
+DisplayTask::LatencyStats DisplayTask::get_update_latency(UpdatePath path) const {
+    return update_latency_[path < UPDATE_PATH_COUNT ? path : UPDATE_PATH_POLL].read();
+}
+
+DisplayTask::LatencyStats DisplayTask::get_timeline_stats() const {
+    LatencyStats stats = timeline_lateness_.read();
+    stats.dropped = timeline_mailbox_.overwritten();
+    return stats;
+}
@@ -0,0 +1,165 @@
+// display_task.h
+#pragma once
+
+#include "led_controller.h"
+#include "frame.h"
+#include "animation.h"
+#include "frame_mailbox.h"
+#include "frame_codec.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <atomic>
+
+#define DISPLAY_TASK_PERIOD_MS 20       // latch cadence (50 Hz)
+#define DISPLAY_TASK_STACK_SIZE 4096
+#define DISPLAY_TASK_PRIORITY 6
+#define DISPLAY_TASK_CORE APP_CPU_NUM   // keep the display away from the Wi-Fi/TLS core
+#define DISPLAY_TRANSITION_MS 200       // fade-out + fade-in between different frames
+#define BRIGHTNESS_UPDATE_MS 1000       // how often the brightness schedule is evaluated
+#define BRIGHTNESS_RAMP_MS 2000         // fade used when the schedule changes level
+#define DISPLAY_TIMELINE_SLOTS FRAME_CODEC_TIMELINE_MAX_ENTRIES    // frames a timeline schedules ahead
+
+// Brightness by local time of day, linearly interpolated between hours.
+// default_level is used until SNTP has set the clock.
+struct BrightnessSchedule {
+    uint8_t hourly[24];
+    uint8_t default_level;
+};
+
+// How a published frame reached the device
+enum UpdatePath : uint8_t {
+    UPDATE_PATH_POLL,
+    UPDATE_PATH_PUSH,
+    UPDATE_PATH_COUNT,
+};
+
+// Frames from the server to latch at set times (esp_timer clock), in order.
+// Acts as a jitter buffer: late or missing polls do not show as long as
+// the timeline lasts.
+struct Timeline {
+    struct Entry {
+        Animation animation;
+        int64_t apply_us;
+    };
+    Entry entries[DISPLAY_TIMELINE_SLOTS];
+    uint8_t count;
+    UpdatePath path;
+    int64_t emitted_us;     // when the server produced it, 0 when unknown
+};
+
+// Owns the LEDController once started. Producers publish frames or animations
+// into a lock-free mailbox and the task latches the newest one at a fixed
+// cadence, so a slow network fetch never delays rendering. Animations are
+// re-rendered every tick, which also moves dead-reckoned vehicles along;
+// unchanged frames are suppressed by the controller.
+class DisplayTask {
+public:
+    DisplayTask(LEDController& led_controller);
+    ~DisplayTask();
+
+    bool start();
+    void stop();
+    bool is_running() const { return task_handle_ != nullptr; }
+
+    // Callable from any task. A static frame replaces any running animation.
+    bool publish(const Frame& frame);
+    bool publish(const Animation& animation);
+    // Frame from the server: emitted_us is when the server produced it,
+    // converted to the esp_timer clock (0 when unknown), and feeds the
+    // server-to-latch latency of path.
+    bool publish(const Animation& animation, UpdatePath path, int64_t emitted_us);
+    // Replaces whatever was still scheduled; a frame published afterwards
+    // cancels the rest of the timeline.
+    bool publish_timeline(const Timeline& timeline);
+
+    // Brightness, applied by the display task through the OE PWM
+    void set_brightness(uint8_t level);
+    void set_brightness_schedule(const BrightnessSchedule& schedule);
+    void set_transition_ms(uint32_t duration_ms) { transition_ms_ = duration_ms; }
+
+    // Chain layout change, applied by the display task before the next latch
+    void set_topology(const DisplayTopology& topology);
+
+    // Publish-to-latch latency of frames that were actually latched
+    struct LatencyStats {
+        uint32_t frames;
+        uint32_t min_us;
+        uint32_t max_us;
+        uint32_t avg_us;
+        uint32_t dropped;   // overwritten by a newer frame before being latched
+    };
+    LatencyStats get_latency_stats() const;
+
+    // Server-to-latch latency of timestamped frames per update path
+    // (dropped is not tracked per path)
+    LatencyStats get_update_latency(UpdatePath path) const;
+
+    // Apply-time-to-latch lateness of timeline frames
+    LatencyStats get_timeline_stats() const;
+
+private:
+    struct Update {
+        Animation animation;
+        int64_t emitted_us;
+        UpdatePath path;
+    };
+
+    // Single writer (the display task), any number of readers. Only 32-bit
+    // atomics, the ones lock-free on Xtensa: the sum stays with the writer,
+    // readers get the average it publishes.
+    struct LatencyCounter {
+        std::atomic<uint32_t> frames;
+        std::atomic<uint32_t> min_us;
+        std::atomic<uint32_t> max_us;
+        std::atomic<uint32_t> avg_us;
+        uint64_t total_us;      // writer only
+
+        LatencyCounter() : frames(0), min_us(UINT32_MAX), max_us(0), avg_us(0), total_us(0) {}
+        void record(uint32_t latency_us);
+        LatencyStats read() const;
+    };
+
+    static void task_entry(void* param);
+    void run();
+    // Renders current_ and latches it, or starts the transition to it when
+    // it differs from the frame on the LEDs. published_at and apply_us (0
+    // when not applicable) feed the latency and timeline stats once latched.
+    void show_current(int64_t now_us, bool allow_transition, int64_t published_at, int64_t apply_us);
+    // Fade-out over: latches current_, rendered now, and fades back in
+    void finish_transition();
+    void record_latched(int64_t latched_us, int64_t faded_us, int64_t published_at, int64_t apply_us);
+    // Moves to the last timeline frame that is due, false when none is
+    bool apply_due_timeline_entry(int64_t now_us);
+    void update_brightness();
+    uint8_t scheduled_level() const;
+
+    LEDController& led_controller_;
+    Mailbox<Update> mailbox_;
+    Update current_;                    // display task only
+    Mailbox<Timeline, 3> timeline_mailbox_;
+    Timeline timeline_;                 // display task only
+    uint8_t timeline_next_;             // next entry to apply, display task only
+    int64_t timeline_published_at_;     // display task only
+    Mailbox<BrightnessSchedule, 4> schedule_mailbox_;
+    Mailbox<DisplayTopology, 4> topology_mailbox_;
+    BrightnessSchedule schedule_;       // display task only
+    uint8_t level_;                     // display task only
+    std::atomic<uint32_t> transition_ms_;
+
+    // Transition between frames, display task only: the fade-out started
+    // at fade_started_us_ runs without blocking the cadence, and current_
+    // is latched on the first tick after fade_until_us_
+    uint32_t fade_ms_;
+    int64_t fade_started_us_;
+    int64_t fade_until_us_;             // 0 when no transition runs
+    int64_t pending_published_at_;
+    int64_t pending_apply_us_;
+    TaskHandle_t task_handle_;
+    std::atomic<bool> running_;
+
+    LatencyCounter latency_;
+    LatencyCounter update_latency_[UPDATE_PATH_COUNT];
+    LatencyCounter timeline_lateness_;
+
+    static const char* TAG;
+};
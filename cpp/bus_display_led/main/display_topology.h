@@ -0,0 +1,61 @@
+// display_topology.h
+#pragma once
+
+#include "frame.h"
+#include "led_mapping.h"
+#include <cstdint>
+
+#define TOPOLOGY_VERSION 1
+#define TOPOLOGY_DEFAULT_REGISTERS 10
+
+// Physical layout of the register chain.
+// Every frame shifts exactly register_count words, whatever the payload held.
+// Logical row r (display order) is written to chain position row_order[r],
+// position 0 being the first word shifted (the register furthest from the ESP32).
+struct DisplayTopology {
+    uint8_t version;
+    uint8_t register_count;             // chained 16-bit registers
+    uint16_t populated_mask;            // register bits actually wired to LEDs
+    uint8_t row_order[LED_MAX_ROWS];
+
+    static DisplayTopology defaults() {
+        DisplayTopology topology;
+        topology.version = TOPOLOGY_VERSION;
+        topology.register_count = TOPOLOGY_DEFAULT_REGISTERS;
+        topology.populated_mask = led_row_to_register(FRAME_ROW_MASK);
+        for (uint8_t r = 0; r < LED_MAX_ROWS; r++) {
+            topology.row_order[r] = r;
+        }
+        return topology;
+    }
+
+    bool is_valid() const {
+        if (version != TOPOLOGY_VERSION || register_count == 0 || register_count > LED_MAX_ROWS) {
+            return false;
+        }
+        uint64_t used = 0;
+        for (uint8_t r = 0; r < register_count; r++) {
+            if (row_order[r] >= register_count || ((used >> row_order[r]) & 1)) {
+                return false;
+            }
+            used |= 1ULL << row_order[r];
+        }
+        return true;
+    }
+
+    // Register words for the whole chain, in shift order. Rows beyond the
+    // frame stay dark. Returns the number of words, always register_count.
+    size_t encode(const Frame& frame, uint16_t* words) const {
+        memset(words, 0, register_count * sizeof(words[0]));
+        size_t rows = frame.row_count < register_count ? frame.row_count : register_count;
+        for (size_t r = 0; r < rows; r++) {
+            words[row_order[r]] = led_row_to_register(frame.rows[r]) & populated_mask;
+        }
+        return register_count;
+    }
+
+    bool operator==(const DisplayTopology& other) const {
+        return register_count == other.register_count && populated_mask == other.populated_mask &&
+               memcmp(row_order, other.row_order, register_count) == 0;
+    }
+};
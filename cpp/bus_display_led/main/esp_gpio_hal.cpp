@@ -0,0 +1,51 @@
+// esp_gpio_hal.cpp
+#include "esp_gpio_hal.h"
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "rom/ets_sys.h"
+#include "soc/gpio_reg.h"
+#include "soc/soc.h"
+
+const char* EspGpioHal::TAG = "GPIO_HAL";
+
+bool EspGpioHal::configure_output(int pin) {
+    gpio_config_t io_conf = {};
+    io_conf.intr_type = GPIO_INTR_DISABLE;
+    io_conf.mode = GPIO_MODE_OUTPUT;
+    io_conf.pin_bit_mask = 1ULL << pin;
+    io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+    io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
+
+    esp_err_t ret = gpio_config(&io_conf);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "GPIO %d config failed: %s", pin, esp_err_to_name(ret));
+        return false;
+    }
+    return true;
+}
+
+void EspGpioHal::set_level(int pin, int level) {
+    gpio_set_level((gpio_num_t)pin, level);
+}
+
+void EspGpioHal::write_mask(uint32_t set_mask, uint32_t clear_mask) {
+    if (set_mask) {
+        REG_WRITE(GPIO_OUT_W1TS_REG, set_mask);
+    }
+    if (clear_mask) {
+        REG_WRITE(GPIO_OUT_W1TC_REG, clear_mask);
+    }
+}
+
+void EspGpioHal::delay_us(uint32_t us) {
+    ets_delay_us(us);
+}
+
+void EspGpioHal::reset_pin(int pin) {
+    gpio_reset_pin((gpio_num_t)pin);
+}
+
+int64_t EspGpioHal::now_us() {
+    return esp_timer_get_time();
+}
@@ -0,0 +1,17 @@
+// esp_gpio_hal.h
+#pragma once
+
+#include "gpio_hal.h"
+
+class EspGpioHal : public GpioHal {
+public:
+    bool configure_output(int pin) override;
+    void set_level(int pin, int level) override;
+    void write_mask(uint32_t set_mask, uint32_t clear_mask) override;
+    void delay_us(uint32_t us) override;
+    void reset_pin(int pin) override;
+    int64_t now_us() override;
+
+private:
+    static const char* TAG;
+};
@@ -0,0 +1,99 @@
+// esp_led_controller.cpp
+#include "esp_led_controller.h"
+#include "spi_led_output.h"
+
+const char* EspLEDController::TAG = "LED_CTRL";
+
+EspLEDController::EspLEDController(GpioHal& hal, const LEDPinConfig& pins)
+    : LEDController(hal, pins), pwm_started_(false) {
+}
+
+EspLEDController::~EspLEDController() {
+    if (pwm_started_) {
+        ledc_stop(LED_PWM_MODE, LED_PWM_CHANNEL, 1);  // idle high = outputs disabled
+    }
+}
+
+LEDOutput* EspLEDController::create_output() {
+#if LED_OUTPUT_USE_SPI
+    if (pins_.chain_count == 1) {
+        LEDOutput* output = new SpiLEDOutput((gpio_num_t)pins_.clock, (gpio_num_t)pins_.data[0],
+                                             (gpio_num_t)pins_.latch);
+        if (output->initialize()) {
+            return output;
+        }
+        ESP_LOGW(TAG, "SPI output unavailable, falling back to GPIO bit-banging");
+        delete output;
+    }
+#endif
+    return LEDController::create_output();
+}
+
+bool EspLEDController::start_pwm() {
+    pwm_started_ = init_brightness_pwm();
+    if (!pwm_started_) {
+        ESP_LOGW(TAG, "PWM brightness unavailable, OE driven as plain GPIO");
+    }
+    return pwm_started_;
+}
+
+bool EspLEDController::init_brightness_pwm() {
+    ledc_timer_config_t timer_conf = {};
+    timer_conf.speed_mode = LED_PWM_MODE;
+    timer_conf.duty_resolution = LED_PWM_RESOLUTION;
+    timer_conf.timer_num = LED_PWM_TIMER;
+    timer_conf.freq_hz = LED_PWM_FREQ_HZ;
+    timer_conf.clk_cfg = LEDC_AUTO_CLK;
+
+    esp_err_t ret = ledc_timer_config(&timer_conf);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "LEDC timer config failed: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    ledc_channel_config_t channel_conf = {};
+    channel_conf.gpio_num = pins_.oe;
+    channel_conf.speed_mode = LED_PWM_MODE;
+    channel_conf.channel = LED_PWM_CHANNEL;
+    channel_conf.intr_type = LEDC_INTR_DISABLE;
+    channel_conf.timer_sel = LED_PWM_TIMER;
+    channel_conf.duty = brightness_to_duty(brightness());
+    channel_conf.hpoint = 0;
+    channel_conf.flags.output_invert = 1;  // OE is active low, duty = on-time
+
+    ret = ledc_channel_config(&channel_conf);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "LEDC channel config failed: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    ret = ledc_fade_func_install(0);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "LEDC fade install failed: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    return true;
+}
+
+uint32_t EspLEDController::brightness_to_duty(uint8_t level) {
+    // Square law so equal steps look roughly equal to the eye
+    return ((uint32_t)level * level * LED_PWM_MAX_DUTY + (255 * 255 / 2)) / (255 * 255);
+}
+
+void EspLEDController::fade_pwm(uint8_t level, uint32_t duration_ms, bool wait) {
+    uint32_t duty = brightness_to_duty(level);
+    esp_err_t ret;
+    if (duration_ms == 0) {
+        ret = ledc_set_duty_and_update(LED_PWM_MODE, LED_PWM_CHANNEL, duty, 0);
+    } else {
+        ret = ledc_set_fade_with_time(LED_PWM_MODE, LED_PWM_CHANNEL, duty, duration_ms);
+        if (ret == ESP_OK) {
+            ret = ledc_fade_start(LED_PWM_MODE, LED_PWM_CHANNEL, wait ? LEDC_FADE_WAIT_DONE : LEDC_FADE_NO_WAIT);
+        }
+    }
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Brightness change to %d failed: %s", level, esp_err_to_name(ret));
+    }
+}
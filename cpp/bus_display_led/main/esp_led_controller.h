@@ -0,0 +1,40 @@
+// esp_led_controller.h
+#pragma once
+
+#include "led_controller.h"
+#include "driver/ledc.h"
+#include "esp_log.h"
+
+// Output backend for single-chain boards: SPI+DMA when set, bit-banged GPIO
+// otherwise. The GPIO backend is also used as a fallback when the SPI bus
+// can't be set up. Boards with several chains always use the parallel backend.
+#define LED_OUTPUT_USE_SPI 1
+
+// Brightness: OE (active low) is driven by an LEDC PWM channel
+#define LED_PWM_MODE LEDC_LOW_SPEED_MODE
+#define LED_PWM_TIMER LEDC_TIMER_0
+#define LED_PWM_CHANNEL LEDC_CHANNEL_0
+#define LED_PWM_FREQ_HZ 5000
+#define LED_PWM_RESOLUTION LEDC_TIMER_10_BIT
+#define LED_PWM_MAX_DUTY ((1 << 10) - 1)
+
+// LEDController on the ESP32 peripherals: the SPI backend and brightness
+// through LEDC PWM on OE
+class EspLEDController : public LEDController {
+public:
+    explicit EspLEDController(GpioHal& hal, const LEDPinConfig& pins = BOARD_PINS);
+    ~EspLEDController() override;
+
+protected:
+    LEDOutput* create_output() override;
+    bool start_pwm() override;
+    void fade_pwm(uint8_t level, uint32_t duration_ms, bool wait) override;
+
+private:
+    bool init_brightness_pwm();
+    static uint32_t brightness_to_duty(uint8_t level);
+
+    bool pwm_started_;
+
+    static const char* TAG;
+};
@@ -0,0 +1,66 @@
+// frame.h
+#pragma once
+
+#include "led_output.h"
+#include <cstdint>
+#include <cstring>
+
+#define LED_MAX_ROWS LED_OUTPUT_MAX_WORDS
+#define LEDS_PER_ROW 12
+#define FRAME_ROW_MASK 0x0FFF
+
+// Packed display frame: one logical row mask per strip, bit i = LED i+1.
+// Rows are in display order (sorted by 'h'); the mapping to physical
+// register bits is done by LEDController.
+struct Frame {
+    uint16_t rows[LED_MAX_ROWS];
+    uint8_t row_count;
+
+    Frame() : row_count(0) { memset(rows, 0, sizeof(rows)); }
+
+    void clear() {
+        memset(rows, 0, sizeof(rows));
+        row_count = 0;
+    }
+
+    void set_led(size_t row, size_t led, bool on) {
+        if (row >= LED_MAX_ROWS || led >= LEDS_PER_ROW) {
+            return;
+        }
+        if (on) {
+            rows[row] |= (uint16_t)(1u << led);
+        } else {
+            rows[row] &= (uint16_t)~(1u << led);
+        }
+        if (row >= row_count) {
+            row_count = row + 1;
+        }
+    }
+
+    // From the legacy bool-per-LED row array
+    static Frame from_rows(const bool rows[][LEDS_PER_ROW], size_t row_count) {
+        Frame frame;
+        if (row_count > LED_MAX_ROWS) {
+            row_count = LED_MAX_ROWS;
+        }
+        for (size_t r = 0; r < row_count; r++) {
+            for (size_t i = 0; i < LEDS_PER_ROW; i++) {
+                if (rows[r][i]) {
+                    frame.rows[r] |= (uint16_t)(1u << i);
+                }
+            }
+        }
+        frame.row_count = (uint8_t)row_count;
+        return frame;
+    }
+
+    bool get_led(size_t row, size_t led) const {
+        return row < row_count && led < LEDS_PER_ROW && ((rows[row] >> led) & 1);
+    }
+
+    bool operator==(const Frame& other) const {
+        return row_count == other.row_count &&
+               memcmp(rows, other.rows, row_count * sizeof(rows[0])) == 0;
+    }
+    bool operator!=(const Frame& other) const { return !(*this == other); }
+};
@@ -0,0 +1,503 @@
+// frame_codec.cpp
+#include "frame_codec.h"
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+static void put_u16(uint8_t* p, uint16_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static uint16_t get_u16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static size_t mask_bytes(uint8_t flags, size_t row_count) {
+    return (flags & FRAME_CODEC_FLAG_PACKED12) ? (row_count * 3 + 1) / 2 : row_count * 2;
+}
+
+static void put_u32(uint8_t* p, uint32_t value) {
+    put_u16(p, (uint16_t)value);
+    put_u16(p + 2, (uint16_t)(value >> 16));
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static size_t fields_size(uint8_t flags) {
+    return FRAME_CODEC_HEADER_SIZE +
+           ((flags & FRAME_CODEC_FLAG_SEQUENCE) ? 4 : 0) +
+           ((flags & FRAME_CODEC_FLAG_DELTA) ? 4 : 0) +
+           ((flags & FRAME_CODEC_FLAG_TIMESTAMP) ? 8 : 0);
+}
+
+static uint8_t* put_fields(uint8_t* p, uint8_t flags, uint8_t row_count, const FrameCodecHeader& header) {
+    *p++ = FRAME_CODEC_VERSION;
+    *p++ = flags;
+    *p++ = row_count;
+
+    if (flags & FRAME_CODEC_FLAG_SEQUENCE) {
+        put_u32(p, header.sequence);
+        p += 4;
+    }
+    if (flags & FRAME_CODEC_FLAG_DELTA) {
+        put_u32(p, header.base_sequence);
+        p += 4;
+    }
+    if (flags & FRAME_CODEC_FLAG_TIMESTAMP) {
+        put_u32(p, (uint32_t)header.emitted_ms);
+        put_u32(p + 4, (uint32_t)(header.emitted_ms >> 32));
+        p += 8;
+    }
+    return p;
+}
+
+static uint8_t* put_effects(uint8_t* p, const Animation& animation) {
+    *p++ = animation.effect_count;
+    for (uint8_t e = 0; e < animation.effect_count; e++) {
+        const LEDEffect& effect = animation.effects[e];
+        p[0] = effect.row;
+        p[1] = effect.led;
+        put_u16(p + 2, effect.period_ms);
+        put_u16(p + 4, effect.on_ms);
+        put_u16(p + 6, effect.phase_ms);
+        p += FRAME_CODEC_EFFECT_SIZE;
+    }
+    return p;
+}
+
+static uint8_t* put_vehicles(uint8_t* p, const Animation& animation) {
+    *p++ = animation.vehicle_count;
+    for (uint8_t v = 0; v < animation.vehicle_count; v++) {
+        const Vehicle& vehicle = animation.vehicles[v];
+        p[0] = vehicle.row;
+        put_u16(p + 1, vehicle.position);
+        put_u16(p + 3, vehicle.speed);
+        put_u16(p + 5, vehicle.age_ms);
+        p += FRAME_CODEC_VEHICLE_SIZE;
+    }
+    return p;
+}
+
+static size_t vehicles_size(uint8_t flags, const Animation& animation) {
+    return (flags & FRAME_CODEC_FLAG_VEHICLES) ? 1 + animation.vehicle_count * FRAME_CODEC_VEHICLE_SIZE : 0;
+}
+
+size_t frame_codec_encode(const Animation& animation, const FrameCodecHeader& header,
+                          uint8_t* out, size_t capacity) {
+    const Frame& frame = animation.base;
+    uint8_t flags = header.flags & (FRAME_CODEC_FLAG_SEQUENCE | FRAME_CODEC_FLAG_PACKED12 | FRAME_CODEC_FLAG_TIMESTAMP);
+    if (animation.effect_count) {
+        flags |= FRAME_CODEC_FLAG_EFFECTS;
+    }
+    if (animation.vehicle_count) {
+        flags |= FRAME_CODEC_FLAG_VEHICLES;
+    }
+
+    const size_t size = fields_size(flags) + mask_bytes(flags, frame.row_count) +
+                        ((flags & FRAME_CODEC_FLAG_EFFECTS) ? 1 + animation.effect_count * FRAME_CODEC_EFFECT_SIZE : 0) +
+                        vehicles_size(flags, animation);
+    if (size > capacity) {
+        return 0;
+    }
+
+    uint8_t* p = put_fields(out, flags, frame.row_count, header);
+
+    if (flags & FRAME_CODEC_FLAG_PACKED12) {
+        for (size_t r = 0; r < frame.row_count; r += 2) {
+            const uint16_t a = frame.rows[r] & FRAME_ROW_MASK;
+            const uint16_t b = r + 1 < frame.row_count ? frame.rows[r + 1] & FRAME_ROW_MASK : 0;
+            *p++ = (uint8_t)a;
+            if (r + 1 < frame.row_count) {
+                *p++ = (uint8_t)((a >> 8) | (b << 4));
+                *p++ = (uint8_t)(b >> 4);
+            } else {
+                *p++ = (uint8_t)(a >> 8);
+            }
+        }
+    } else {
+        for (size_t r = 0; r < frame.row_count; r++) {
+            put_u16(p, frame.rows[r] & FRAME_ROW_MASK);
+            p += 2;
+        }
+    }
+
+    if (flags & FRAME_CODEC_FLAG_EFFECTS) {
+        p = put_effects(p, animation);
+    }
+    if (flags & FRAME_CODEC_FLAG_VEHICLES) {
+        p = put_vehicles(p, animation);
+    }
+
+    return (size_t)(p - out);
+}
+
+// Row mask as encoded, rows past row_count read as off
+static uint16_t row_mask(const Frame& frame, size_t row) {
+    return row < frame.row_count ? frame.rows[row] & FRAME_ROW_MASK : 0;
+}
+
+static bool same_effects(const Animation& a, const Animation& b) {
+    if (a.effect_count != b.effect_count) {
+        return false;
+    }
+    for (uint8_t e = 0; e < a.effect_count; e++) {
+        const LEDEffect& x = a.effects[e];
+        const LEDEffect& y = b.effects[e];
+        if (x.row != y.row || x.led != y.led || x.period_ms != y.period_ms ||
+            x.on_ms != y.on_ms || x.phase_ms != y.phase_ms) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t frame_codec_encode_delta(const Animation& base, const Animation& target,
+                                const FrameCodecHeader& header, uint8_t* out, size_t capacity) {
+    const Frame& to = target.base;
+    uint8_t flags = FRAME_CODEC_FLAG_SEQUENCE | FRAME_CODEC_FLAG_DELTA | (header.flags & FRAME_CODEC_FLAG_TIMESTAMP);
+    if (!same_effects(base, target)) {
+        flags |= FRAME_CODEC_FLAG_EFFECTS;
+    }
+    if (base.vehicle_count || target.vehicle_count) {
+        flags |= FRAME_CODEC_FLAG_VEHICLES;
+    }
+
+    uint8_t changed = 0;
+    for (size_t r = 0; r < to.row_count; r++) {
+        if (row_mask(to, r) != row_mask(base.base, r)) {
+            changed++;
+        }
+    }
+
+    const size_t size = fields_size(flags) + 1 + changed * FRAME_CODEC_DELTA_ROW_SIZE +
+                        ((flags & FRAME_CODEC_FLAG_EFFECTS) ? 1 + target.effect_count * FRAME_CODEC_EFFECT_SIZE : 0) +
+                        vehicles_size(flags, target);
+    if (size > capacity) {
+        return 0;
+    }
+
+    uint8_t* p = put_fields(out, flags, to.row_count, header);
+    *p++ = changed;
+    for (size_t r = 0; r < to.row_count; r++) {
+        if (row_mask(to, r) != row_mask(base.base, r)) {
+            p[0] = (uint8_t)r;
+            put_u16(p + 1, row_mask(to, r));
+            p += FRAME_CODEC_DELTA_ROW_SIZE;
+        }
+    }
+
+    if (flags & FRAME_CODEC_FLAG_EFFECTS) {
+        p = put_effects(p, target);
+    }
+    if (flags & FRAME_CODEC_FLAG_VEHICLES) {
+        p = put_vehicles(p, target);
+    }
+
+    return (size_t)(p - out);
+}
+
+// Parses the header fields, returns the first byte after them or nullptr
+static const uint8_t* get_fields(const uint8_t* data, size_t length, FrameCodecHeader& fields) {
+    if (length < FRAME_CODEC_HEADER_SIZE || data[0] != FRAME_CODEC_VERSION ||
+        (data[1] & ~FRAME_CODEC_KNOWN_FLAGS) || data[2] > LED_MAX_ROWS) {
+        return nullptr;
+    }
+
+    const uint8_t flags = data[1];
+    if ((flags & FRAME_CODEC_FLAG_DELTA) &&
+        (!(flags & FRAME_CODEC_FLAG_SEQUENCE) || (flags & FRAME_CODEC_FLAG_PACKED12))) {
+        return nullptr;
+    }
+    if ((flags & FRAME_CODEC_FLAG_TIMELINE) &&
+        (flags != (FRAME_CODEC_FLAG_TIMELINE | FRAME_CODEC_FLAG_TIMESTAMP) || data[2] != 0)) {
+        return nullptr;
+    }
+    if (length < fields_size(flags)) {
+        return nullptr;
+    }
+
+    const uint8_t* p = data + FRAME_CODEC_HEADER_SIZE;
+    fields = FrameCodecHeader{};
+    fields.flags = flags;
+    if (flags & FRAME_CODEC_FLAG_SEQUENCE) {
+        fields.sequence = get_u32(p);
+        p += 4;
+    }
+    if (flags & FRAME_CODEC_FLAG_DELTA) {
+        fields.base_sequence = get_u32(p);
+        p += 4;
+    }
+    if (flags & FRAME_CODEC_FLAG_TIMESTAMP) {
+        fields.emitted_ms = get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+        p += 8;
+    }
+    return p;
+}
+
+bool frame_codec_read_header(const uint8_t* data, size_t length, FrameCodecHeader& header) {
+    return get_fields(data, length, header) != nullptr;
+}
+
+static void decode_masks(const uint8_t* p, uint8_t flags, uint8_t row_count, Frame& frame) {
+    frame.clear();
+    if (flags & FRAME_CODEC_FLAG_PACKED12) {
+        for (size_t r = 0; r < row_count; r += 2) {
+            frame.rows[r] = (uint16_t)(p[0] | ((p[1] & 0x0F) << 8));
+            if (r + 1 < row_count) {
+                frame.rows[r + 1] = (uint16_t)((p[1] >> 4) | (p[2] << 4));
+                p += 3;
+            } else {
+                p += 2;
+            }
+        }
+    } else {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy(frame.rows, p, mask_bytes(flags, row_count));
+#else
+        for (size_t r = 0; r < row_count; r++) {
+            frame.rows[r] = get_u16(p + r * 2);
+        }
+#endif
+        for (size_t r = 0; r < row_count; r++) {
+            frame.rows[r] &= FRAME_ROW_MASK;
+        }
+    }
+    frame.row_count = row_count;
+}
+
+// Only the changed rows are touched, the rest of the retained frame stays
+static void apply_delta(const uint8_t* p, uint8_t row_count, Frame& frame) {
+    const uint8_t kept = frame.row_count < row_count ? frame.row_count : row_count;
+    memset(frame.rows + kept, 0, (LED_MAX_ROWS - kept) * sizeof(frame.rows[0]));
+    const uint8_t changed = *p++;
+    for (uint8_t i = 0; i < changed; i++, p += FRAME_CODEC_DELTA_ROW_SIZE) {
+        frame.rows[p[0]] = get_u16(p + 1) & FRAME_ROW_MASK;
+    }
+    frame.row_count = row_count;
+}
+
+bool frame_codec_decode(const uint8_t* data, size_t length, Animation& out, FrameCodecHeader* header) {
+    FrameCodecHeader fields;
+    const uint8_t* p = get_fields(data, length, fields);
+    if (!p) {
+        return false;
+    }
+
+    const uint8_t flags = fields.flags;
+    const uint8_t row_count = data[2];
+    const uint8_t* end = data + length;
+    if (flags & FRAME_CODEC_FLAG_TIMELINE) {
+        return false;
+    }
+
+    // Check the whole layout before out is touched
+    const uint8_t* rows = p;
+    if (flags & FRAME_CODEC_FLAG_DELTA) {
+        if (p == end || (size_t)(end - p - 1) < (size_t)p[0] * FRAME_CODEC_DELTA_ROW_SIZE) {
+            return false;
+        }
+        const uint8_t changed = *p++;
+        for (uint8_t i = 0; i < changed; i++, p += FRAME_CODEC_DELTA_ROW_SIZE) {
+            if (p[0] >= row_count) {
+                return false;
+            }
+        }
+    } else {
+        const size_t masks = mask_bytes(flags, row_count);
+        if ((size_t)(end - p) < masks) {
+            return false;
+        }
+        p += masks;
+    }
+
+    const uint8_t* effects = nullptr;
+    if (flags & FRAME_CODEC_FLAG_EFFECTS) {
+        if (p == end || (size_t)(end - p - 1) < (size_t)p[0] * FRAME_CODEC_EFFECT_SIZE) {
+            return false;
+        }
+        effects = p;
+        p += 1 + p[0] * FRAME_CODEC_EFFECT_SIZE;
+    }
+    const uint8_t* vehicles = nullptr;
+    if (flags & FRAME_CODEC_FLAG_VEHICLES) {
+        if (p == end || (size_t)(end - p - 1) < (size_t)p[0] * FRAME_CODEC_VEHICLE_SIZE) {
+            return false;
+        }
+        vehicles = p;
+        p += 1 + p[0] * FRAME_CODEC_VEHICLE_SIZE;
+    }
+    if (p != end) {
+        return false;
+    }
+
+    if (flags & FRAME_CODEC_FLAG_DELTA) {
+        apply_delta(rows, row_count, out.base);
+    } else {
+        decode_masks(rows, flags, row_count, out.base);
+    }
+
+    // A delta without effects keeps the current ones
+    if (effects || !(flags & FRAME_CODEC_FLAG_DELTA)) {
+        out.effect_count = 0;
+    }
+    if (effects) {
+        const uint8_t count = *effects++;
+        for (uint8_t e = 0; e < count; e++, effects += FRAME_CODEC_EFFECT_SIZE) {
+            // Same limits as for JSON effects: invalid ones are dropped
+            out.add_effect(effects[0], effects[1], get_u16(effects + 2), get_u16(effects + 4), get_u16(effects + 6));
+        }
+    }
+
+    out.vehicle_count = 0;
+    if (vehicles) {
+        const uint8_t count = *vehicles++;
+        for (uint8_t v = 0; v < count; v++, vehicles += FRAME_CODEC_VEHICLE_SIZE) {
+            out.add_vehicle(vehicles[0], get_u16(vehicles + 1), get_u16(vehicles + 3), get_u16(vehicles + 5));
+        }
+    }
+
+    if (header) {
+        *header = fields;
+    }
+    return true;
+}
+
+size_t frame_codec_encode_timeline(uint64_t emitted_ms, const FrameCodecTimelineEntry* entries, size_t count,
+                                   uint8_t* out, size_t capacity) {
+    const uint8_t flags = FRAME_CODEC_FLAG_TIMELINE | FRAME_CODEC_FLAG_TIMESTAMP;
+    size_t size = fields_size(flags) + 1;
+    for (size_t i = 0; i < count; i++) {
+        size += FRAME_CODEC_TIMELINE_ENTRY_SIZE + entries[i].length;
+    }
+    if (count > FRAME_CODEC_TIMELINE_MAX_ENTRIES || size > capacity) {
+        return 0;
+    }
+
+    FrameCodecHeader header{};
+    header.emitted_ms = emitted_ms;
+    uint8_t* p = put_fields(out, flags, 0, header);
+    *p++ = (uint8_t)count;
+    for (size_t i = 0; i < count; i++) {
+        put_u32(p, entries[i].offset_ms);
+        put_u16(p + 4, (uint16_t)entries[i].length);
+        memcpy(p + FRAME_CODEC_TIMELINE_ENTRY_SIZE, entries[i].data, entries[i].length);
+        p += FRAME_CODEC_TIMELINE_ENTRY_SIZE + entries[i].length;
+    }
+    return (size_t)(p - out);
+}
+
+size_t frame_codec_timeline_limit(const char* accept) {
+    const char* param = accept ? strstr(accept, FRAME_CODEC_TIMELINE_PARAM) : nullptr;
+    if (!param) {
+        return 0;
+    }
+    const unsigned long entries = strtoul(param + strlen(FRAME_CODEC_TIMELINE_PARAM), nullptr, 10);
+    return entries < FRAME_CODEC_TIMELINE_MAX_ENTRIES ? entries : FRAME_CODEC_TIMELINE_MAX_ENTRIES;
+}
+
+size_t frame_codec_read_timeline(const uint8_t* data, size_t length, FrameCodecHeader& header,
+                                 FrameCodecTimelineEntry* entries, size_t capacity) {
+    const uint8_t* p = get_fields(data, length, header);
+    const uint8_t* end = data + length;
+    if (!p || !(header.flags & FRAME_CODEC_FLAG_TIMELINE) || p == end || *p == 0 || capacity == 0) {
+        return 0;
+    }
+
+    const uint8_t count = *p++;
+    size_t kept = 0;
+    while (kept < count && kept < capacity) {
+        // A cut entry ends the timeline there, the ones before it still apply
+        if (end - p < FRAME_CODEC_TIMELINE_ENTRY_SIZE ||
+            (size_t)(end - p) - FRAME_CODEC_TIMELINE_ENTRY_SIZE < get_u16(p + 4)) {
+            break;
+        }
+        FrameCodecTimelineEntry& entry = entries[kept];
+        entry.offset_ms = get_u32(p);
+        entry.length = get_u16(p + 4);
+        entry.data = p + FRAME_CODEC_TIMELINE_ENTRY_SIZE;
+        p += FRAME_CODEC_TIMELINE_ENTRY_SIZE;
+
+        FrameCodecHeader nested;
+        if ((kept && entry.offset_ms < entries[kept - 1].offset_ms) ||
+            !get_fields(entry.data, entry.length, nested) || (nested.flags & FRAME_CODEC_FLAG_TIMELINE)) {
+            return 0;
+        }
+        p += entry.length;
+        kept++;
+    }
+    // All entries read: nothing may follow them
+    return kept == count && p != end ? 0 : kept;
+}
+
+static const char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static int base64_value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+size_t frame_codec_base64_encode(const uint8_t* data, size_t length, char* out, size_t capacity) {
+    if (FRAME_CODEC_BASE64_SIZE(length) > capacity) {
+        return 0;
+    }
+
+    char* p = out;
+    for (size_t i = 0; i < length; i += 3) {
+        const uint32_t n = (uint32_t)data[i] << 16 |
+                           (i + 1 < length ? (uint32_t)data[i + 1] << 8 : 0) |
+                           (i + 2 < length ? data[i + 2] : 0);
+        *p++ = BASE64_ALPHABET[(n >> 18) & 63];
+        *p++ = BASE64_ALPHABET[(n >> 12) & 63];
+        *p++ = i + 1 < length ? BASE64_ALPHABET[(n >> 6) & 63] : '=';
+        *p++ = i + 2 < length ? BASE64_ALPHABET[n & 63] : '=';
+    }
+    return (size_t)(p - out);
+}
+
+size_t frame_codec_base64_decode(const char* text, size_t length, uint8_t* out, size_t capacity) {
+    if (length % 4) {
+        return 0;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < length; i += 4) {
+        const bool last = i + 4 == length;
+        const int pad = last ? (text[i + 3] == '=') + (text[i + 2] == '=') : 0;
+        int v[4];
+        for (int k = 0; k < 4; k++) {
+            v[k] = k >= 4 - pad ? 0 : base64_value(text[i + k]);
+            if (v[k] < 0) {
+                return 0;
+            }
+        }
+        if (n + 3 - pad > capacity) {
+            return 0;
+        }
+
+        const uint32_t bits = (uint32_t)v[0] << 18 | v[1] << 12 | v[2] << 6 | v[3];
+        out[n++] = (uint8_t)(bits >> 16);
+        if (pad < 2) {
+            out[n++] = (uint8_t)(bits >> 8);
+        }
+        if (pad < 1) {
+            out[n++] = (uint8_t)bits;
+        }
+    }
+    return n;
+}
+
+bool frame_codec_is_content_type(const char* content_type) {
+    const size_t n = strlen(FRAME_CODEC_CONTENT_TYPE);
+    if (!content_type || strncasecmp(content_type, FRAME_CODEC_CONTENT_TYPE, n) != 0) {
+        return false;
+    }
+    const char next = content_type[n];
+    return next == '\0' || next == ';' || next == ' ';
+}
@@ -0,0 +1,145 @@
+// frame_codec.h
+#pragma once
+
+#include "animation.h"
+#include "frame.h"
+#include <cstddef>
+#include <cstdint>
+
+// Compact binary representation of an Animation, served instead of the JSON
+// strips when the request advertises it in Accept. Shared with the host
+// tools (cpp/host), so keep it free of ESP-IDF dependencies.
+//
+//   u8  version            FRAME_CODEC_VERSION
+//   u8  flags              FRAME_CODEC_FLAG_*
+//   u8  row_count          <= LED_MAX_ROWS, rows in display order
+//   u32 sequence           only with FRAME_CODEC_FLAG_SEQUENCE
+//   u32 base_sequence      only with FRAME_CODEC_FLAG_DELTA
+//   u64 emitted_ms         only with FRAME_CODEC_FLAG_TIMESTAMP: server clock
+//                          when the state was produced, ms since the epoch
+//   row masks              u16 per row (bit i = LED i+1), or with
+//                          FRAME_CODEC_FLAG_PACKED12 two rows per 3 bytes
+//   u8  effect_count       only with FRAME_CODEC_FLAG_EFFECTS, then per
+//                          effect: u8 row, u8 led, u16 period_ms, u16 on_ms,
+//                          u16 phase_ms
+//   u8  vehicle_count      only with FRAME_CODEC_FLAG_VEHICLES, then per
+//                          vehicle: u8 row, u16 position, u16 speed,
+//                          u16 age_ms (see Vehicle)
+//
+// A delta (FRAME_CODEC_FLAG_DELTA, requires SEQUENCE) turns the frame at
+// base_sequence into the one at sequence. Instead of all row masks it holds
+// u8 changed_count, then per changed row u8 row and u16 mask; rows at or
+// past row_count are cleared. The effect list is only present when it
+// changed and then replaces the whole list, possibly with an empty one.
+// Vehicles are always sent in full: their ages refer to this message.
+// PACKED12 does not apply to deltas.
+//
+// A timeline (FRAME_CODEC_FLAG_TIMELINE with TIMESTAMP, row_count 0) holds
+// frames to apply at emitted_ms + offset_ms instead of one frame for now:
+//   u8  entry_count        then per entry: u32 offset_ms, u16 length and a
+//                          complete frame message of that length
+// Entries are in apply order. The first one is a full frame or a delta onto
+// the client's frame as usual; a later delta applies onto the entry before
+// it. Only clients that list FRAME_CODEC_TIMELINE_PARAM in Accept get them,
+// with the most entries they keep as its value ("timeline=6"), and never more
+// than that. A client reading a timeline cut short by its buffer keeps the
+// leading complete entries.
+//
+// Multi-byte fields are little endian, so 16-bit masks decode with a single
+// memcpy into Frame::rows on the ESP32. Text transports (the event stream)
+// carry the same bytes base64 encoded.
+#define FRAME_CODEC_CONTENT_TYPE "application/vnd.trillet.frame"
+#define FRAME_CODEC_VERSION 1
+
+#define FRAME_CODEC_FLAG_SEQUENCE 0x01
+#define FRAME_CODEC_FLAG_PACKED12 0x02
+#define FRAME_CODEC_FLAG_EFFECTS 0x04
+#define FRAME_CODEC_FLAG_TIMESTAMP 0x08
+#define FRAME_CODEC_FLAG_DELTA 0x10
+#define FRAME_CODEC_FLAG_VEHICLES 0x20
+#define FRAME_CODEC_FLAG_TIMELINE 0x40
+#define FRAME_CODEC_KNOWN_FLAGS (FRAME_CODEC_FLAG_SEQUENCE | FRAME_CODEC_FLAG_PACKED12 | \
+                                 FRAME_CODEC_FLAG_EFFECTS | FRAME_CODEC_FLAG_TIMESTAMP | \
+                                 FRAME_CODEC_FLAG_DELTA | FRAME_CODEC_FLAG_VEHICLES | \
+                                 FRAME_CODEC_FLAG_TIMELINE)
+#define FRAME_CODEC_TIMELINE_PARAM "timeline="
+
+#define FRAME_CODEC_HEADER_SIZE 3
+#define FRAME_CODEC_EFFECT_SIZE 8
+#define FRAME_CODEC_DELTA_ROW_SIZE 3
+#define FRAME_CODEC_VEHICLE_SIZE 7
+#define FRAME_CODEC_TIMELINE_ENTRY_SIZE 6       // before the nested message
+#define FRAME_CODEC_TIMELINE_MAX_ENTRIES 6
+#define FRAME_CODEC_STRINGIFY_(x) #x
+#define FRAME_CODEC_STRINGIFY(x) FRAME_CODEC_STRINGIFY_(x)
+// Accept media range for frames and timelines of up to entries frames
+#define FRAME_CODEC_TIMELINE_ACCEPT(entries) \
+    FRAME_CODEC_CONTENT_TYPE ";" FRAME_CODEC_TIMELINE_PARAM FRAME_CODEC_STRINGIFY(entries)
+// Largest message, a delta touching every row
+#define FRAME_CODEC_MAX_SIZE (FRAME_CODEC_HEADER_SIZE + 4 + 4 + 8 + 1 + \
+                              LED_MAX_ROWS * FRAME_CODEC_DELTA_ROW_SIZE + 1 + \
+                              ANIMATION_MAX_EFFECTS * FRAME_CODEC_EFFECT_SIZE + 1 + \
+                              ANIMATION_MAX_VEHICLES * FRAME_CODEC_VEHICLE_SIZE)
+#define FRAME_CODEC_BASE64_SIZE(n) (((n) + 2) / 3 * 4)
+
+// Optional header fields. On decode, fields whose flag is absent are 0.
+struct FrameCodecHeader {
+    uint8_t flags;          // FRAME_CODEC_FLAG_*
+    uint32_t sequence;
+    uint32_t base_sequence; // deltas only
+    uint64_t emitted_ms;
+};
+
+// Encodes animation with header.flags (EFFECTS and VEHICLES are added when
+// the animation has any). Returns the encoded size, 0 when capacity is too small.
+size_t frame_codec_encode(const Animation& animation, const FrameCodecHeader& header,
+                          uint8_t* out, size_t capacity);
+
+// Encodes the rows and effects of target that differ from base as a delta
+// from header.base_sequence to header.sequence (TIMESTAMP is kept from
+// header.flags). Returns 0 when capacity is too small.
+size_t frame_codec_encode_delta(const Animation& base, const Animation& target,
+                                const FrameCodecHeader& header, uint8_t* out, size_t capacity);
+
+// Reads the header fields of a message without decoding it, e.g. to check
+// a delta's base_sequence first. Returns false on an unknown version or flag.
+bool frame_codec_read_header(const uint8_t* data, size_t length, FrameCodecHeader& header);
+
+// One frame of a timeline, data points into the timeline message
+struct FrameCodecTimelineEntry {
+    uint32_t offset_ms;
+    const uint8_t* data;
+    size_t length;
+};
+
+// Encodes count frame messages as a timeline produced at emitted_ms.
+// Returns 0 when capacity is too small.
+size_t frame_codec_encode_timeline(uint64_t emitted_ms, const FrameCodecTimelineEntry* entries, size_t count,
+                                   uint8_t* out, size_t capacity);
+
+// Entries a client keeps according to its Accept header, at most
+// FRAME_CODEC_TIMELINE_MAX_ENTRIES, 0 when it does not take timelines
+size_t frame_codec_timeline_limit(const char* accept);
+
+// Splits a timeline message into its entries, checking the layout, the
+// order of the offsets and the header of every entry (not their bodies).
+// Keeps the leading entries that fit capacity and are complete within
+// length, so a message cut short still yields its first frames. Returns
+// the entry count, 0 when malformed or without a complete first entry.
+size_t frame_codec_read_timeline(const uint8_t* data, size_t length, FrameCodecHeader& header,
+                                 FrameCodecTimelineEntry* entries, size_t capacity);
+
+// Decodes a complete message. A full frame replaces out, a delta is applied
+// onto it, so out must hold the frame at base_sequence. Returns false, with
+// out untouched, on an unknown version or flag, a timeline, or a length or
+// row index that does not match the header.
+bool frame_codec_decode(const uint8_t* data, size_t length, Animation& out, FrameCodecHeader* header = nullptr);
+
+// Standard base64 with padding. Encode returns the text length (no
+// terminator written), decode the byte count; both return 0 when the output
+// does not fit, decode also on malformed input.
+size_t frame_codec_base64_encode(const uint8_t* data, size_t length, char* out, size_t capacity);
+size_t frame_codec_base64_decode(const char* text, size_t length, uint8_t* out, size_t capacity);
+
+// True when a Content-Type header value names this format (parameters ignored)
+bool frame_codec_is_content_type(const char* content_type);
@@ -0,0 +1,93 @@
+// frame_mailbox.h
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free "latest value" mailbox: any number of producers, one consumer.
+// Each publish() lands in its own slot and replaces whatever the consumer has
+// not picked up yet, so the consumer always sees the newest value and
+// producers never block. SLOTS must cover the concurrent producers plus the
+// value being held as latest.
+template <typename T, unsigned SLOTS = 8>
+class Mailbox {
+    static_assert(SLOTS >= 2 && SLOTS <= 32, "Mailbox needs between 2 and 32 slots");
+
+public:
+    Mailbox() : free_mask_(SLOTS == 32 ? 0xFFFFFFFFu : ((1u << SLOTS) - 1)), latest_(EMPTY),
+                published_(0), overwritten_(0), rejected_(0) {}
+
+    // Producer side, callable from any task. Returns false when all slots are busy.
+    bool publish(const T& value, int64_t stamp_us) {
+        int slot = claim_slot();
+        if (slot < 0) {
+            rejected_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        slots_[slot].value = value;
+        slots_[slot].stamp_us = stamp_us;
+
+        uint8_t previous = latest_.exchange((uint8_t)slot, std::memory_order_acq_rel);
+        if (previous != EMPTY) {
+            // The consumer never saw the previous value
+            release_slot(previous);
+            overwritten_.fetch_add(1, std::memory_order_relaxed);
+        }
+        published_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer side, single task only. Returns false when nothing new was published.
+    bool take(T& value, int64_t* stamp_us = nullptr) {
+        uint8_t slot = latest_.exchange(EMPTY, std::memory_order_acq_rel);
+        if (slot == EMPTY) {
+            return false;
+        }
+
+        value = slots_[slot].value;
+        if (stamp_us) {
+            *stamp_us = slots_[slot].stamp_us;
+        }
+        release_slot(slot);
+        return true;
+    }
+
+    bool has_pending() const { return latest_.load(std::memory_order_acquire) != EMPTY; }
+
+    uint32_t published() const { return published_.load(std::memory_order_relaxed); }
+    uint32_t overwritten() const { return overwritten_.load(std::memory_order_relaxed); }
+    uint32_t rejected() const { return rejected_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr uint8_t EMPTY = 0xFF;
+
+    struct Slot {
+        T value;
+        int64_t stamp_us;
+    };
+
+    int claim_slot() {
+        uint32_t mask = free_mask_.load(std::memory_order_relaxed);
+        while (mask) {
+            int slot = __builtin_ctz(mask);
+            if (free_mask_.compare_exchange_weak(mask, mask & ~(1u << slot),
+                                                 std::memory_order_acquire,
+                                                 std::memory_order_relaxed)) {
+                return slot;
+            }
+        }
+        return -1;
+    }
+
+    void release_slot(uint8_t slot) {
+        free_mask_.fetch_or(1u << slot, std::memory_order_release);
+    }
+
+    Slot slots_[SLOTS];
+    std::atomic<uint32_t> free_mask_;
+    std::atomic<uint8_t> latest_;
+    std::atomic<uint32_t> published_;
+    std::atomic<uint32_t> overwritten_;
+    std::atomic<uint32_t> rejected_;
+};
@@ -0,0 +1,21 @@
+// gpio_hal.h
+#pragma once
+
+#include <cstdint>
+
+// Minimal GPIO seam under the bit-banged output path.
+// EspGpioHal drives real pins, SimGpioHal records them on a Linux host.
+class GpioHal {
+public:
+    virtual ~GpioHal() {}
+
+    virtual bool configure_output(int pin) = 0;
+    virtual void set_level(int pin, int level) = 0;
+    // Several pins below GPIO 32 at once: the set_mask pins go high in one
+    // register write, then the clear_mask pins low in a second one
+    virtual void write_mask(uint32_t set_mask, uint32_t clear_mask) = 0;
+    virtual void delay_us(uint32_t us) = 0;
+    virtual void reset_pin(int pin) = 0;
+    // Monotonic time, simulated on the host
+    virtual int64_t now_us() = 0;
+};
@@ -0,0 +1,65 @@
+// gpio_led_output.cpp
+#include "gpio_led_output.h"
+
+GpioLEDOutput::GpioLEDOutput(GpioHal& hal, int clock_pin, int data_pin, int latch_pin,
+                             uint32_t pulse_delay_us)
+    : hal_(hal), clock_pin_(clock_pin), data_pin_(data_pin), latch_pin_(latch_pin),
+      pulse_delay_us_(pulse_delay_us), initialized_(false) {
+}
+
+GpioLEDOutput::~GpioLEDOutput() {
+    if (initialized_) {
+        hal_.reset_pin(clock_pin_);
+        hal_.reset_pin(data_pin_);
+        hal_.reset_pin(latch_pin_);
+    }
+}
+
+bool GpioLEDOutput::initialize() {
+    if (!hal_.configure_output(clock_pin_) ||
+        !hal_.configure_output(data_pin_) ||
+        !hal_.configure_output(latch_pin_)) {
+        return false;
+    }
+
+    hal_.set_level(latch_pin_, 0);
+    hal_.set_level(clock_pin_, 0);
+    hal_.set_level(data_pin_, 0);
+
+    initialized_ = true;
+    return true;
+}
+
+void GpioLEDOutput::pulse_pin(int pin) {
+    hal_.delay_us(pulse_delay_us_);
+    hal_.set_level(pin, 1);
+    hal_.delay_us(pulse_delay_us_ * 2);
+    hal_.set_level(pin, 0);
+    hal_.delay_us(pulse_delay_us_);
+}
+
+void GpioLEDOutput::feed_register(uint16_t value) {
+    // Send each bit (from LSB to MSB) - matching your MicroPython code
+    for (int i = 0; i < 16; i++) {
+        int bit = (value >> i) & 1;  // Extract the bit (starting from LSB)
+        hal_.set_level(data_pin_, bit);
+        pulse_pin(clock_pin_);
+    }
+    hal_.set_level(data_pin_, 0);     // Reset to 0 in idle state
+}
+
+void GpioLEDOutput::latch_data() {
+    pulse_pin(latch_pin_);
+}
+
+bool GpioLEDOutput::write_frame(const uint16_t* words, size_t count) {
+    if (!initialized_) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        feed_register(words[i]);  // feed each row sequentially
+    }
+    latch_data();  // latch after all rows are fed
+    return true;
+}
@@ -0,0 +1,34 @@
+// gpio_led_output.h
+#pragma once
+
+#include "led_output.h"
+#include "gpio_hal.h"
+
+// Timing
+#define PULSE_DELAY_US 200
+
+// Bit-banged backend, kept as a fallback when no SPI host is available.
+// Goes through GpioHal only, so it also runs against the host simulator.
+class GpioLEDOutput : public LEDOutput {
+public:
+    GpioLEDOutput(GpioHal& hal, int clock_pin, int data_pin, int latch_pin,
+                  uint32_t pulse_delay_us = PULSE_DELAY_US);
+    ~GpioLEDOutput() override;
+
+    bool initialize() override;
+    bool write_frame(const uint16_t* words, size_t count) override;
+    const char* name() const override { return "gpio"; }
+
+    void latch_data();
+
+private:
+    void pulse_pin(int pin);
+    void feed_register(uint16_t value);
+
+    GpioHal& hal_;
+    int clock_pin_;
+    int data_pin_;
+    int latch_pin_;
+    uint32_t pulse_delay_us_;
+    bool initialized_;
+};
@@ -0,0 +1,348 @@
+// https_client.cpp
+#include "https_client.h"
+#include "esp_crt_bundle.h"
+#include "esp_timer.h"
+#include <strings.h>
+
+const char* HttpsClient::TAG = "HTTPS_CLIENT";
+
+HttpsClient::HttpsClient(const std::string& base_url, int timeout_ms)
+    : base_url_(base_url), timeout_ms_(timeout_ms), client_(nullptr), lock_(xSemaphoreCreateMutex()),
+      connected_(false), server_close_(false), stream_sink_(nullptr), stream_headers_(nullptr),
+      stream_delivered_(false), stream_rejected_(false), session_cached_(false), request_start_us_(0), next_(nullptr),
+      requests_(0), handshakes_(0), tickets_offered_(0), full_handshake_ms_(0),
+      ticket_handshake_ms_(0), retries_(0), failures_(0) {
+}
+
+HttpsClient::~HttpsClient() {
+    if (client_) {
+        esp_http_client_cleanup(client_);
+        client_ = nullptr;
+    }
+    if (lock_) {
+        vSemaphoreDelete(lock_);
+        lock_ = nullptr;
+    }
+}
+
+HttpsClient& HttpsClient::for_host(const std::string& base_url, int timeout_ms) {
+    static SemaphoreHandle_t registry_lock = xSemaphoreCreateMutex();
+    static HttpsClient* registry = nullptr;
+
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    HttpsClient* client = registry;
+    while (client && (client->base_url_ != base_url || client->timeout_ms_ != timeout_ms)) {
+        client = client->next_;
+    }
+    if (!client) {
+        client = new HttpsClient(base_url, timeout_ms);
+        client->next_ = registry;
+        registry = client;
+    }
+    xSemaphoreGive(registry_lock);
+    return *client;
+}
+
+bool HttpsClient::ensure_client() {
+    if (client_) {
+        return true;
+    }
+
+    // The handle keeps the socket, TLS context and session ticket between requests
+    esp_http_client_config_t config{};
+    config.url = base_url_.c_str();
+    config.crt_bundle_attach = esp_crt_bundle_attach;
+    config.timeout_ms = timeout_ms_;
+    config.buffer_size = HTTPS_CLIENT_BUFFER_SIZE;
+    config.buffer_size_tx = HTTPS_CLIENT_BUFFER_SIZE;
+    config.event_handler = event_handler;
+    config.user_data = this;
+    config.save_client_session = true;  // needs CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    config.keep_alive_enable = true;    // TCP keepalive notices a dead peer between polls
+    config.keep_alive_idle = 30;
+    config.keep_alive_interval = 5;
+    config.keep_alive_count = 3;
+
+    client_ = esp_http_client_init(&config);
+    if (!client_) {
+        ESP_LOGE(TAG, "Failed to initialize HTTP client");
+        return false;
+    }
+
+    esp_http_client_set_header(client_, "User-Agent", "ESP32-BusDisplay/1.0");
+    esp_http_client_set_header(client_, "Accept", HTTPS_CLIENT_DEFAULT_ACCEPT);
+    return true;
+}
+
+esp_err_t HttpsClient::event_handler(esp_http_client_event_t* evt) {
+    HttpsClient* self = static_cast<HttpsClient*>(evt->user_data);
+
+    switch (evt->event_id) {
+        case HTTP_EVENT_ON_CONNECTED: {
+            uint32_t elapsed_ms = (uint32_t)((esp_timer_get_time() - self->request_start_us_) / 1000);
+            uint32_t count = self->handshakes_.fetch_add(1, std::memory_order_relaxed) + 1;
+            if (self->session_cached_) {
+                self->tickets_offered_.fetch_add(1, std::memory_order_relaxed);
+                self->ticket_handshake_ms_.store(elapsed_ms, std::memory_order_relaxed);
+            } else {
+                self->full_handshake_ms_.store(elapsed_ms, std::memory_order_relaxed);
+            }
+            ESP_LOGI(TAG, "Connected to %s in %lu ms (handshake #%lu, %s)",
+                     self->base_url_.c_str(), (unsigned long)elapsed_ms, (unsigned long)count,
+                     self->session_cached_ ? "session ticket offered" : "full");
+            self->connected_ = true;
+            self->session_cached_ = true;
+            break;
+        }
+        case HTTP_EVENT_ON_HEADER:
+            if (strcasecmp(evt->header_key, "Connection") == 0 && strcasecmp(evt->header_value, "close") == 0) {
+                self->server_close_ = true;
+            } else if (strcasecmp(evt->header_key, "ETag") == 0) {
+                self->response_headers_.etag = evt->header_value;
+            } else if (strcasecmp(evt->header_key, "Content-Type") == 0) {
+                self->response_headers_.content_type = evt->header_value;
+            } else if (strcasecmp(evt->header_key, "Cache-Control") == 0) {
+                self->response_headers_.cache_control = evt->header_value;
+            } else if (strcasecmp(evt->header_key, "Retry-After") == 0) {
+                self->response_headers_.retry_after = evt->header_value;
+            }
+            break;
+        case HTTP_EVENT_ON_DATA: {
+            if (!self->stream_sink_ || self->stream_rejected_) {
+                break;
+            }
+            int status_code = esp_http_client_get_status_code(evt->client);
+            if (status_code < 200 || status_code >= 300) {
+                break;
+            }
+            if (!self->stream_delivered_ && self->stream_headers_) {
+                *self->stream_headers_ = self->response_headers_;
+            }
+            self->stream_delivered_ = true;
+            if (!(*self->stream_sink_)((const char*)evt->data, evt->data_len)) {
+                self->stream_rejected_ = true;
+            }
+            break;
+        }
+        case HTTP_EVENT_DISCONNECTED:
+            self->connected_ = false;
+            break;
+        default:
+            break;
+    }
+    return ESP_OK;
+}
+
+int HttpsClient::request_once(const std::string& url, const std::string* payload, bool stream,
+                              ResponseHeaders* headers, const BodySink& sink, bool& delivered) {
+    server_close_ = false;
+    response_headers_ = ResponseHeaders();
+    request_start_us_ = esp_timer_get_time();
+
+    // Body bytes parsed along with the headers already go to a stream sink
+    stream_sink_ = stream ? &sink : nullptr;
+    stream_headers_ = headers;
+    stream_delivered_ = false;
+    stream_rejected_ = false;
+
+    esp_http_client_set_url(client_, url.c_str());
+
+    // Reuses the open connection when there is one, connects otherwise
+    const int payload_length = payload ? (int)payload->length() : 0;
+    esp_err_t err = esp_http_client_open(client_, payload_length);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to open connection: %s", esp_err_to_name(err));
+        close_connection();
+        return -1;
+    }
+
+    if (payload_length > 0 && esp_http_client_write(client_, payload->c_str(), payload_length) != payload_length) {
+        ESP_LOGW(TAG, "Failed to write request body");
+        close_connection();
+        return -1;
+    }
+
+    int64_t content_length = esp_http_client_fetch_headers(client_);
+    int status_code = esp_http_client_get_status_code(client_);
+    if (content_length < 0 || status_code <= 0) {
+        // Typically a keep-alive socket the server already closed
+        ESP_LOGW(TAG, "No response received, dropping connection");
+        delivered = delivered || stream_delivered_;
+        close_connection();
+        return -1;
+    }
+    if (headers && !stream_delivered_) {
+        *headers = response_headers_;
+    }
+
+    // Only successful bodies reach the sink, error pages are drained. A
+    // stream is delivered by the event handler, the reads only drive it.
+    const bool to_sink = !stream && status_code >= 200 && status_code < 300;
+    bool rejected = false;
+    int read;
+    while ((read = esp_http_client_read_response(client_, chunk_, sizeof(chunk_))) > 0) {
+        if (stream_rejected_) {
+            rejected = true;
+            break;
+        }
+        if (to_sink) {
+            delivered = true;
+            if (!sink(chunk_, read)) {
+                rejected = true;
+                break;
+            }
+        }
+    }
+    rejected = rejected || stream_rejected_;
+    delivered = delivered || stream_delivered_;
+
+    if (read < 0) {
+        ESP_LOGW(TAG, "Connection lost while reading response");
+        close_connection();
+        return -1;
+    }
+
+    // The connection can only carry the next request when this response was
+    // read to the end and the server intends to keep it open
+    if (rejected || server_close_ || !esp_http_client_is_complete_data_received(client_)) {
+        close_connection();
+    }
+
+    requests_.fetch_add(1, std::memory_order_relaxed);
+    return status_code;
+}
+
+int HttpsClient::request(const RequestSpec& spec, const std::string& path, ResponseHeaders* headers,
+                         const BodySink& sink) {
+    if (xSemaphoreTake(lock_, pdMS_TO_TICKS(HTTPS_CLIENT_LOCK_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGW(TAG, "Client busy, %s skipped", path.c_str());
+        failures_.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+
+    if (!ensure_client()) {
+        xSemaphoreGive(lock_);
+        failures_.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+
+    // Per-request headers, undone below so the handle stays neutral
+    esp_http_client_set_method(client_, spec.method);
+    if (spec.accept) {
+        esp_http_client_set_header(client_, "Accept", spec.accept);
+    }
+    if (spec.content_type) {
+        esp_http_client_set_header(client_, "Content-Type", spec.content_type);
+    }
+    const bool conditional = spec.if_none_match && !spec.if_none_match->empty();
+    if (conditional) {
+        esp_http_client_set_header(client_, "If-None-Match", spec.if_none_match->c_str());
+    }
+    if (spec.authorization) {
+        esp_http_client_set_header(client_, "Authorization", spec.authorization);
+    }
+
+    const std::string url = base_url_ + path;
+    const bool reused = connected_;
+    bool delivered = false;
+
+    int status_code = request_once(url, spec.payload, spec.stream, headers, sink, delivered);
+    if (status_code < 0 && reused && !delivered) {
+        // The server may have closed the idle socket: retry once on a fresh
+        // connection. Requests going through here are idempotent, and the
+        // sink has not seen any byte yet.
+        retries_.fetch_add(1, std::memory_order_relaxed);
+        status_code = request_once(url, spec.payload, spec.stream, headers, sink, delivered);
+    }
+    stream_sink_ = nullptr;
+
+    if (spec.accept) {
+        esp_http_client_set_header(client_, "Accept", HTTPS_CLIENT_DEFAULT_ACCEPT);
+    }
+    if (spec.content_type) {
+        esp_http_client_delete_header(client_, "Content-Type");
+    }
+    if (conditional) {
+        esp_http_client_delete_header(client_, "If-None-Match");
+    }
+    if (spec.authorization) {
+        esp_http_client_delete_header(client_, "Authorization");
+    }
+    xSemaphoreGive(lock_);
+
+    if (status_code < 0) {
+        failures_.fetch_add(1, std::memory_order_relaxed);
+        ESP_LOGE(TAG, "%s %s failed", spec.method == HTTP_METHOD_POST ? "POST" : "GET", path.c_str());
+    }
+    return status_code;
+}
+
+HttpsClient::BodySink HttpsClient::string_sink(std::string& body, size_t max_body) {
+    body.clear();
+    return [&body, max_body](const char* data, size_t length) {
+        if (body.length() + length > max_body) {
+            ESP_LOGW(TAG, "Response larger than %d bytes, truncated", (int)max_body);
+            return false;
+        }
+        body.append(data, length);
+        return true;
+    };
+}
+
+int HttpsClient::get(const std::string& path, std::string& body, size_t max_body) {
+    const RequestSpec spec = {HTTP_METHOD_GET, nullptr, nullptr, nullptr, nullptr, nullptr, false};
+    return request(spec, path, nullptr, string_sink(body, max_body));
+}
+
+int HttpsClient::post(const std::string& path, const char* content_type, const std::string& payload,
+                      std::string& body, size_t max_body) {
+    const RequestSpec spec = {HTTP_METHOD_POST, nullptr, content_type, &payload, nullptr, nullptr, false};
+    return request(spec, path, nullptr, string_sink(body, max_body));
+}
+
+int HttpsClient::get_if_none_match(const std::string& path, const std::string& etag, std::string& response_etag,
+                                   std::string& body, size_t max_body) {
+    const RequestSpec spec = {HTTP_METHOD_GET, nullptr, nullptr, nullptr, &etag, nullptr, false};
+    ResponseHeaders headers;
+    int status_code = request(spec, path, &headers, string_sink(body, max_body));
+    response_etag = headers.etag;
+    return status_code;
+}
+
+int HttpsClient::get_streamed(const std::string& path, const char* accept, const std::string& if_none_match,
+                              ResponseHeaders& headers, const BodySink& sink, const char* authorization) {
+    const RequestSpec spec = {HTTP_METHOD_GET, accept, nullptr, nullptr, &if_none_match, authorization, false};
+    headers = ResponseHeaders();
+    return request(spec, path, &headers, sink);
+}
+
+int HttpsClient::get_event_stream(const std::string& path, const BodySink& sink) {
+    const RequestSpec spec = {HTTP_METHOD_GET, HTTPS_CLIENT_EVENT_STREAM, nullptr, nullptr, nullptr, nullptr, true};
+    return request(spec, path, nullptr, sink);
+}
+
+void HttpsClient::disconnect() {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    close_connection();
+    xSemaphoreGive(lock_);
+}
+
+void HttpsClient::close_connection() {
+    if (client_) {
+        esp_http_client_close(client_);
+    }
+    connected_ = false;
+}
+
+HttpsClient::Stats HttpsClient::get_stats() const {
+    Stats stats{};
+    stats.requests = requests_.load(std::memory_order_relaxed);
+    stats.handshakes = handshakes_.load(std::memory_order_relaxed);
+    stats.tickets_offered = tickets_offered_.load(std::memory_order_relaxed);
+    stats.no_ticket = stats.handshakes - stats.tickets_offered;
+    stats.full_handshake_ms = full_handshake_ms_.load(std::memory_order_relaxed);
+    stats.ticket_handshake_ms = ticket_handshake_ms_.load(std::memory_order_relaxed);
+    stats.retries = retries_.load(std::memory_order_relaxed);
+    stats.failures = failures_.load(std::memory_order_relaxed);
+    return stats;
+}
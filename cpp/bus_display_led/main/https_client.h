@@ -0,0 +1,157 @@
+// https_client.h
+#pragma once
+
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#define HTTPS_CLIENT_TIMEOUT_MS 3000
+#define HTTPS_CLIENT_LOCK_TIMEOUT_MS 10000
+#define HTTPS_CLIENT_BUFFER_SIZE 1024
+#define HTTPS_CLIENT_CHUNK_SIZE 512
+#define HTTPS_CLIENT_MAX_BODY 4096
+#define HTTPS_CLIENT_DEFAULT_ACCEPT "application/json"
+#define HTTPS_CLIENT_EVENT_STREAM "text/event-stream"
+
+// One long-lived keep-alive connection to a single HTTPS host. The TLS
+// session is set up on the first request and reused afterwards, so a steady
+// poll is one request/response on an open socket. A connection the server
+// dropped is reopened transparently and the request retried once.
+//
+// The session ticket of the last handshake is kept with the connection
+// (CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS), so reconnects after a Wi-Fi drop
+// or server idle timeout offer it and a server that accepts tickets resumes
+// the session instead of doing a full handshake. Modules share one client,
+// and so one cached session, per host through for_host(). Requests are
+// serialized by an internal mutex.
+//
+// An event stream holds its client for as long as it runs, so it gets a
+// client of its own from for_host() with its longer read timeout. That is
+// a second connection with a ticket of its own: esp_http_client keeps the
+// ticket per handle and has no way to hand it to another one.
+class HttpsClient {
+public:
+    // base_url is scheme and host only, e.g. "https://transport.trillet.be".
+    // timeout_ms bounds each socket read, so a long-lived stream needs more
+    // than its heartbeat interval.
+    explicit HttpsClient(const std::string& base_url, int timeout_ms = HTTPS_CLIENT_TIMEOUT_MS);
+    ~HttpsClient();
+
+    // Shared client for base_url and timeout_ms, created on first use and
+    // never freed. Another timeout_ms is another client, e.g. for a stream.
+    static HttpsClient& for_host(const std::string& base_url, int timeout_ms = HTTPS_CLIENT_TIMEOUT_MS);
+
+    // GET/POST base_url + path. Return the HTTP status code with the
+    // (possibly truncated to max_body) response in body, or -1 on a
+    // transport failure.
+    int get(const std::string& path, std::string& body, size_t max_body = HTTPS_CLIENT_MAX_BODY);
+    int post(const std::string& path, const char* content_type, const std::string& payload,
+             std::string& body, size_t max_body = HTTPS_CLIENT_MAX_BODY);
+
+    // Conditional GET: sends If-None-Match when etag is not empty. A 304
+    // comes back with an empty body. response_etag receives the ETag header
+    // of the response (empty when there was none).
+    int get_if_none_match(const std::string& path, const std::string& etag, std::string& response_etag,
+                          std::string& body, size_t max_body = HTTPS_CLIENT_MAX_BODY);
+
+    // Receives a 2xx body chunk by chunk as it is read off the socket, with
+    // no size limit. Returning false stops the transfer and drops the
+    // connection.
+    typedef std::function<bool(const char* data, size_t length)> BodySink;
+
+    // Response headers the caller may need. Filled in before the first body
+    // chunk reaches the sink, so the sink can pick a decoder.
+    struct ResponseHeaders {
+        std::string etag;
+        std::string content_type;
+        std::string cache_control;
+        std::string retry_after;
+    };
+
+    // Streaming conditional GET. accept replaces HTTPS_CLIENT_DEFAULT_ACCEPT
+    // for this request when not null, if_none_match is sent when not empty,
+    // authorization as the Authorization header when not null.
+    int get_streamed(const std::string& path, const char* accept, const std::string& if_none_match,
+                     ResponseHeaders& headers, const BodySink& sink, const char* authorization = nullptr);
+
+    // Long-lived GET of a text/event-stream. The sink sees the body as each
+    // socket read is parsed instead of once a chunk buffer fills up, so a
+    // small event is delivered the moment it arrives. Returns when the
+    // server ends the stream, a read times out or the sink returns false.
+    // Holds the client for the whole stream: use a dedicated instance, e.g.
+    // for_host() with the stream's timeout.
+    int get_event_stream(const std::string& path, const BodySink& sink);
+
+    // Drop the connection, the next request opens a new one. The cached
+    // session survives so that request can still resume it.
+    void disconnect();
+    bool is_connected() const { return connected_; }
+    const std::string& base_url() const { return base_url_; }
+
+    struct Stats {
+        uint32_t requests;          // completed request/response exchanges
+        uint32_t handshakes;        // TCP+TLS connections opened
+        // esp_http_client does not tell whether the server took a ticket:
+        // compare the handshake times. Ticket handshakes as slow as full
+        // ones mean the server declines tickets.
+        uint32_t tickets_offered;   // handshakes that offered a cached session ticket
+        uint32_t no_ticket;         // handshakes without one (first connection), always full
+        uint32_t full_handshake_ms;     // duration of the last handshake without a ticket
+        uint32_t ticket_handshake_ms;   // duration of the last handshake offering one
+        uint32_t retries;           // requests repeated on a fresh connection
+        uint32_t failures;          // requests that failed even after the retry
+    };
+    Stats get_stats() const;
+
+private:
+    bool ensure_client();
+    void close_connection();
+    struct RequestSpec {
+        esp_http_client_method_t method;
+        const char* accept;             // null: HTTPS_CLIENT_DEFAULT_ACCEPT
+        const char* content_type;       // of the payload
+        const std::string* payload;
+        const std::string* if_none_match;
+        const char* authorization;      // null: none
+        bool stream;                    // deliver from HTTP_EVENT_ON_DATA
+    };
+
+    int request(const RequestSpec& spec, const std::string& path, ResponseHeaders* headers, const BodySink& sink);
+    int request_once(const std::string& url, const std::string* payload, bool stream,
+                     ResponseHeaders* headers, const BodySink& sink, bool& delivered);
+    static BodySink string_sink(std::string& body, size_t max_body);
+    static esp_err_t event_handler(esp_http_client_event_t* evt);
+
+    std::string base_url_;
+    int timeout_ms_;
+    esp_http_client_handle_t client_;
+    SemaphoreHandle_t lock_;
+    bool connected_;
+    bool server_close_;             // response carried "Connection: close"
+    ResponseHeaders response_headers_;  // of the current response
+
+    // Event stream delivery from the event handler, set for one request
+    const BodySink* stream_sink_;
+    ResponseHeaders* stream_headers_;
+    bool stream_delivered_;
+    bool stream_rejected_;
+    bool session_cached_;           // a handshake completed, its ticket is kept for the next one
+    int64_t request_start_us_;
+    char chunk_[HTTPS_CLIENT_CHUNK_SIZE];
+    HttpsClient* next_;             // for_host() registry
+
+    std::atomic<uint32_t> requests_;
+    std::atomic<uint32_t> handshakes_;
+    std::atomic<uint32_t> tickets_offered_;
+    std::atomic<uint32_t> full_handshake_ms_;
+    std::atomic<uint32_t> ticket_handshake_ms_;
+    std::atomic<uint32_t> retries_;
+    std::atomic<uint32_t> failures_;
+
+    static const char* TAG;
+};
@@ -0,0 +1,285 @@
+// json_scanner.cpp
+#include "json_scanner.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+void JsonScanner::reset() {
+    state_ = ST_VALUE;
+    depth_ = 0;
+    string_is_key_ = false;
+    text_len_ = 0;
+    text_overflow_ = false;
+    text_[0] = '\0';
+    key_[0] = '\0';
+    unicode_ = 0;
+    unicode_left_ = 0;
+    literal_ = nullptr;
+    literal_pos_ = 0;
+}
+
+bool JsonScanner::feed(const char* data, size_t length) {
+    for (size_t n = 0; n < length; n++) {
+        if (state_ == ST_DONE) {
+            return true;
+        }
+        if (!step(data[n])) {
+            return false;
+        }
+    }
+    return state_ != ST_ERROR;
+}
+
+bool JsonScanner::step(char c) {
+    const unsigned char uc = (unsigned char)c;
+
+    switch (state_) {
+        case ST_STRING:
+            if (c == '"') {
+                end_string();
+            } else if (c == '\\') {
+                state_ = ST_STRING_ESCAPE;
+            } else if (uc < 0x20) {
+                state_ = ST_ERROR;
+            } else {
+                string_char(c);
+            }
+            return state_ != ST_ERROR;
+
+        case ST_STRING_ESCAPE: {
+            // Escape letter, unescaped character
+            static const char ESCAPES[] = "\"\"\\\\//b\bf\fn\nr\rt\t";
+            if (c == 'u') {
+                unicode_ = 0;
+                unicode_left_ = 4;
+                state_ = ST_STRING_UNICODE;
+                return true;
+            }
+            for (const char* e = ESCAPES; *e; e += 2) {
+                if (*e == c) {
+                    state_ = ST_STRING;
+                    string_char(e[1]);
+                    return true;
+                }
+            }
+            state_ = ST_ERROR;
+            return false;
+        }
+
+        case ST_STRING_UNICODE:
+            if (!isxdigit(uc)) {
+                state_ = ST_ERROR;
+                return false;
+            }
+            unicode_ = unicode_ << 4 | (uint32_t)(isdigit(uc) ? uc - '0' : (uc | 0x20) - 'a' + 10);
+            if (--unicode_left_ == 0) {
+                // Surrogate halves are not paired up, each becomes U+FFFD
+                if (unicode_ >= 0xD800 && unicode_ <= 0xDFFF) {
+                    unicode_ = 0xFFFD;
+                }
+                state_ = ST_STRING;
+                if (unicode_ < 0x80) {
+                    string_char((char)unicode_);
+                } else if (unicode_ < 0x800) {
+                    string_char((char)(0xC0 | unicode_ >> 6));
+                    string_char((char)(0x80 | (unicode_ & 0x3F)));
+                } else {
+                    string_char((char)(0xE0 | unicode_ >> 12));
+                    string_char((char)(0x80 | (unicode_ >> 6 & 0x3F)));
+                    string_char((char)(0x80 | (unicode_ & 0x3F)));
+                }
+            }
+            return true;
+
+        case ST_NUMBER:
+            if (isdigit(uc) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') {
+                append(c);
+                return true;
+            }
+            if (!end_number()) {
+                state_ = ST_ERROR;
+                return false;
+            }
+            return step(c);     // the delimiter belongs to the enclosing container
+
+        case ST_LITERAL:
+            if (c != literal_[literal_pos_]) {
+                state_ = ST_ERROR;
+                return false;
+            }
+            if (literal_[++literal_pos_] == '\0') {
+                end_value();
+                listener_.on_value(*this, SCALAR_LITERAL, literal_);
+            }
+            return true;
+
+        case ST_DONE:
+            return true;
+
+        case ST_ERROR:
+            return false;
+
+        default:
+            break;
+    }
+
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        return true;
+    }
+
+    bool ok = false;
+    switch (state_) {
+        case ST_VALUE:
+            ok = begin_value(c);
+            break;
+
+        case ST_VALUE_OR_END:
+            ok = c == ']' ? close_container(false) : begin_value(c);
+            break;
+
+        case ST_KEY_OR_END:
+            if (c == '}') {
+                ok = close_container(true);
+                break;
+            }
+            // fall through
+        case ST_KEY:
+            if (c == '"') {
+                string_is_key_ = true;
+                text_len_ = 0;
+                text_overflow_ = false;
+                state_ = ST_STRING;
+                ok = true;
+            }
+            break;
+
+        case ST_COLON:
+            if (c == ':') {
+                state_ = ST_VALUE;
+                ok = true;
+            }
+            break;
+
+        case ST_AFTER_VALUE:
+            if (c == ',') {
+                state_ = is_object_[depth_ - 1] ? ST_KEY : ST_VALUE;
+                ok = true;
+            } else if (c == '}' || c == ']') {
+                ok = close_container(c == '}');
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if (!ok) {
+        state_ = ST_ERROR;
+    }
+    return ok;
+}
+
+bool JsonScanner::begin_value(char c) {
+    if (depth_ == 0 && c != '{' && c != '[') {
+        return false;
+    }
+
+    text_len_ = 0;
+    text_overflow_ = false;
+    switch (c) {
+        case '{':
+            return open_container(true);
+        case '[':
+            return open_container(false);
+        case '"':
+            string_is_key_ = false;
+            state_ = ST_STRING;
+            return true;
+        case 't':
+            literal_ = "true";
+            break;
+        case 'f':
+            literal_ = "false";
+            break;
+        case 'n':
+            literal_ = "null";
+            break;
+        default:
+            if (c == '-' || isdigit((unsigned char)c)) {
+                append(c);
+                state_ = ST_NUMBER;
+                return true;
+            }
+            return false;
+    }
+
+    literal_pos_ = 1;
+    state_ = ST_LITERAL;
+    return true;
+}
+
+bool JsonScanner::open_container(bool is_object) {
+    if (depth_ >= JSON_SCANNER_MAX_DEPTH) {
+        return false;
+    }
+
+    listener_.on_open(*this, is_object);
+    is_object_[depth_++] = is_object;
+    key_[0] = '\0';
+    state_ = is_object ? ST_KEY_OR_END : ST_VALUE_OR_END;
+    return true;
+}
+
+bool JsonScanner::close_container(bool is_object) {
+    if (depth_ == 0 || is_object_[depth_ - 1] != is_object) {
+        return false;
+    }
+
+    depth_--;
+    key_[0] = '\0';
+    state_ = depth_ == 0 ? ST_DONE : ST_AFTER_VALUE;
+    listener_.on_close(*this, is_object);
+    return true;
+}
+
+void JsonScanner::string_char(char c) {
+    append(c);
+    if (!string_is_key_) {
+        listener_.on_string_char(*this, c);
+    }
+}
+
+void JsonScanner::end_string() {
+    text_[text_len_] = '\0';
+    if (string_is_key_) {
+        // A truncated key matches nothing
+        strcpy(key_, text_overflow_ ? "" : text_);
+        state_ = ST_COLON;
+        return;
+    }
+    end_value();
+    listener_.on_value(*this, SCALAR_STRING, text_);
+}
+
+bool JsonScanner::end_number() {
+    text_[text_len_] = '\0';
+    if (text_overflow_) {
+        return false;
+    }
+    char* end = nullptr;
+    strtod(text_, &end);
+    if (end != text_ + text_len_) {
+        return false;
+    }
+    end_value();
+    listener_.on_value(*this, SCALAR_NUMBER, text_);
+    return true;
+}
+
+void JsonScanner::append(char c) {
+    if (text_len_ < JSON_SCANNER_TEXT_SIZE - 1) {
+        text_[text_len_++] = c;
+    } else {
+        text_overflow_ = true;
+    }
+}
@@ -0,0 +1,95 @@
+// json_scanner.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define JSON_SCANNER_MAX_DEPTH 16
+#define JSON_SCANNER_TEXT_SIZE 24
+
+// Byte-at-a-time JSON tokenizer reporting the document structure to a
+// Listener: no DOM, no heap, no limit on the document size. The root must
+// be an object or an array; bytes after it are ignored.
+//
+// String values are reported character by character as they are unescaped,
+// so a string that itself holds JSON can be fed straight into a second
+// scanner. Keys and scalar values are also collected, truncated to
+// JSON_SCANNER_TEXT_SIZE - 1 bytes (text_overflow() tells). Portable, also
+// built by the host tools.
+class JsonScanner {
+public:
+    enum Scalar : uint8_t { SCALAR_STRING, SCALAR_NUMBER, SCALAR_LITERAL };
+
+    // Callbacks see depth() as the number of containers around the token:
+    // on_open before the new container counts, on_close once it no longer
+    // does. key() is the key of the latest member of the innermost object,
+    // empty in arrays; it is not restored when a nested container closes.
+    class Listener {
+    public:
+        virtual ~Listener() {}
+        virtual void on_open(const JsonScanner& scanner, bool is_object) {}
+        virtual void on_close(const JsonScanner& scanner, bool is_object) {}
+        // Every unescaped byte of a string value (\u escapes as UTF-8),
+        // before on_value for the whole string
+        virtual void on_string_char(const JsonScanner& scanner, char c) {}
+        // A complete string (unescaped), number or true/false/null
+        virtual void on_value(const JsonScanner& scanner, Scalar type, const char* text) {}
+    };
+
+    explicit JsonScanner(Listener& listener) : listener_(listener) { reset(); }
+
+    // Start a new document
+    void reset();
+
+    // Consume the next chunk or byte. Return false once the input is
+    // malformed, further input is then ignored.
+    bool feed(const char* data, size_t length);
+    bool step(char c);
+
+    bool done() const { return state_ == ST_DONE; }
+    bool failed() const { return state_ == ST_ERROR; }
+    uint8_t depth() const { return depth_; }
+    const char* key() const { return key_; }
+    bool text_overflow() const { return text_overflow_; }
+
+private:
+    enum State : uint8_t {
+        ST_VALUE,               // a value is expected
+        ST_VALUE_OR_END,        // after '['
+        ST_KEY_OR_END,          // after '{'
+        ST_KEY,                 // after ',' in an object
+        ST_COLON,
+        ST_AFTER_VALUE,         // ',' or the closing bracket
+        ST_STRING,
+        ST_STRING_ESCAPE,
+        ST_STRING_UNICODE,
+        ST_NUMBER,
+        ST_LITERAL,
+        ST_DONE,                // root closed, trailing bytes are ignored
+        ST_ERROR,
+    };
+
+    bool begin_value(char c);
+    bool open_container(bool is_object);
+    bool close_container(bool is_object);
+    void string_char(char c);
+    void end_string();
+    bool end_number();
+    void append(char c);
+    void end_value() { state_ = ST_AFTER_VALUE; }
+
+    Listener& listener_;
+    State state_;
+    bool is_object_[JSON_SCANNER_MAX_DEPTH];
+    uint8_t depth_;
+
+    bool string_is_key_;
+    char text_[JSON_SCANNER_TEXT_SIZE];
+    uint8_t text_len_;
+    bool text_overflow_;
+    char key_[JSON_SCANNER_TEXT_SIZE];
+    uint32_t unicode_;
+    uint8_t unicode_left_;
+    const char* literal_;
+    uint8_t literal_pos_;
+};
@@ -0,0 +1,58 @@
+// layout_id.cpp
+#include "layout_id.h"
+#include <cctype>
+#include <cstring>
+
+bool layout_id_is_valid(const char* id) {
+    size_t n = 0;
+    for (; id[n]; n++) {
+        const unsigned char c = (unsigned char)id[n];
+        if (n >= LAYOUT_ID_SIZE - 1 || !(isalnum(c) || c == '-' || c == '_')) {
+            return false;
+        }
+    }
+    return n > 0;
+}
+
+void LayoutIdParser::reset() {
+    scanner_.reset();
+    id_[0] = '\0';
+    length_ = 0;
+    overflow_ = false;
+    found_ = false;
+}
+
+bool LayoutIdParser::feed(const char* data, size_t length) {
+    return scanner_.feed(data, length);
+}
+
+bool LayoutIdParser::finish(char* out) const {
+    if (!scanner_.done() || !found_ || !layout_id_is_valid(id_)) {
+        return false;
+    }
+    strcpy(out, id_);
+    return true;
+}
+
+void LayoutIdParser::on_string_char(const JsonScanner& scanner, char c) {
+    // Collected here rather than from the scanner, whose text is shorter
+    if (scanner.depth() != 1 || found_ || strcmp(scanner.key(), "layout") != 0) {
+        return;
+    }
+    if (length_ < LAYOUT_ID_SIZE - 1) {
+        id_[length_++] = c;
+        id_[length_] = '\0';
+    } else {
+        overflow_ = true;
+    }
+}
+
+void LayoutIdParser::on_value(const JsonScanner& scanner, JsonScanner::Scalar type, const char* text) {
+    if (scanner.depth() == 1 && !found_ && strcmp(scanner.key(), "layout") == 0) {
+        found_ = type == JsonScanner::SCALAR_STRING && !overflow_;
+        if (!found_) {
+            id_[0] = '\0';
+            length_ = 0;
+        }
+    }
+}
@@ -0,0 +1,39 @@
+// layout_id.h
+#pragma once
+
+#include "json_scanner.h"
+#include <cstddef>
+
+#define LAYOUT_ID_SIZE 33       // up to 32 characters and the terminator
+
+// A layout names what a group of displays show: the server gives every
+// display showing the same lines the same ID, and the display then polls
+// /api/esp/ledstrips/layout/<id>, which shared HTTP caches can serve to all
+// of them. IDs are URL path safe: letters, digits, '-' and '_'.
+bool layout_id_is_valid(const char* id);
+
+// Registration response: {"layout":"<id>"}, other members are ignored.
+// Portable, also built by the host tools.
+class LayoutIdParser : private JsonScanner::Listener {
+public:
+    LayoutIdParser() : scanner_(*this) { reset(); }
+
+    void reset();
+
+    // Consume the next chunk, false once the response is malformed
+    bool feed(const char* data, size_t length);
+
+    // After the last chunk: copies the ID into out (LAYOUT_ID_SIZE bytes).
+    // False when the response is incomplete or holds no valid ID.
+    bool finish(char* out) const;
+
+private:
+    void on_string_char(const JsonScanner& scanner, char c) override;
+    void on_value(const JsonScanner& scanner, JsonScanner::Scalar type, const char* text) override;
+
+    JsonScanner scanner_;
+    char id_[LAYOUT_ID_SIZE];
+    size_t length_;
+    bool overflow_;
+    bool found_;
+};
@@ -1,98 +1,151 @@
 // led_controller.cpp
 #include "led_controller.h"
-#include "rom/ets_sys.h"
+#include "led_mapping.h"
+#include "gpio_led_output.h"
+#include "parallel_led_output.h"
+#include "esp_log.h"
+#include <cstring>
 
 const char* LEDController::TAG = "LED_CTRL";
 
-// LED to register bit mapping (matching your MicroPython code)
-const uint16_t LEDController::led_to_register[12] = {
-    0b0100000000000000,      // LED 1
-    0b0010000000000000,      // LED 2
-    0b0001000000000000,      // LED 3
-    0b0000100000000000,      // LED 4
-    0b0000010000000000,      // LED 5
-    0b0000001000000000,      // LED 6
-    0b0000000000000010,      // LED 7
-    0b0000000000000100,      // LED 8
-    0b0000000000001000,      // LED 9
-    0b0000000000010000,      // LED 10
-    0b0000000000100000,      // LED 11
-    0b0000000001000000,      // LED 12
-};
-
-LEDController::LEDController() : initialized_(false) {
+LEDController::LEDController(GpioHal& hal, const LEDPinConfig& pins)
+    : hal_(hal), pins_(pins), initialized_(false), output_(nullptr),
+      topology_(DisplayTopology::defaults()),
+      last_frame_valid_(false), frames_pushed_(0), frames_skipped_(0),
+      pushes_(0), push_min_us_(UINT32_MAX), push_max_us_(0), last_push_us_(0),
+      push_avg_us_(0), push_total_ms_(0), last_latch_at_ms_(0), stats_since_ms_(0), push_total_us_(0),
+      pwm_enabled_(false), brightness_(LED_DEFAULT_BRIGHTNESS) {
 }
 
 LEDController::~LEDController() {
     if (initialized_) {
         clear_all();
-        gpio_reset_pin(CLOCK_PIN);
-        gpio_reset_pin(DATA_PIN);
-        gpio_reset_pin(LATCH_PIN);
-        gpio_reset_pin(RESET_PIN);
-        gpio_reset_pin(OE_PIN);
+        hal_.reset_pin(pins_.reset);
+        hal_.reset_pin(pins_.oe);
     }
+    delete output_;
+    output_ = nullptr;
 }
 
 bool LEDController::initialize() {
     ESP_LOGI(TAG, "Initializing LED controller pins");
+    stats_since_ms_.store((uint32_t)(hal_.now_us() / 1000), std::memory_order_relaxed);
     
-    // Configure all pins as outputs
-    gpio_config_t io_conf = {};
-    io_conf.intr_type = GPIO_INTR_DISABLE;
-    io_conf.mode = GPIO_MODE_OUTPUT;
-    io_conf.pin_bit_mask = (1ULL << CLOCK_PIN) | (1ULL << DATA_PIN) | 
-                           (1ULL << LATCH_PIN) | (1ULL << RESET_PIN) | (1ULL << OE_PIN);
-    io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
-    io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
-    
-    esp_err_t ret = gpio_config(&io_conf);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "GPIO config failed: %s", esp_err_to_name(ret));
+    // Reset and output-enable stay plain GPIOs, the backend owns clock/data/latch
+    if (!hal_.configure_output(pins_.reset) || !hal_.configure_output(pins_.oe)) {
+        ESP_LOGE(TAG, "Reset/OE GPIO config failed");
         return false;
     }
     
     // Initialize pins to safe state (matching your MicroPython init_pins())
-    gpio_set_level(OE_PIN, 1);        // Disable output (high impedance)
-    gpio_set_level(LATCH_PIN, 0);
-    gpio_set_level(CLOCK_PIN, 0);
-    gpio_set_level(DATA_PIN, 0);
+    hal_.set_level(pins_.oe, 1);        // Disable output (high impedance)
+
+    output_ = create_output();
+    if (!output_) {
+        return false;
+    }
     
     // Reset shift register
-    pulse_pin(RESET_PIN);             // Put low to reset shift register
-    gpio_set_level(RESET_PIN, 1);     // Keep high to prevent resetting
+    pulse_pin(pins_.reset);             // Put low to reset shift register
+    hal_.set_level(pins_.reset, 1);     // Keep high to prevent resetting
     
     // Put 0s in latches
-    pulse_pin(LATCH_PIN);
+    const uint16_t zero = 0;
+    output_->write_frame(&zero, 1);
     
-    // Enable output
-    gpio_set_level(OE_PIN, 0);
+    // Enable output, through PWM when available
+    pwm_enabled_ = start_pwm();
+    if (!pwm_enabled_) {
+        hal_.set_level(pins_.oe, 0);
+    }
     
     initialized_ = true;
-    ESP_LOGI(TAG, "LED controller initialized successfully");
+    ESP_LOGI(TAG, "LED controller initialized successfully (%s output)", output_->name());
     return true;
 }
 
-void LEDController::pulse_pin(gpio_num_t pin) {
-    ets_delay_us(PULSE_DELAY_US);
-    gpio_set_level(pin, 1);
-    ets_delay_us(PULSE_DELAY_US * 2);
-    gpio_set_level(pin, 0);
-    ets_delay_us(PULSE_DELAY_US);
+LEDOutput* LEDController::create_output() {
+    LEDOutput* output;
+    if (pins_.chain_count > 1) {
+        output = new ParallelGpioLEDOutput(hal_, pins_);
+    } else {
+        output = new GpioLEDOutput(hal_, pins_.clock, pins_.data[0], pins_.latch);
+    }
+    if (!output->initialize()) {
+        ESP_LOGE(TAG, "Failed to initialize %s output", output->name());
+        delete output;
+        return nullptr;
+    }
+    return output;
+}
+
+void LEDController::set_brightness(uint8_t level) {
+    fade_to(level, 0, false);
 }
 
-void LEDController::feed_register(uint16_t value) {
-    // Send each bit (from LSB to MSB) - matching your MicroPython code
-    for (int i = 0; i < 16; i++) {
-        int bit = (value >> i) & 1;  // Extract the bit (starting from LSB)
-        gpio_set_level(DATA_PIN, bit);
-        pulse_pin(CLOCK_PIN);
+void LEDController::fade_to(uint8_t level, uint32_t duration_ms, bool wait) {
+    brightness_ = level;
+    if (initialized_ && pwm_enabled_) {
+        fade_pwm(level, duration_ms, wait);
     }
-    gpio_set_level(DATA_PIN, 0);     // Reset to 0 in idle state
 }
 
-void LEDController::latch_data() {
-    pulse_pin(LATCH_PIN);
+void LEDController::pulse_pin(int pin) {
+    hal_.delay_us(PULSE_DELAY_US);
+    hal_.set_level(pin, 1);
+    hal_.delay_us(PULSE_DELAY_US * 2);
+    hal_.set_level(pin, 0);
+    hal_.delay_us(PULSE_DELAY_US);
+}
+
+void LEDController::push_words(const uint16_t* words, size_t count) {
+    int64_t start = hal_.now_us();
+    output_->write_frame(words, count);
+    int64_t end = hal_.now_us();
+    record_push((uint32_t)(end - start), end);
+    ESP_LOGD(TAG, "Pushed %d words in %lu us", (int)count, (unsigned long)(end - start));
+}
+
+// Single writer (whoever drives the output); readers only load
+void LEDController::record_push(uint32_t push_us, int64_t now_us) {
+    const uint32_t pushes = pushes_.load(std::memory_order_relaxed) + 1;
+    push_total_us_ += push_us;
+    pushes_.store(pushes, std::memory_order_relaxed);
+    push_avg_us_.store((uint32_t)(push_total_us_ / pushes), std::memory_order_relaxed);
+    push_total_ms_.store((uint32_t)(push_total_us_ / 1000), std::memory_order_relaxed);
+    last_push_us_.store(push_us, std::memory_order_relaxed);
+    last_latch_at_ms_.store((uint32_t)(now_us / 1000), std::memory_order_relaxed);
+
+    if (push_us < push_min_us_.load(std::memory_order_relaxed)) {
+        push_min_us_.store(push_us, std::memory_order_relaxed);
+    }
+    if (push_us > push_max_us_.load(std::memory_order_relaxed)) {
+        push_max_us_.store(push_us, std::memory_order_relaxed);
+    }
+}
+
+LEDController::LEDStats LEDController::get_stats() const {
+    LEDStats stats{};
+    const int64_t now = hal_.now_us();
+
+    stats.frames_pushed = frames_pushed_.load(std::memory_order_relaxed);
+    stats.frames_skipped = frames_skipped_.load(std::memory_order_relaxed);
+    stats.pushes = pushes_.load(std::memory_order_relaxed);
+    stats.push_min_us = stats.pushes ? push_min_us_.load(std::memory_order_relaxed) : 0;
+    stats.push_max_us = push_max_us_.load(std::memory_order_relaxed);
+    stats.last_push_us = last_push_us_.load(std::memory_order_relaxed);
+
+    stats.push_avg_us = push_avg_us_.load(std::memory_order_relaxed);
+
+    const uint32_t now_ms = (uint32_t)(now / 1000);
+    const uint32_t latched_at_ms = last_latch_at_ms_.load(std::memory_order_relaxed);
+    stats.since_latch_ms = stats.pushes ? now_ms - latched_at_ms : UINT32_MAX;
+
+    // initialize() runs at boot, the window itself never wraps
+    const int64_t window_ms = now / 1000 - stats_since_ms_.load(std::memory_order_relaxed);
+    const uint32_t busy_ms = push_total_ms_.load(std::memory_order_relaxed);
+    stats.busy_permille = window_ms > 0 ? (uint32_t)((uint64_t)busy_ms * 1000 / window_ms) : 0;
+    return stats;
 }
 
 void LEDController::set_leds(uint16_t pattern) {
@@ -101,9 +154,9 @@ void LEDController::set_leds(uint16_t pattern) {
         return;
     }
     
-    feed_register(pattern);
-    latch_data();
-    ESP_LOGD(TAG, "Set LEDs with pattern: 0x%04X", pattern);
+    push_words(&pattern, 1);
+    last_frame_valid_ = false;  // raw pattern, latched state no longer matches last_frame_
+    ESP_LOGD(TAG, "Set LEDs with pattern: 0x%04X (row mask 0x%03X)", pattern, decode_register(pattern));
 }
 
 void LEDController::set_single_led(int led_number) {
@@ -117,7 +170,7 @@ void LEDController::set_single_led(int led_number) {
         return;
     }
     
-    uint16_t pattern = led_to_register[led_number];
+    uint16_t pattern = led_row_to_register(1u << (led_number - 1));
     set_leds(pattern);
     ESP_LOGI(TAG, "Set LED %d (pattern: 0x%04X)", led_number, pattern);
 }
@@ -128,46 +181,72 @@ void LEDController::clear_all() {
         return;
     }
     
-    set_leds(0x0000);
+    memset(words_, 0, topology_.register_count * sizeof(words_[0]));
+    push_words(words_, topology_.register_count);
+    last_frame_valid_ = false;
     ESP_LOGI(TAG, "All LEDs cleared");
 }
 
-void LEDController::set_all(const bool state) {
-    const size_t row_count = 10;
-    bool rows[row_count][12] = {0};
+bool LEDController::set_topology(const DisplayTopology& topology) {
+    if (!topology.is_valid()) {
+        ESP_LOGE(TAG, "Invalid topology rejected (%d registers)", topology.register_count);
+        return false;
+    }
 
-    for (size_t r = 0; r < row_count; r++) {
-        for (int i = 0; i < 12; i++) {
-            rows[r][i] = state;
-        }
+    topology_ = topology;
+    last_frame_valid_ = false;  // force the next frame out with the new layout
+    ESP_LOGI(TAG, "Topology: %d registers, populated bits 0x%04X",
+             topology_.register_count, topology_.populated_mask);
+    return true;
+}
+
+void LEDController::set_all(const bool state) {
+    Frame frame;
+    frame.row_count = topology_.register_count;
+    for (size_t r = 0; r < frame.row_count; r++) {
+        frame.rows[r] = state ? FRAME_ROW_MASK : 0;
     }
 
-    set_rows(rows, row_count);
+    set_frame(frame);
 }
 
 void LEDController::set_rows(const bool rows[][12], size_t row_count) {
+    if (row_count > LED_MAX_ROWS) {
+        ESP_LOGW(TAG, "Too many rows (%d), truncating to %d", (int)row_count, LED_MAX_ROWS);
+    }
+
+    set_frame(Frame::from_rows(rows, row_count));
+}
+
+uint16_t LEDController::decode_register(uint16_t word) {
+    return led_register_to_row(word);
+}
+
+bool LEDController::set_frame(const Frame& frame) {
     if (!initialized_) {
         ESP_LOGE(TAG, "LED controller not initialized");
-        return;
+        return false;
     }
 
-    for (size_t r = 0; r < row_count; r++) {
-        uint16_t pattern = 0;
-        for (size_t i = 0; i < 12; i++) {
-            if (rows[r][i]) {
-                pattern |= led_to_register[i];
-            }
-        }
-        feed_register(pattern);  // feed each row sequentially
+    if (last_frame_valid_ && frame == last_frame_) {
+        frames_skipped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
     }
 
-    latch_data();  // latch after all rows are fed
+    // Always shift the full physical chain, rows beyond the frame stay dark
+    const size_t chain_length = topology_.encode(frame, words_);
+    push_words(words_, chain_length);  // feed all rows, then latch
+
+    last_frame_ = frame;
+    last_frame_valid_ = true;
+    frames_pushed_.fetch_add(1, std::memory_order_relaxed);
+    return true;
 }
 
-// Updated test_sequence to use 4 rows
+// Walks one LED through every row of the configured chain
 void LEDController::test_sequence() {
-    const size_t row_count = 4;
-    bool rows[row_count][12] = {0};
+    const size_t row_count = topology_.register_count;
+    bool rows[LED_MAX_ROWS][12] = {0};
 
     for (int led = 0; led < 12; led++) {
         // Clear all LEDs
@@ -180,6 +259,6 @@ void LEDController::test_sequence() {
         set_rows(rows, row_count);
 
         // wait 1 second before next LED
-        ets_delay_us(1000000);  // 1 second
+        hal_.delay_us(1000000);  // 1 second
     }
 }
@@ -1,25 +1,25 @@
 // led_controller.h
 #pragma once
 
-#include "driver/gpio.h"
-#include "esp_log.h"
+#include "led_output.h"
+#include "frame.h"
+#include "display_topology.h"
 #include <cstdint>
+#include <atomic>
+#include "board_pins.h"
+#include "gpio_hal.h"
 
+#define LED_DEFAULT_BRIGHTNESS 255
 
-// GPIO Pin Definitions
-#define CLOCK_PIN GPIO_NUM_18
-#define DATA_PIN GPIO_NUM_15
-#define LATCH_PIN GPIO_NUM_5
-#define RESET_PIN GPIO_NUM_19
-#define OE_PIN GPIO_NUM_2
-
-// Timing
-#define PULSE_DELAY_US 200
-
+// Frame path of the register chain: every pin, RESET and OE included, goes
+// through the GpioHal, so the controller also runs against SimGpioHal on the
+// host. Backends are the bit-banged GPIO one for a single chain and the
+// parallel one for several; there is no brightness PWM, OE is simply driven
+// low. EspLEDController adds the SPI backend and LEDC brightness.
 class LEDController {
 public:
-    LEDController();
-    ~LEDController();
+    explicit LEDController(GpioHal& hal, const LEDPinConfig& pins = BOARD_PINS);
+    virtual ~LEDController();
     
     bool initialize();
     void set_leds(uint16_t pattern);
@@ -28,15 +28,88 @@ public:
     void set_all(const bool state);
     void test_sequence();
     void set_rows(const bool rows[][12], size_t row_count);
-    
+
+    // Latch a packed frame. Returns false when the frame is identical to the
+    // one currently latched and output was skipped.
+    bool set_frame(const Frame& frame);
+
+    // Chain layout; invalid descriptors are rejected and the current one kept
+    bool set_topology(const DisplayTopology& topology);
+    const DisplayTopology& topology() const { return topology_; }
+
+    bool is_latched(const Frame& frame) const { return last_frame_valid_ && frame == last_frame_; }
+
+    // Global brightness (0-255, perceptual) through hardware PWM on OE.
+    // fade_to() is timed by the PWM peripheral; with wait=false it returns
+    // immediately and costs no CPU while the fade runs. Without PWM the
+    // level is only remembered.
+    void set_brightness(uint8_t level);
+    void fade_to(uint8_t level, uint32_t duration_ms, bool wait);
+    uint8_t brightness() const { return brightness_; }
+
+    // Output path counters. Written only by the thread driving the LEDs,
+    // readable from any task without locking or touching the GPIO path:
+    // only 32-bit atomics, the widest that are lock-free on Xtensa.
+    struct LEDStats {
+        uint32_t frames_pushed;     // frames shifted and latched
+        uint32_t frames_skipped;    // identical to the latched frame, not pushed
+        uint32_t pushes;            // all shift+latch cycles, including raw patterns
+        uint32_t push_min_us;
+        uint32_t push_avg_us;
+        uint32_t push_max_us;
+        uint32_t last_push_us;
+        uint32_t since_latch_ms;    // UINT32_MAX until the first latch
+        uint32_t busy_permille;     // share of wall time spent shifting since initialize()
+    };
+    LEDStats get_stats() const;
+
+    // Logical row mask held by a register word, for diagnostics
+    static uint16_t decode_register(uint16_t word);
+
+    const char* output_name() const { return output_ ? output_->name() : "none"; }
+    uint32_t last_push_us() const { return last_push_us_.load(std::memory_order_relaxed); }
+
+protected:
+    // Initialized backend for the pins, nullptr when it could not be set up
+    virtual LEDOutput* create_output();
+    // Brightness PWM on OE, started once the registers hold zeros. False
+    // when there is none: OE is then driven low as a plain GPIO.
+    virtual bool start_pwm() { return false; }
+    virtual void fade_pwm(uint8_t level, uint32_t duration_ms, bool wait) {}
+
+    GpioHal& hal_;
+    LEDPinConfig pins_;
+
 private:
-    void pulse_pin(gpio_num_t pin);
-    void feed_register(uint16_t value);
-    void latch_data();
+    void pulse_pin(int pin);
+    void push_words(const uint16_t* words, size_t count);
+    void record_push(uint32_t push_us, int64_t now_us);
     bool initialized_;
+    LEDOutput* output_;
+    uint16_t words_[LED_OUTPUT_MAX_WORDS];
+    DisplayTopology topology_;
+
+    // Last frame latched through set_frame(), for dirty-frame suppression
+    Frame last_frame_;
+    bool last_frame_valid_;
+
+    std::atomic<uint32_t> frames_pushed_;
+    std::atomic<uint32_t> frames_skipped_;
+    std::atomic<uint32_t> pushes_;
+    std::atomic<uint32_t> push_min_us_;
+    std::atomic<uint32_t> push_max_us_;
+    std::atomic<uint32_t> last_push_us_;
+    std::atomic<uint32_t> push_avg_us_;
+    // Times in ms since boot, truncated: since_latch_ms wraps after 49 days
+    // without a frame, busy time after 49 days spent shifting (years at a
+    // typical share)
+    std::atomic<uint32_t> push_total_ms_;
+    std::atomic<uint32_t> last_latch_at_ms_;
+    std::atomic<uint32_t> stats_since_ms_;
+    uint64_t push_total_us_;            // writer only
+
+    bool pwm_enabled_;
+    uint8_t brightness_;
     
     static const char* TAG;
-    
-    // LED to register bit mapping (from your original code)
-    static const uint16_t led_to_register[12];
-};
\ No newline at end of file
+};
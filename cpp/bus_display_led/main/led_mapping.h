@@ -0,0 +1,82 @@
+// led_mapping.h
+#pragma once
+
+#include "frame.h"
+#include <array>
+#include <cstdint>
+
+// Register bit driving each LED of a row, LED 1 first (matching your MicroPython code).
+// This is the only thing to change for a new PCB revision; the lookup tables
+// below are generated from it at compile time.
+inline constexpr uint8_t LED_REGISTER_BIT[LEDS_PER_ROW] = {
+    14, 13, 12, 11, 10, 9,      // LED 1-6
+    1, 2, 3, 4, 5, 6,           // LED 7-12
+};
+
+#define LED_HALF_BITS (LEDS_PER_ROW / 2)
+
+// Logical 6-bit half row -> register word
+constexpr std::array<uint16_t, 1 << LED_HALF_BITS> make_half_row_table(unsigned first_led) {
+    std::array<uint16_t, 1 << LED_HALF_BITS> table{};
+    for (unsigned mask = 0; mask < table.size(); mask++) {
+        uint16_t word = 0;
+        for (unsigned i = 0; i < LED_HALF_BITS; i++) {
+            if ((mask >> i) & 1) {
+                word |= (uint16_t)(1u << LED_REGISTER_BIT[first_led + i]);
+            }
+        }
+        table[mask] = word;
+    }
+    return table;
+}
+
+// Register byte -> logical row mask, for diagnostics
+constexpr std::array<uint16_t, 256> make_register_byte_table(unsigned first_bit) {
+    std::array<uint16_t, 256> table{};
+    for (unsigned byte = 0; byte < table.size(); byte++) {
+        uint16_t mask = 0;
+        for (unsigned led = 0; led < LEDS_PER_ROW; led++) {
+            unsigned bit = LED_REGISTER_BIT[led];
+            if (bit >= first_bit && bit < first_bit + 8 && ((byte >> (bit - first_bit)) & 1)) {
+                mask |= (uint16_t)(1u << led);
+            }
+        }
+        table[byte] = mask;
+    }
+    return table;
+}
+
+inline constexpr auto LED_ROW_LOW_TABLE = make_half_row_table(0);
+inline constexpr auto LED_ROW_HIGH_TABLE = make_half_row_table(LED_HALF_BITS);
+inline constexpr auto LED_REGISTER_LOW_TABLE = make_register_byte_table(0);
+inline constexpr auto LED_REGISTER_HIGH_TABLE = make_register_byte_table(8);
+
+// 12-bit logical row mask (bit i = LED i+1) -> physical register word
+constexpr uint16_t led_row_to_register(uint16_t row_mask) {
+    return LED_ROW_LOW_TABLE[row_mask & 0x3F] | LED_ROW_HIGH_TABLE[(row_mask >> LED_HALF_BITS) & 0x3F];
+}
+
+// Physical register word -> logical row mask, unpopulated bits are dropped
+constexpr uint16_t led_register_to_row(uint16_t word) {
+    return LED_REGISTER_LOW_TABLE[word & 0xFF] | LED_REGISTER_HIGH_TABLE[word >> 8];
+}
+
+constexpr bool led_mapping_is_bijective() {
+    uint16_t used = 0;
+    for (unsigned led = 0; led < LEDS_PER_ROW; led++) {
+        if (LED_REGISTER_BIT[led] > 15 || (used >> LED_REGISTER_BIT[led]) & 1) {
+            return false;
+        }
+        used |= (uint16_t)(1u << LED_REGISTER_BIT[led]);
+    }
+    for (unsigned mask = 0; mask <= FRAME_ROW_MASK; mask++) {
+        if (led_register_to_row(led_row_to_register(mask)) != mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(led_mapping_is_bijective(), "LED_REGISTER_BIT must map every LED to a distinct register bit");
+static_assert(led_row_to_register(0x001) == 0b0100000000000000, "LED 1 is register bit 14");
+static_assert(led_row_to_register(0x800) == 0b0000000001000000, "LED 12 is register bit 6");
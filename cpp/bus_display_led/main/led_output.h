@@ -0,0 +1,21 @@
+// led_output.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Maximum number of 16-bit register words a backend has to buffer for one frame
+#define LED_OUTPUT_MAX_WORDS 64
+
+// Output backend for the 74HC595 register chain.
+// A backend shifts a whole frame of register words out and latches it.
+// Words are shifted in buffer order, each word from LSB to MSB, so the
+// first word ends up in the register furthest away from the ESP32.
+class LEDOutput {
+public:
+    virtual ~LEDOutput() {}
+
+    virtual bool initialize() = 0;
+    virtual bool write_frame(const uint16_t* words, size_t count) = 0;
+    virtual const char* name() const = 0;
+};
@@ -1,214 +1,639 @@
 #include "led_updater.h"
-#include "esp_crt_bundle.h"
-#include "cJSON.h"
-#include <vector>
-#include <algorithm>
+#include "esp_random.h"
+#include "esp_timer.h"
+#include <cstring>
+#include <ctime>
+#include <sys/time.h>
 
 const char* LEDUpdater::TAG = "LED_UPDATER";
 
-LEDUpdater::LEDUpdater(LEDController& led_controller, WiFiManager& wifi_manager)
-    : led_controller_(led_controller), wifi_manager_(wifi_manager),
-      chunk_buffer_(nullptr), chunk_buffer_size_(512) 
+LEDUpdater::LEDUpdater(DisplayTask& display, WiFiManager& wifi_manager, StorageManager& storage)
+    : display_(display), wifi_manager_(wifi_manager), storage_(storage),
+      binary_length_(0), binary_truncated_(false), sequence_(0),
+      stream_client_(HttpsClient::for_host(LED_UPDATER_BASE_URL, LED_UPDATER_STREAM_TIMEOUT_MS)),
+      sse_([this](const SseEvent& event) { on_stream_event(event); }),
+      push_enabled_(LED_UPDATER_PUSH_ENABLED), pushing_(false), stream_resync_(false),
+      timeline_end_us_(0), stib_(StibConfig::defaults()), stib_client_(nullptr), direct_(false),
+      next_registration_us_(0), next_timetable_us_(0), live_at_us_(0), next_poll_us_(0), next_schedule_us_(0), scheduled_(false),
+      poll_delay_ms_(0),
+      client_(HttpsClient::for_host(LED_UPDATER_BASE_URL)), not_modified_count_(0), binary_count_(0),
+      pushed_count_(0), stream_count_(0), delta_count_(0), timeline_count_(0), direct_count_(0),
+      scheduled_count_(0)
 {
-    chunk_buffer_ = (char*)malloc(chunk_buffer_size_);
-    if (!chunk_buffer_) {
-        ESP_LOGE(TAG, "Failed to allocate chunk buffer");
-        chunk_buffer_size_ = 0;
+    // A stored ID is used right away, the server is only asked again later
+    if (storage_.load_layout_id(layout_id_)) {
+        ESP_LOGI(TAG, "Layout %s", layout_id_);
+        next_registration_us_ = (int64_t)LED_UPDATER_REGISTER_REFRESH_MS * 1000;
     }
 }
 
-LEDUpdater::~LEDUpdater() {
-    if (chunk_buffer_) {
-        free(chunk_buffer_);
-        chunk_buffer_ = nullptr;
-        chunk_buffer_size_ = 0;
-    }
+void LEDUpdater::set_poll_profile(const PollProfile& profile) {
+    profile_mailbox_.publish(profile, esp_timer_get_time());
 }
 
-std::string LEDUpdater::http_get(const std::string& url) {
-    ESP_LOGI(TAG, "Starting HTTP GET request to: %s", url.c_str());
+void LEDUpdater::set_stib_config(const StibConfig& config) {
+    stib_mailbox_.publish(config, esp_timer_get_time());
+    // Ends a running push stream right away
+    direct_ = config.enabled;
+}
 
-    if (!wifi_manager_.is_connected()) {
-        ESP_LOGW(TAG, "Wi-Fi disconnected, skipping HTTP request");
-        return "";
+// Records query for the lines of the table: where=lineid='8' OR lineid='25'
+static std::string stib_path(const StibConfig& config) {
+    uint16_t lines[STIB_MAX_LINES];
+    size_t count = config.line_list(lines, STIB_MAX_LINES);
+    std::string path = LED_UPDATER_STIB_PATH;
+    for (size_t i = 0; i < count; i++) {
+        path += (i ? "%20OR%20" : "") + std::string("lineid%3D%27") + std::to_string(lines[i]) + "%27";
     }
+    return path;
+}
 
-    esp_http_client_config_t config{};
-    config.url = url.c_str();
-    config.crt_bundle_attach = esp_crt_bundle_attach;
-    config.timeout_ms = 3000; // 3s timeout
-    config.buffer_size = 1024;
-    config.buffer_size_tx = 1024;
-
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (!client) {
-        ESP_LOGE(TAG, "Failed to initialize HTTP client");
-        return "";
+// Local time of day for the poll profile, -1 until SNTP has set the clock
+static int32_t local_second_of_day() {
+    time_t now = time(nullptr);
+    if (now < 1600000000) {
+        return -1;
     }
+    struct tm local;
+    localtime_r(&now, &local);
+    return local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec;
+}
 
-    esp_http_client_set_header(client, "User-Agent", "ESP32-BusDisplay/1.0");
-    esp_http_client_set_header(client, "Accept", "application/json");
-    esp_http_client_set_header(client, "Connection", "close");
+void LEDUpdater::run() {
+    uint32_t backoff_ms = LED_UPDATER_BACKOFF_MIN_MS;
+    int64_t next_stream_at_us = 0;
+    PollProfile profile;
+    timetable_store_.mount();
 
-    esp_err_t err = esp_http_client_open(client, 0);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
-        esp_http_client_cleanup(client);
-        return "";
-    }
-
-    int content_length = esp_http_client_fetch_headers(client);
-    int status_code = esp_http_client_get_status_code(client);
-
-    //ESP_LOGI(TAG, "HTTP Status: %d, Content-Length: %d", status_code, content_length);
-
-    std::string response;
-    response.reserve(4096);  // pre-allocate for efficiency
-
-    if (status_code == 200) {
-        if (content_length > 0) {
-            char* buffer = (char*)malloc(content_length + 1);
-            if (buffer) {
-                int total_read = 0;
-                while (total_read < content_length) {
-                    int read = esp_http_client_read_response(client, buffer + total_read, content_length - total_read);
-                    if (read <= 0) break;
-                    total_read += read;
-                }
-                buffer[total_read] = '\0';
-                response.assign(buffer, total_read);
-                free(buffer);
-            } else {
-                ESP_LOGE(TAG, "Failed to allocate buffer for fixed-length response");
-            }
-        } else if (chunk_buffer_ && chunk_buffer_size_ > 0) {
-            int total_read = 0;
-            while (true) {
-                int read = esp_http_client_read_response(client, chunk_buffer_, chunk_buffer_size_ - 1);
-                if (read <= 0) break;
-                chunk_buffer_[read] = '\0';
-                response.append(chunk_buffer_, read);
-                total_read += read;
-                if (total_read >= 4096) {
-                    ESP_LOGW(TAG, "Response too large, truncating");
-                    break;
-                }
+    while (true) {
+        if (profile_mailbox_.take(profile)) {
+            scheduler_.set_profile(profile);
+        }
+        if (stib_mailbox_.take(stib_)) {
+            stib_path_ = stib_path(stib_);
+            stib_authorization_ = std::string("Apikey ") + stib_.api_key;
+            stib_etag_.clear();
+            // Whatever the display holds came from the other source
+            sequence_ = 0;
+            etag_.clear();
+            timeline_end_us_ = 0;
+            ESP_LOGI(TAG, "Direct STIB mode %s (%d stops)", stib_.enabled ? "on" : "off", stib_.point_count);
+        }
+        const bool direct = stib_.enabled;
+        show_schedule();
+
+        if (!wifi_manager_.is_connected()) {
+            vTaskDelay(pdMS_TO_TICKS(LED_UPDATER_OFFLINE_MS));
+            continue;
+        }
+
+        if (!direct && esp_timer_get_time() >= next_registration_us_) {
+            register_layout();
+        }
+        if (esp_timer_get_time() >= next_timetable_us_) {
+            refresh_timetable();
+        }
+
+        if (!direct && push_enabled_ && esp_timer_get_time() >= next_stream_at_us) {
+            if (stream_updates()) {
+                backoff_ms = LED_UPDATER_BACKOFF_MIN_MS;
             }
+
+            // The server's "retry:" is a floor, jitter keeps a fleet from
+            // reconnecting in lockstep after a server restart
+            uint32_t delay_ms = backoff_ms > sse_.retry_ms() ? backoff_ms : sse_.retry_ms();
+            delay_ms -= esp_random() % (delay_ms / 4 + 1);
+            next_stream_at_us = esp_timer_get_time() + (int64_t)delay_ms * 1000;
+            backoff_ms = backoff_ms * 2 < LED_UPDATER_BACKOFF_MAX_MS ? backoff_ms * 2 : LED_UPDATER_BACKOFF_MAX_MS;
+            ESP_LOGI(TAG, "Update stream down, polling, next stream attempt in %lu ms", (unsigned long)delay_ms);
+        }
+
+        // Also catches up right after the stream dropped
+        PollOutcome outcome;
+        if (direct) {
+            fetch_stib(&outcome);
         } else {
-            ESP_LOGE(TAG, "No chunk buffer available for reading response");
+            fetch_and_update(&outcome);
+        }
+        uint32_t delay_ms = scheduler_.next_delay_ms(outcome, local_second_of_day(), esp_random());
+        if (direct && delay_ms < LED_UPDATER_STIB_MIN_POLL_MS) {
+            // Nothing new sooner, and the API key has a daily quota
+            delay_ms = LED_UPDATER_STIB_MIN_POLL_MS;
+        }
+        poll_delay_ms_.store(delay_ms, std::memory_order_relaxed);
+        if (scheduler_.consecutive_failures()) {
+            ESP_LOGW(TAG, "Poll failed %lu times in a row, next in %lu ms",
+                     (unsigned long)scheduler_.consecutive_failures(), (unsigned long)delay_ms);
         }
+
+        // Wake up for the next stream attempt when it comes first
+        if (!direct && push_enabled_) {
+            int64_t until_stream_ms = (next_stream_at_us - esp_timer_get_time()) / 1000;
+            if (until_stream_ms < (int64_t)delay_ms) {
+                delay_ms = until_stream_ms > 0 ? (uint32_t)until_stream_ms : 0;
+            }
+        }
+        next_poll_us_ = esp_timer_get_time() + (int64_t)delay_ms * 1000;
+        wait(delay_ms);
+    }
+}
+
+void LEDUpdater::wait(uint32_t delay_ms) {
+    const int64_t until_us = esp_timer_get_time() + (int64_t)delay_ms * 1000;
+    while (true) {
+        show_schedule();
+        const int64_t left_ms = (until_us - esp_timer_get_time()) / 1000;
+        if (left_ms <= 0) {
+            return;
+        }
+        vTaskDelay(pdMS_TO_TICKS(left_ms < LED_UPDATER_SCHEDULE_TICK_MS ? left_ms : LED_UPDATER_SCHEDULE_TICK_MS));
+    }
+}
+
+std::string LEDUpdater::timetable_path() const {
+    if (layout_id_[0]) {
+        return std::string(LED_UPDATER_TIMETABLE_LAYOUT_PATH) + layout_id_;
+    }
+    return LED_UPDATER_TIMETABLE_PATH + wifi_manager_.get_mac_address();
+}
+
+void LEDUpdater::refresh_timetable() {
+    next_timetable_us_ = esp_timer_get_time() + (int64_t)LED_UPDATER_TIMETABLE_REFRESH_MS * 1000;
+    if (!timetable_store_.begin()) {
+        return;     // no partition
+    }
+
+    char etag[TIMETABLE_ETAG_SIZE] = "";
+    const Timetable& current = timetable_store_.timetable();
+    if (current.is_valid()) {
+        timetable_etag(current.crc32(), etag);
+    }
+    HttpsClient::ResponseHeaders headers;
+    int status_code = client_.get_streamed(timetable_path(), TIMETABLE_CONTENT_TYPE, etag, headers,
+        [this, &headers](const char* data, size_t length) {
+            return strncmp(headers.content_type.c_str(), TIMETABLE_CONTENT_TYPE, strlen(TIMETABLE_CONTENT_TYPE)) == 0 &&
+                   timetable_store_.write(data, length);
+        });
+
+    if (status_code == 200 && timetable_store_.commit()) {
+        return;
+    }
+    timetable_store_.abort();
+    if (status_code == 304) {
+        ESP_LOGD(TAG, "Timetable unchanged");
+    } else if (status_code == 404) {
+        ESP_LOGI(TAG, "No timetable for this display on the server");
     } else {
-        ESP_LOGE(TAG, "HTTP request failed with status: %d", status_code);
+        ESP_LOGW(TAG, "Timetable download failed (status %d)", status_code);
+        next_timetable_us_ = esp_timer_get_time() + (int64_t)LED_UPDATER_TIMETABLE_RETRY_MS * 1000;
     }
+}
 
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
+void LEDUpdater::mark_live() {
+    live_at_us_ = esp_timer_get_time();
+    if (scheduled_) {
+        scheduled_ = false;
+        ESP_LOGI(TAG, "Live data back, leaving the timetable");
+    }
+}
 
-    ESP_LOGI(TAG, "Full response (%d bytes)", response.length());
-    if (response.empty()) {
-        ESP_LOGW(TAG, "Received empty response from server");
+void LEDUpdater::show_schedule() {
+    const int64_t now_us = esp_timer_get_time();
+    const int64_t live_until_us = live_at_us_ > timeline_end_us_ ? live_at_us_ : timeline_end_us_;
+    if (!scheduler_.is_stale(now_us / 1000, live_until_us / 1000, next_poll_us_ / 1000) ||
+        now_us < next_schedule_us_) {
+        return;
     }
+    next_schedule_us_ = now_us + (int64_t)LED_UPDATER_SCHEDULE_TICK_MS * 1000;
 
-    return response;
+    const Timetable& timetable = timetable_store_.timetable();
+    const time_t now = time(nullptr);
+    if (!timetable.is_valid() || now < 1600000000 ||
+        (timetable.valid_until_s() && (uint32_t)now > timetable.valid_until_s())) {
+        return;     // the last live state stays
+    }
+
+    struct tm local;
+    localtime_r(&now, &local);
+    Frame frame;
+    const size_t vehicles = timetable.predict((local.tm_wday + 6) % 7, local.tm_hour * 3600 + local.tm_min * 60 +
+                                              local.tm_sec, stib_.enabled ? &stib_ : nullptr, frame);
+    if (!scheduled_) {
+        ESP_LOGW(TAG, "No live data for %lld s, showing the timetable (%d vehicles)",
+                 (long long)((now_us - live_until_us) / 1000000), (int)vehicles);
+        scheduled_ = true;
+        // The display no longer holds what the tags and sequence describe
+        sequence_ = 0;
+        etag_.clear();
+        stib_etag_.clear();
+        timeline_end_us_ = 0;
+    }
+    if (display_.publish(Animation(frame))) {
+        scheduled_count_.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
+void LEDUpdater::register_layout() {
+    const std::string path = LED_UPDATER_REGISTER_PATH + wifi_manager_.get_mac_address();
+    HttpsClient::ResponseHeaders headers;
+    layout_parser_.reset();
+    int status_code = client_.get_streamed(path, "application/json", "", headers,
+        [this](const char* data, size_t length) { return layout_parser_.feed(data, length); });
+
+    char id[LAYOUT_ID_SIZE];
+    if (status_code == 200 && layout_parser_.finish(id)) {
+        next_registration_us_ = esp_timer_get_time() + (int64_t)LED_UPDATER_REGISTER_REFRESH_MS * 1000;
+        if (strcmp(id, layout_id_) != 0) {
+            ESP_LOGI(TAG, "Layout %s%s%s", id, layout_id_[0] ? ", was " : "", layout_id_);
+            strcpy(layout_id_, id);
+            storage_.save_layout_id(layout_id_);
+            // Another resource: what the display holds came from the old one
+            sequence_ = 0;
+            etag_.clear();
+            timeline_end_us_ = 0;
+        }
+        return;
+    }
+
+    if (status_code == 404 && layout_id_[0]) {
+        forget_layout();
+    } else if (status_code == 404) {
+        ESP_LOGI(TAG, "Server assigns no layout, polling by MAC");
+    } else {
+        // Keeps the stored layout, if any
+        ESP_LOGW(TAG, "Layout registration failed (status %d)", status_code);
+    }
+    next_registration_us_ = esp_timer_get_time() + (int64_t)LED_UPDATER_REGISTER_RETRY_MS * 1000;
+}
 
-bool LEDUpdater::parse_json_to_strips(const char* json, std::vector<StripData>& strips_out) {
-    //ESP_LOGI(TAG, "Parsing JSON: %s", json);
+void LEDUpdater::forget_layout() {
+    ESP_LOGW(TAG, "Layout %s unknown to the server, polling by MAC", layout_id_);
+    layout_id_[0] = '\0';
+    storage_.clear_layout_id();
+    // Not right away: a server handing out a layout it then does not serve
+    // would otherwise cost two NVS writes a poll
+    next_registration_us_ = esp_timer_get_time() + (int64_t)LED_UPDATER_REGISTER_RETRY_MS * 1000;
+    sequence_ = 0;
+    etag_.clear();
+    timeline_end_us_ = 0;
+}
 
-    cJSON* root = cJSON_Parse(json);
-    if (!root) {
-        ESP_LOGE(TAG, "Failed to parse JSON");
-        return false;
+std::string LEDUpdater::ledstrips_path() const {
+    if (layout_id_[0]) {
+        return std::string(LED_UPDATER_LAYOUT_PATH) + layout_id_;
     }
+    return LED_UPDATER_PATH + wifi_manager_.get_mac_address();
+}
 
-    cJSON* strips = cJSON_GetObjectItem(root, "strips");
-    if (!cJSON_IsArray(strips)) {
-        ESP_LOGW(TAG, "No 'strips' array in JSON");
-        cJSON_Delete(root);
-        return false;
+std::string LEDUpdater::stream_path() const {
+    if (layout_id_[0]) {
+        return std::string(LED_UPDATER_LAYOUT_PATH) + layout_id_ + LED_UPDATER_LAYOUT_STREAM;
     }
+    return LED_UPDATER_STREAM_PATH + wifi_manager_.get_mac_address();
+}
 
-    strips_out.clear();
+bool LEDUpdater::stream_updates() {
+    const std::string path = stream_path();
+    const int64_t started_us = esp_timer_get_time();
+    const uint32_t frames_before = pushed_count();
 
-    cJSON* strip = nullptr;
-    cJSON_ArrayForEach(strip, strips) {
-        StripData data{};
+    // No polls while the stream is up: free the TLS memory of that connection
+    client_.disconnect();
 
-        cJSON* h = cJSON_GetObjectItem(strip, "h");
-        if (!cJSON_IsNumber(h)) {
-            ESP_LOGW(TAG, "Strip without valid 'h', skipping");
-            continue;
+    sse_.reset();
+    stream_resync_ = false;
+    stream_count_.fetch_add(1, std::memory_order_relaxed);
+    ESP_LOGI(TAG, "Opening update stream");
+
+    int status_code = stream_client_.get_event_stream(path, [this](const char* data, size_t length) {
+        pushing_ = true;
+        // Heartbeats too: the state on the display is still the current one
+        if (!scheduled_) {
+            live_at_us_ = esp_timer_get_time();
         }
-        data.h = h->valueint;
+        sse_.feed(data, length);
+        return !stream_resync_ && push_enabled_.load() && !direct_.load() && wifi_manager_.is_connected();
+    });
+    pushing_ = false;
+
+    const uint32_t frames = pushed_count() - frames_before;
+    const int64_t up_ms = (esp_timer_get_time() - started_us) / 1000;
+    if (status_code == 404 && layout_id_[0]) {
+        forget_layout();
+    } else if (status_code != 200) {
+        ESP_LOGW(TAG, "Update stream unavailable (status %d)", status_code);
+    } else {
+        ESP_LOGI(TAG, "Update stream ended after %lld ms: %lu frames, %lu heartbeats, %lu events dropped",
+                 (long long)up_ms, (unsigned long)frames, (unsigned long)sse_.heartbeats(),
+                 (unsigned long)sse_.dropped());
+    }
+    stream_client_.disconnect();
+
+    return frames > 0 && up_ms >= LED_UPDATER_STREAM_STABLE_MS;
+}
+
+void LEDUpdater::on_stream_event(const SseEvent& event) {
+    if (strcmp(event.name, LED_UPDATER_STREAM_EVENT) != 0) {
+        return;
+    }
+
+    FrameCodecHeader header;
+    binary_truncated_ = false;
+    size_t length = frame_codec_base64_decode(event.data, event.data_length, binary_, sizeof(binary_));
+    esp_err_t err = length ? decode_binary(length, header) : ESP_FAIL;
+    if (err == ESP_ERR_INVALID_STATE) {
+        // A reconnect starts over with a full frame
+        stream_resync_ = true;
+        return;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Invalid frame event (%d bytes)", (int)event.data_length);
+        return;
+    }
 
-        cJSON* v = cJSON_GetObjectItem(strip, "v");
-        if (!cJSON_IsArray(v)) {
-            ESP_LOGW(TAG, "Strip without 'v' array, skipping h=%d", data.h);
+    if (publish(UPDATE_PATH_PUSH, header)) {
+        pushed_count_.fetch_add(1, std::memory_order_relaxed);
+        mark_live();
+        // The poll ETag no longer describes what is on the display
+        etag_.clear();
+    }
+}
+
+// Server time (ms since the epoch) on the esp_timer clock, 0 until SNTP has set the clock
+static int64_t local_time_us(uint64_t epoch_ms) {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    if (!epoch_ms || now.tv_sec < 1600000000) {
+        return 0;
+    }
+    int64_t age_ms = (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000 - (int64_t)epoch_ms;
+    return esp_timer_get_time() - age_ms * 1000;
+}
+
+bool LEDUpdater::publish(UpdatePath path, const FrameCodecHeader& header) {
+    if (header.flags & FRAME_CODEC_FLAG_TIMELINE) {
+        timeline_.path = path;
+        return display_.publish_timeline(timeline_);
+    }
+    return display_.publish(animation_, path, local_time_us(header.emitted_ms));
+}
+
+int LEDUpdater::http_get(const std::string& path, HttpsClient::ResponseHeaders& headers) {
+    ESP_LOGD(TAG, "GET %s (If-None-Match: %s)", path.c_str(), etag_.empty() ? "-" : etag_.c_str());
+
+    if (!wifi_manager_.is_connected()) {
+        ESP_LOGW(TAG, "Wi-Fi disconnected, skipping HTTP request");
+        client_.disconnect();
+        return -1;
+    }
+
+    parser_.reset();
+    binary_length_ = 0;
+    binary_truncated_ = false;
+    int status_code = client_.get_streamed(path, LED_UPDATER_ACCEPT, etag_, headers,
+        [this, &headers](const char* data, size_t length) {
+            if (!frame_codec_is_content_type(headers.content_type.c_str())) {
+                return parser_.feed(data, length);
+            }
+            // Past the buffer the body is only drained: a timeline keeps
+            // its leading entries, anything else is refused once complete
+            if (binary_length_ + length > sizeof(binary_)) {
+                binary_truncated_ = true;
+                length = sizeof(binary_) - binary_length_;
+            }
+            memcpy(binary_ + binary_length_, data, length);
+            binary_length_ += length;
+            return true;
+        });
+    if (status_code > 0 && status_code != 200 && status_code != 304) {
+        ESP_LOGE(TAG, "HTTP request failed with status: %d", status_code);
+    }
+    return status_code;
+}
+
+
+esp_err_t LEDUpdater::fetch_and_update(PollOutcome* outcome) {
+    HttpsClient::ResponseHeaders headers;
+    int status_code = -1;
+    esp_err_t ret = ESP_FAIL;
+    // A second attempt only after a delta that did not fit, sequence_ is 0
+    // by then so it asks for a full frame, or after the server dropped the
+    // layout, by MAC then
+    for (int attempt = 0; attempt < 2; attempt++) {
+        const bool by_layout = layout_id_[0];
+        std::string path = ledstrips_path();
+        if (sequence_) {
+            path += (path.find('?') == std::string::npos ? "?" : "&");
+            path += LED_UPDATER_SINCE_PARAM + std::to_string(sequence_);
+        }
+        headers = HttpsClient::ResponseHeaders();
+        status_code = http_get(path, headers);
+        if (status_code == 404 && by_layout) {
+            forget_layout();
             continue;
         }
-
-        int idx = 0;
-        cJSON* val = nullptr;
-        cJSON_ArrayForEach(val, v) {
-            uint8_t state = (cJSON_IsTrue(val) || (cJSON_IsNumber(val) && val->valueint != 0)) ? 1 : 0;
-            data.values.push_back(state);
-            //ESP_LOGI(TAG, "Strip h=%d, v[%d]=%d", data.h, idx, state);
-            idx++;
+        ret = apply_response(status_code, headers);
+        if (ret != ESP_ERR_INVALID_STATE) {
+            break;
         }
+    }
+    set_outcome(outcome, status_code, ret, headers);
+    return ret;
+}
 
-        strips_out.push_back(std::move(data));
+void LEDUpdater::set_outcome(PollOutcome* outcome, int status_code, esp_err_t ret,
+                             const HttpsClient::ResponseHeaders& headers) const {
+    if (!outcome) {
+        return;
     }
+    // A body that does not decode counts as a failed poll
+    outcome->status = ret != ESP_OK && status_code == 200 ? -1 : status_code;
+    outcome->max_age_s = PollScheduler::parse_max_age(headers.cache_control.c_str());
+    // No need to poll while the timeline still has frames to show
+    const int64_t timeline_left_ms = (timeline_end_us_ - esp_timer_get_time()) / 1000;
+    if (outcome->max_age_s < 0 && timeline_end_us_ && timeline_left_ms > LED_UPDATER_TIMELINE_MARGIN_MS) {
+        outcome->max_age_s = (int32_t)((timeline_left_ms - LED_UPDATER_TIMELINE_MARGIN_MS) / 1000);
+    }
+    time_t now = time(nullptr);
+    outcome->retry_after_s = PollScheduler::parse_retry_after(headers.retry_after.c_str(),
+                                                              now >= 1600000000 ? now : 0);
+}
 
-    cJSON_Delete(root);
+esp_err_t LEDUpdater::fetch_stib(PollOutcome* outcome) {
+    HttpsClient::ResponseHeaders headers;
+    if (!wifi_manager_.is_connected()) {
+        ESP_LOGW(TAG, "Wi-Fi disconnected, skipping STIB request");
+        set_outcome(outcome, -1, ESP_FAIL, headers);
+        return ESP_FAIL;
+    }
+    if (!stib_client_) {
+        stib_client_ = &HttpsClient::for_host(LED_UPDATER_STIB_URL);
+    }
 
-    // sort by h
-    std::sort(strips_out.begin(), strips_out.end(), 
-              [](const StripData& a, const StripData& b) { return a.h < b.h; });
+    stib_parser_.reset(stib_);
+    int status_code = stib_client_->get_streamed(stib_path_, HTTPS_CLIENT_DEFAULT_ACCEPT, stib_etag_, headers,
+        [this](const char* data, size_t length) { return stib_parser_.feed(data, length); },
+        stib_authorization_.c_str());
+
+    esp_err_t ret = ESP_FAIL;
+    if (status_code == 304) {
+        not_modified_count_.fetch_add(1, std::memory_order_relaxed);
+        mark_live();
+        ret = ESP_OK;
+    } else if (status_code != 200) {
+        ESP_LOGE(TAG, "STIB request failed with status: %d", status_code);
+    } else if (!stib_parser_.finish(animation_)) {
+        ESP_LOGE(TAG, "Failed to parse STIB vehicle positions");
+    } else {
+        if (stib_parser_.invalid() || stib_parser_.dropped()) {
+            ESP_LOGW(TAG, "STIB: %lu position lists invalid, %lu vehicles over capacity",
+                     (unsigned long)stib_parser_.invalid(), (unsigned long)stib_parser_.dropped());
+        }
+        ESP_LOGD(TAG, "STIB: %lu lines, %lu vehicles, %lu at a stop of the display",
+                 (unsigned long)stib_parser_.results(), (unsigned long)stib_parser_.positions(),
+                 (unsigned long)stib_parser_.matched());
+        if (publish(UPDATE_PATH_POLL, FrameCodecHeader{})) {
+            stib_etag_ = headers.etag;
+            direct_count_.fetch_add(1, std::memory_order_relaxed);
+            mark_live();
+            ret = ESP_OK;
+        }
+    }
 
-    //ESP_LOGI(TAG, "Parsed %d strips", (int)strips_out.size());
-    return !strips_out.empty();
+    set_outcome(outcome, status_code, ret, headers);
+    return ret;
 }
 
+esp_err_t LEDUpdater::apply_response(int status_code, const HttpsClient::ResponseHeaders& headers) {
+    if (status_code == 304) {
+        // Same state as on the display: nothing to parse or shift out
+        not_modified_count_.fetch_add(1, std::memory_order_relaxed);
+        mark_live();
+        return ESP_OK;
+    }
 
-esp_err_t LEDUpdater::fetch_and_update() {
-    std::string mac = wifi_manager_.get_mac_address();
-    std::string url = "https://transport.trillet.be/api/esp/ledstrips?mac=" + mac;
-    std::string response = http_get(url);
-
-    if (response.empty()) {
-        ESP_LOGE(TAG, "Empty response from server for url: %s", url.c_str());
+    if (status_code != 200) {
+        ESP_LOGE(TAG, "No LED state from server");
         return ESP_FAIL;
     }
 
-    std::vector<StripData> strips;
-    if (!parse_json_to_strips(response.c_str(), strips)) {
-        ESP_LOGE(TAG, "Failed to parse LED states");
+    FrameCodecHeader header{};
+    if (frame_codec_is_content_type(headers.content_type.c_str())) {
+        esp_err_t err = decode_binary(binary_length_, header);
+        if (err != ESP_OK) {
+            if (err == ESP_FAIL) {
+                ESP_LOGE(TAG, "Invalid binary frame (%d bytes)", (int)binary_length_);
+            }
+            return err;
+        }
+        binary_count_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        // JSON carries no sequence, the next poll gets a full frame again
+        sequence_ = 0;
+        timeline_end_us_ = 0;
+        if (!parser_.finish(animation_)) {
+            ESP_LOGE(TAG, "Failed to parse LED states");
+            return ESP_FAIL;
+        }
+
+        if (parser_.strips_dropped() || parser_.effects_dropped()) {
+            ESP_LOGW(TAG, "Dropped %lu strips and %lu effects over capacity",
+                     (unsigned long)parser_.strips_dropped(), (unsigned long)parser_.effects_dropped());
+        }
+    }
+
+    // Hand the frame to the display task, it skips output when nothing changed
+    if (!publish(UPDATE_PATH_POLL, header)) {
         return ESP_FAIL;
     }
 
-    //ESP_LOGI(TAG, "Parsed %zu strips", strips.size());
+    // Only remember the tag once its state actually reached the display
+    etag_ = headers.etag;
+    mark_live();
+    return ESP_OK;
+}
 
-    if (strips.empty()) {
-        return ESP_OK; // nothing to update
+esp_err_t LEDUpdater::check_base(const FrameCodecHeader& header) {
+    if ((header.flags & FRAME_CODEC_FLAG_DELTA) && header.base_sequence != sequence_) {
+        ESP_LOGW(TAG, "Delta onto seq %lu, holding %lu: need a full frame",
+                 (unsigned long)header.base_sequence, (unsigned long)sequence_);
+        sequence_ = 0;
+        etag_.clear();
+        return ESP_ERR_INVALID_STATE;
     }
+    return ESP_OK;
+}
 
-    // Dynamically allocate array for rows
-    size_t row_count = strips.size();
-    bool (*rows)[12] = new bool[row_count][12]();
+esp_err_t LEDUpdater::decode_binary(size_t length, FrameCodecHeader& header) {
+    if (!frame_codec_read_header(binary_, length, header)) {
+        return ESP_FAIL;
+    }
+    if (header.flags & FRAME_CODEC_FLAG_TIMELINE) {
+        return decode_timeline(length, header);
+    }
+    if (binary_truncated_) {
+        ESP_LOGW(TAG, "Binary frame larger than %d bytes", (int)sizeof(binary_));
+        return ESP_FAIL;
+    }
 
-    for (size_t r = 0; r < row_count; r++) {
-        const auto& s = strips[r];
-        //ESP_LOGI(TAG, "Updating strip h=%d with %zu values", s.h, s.values.size());
+    const bool delta = header.flags & FRAME_CODEC_FLAG_DELTA;
+    esp_err_t err = check_base(header);
+    if (err != ESP_OK) {
+        return err;
+    }
 
-        for (size_t i = 0; i < s.values.size() && i < 12; i++) {
-            rows[r][i] = (s.values[i] != 0);
-        }
+    // On failure animation_ is untouched, so sequence_ still describes it
+    if (!frame_codec_decode(binary_, length, animation_, &header)) {
+        return ESP_FAIL;
+    }
+    sequence_ = header.sequence;
+    timeline_end_us_ = 0;
+    if (delta) {
+        delta_count_.fetch_add(1, std::memory_order_relaxed);
     }
+    ESP_LOGD(TAG, "%s: %d rows, seq %lu, %d bytes", delta ? "Delta" : "Frame",
+             animation_.base.row_count, (unsigned long)sequence_, (int)length);
+    return ESP_OK;
+}
 
-    // Feed all rows at once
-    led_controller_.set_rows(rows, row_count);
+esp_err_t LEDUpdater::decode_timeline(size_t length, FrameCodecHeader& header) {
+    FrameCodecTimelineEntry entries[DISPLAY_TIMELINE_SLOTS];
+    size_t count = frame_codec_read_timeline(binary_, length, header, entries, DISPLAY_TIMELINE_SLOTS);
+    FrameCodecHeader first;
+    if (!count || !frame_codec_read_header(entries[0].data, entries[0].length, first)) {
+        return ESP_FAIL;
+    }
+    esp_err_t err = check_base(first);
+    if (err != ESP_OK) {
+        return err;
+    }
 
-    delete[] rows;
+    // Each entry builds on the one before, the first on animation_, which
+    // only takes the first frame once the whole timeline decoded
+    for (size_t i = 0; i < count; i++) {
+        Animation& animation = timeline_.entries[i].animation;
+        animation = i ? timeline_.entries[i - 1].animation : animation_;
+        if (!frame_codec_decode(entries[i].data, entries[i].length, animation)) {
+            timeline_end_us_ = 0;
+            return ESP_FAIL;
+        }
+    }
+    animation_ = timeline_.entries[0].animation;
+    sequence_ = first.sequence;
+
+    // Apply times follow the server clock once SNTP has set ours
+    timeline_.emitted_us = local_time_us(header.emitted_ms);
+    const int64_t start_us = timeline_.emitted_us ? timeline_.emitted_us : esp_timer_get_time();
+    for (size_t i = 0; i < count; i++) {
+        timeline_.entries[i].apply_us = start_us + (int64_t)entries[i].offset_ms * 1000;
+    }
+    timeline_.count = (uint8_t)count;
+    timeline_end_us_ = timeline_.entries[count - 1].apply_us;
+    timeline_count_.fetch_add(1, std::memory_order_relaxed);
+    if (binary_truncated_) {
+        ESP_LOGW(TAG, "Timeline larger than %d bytes, kept %d frames", (int)sizeof(binary_), (int)count);
+    }
+    ESP_LOGD(TAG, "Timeline: %d frames over %lu ms, seq %lu, %d bytes", (int)count,
+             (unsigned long)entries[count - 1].offset_ms, (unsigned long)sequence_, (int)length);
     return ESP_OK;
 }
\ No newline at end of file
@@ -1,39 +1,248 @@
 #pragma once
-#include "led_controller.h"
+#include "display_task.h"
 #include "wifi_manager.h"
+#include "storage_manager.h"
 #include "esp_log.h"
-#include "esp_http_client.h"
-#include "cJSON.h"
+#include "https_client.h"
+#include "strips_parser.h"
+#include "frame_codec.h"
+#include "sse_parser.h"
+#include "stib_parser.h"
+#include "layout_id.h"
+#include "timetable_store.h"
+#include "poll_scheduler.h"
+#include "frame_mailbox.h"
+#include <atomic>
 #include <string>
-#include <vector>
+
+// Overridable to point a test build at a local stand-in server (cpp/host)
+#ifndef LED_UPDATER_BASE_URL
+#define LED_UPDATER_BASE_URL "https://transport.trillet.be"
+#endif
+
+// Binary frames and timelines preferred, JSON strips still understood as a fallback
+#define LED_UPDATER_ACCEPT FRAME_CODEC_TIMELINE_ACCEPT(DISPLAY_TIMELINE_SLOTS) ", application/json;q=0.5"
+// A timeline of small deltas fits. Of a larger timeline the leading entries
+// that fit are kept, any other larger body is refused.
+#define LED_UPDATER_BINARY_SIZE 2048
+// Next poll at the latest this long before a timeline runs out
+#define LED_UPDATER_TIMELINE_MARGIN_MS 10000
+
+#define LED_UPDATER_OFFLINE_MS 5000     // Wi-Fi check while disconnected
+#define LED_UPDATER_PATH "/api/esp/ledstrips?mac="
+// Sequence of the frame the device holds: the server answers with a delta
+// onto it when it still knows that frame, with a full frame otherwise
+#define LED_UPDATER_SINCE_PARAM "since="
+
+// Layout URLs: the device asks the server once which layout it shows and
+// keeps the ID in NVS. Polls and the stream then go to the layout, the same
+// URL for every display showing those lines, so shared HTTP caches absorb
+// the fleet. The MAC only goes to the registration. Without an ID (a server
+// that does not know layouts) the per-MAC URLs stay in use.
+#define LED_UPDATER_REGISTER_PATH "/api/esp/layout?mac="
+#define LED_UPDATER_LAYOUT_PATH "/api/esp/ledstrips/layout/"
+#define LED_UPDATER_LAYOUT_STREAM "/stream"
+#define LED_UPDATER_REGISTER_RETRY_MS 3600000           // after a failed registration
+#define LED_UPDATER_REGISTER_REFRESH_MS 86400000        // picks up a layout the server reassigned
+
+// Push mode: a Server-Sent Events stream of "frame" events, each carrying a
+// base64 frame_codec message. The server sends the current state first,
+// then deltas onto the previous event, and a comment line as heartbeat, so
+// a read timeout means the stream is dead.
+#ifndef LED_UPDATER_PUSH_ENABLED
+#define LED_UPDATER_PUSH_ENABLED 1
+#endif
+#define LED_UPDATER_STREAM_PATH "/api/esp/ledstrips/stream?mac="
+#define LED_UPDATER_STREAM_EVENT "frame"
+#define LED_UPDATER_STREAM_TIMEOUT_MS 45000     // three missed 15 s heartbeats
+#define LED_UPDATER_STREAM_STABLE_MS 60000      // up this long: backoff starts over
+#define LED_UPDATER_BACKOFF_MIN_MS 5000
+#define LED_UPDATER_BACKOFF_MAX_MS 300000
+
+// Direct mode (StibConfig): the STIB open-data vehicle positions instead of
+// the LED server, with the Authorization: Apikey header. The URL is
+// overridable like LED_UPDATER_BASE_URL, e.g. for the replay in cpp/host.
+#ifndef LED_UPDATER_STIB_URL
+#define LED_UPDATER_STIB_URL "https://data.stib-mivb.brussels"
+#endif
+#define LED_UPDATER_STIB_PATH "/api/explore/v2.1/catalog/datasets/vehicle-position-rt-production/records" \
+                              "?select=lineid%2Cvehiclepositions&limit=100&where="
+#define LED_UPDATER_STIB_MIN_POLL_MS 20000      // the dataset refreshes about every 20 s
+
+// Offline timetable (timetable.h), fetched once a day into the spiffs
+// partition, by layout once registered, by MAC before. When live data is
+// stale (PollScheduler::is_stale(): a poll failed or was missed, Wi-Fi or
+// the server being down), the display shows where the schedule puts the
+// vehicles instead of a frozen state, until live data is back. Needs the
+// clock, so SNTP must have answered once since boot.
+#define LED_UPDATER_TIMETABLE_PATH "/api/esp/timetable?mac="
+#define LED_UPDATER_TIMETABLE_LAYOUT_PATH "/api/esp/timetable/layout/"
+#define LED_UPDATER_TIMETABLE_REFRESH_MS 86400000
+#define LED_UPDATER_TIMETABLE_RETRY_MS 3600000
+#define LED_UPDATER_SCHEDULE_TICK_MS 15000      // the schedule's frame is redrawn this often
 
 class LEDUpdater {
 public:
-    LEDUpdater(LEDController& led_controller, WiFiManager& wifi_manager);
-    ~LEDUpdater();
+    LEDUpdater(DisplayTask& display, WiFiManager& wifi_manager, StorageManager& storage);
+
+    // Update loop, never returns: follows the push stream while it is up
+    // and polls as the PollScheduler decides otherwise, retrying the stream
+    // with exponential backoff.
+    void run();
+
+    // Fetch JSON from server and update LEDs. outcome receives what the
+    // poll scheduler needs (status and server hints).
+    esp_err_t fetch_and_update(PollOutcome* outcome = nullptr);
+
+    // Service-hours profile, applied by the update task before its next poll
+    void set_poll_profile(const PollProfile& profile);
+    // Delay chosen after the last poll
+    uint32_t poll_delay_ms() const { return poll_delay_ms_.load(std::memory_order_relaxed); }
+
+    // Direct STIB mode, applied by the update task before its next poll. An
+    // enabled config ends the push stream and replaces the LED server.
+    void set_stib_config(const StibConfig& config);
+    bool is_direct() const { return direct_; }
+
+    void set_push_enabled(bool enabled) { push_enabled_ = enabled; }
+    bool is_pushing() const { return pushing_; }
+
+    const HttpsClient& client() const { return client_; }
+    const HttpsClient& stream_client() const { return stream_client_; }
 
-    // Fetch JSON from server and update LEDs
-    esp_err_t fetch_and_update();
+    // Polls answered with 304 Not Modified (nothing parsed or rendered)
+    uint32_t not_modified_count() const { return not_modified_count_.load(std::memory_order_relaxed); }
+    // Polls answered with a binary frame instead of JSON
+    uint32_t binary_count() const { return binary_count_.load(std::memory_order_relaxed); }
+    // Frames received over the push stream and stream (re)connections
+    uint32_t pushed_count() const { return pushed_count_.load(std::memory_order_relaxed); }
+    uint32_t stream_count() const { return stream_count_.load(std::memory_order_relaxed); }
+    // Binary frames, polled or pushed, that were deltas onto the last one
+    uint32_t delta_count() const { return delta_count_.load(std::memory_order_relaxed); }
+    // Timelines handed to the display
+    uint32_t timeline_count() const { return timeline_count_.load(std::memory_order_relaxed); }
+    // Polls answered by the STIB dataset in direct mode
+    uint32_t direct_count() const { return direct_count_.load(std::memory_order_relaxed); }
+    // Frames predicted from the timetable while live data was stale
+    uint32_t scheduled_count() const { return scheduled_count_.load(std::memory_order_relaxed); }
+    bool is_scheduled() const { return scheduled_; }
 
 private:
-    LEDController& led_controller_;
+    DisplayTask& display_;
     WiFiManager& wifi_manager_;
+    StorageManager& storage_;
 
     static const char* TAG;
 
-    // Heap-safe HTTP GET using reusable chunk buffer
-    std::string http_get(const std::string& url);
+    // Asks the server for the layout ID and stores it when it changed. A
+    // 404 means the server assigns none: per-MAC URLs, asked again later.
+    void register_layout();
+    // Drops the layout ID after the server no longer knew it
+    void forget_layout();
+    // Poll and stream URLs, by layout once registered, by MAC before
+    std::string ledstrips_path() const;
+    std::string stream_path() const;
+
+    // Conditional download of the timetable into the free flash slot
+    void refresh_timetable();
+    std::string timetable_path() const;
+    // Live data reached the display
+    void mark_live();
+    // Publishes the schedule's frame when live data is stale, at most every
+    // LED_UPDATER_SCHEDULE_TICK_MS
+    void show_schedule();
+    // Sleeps delay_ms, moving the schedule along meanwhile
+    void wait(uint32_t delay_ms);
+
+    // Conditional GET over the persistent connection. A JSON body is
+    // streamed into parser_, a binary one collected in binary_ as far as
+    // it fits. Returns the
+    // status code (304 when etag_ still matches), -1 on failure.
+    int http_get(const std::string& path, HttpsClient::ResponseHeaders& headers);
+
+    // Decodes and publishes a polled body, tracks 304s. ESP_ERR_INVALID_STATE
+    // when it was a delta onto a frame other than animation_.
+    esp_err_t apply_response(int status_code, const HttpsClient::ResponseHeaders& headers);
+
+    // Decodes length bytes of binary_ into animation_, full frame or delta,
+    // or a timeline into timeline_ (and its first frame into animation_)
+    esp_err_t decode_binary(size_t length, FrameCodecHeader& header);
+    esp_err_t decode_timeline(size_t length, FrameCodecHeader& header);
+    // ESP_ERR_INVALID_STATE when a delta is not onto animation_
+    esp_err_t check_base(const FrameCodecHeader& header);
+
+    // Follows the event stream until it ends. Returns true when it carried
+    // frames for at least LED_UPDATER_STREAM_STABLE_MS.
+    bool stream_updates();
+    void on_stream_event(const SseEvent& event);
+
+    // Direct mode poll: streams the STIB response through stib_parser_
+    esp_err_t fetch_stib(PollOutcome* outcome);
+    void set_outcome(PollOutcome* outcome, int status_code, esp_err_t ret,
+                     const HttpsClient::ResponseHeaders& headers) const;
+
+    // Publishes animation_, or timeline_ after a timeline, converting the
+    // server timestamp to the local clock
+    bool publish(UpdatePath path, const FrameCodecHeader& header);
+
+    // Fed straight from the socket, kept off the task stack with animation_
+    StripsParser parser_;
+    uint8_t binary_[LED_UPDATER_BINARY_SIZE];
+    size_t binary_length_;
+    bool binary_truncated_;     // the body did not fit, binary_ holds its start
+    uint32_t sequence_;         // of the frame in animation_, 0 when unknown
+
+    // Push stream, on its own connection since it holds it indefinitely
+    HttpsClient& stream_client_;
+    SseParser sse_;
+    std::atomic<bool> push_enabled_;
+    std::atomic<bool> pushing_;
+    bool stream_resync_;        // a pushed delta did not fit: reconnect
+
+    // Last received state, deltas are applied onto it. Kept off the task
+    // stack (TLS needs it).
+    Animation animation_;
+    Timeline timeline_;
+    int64_t timeline_end_us_;   // last apply time of timeline_, 0 when superseded
+
+    // Direct mode, update task only but for the mailbox and flag
+    StibConfig stib_;
+    StibParser stib_parser_;
+    std::string stib_path_;
+    std::string stib_authorization_;
+    std::string stib_etag_;
+    HttpsClient* stib_client_;          // shared per host, created on first use
+    Mailbox<StibConfig, 2> stib_mailbox_;
+    std::atomic<bool> direct_;
+
+    // Update task only
+    char layout_id_[LAYOUT_ID_SIZE];    // empty until registered
+    LayoutIdParser layout_parser_;
+    int64_t next_registration_us_;
+
+    // Offline timetable, update task only
+    TimetableStore timetable_store_;
+    int64_t next_timetable_us_;
+    int64_t live_at_us_;                // last live state on the display
+    int64_t next_poll_us_;              // when the update loop polls next
+    int64_t next_schedule_us_;
+    std::atomic<bool> scheduled_;       // the display shows the schedule
 
-    // Represents one strip parsed from JSON
-    struct StripData {
-        int h;
-        std::vector<uint8_t> values;  // instead of vector<bool>
-    };
+    PollScheduler scheduler_;           // update task only
+    Mailbox<PollProfile, 4> profile_mailbox_;
+    std::atomic<uint32_t> poll_delay_ms_;
 
-    // Parse JSON into a vector of StripData, sorted by h
-    bool parse_json_to_strips(const char* json, std::vector<StripData>& strips_out);
+    // Keep-alive connection to the LED server, shared with the OTA checks
+    HttpsClient& client_;
 
-    // Reusable buffer for reading chunked HTTP responses
-    char* chunk_buffer_;
-    size_t chunk_buffer_size_;
+    // ETag of the state currently on the display, sent as If-None-Match
+    std::string etag_;
+    std::atomic<uint32_t> not_modified_count_;
+    std::atomic<uint32_t> binary_count_;
+    std::atomic<uint32_t> pushed_count_;
+    std::atomic<uint32_t> stream_count_;
+    std::atomic<uint32_t> delta_count_;
+    std::atomic<uint32_t> timeline_count_;
+    std::atomic<uint32_t> direct_count_;
+    std::atomic<uint32_t> scheduled_count_;
 };
\ No newline at end of file
@@ -4,7 +4,10 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "nvs_flash.h"
-#include "led_controller.h"
+#include "esp_netif_sntp.h"
+#include "esp_gpio_hal.h"
+#include "esp_led_controller.h"
+#include "display_task.h"
 #include "wifi_manager.h"
 #include "web_server.h"
 #include "led_updater.h"
@@ -13,8 +16,14 @@
 
 static const char* TAG = "MAIN";
 
+// Local time is needed for the brightness schedule
+#define SNTP_SERVER "pool.ntp.org"
+#define DISPLAY_TIMEZONE "CET-1CEST,M3.5.0,M10.5.0/3"  // Europe/Brussels
+
 // Global objects
+EspGpioHal* gpio_hal = nullptr;
 LEDController* led_controller = nullptr;
+DisplayTask* display_task = nullptr;
 StorageManager* storage_manager = nullptr;
 WiFiManager* wifi_manager = nullptr;
 WebServer* web_server = nullptr;
@@ -51,6 +60,18 @@ void initial_ota_check_task(void* param) {
     vTaskDelete(NULL);
 }
 
+// Start SNTP; the clock is set in the background once STA has internet
+void start_time_sync() {
+    setenv("TZ", DISPLAY_TIMEZONE, 1);
+    tzset();
+
+    esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG(SNTP_SERVER);
+    esp_err_t ret = esp_netif_sntp_init(&config);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to start SNTP: %s", esp_err_to_name(ret));
+    }
+}
+
 extern "C" void app_main(void)
 {
     ESP_LOGI(TAG, "Bus Display LED - ESP-IDF Version Starting");
@@ -73,18 +94,30 @@ extern "C" void app_main(void)
     ESP_LOGI(TAG, "Storage manager initialized successfully");
     
     // Create LED controller
-    led_controller = new LEDController();
+    gpio_hal = new EspGpioHal();
+    led_controller = new EspLEDController(*gpio_hal);
     if (!led_controller->initialize()) {
         ESP_LOGE(TAG, "Failed to initialize LED controller");
         return;
     }
     ESP_LOGI(TAG, "LED controller initialized successfully");
     
+    DisplayTopology topology;
+    storage_manager->load_topology(topology);
+    led_controller->set_topology(topology);
+
     led_controller->set_all(false); // Ensure LEDs start off
     led_controller->set_all(true); // check if LEDs are working
     vTaskDelay(pdMS_TO_TICKS(1000));    
     //led_controller->set_all(false); // turn off LEDs after check
     //led_controller->test_sequence(); // check if LEDs are working
+
+    // From here on only the display task touches the LED controller
+    display_task = new DisplayTask(*led_controller);
+    if (!display_task->start()) {
+        ESP_LOGE(TAG, "Failed to start display task");
+        return;
+    }
     
     // Create WiFi manager
     wifi_manager = new WiFiManager(*storage_manager);
@@ -94,8 +127,10 @@ extern "C" void app_main(void)
     }
     ESP_LOGI(TAG, "WiFi manager initialized successfully");
 
+    start_time_sync();
+
     // Initialize OTA manager
-    ota_manager = new OTAManager(*wifi_manager, *led_controller);
+    ota_manager = new OTAManager(*wifi_manager, *display_task);
     if (!ota_manager->initialize()) {
         ESP_LOGE(TAG, "Failed to initialize OTA manager");
         return;
@@ -127,6 +162,9 @@ extern "C" void app_main(void)
     web_server = new WebServer(*wifi_manager);
     web_server->set_wifi_config_callback(wifi_config_callback);
     web_server->set_ota_manager(*ota_manager);
+    web_server->set_display_task(*display_task);
+    web_server->set_storage_manager(*storage_manager);
+    web_server->set_led_controller(*led_controller);
     
     if (!web_server->start()) {
         ESP_LOGE(TAG, "Failed to start web server");
@@ -136,18 +174,21 @@ extern "C" void app_main(void)
     ESP_LOGI(TAG, "Connect to WiFi '%s' and go to http://192.168.4.1", WIFI_AP_SSID);
     
     // Create LED updater
-    led_updater = new LEDUpdater(*led_controller, *wifi_manager);
+    led_updater = new LEDUpdater(*display_task, *wifi_manager, *storage_manager);
+    PollProfile poll_profile;
+    storage_manager->load_poll_profile(poll_profile);
+    led_updater->set_poll_profile(poll_profile);
+    StibConfig* stib_config = new StibConfig();     // too large for this stack
+    storage_manager->load_stib_config(*stib_config);
+    led_updater->set_stib_config(*stib_config);
+    delete stib_config;
+    web_server->set_led_updater(*led_updater);
 
-    // Start LED update task
+    // Start LED update task (push stream, polling as fallback). Stream
+    // events are decoded from inside the HTTP client's read, hence the stack.
     xTaskCreate([](void* param) {
-        LEDUpdater* updater = static_cast<LEDUpdater*>(param);
-        while (true) {
-            if (wifi_manager->is_connected()) {
-                updater->fetch_and_update();
-            }
-            vTaskDelay(pdMS_TO_TICKS(5000));
-        }
-    }, "led_update_task", 4096, led_updater, 5, NULL);
+        static_cast<LEDUpdater*>(param)->run();
+    }, "led_update_task", 6144, led_updater, 5, NULL);
 
     // Start OTA update timer (checks every hour)
     ota_manager->start_ota_timer();
@@ -172,6 +213,62 @@ extern "C" void app_main(void)
                      wifi_manager->get_connection_status().c_str(),
                      wifi_manager->get_ip_address().c_str());
         }
+
+        LEDController::LEDStats led_stats = led_controller->get_stats();
+        ESP_LOGI(TAG, "Display - %s output, frames pushed: %lu, skipped: %lu, push min/avg/max: %lu/%lu/%lu us, "
+                 "last latch %lu ms ago, CPU %lu.%lu%%",
+                 led_controller->output_name(),
+                 (unsigned long)led_stats.frames_pushed, (unsigned long)led_stats.frames_skipped,
+                 (unsigned long)led_stats.push_min_us, (unsigned long)led_stats.push_avg_us,
+                 (unsigned long)led_stats.push_max_us, (unsigned long)led_stats.since_latch_ms,
+                 (unsigned long)(led_stats.busy_permille / 10), (unsigned long)(led_stats.busy_permille % 10));
+
+        DisplayTask::LatencyStats latency = display_task->get_latency_stats();
+        ESP_LOGI(TAG, "Display latency - frames: %lu, min/avg/max: %lu/%lu/%lu us, dropped: %lu",
+                 (unsigned long)latency.frames, (unsigned long)latency.min_us,
+                 (unsigned long)latency.avg_us, (unsigned long)latency.max_us,
+                 (unsigned long)latency.dropped);
+
+        HttpsClient::Stats http = led_updater->client().get_stats();
+        ESP_LOGI(TAG, "LED server - requests: %lu, handshakes: %lu, with/without session ticket: %lu/%lu, "
+                 "last full/ticket handshake: %lu/%lu ms, retries: %lu, failures: %lu",
+                 (unsigned long)http.requests, (unsigned long)http.handshakes,
+                 (unsigned long)http.tickets_offered, (unsigned long)http.no_ticket,
+                 (unsigned long)http.full_handshake_ms, (unsigned long)http.ticket_handshake_ms,
+                 (unsigned long)http.retries, (unsigned long)http.failures);
+        // The push stream's own connection, it reconnects the most
+        HttpsClient::Stats stream = led_updater->stream_client().get_stats();
+        ESP_LOGI(TAG, "LED stream - handshakes: %lu, with/without session ticket: %lu/%lu, "
+                 "last full/ticket handshake: %lu/%lu ms",
+                 (unsigned long)stream.handshakes, (unsigned long)stream.tickets_offered,
+                 (unsigned long)stream.no_ticket, (unsigned long)stream.full_handshake_ms,
+                 (unsigned long)stream.ticket_handshake_ms);
+        ESP_LOGI(TAG, "LED server - polls not modified: %lu, binary frames: %lu, deltas: %lu, timelines: %lu, "
+                 "direct STIB polls: %lu",
+                 (unsigned long)led_updater->not_modified_count(),
+                 (unsigned long)led_updater->binary_count(),
+                 (unsigned long)led_updater->delta_count(),
+                 (unsigned long)led_updater->timeline_count(),
+                 (unsigned long)led_updater->direct_count());
+        ESP_LOGI(TAG, "LED server - %s, stream connects: %lu, pushed frames: %lu, poll delay: %lu ms",
+                 led_updater->is_direct() ? "direct STIB" : led_updater->is_pushing() ? "push" : "polling",
+                 (unsigned long)led_updater->stream_count(),
+                 (unsigned long)led_updater->pushed_count(),
+                 (unsigned long)led_updater->poll_delay_ms());
+
+        // Server emit to latch, frames without a server timestamp are not counted
+        for (int path = 0; path < UPDATE_PATH_COUNT; path++) {
+            DisplayTask::LatencyStats e2e = display_task->get_update_latency((UpdatePath)path);
+            ESP_LOGI(TAG, "End-to-end latency (%s) - frames: %lu, min/avg/max: %lu/%lu/%lu ms",
+                     path == UPDATE_PATH_PUSH ? "push" : "poll", (unsigned long)e2e.frames,
+                     (unsigned long)(e2e.min_us / 1000), (unsigned long)(e2e.avg_us / 1000),
+                     (unsigned long)(e2e.max_us / 1000));
+        }
+        DisplayTask::LatencyStats timeline = display_task->get_timeline_stats();
+        ESP_LOGI(TAG, "Timeline frames: %lu, late by min/avg/max: %lu/%lu/%lu ms, timelines replaced unseen: %lu",
+                 (unsigned long)timeline.frames, (unsigned long)(timeline.min_us / 1000),
+                 (unsigned long)(timeline.avg_us / 1000), (unsigned long)(timeline.max_us / 1000),
+                 (unsigned long)timeline.dropped);
         
         vTaskDelay(pdMS_TO_TICKS(30000)); // Status update every 30 seconds
     }
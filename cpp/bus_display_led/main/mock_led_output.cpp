@@ -0,0 +1,31 @@
+// mock_led_output.cpp
+#include "mock_led_output.h"
+#include <chrono>
+
+MockLEDOutput::MockLEDOutput(uint32_t simulated_clock_hz)
+    : simulated_clock_hz_(simulated_clock_hz), last_push_ns_(0), last_bus_ns_(0) {
+}
+
+bool MockLEDOutput::initialize() {
+    clear();
+    return true;
+}
+
+bool MockLEDOutput::write_frame(const uint16_t* words, size_t count) {
+    auto start = std::chrono::steady_clock::now();
+
+    frames_.emplace_back(words, words + count);
+    latched_ = frames_.back();
+
+    auto end = std::chrono::steady_clock::now();
+    last_push_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    last_bus_ns_ = simulated_clock_hz_ ? (uint64_t)count * 16 * 1000000000ULL / simulated_clock_hz_ : 0;
+    return true;
+}
+
+void MockLEDOutput::clear() {
+    frames_.clear();
+    latched_.clear();
+    last_push_ns_ = 0;
+    last_bus_ns_ = 0;
+}
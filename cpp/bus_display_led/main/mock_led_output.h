@@ -0,0 +1,34 @@
+// mock_led_output.h
+#pragma once
+
+#include "led_output.h"
+#include <vector>
+
+// Host-side backend: records every frame instead of driving pins.
+// Builds on Linux without ESP-IDF, so frame output can be checked and timed.
+class MockLEDOutput : public LEDOutput {
+public:
+    explicit MockLEDOutput(uint32_t simulated_clock_hz = 1000000);
+
+    bool initialize() override;
+    bool write_frame(const uint16_t* words, size_t count) override;
+    const char* name() const override { return "mock"; }
+
+    const std::vector<std::vector<uint16_t>>& frames() const { return frames_; }
+    const std::vector<uint16_t>& latched() const { return latched_; }
+    size_t push_count() const { return frames_.size(); }
+
+    // Wall time spent inside write_frame() and the bus time the frame
+    // would take on a real shift register chain
+    uint64_t last_push_ns() const { return last_push_ns_; }
+    uint64_t last_bus_ns() const { return last_bus_ns_; }
+
+    void clear();
+
+private:
+    uint32_t simulated_clock_hz_;
+    std::vector<std::vector<uint16_t>> frames_;
+    std::vector<uint16_t> latched_;
+    uint64_t last_push_ns_;
+    uint64_t last_bus_ns_;
+};
@@ -1,14 +1,17 @@
 // ota_manager.cpp
 #include "ota_manager.h"
+#include "https_client.h"
 #include "esp_crt_bundle.h"
 #include "esp_err.h"
 #include <algorithm>
+#include <cstdlib>
 #include <sstream>
 
 const char* OTAManager::TAG = "OTA_MGR";
 
-OTAManager::OTAManager(WiFiManager& wifi_manager, LEDController& led_controller)
-    : wifi_manager_(wifi_manager), led_controller_(led_controller),
+OTAManager::OTAManager(WiFiManager& wifi_manager, DisplayTask& display)
+    : wifi_manager_(wifi_manager), display_(display),
+      ota_total_bytes_(0), ota_progress_leds_(-1),
       initialized_(false), update_in_progress_(false),
       current_version_(""), last_check_status_("Never checked"),
       ota_timer_(nullptr) {
@@ -129,9 +132,9 @@ esp_err_t OTAManager::check_for_updates() {
     free(json_string);
     
     // Query server for version info
-    std::string url = "https://transport.trillet.be/api/update/versions";
-    ESP_LOGI(TAG, "Making HTTP POST request to: %s", url.c_str());
-    std::string response = http_post_json(url, post_data);
+    std::string path = "/api/update/versions";
+    ESP_LOGI(TAG, "Making HTTP POST request to: %s", path.c_str());
+    std::string response = http_post_json(path, post_data);
 
     ESP_LOGI(TAG, "OTA server response (length=%zu): '%s'", response.length(), response.c_str());
     
@@ -212,17 +215,40 @@ esp_err_t OTAManager::perform_ota_update(const std::string& update_url) {
     
     if (ret == ESP_OK) {
         ESP_LOGI(TAG, "OTA update successful");
-        led_controller_.clear_all();
+        show_pattern(0);
     } else {
         ESP_LOGE(TAG, "OTA update failed: %s", esp_err_to_name(ret));
-        led_controller_.set_leds(0xFFFF);
+        show_pattern(FRAME_ROW_MASK);
         vTaskDelay(pdMS_TO_TICKS(3000));
-        led_controller_.clear_all();
+        show_pattern(0);
     }
     
     return ret;
 }
 
+void OTAManager::show_pattern(uint16_t row_mask) {
+    Frame frame;
+    frame.row_count = 1;
+    frame.rows[0] = row_mask;
+    display_.publish(frame);
+}
+
+void OTAManager::show_progress(int bytes_downloaded) {
+    if (ota_total_bytes_ <= 0) {
+        return;
+    }
+
+    int leds = (int)((int64_t)bytes_downloaded * LEDS_PER_ROW / ota_total_bytes_);
+    if (leds > LEDS_PER_ROW) {
+        leds = LEDS_PER_ROW;
+    }
+    if (leds == ota_progress_leds_) {
+        return;
+    }
+    ota_progress_leds_ = leds;
+    show_pattern((uint16_t)((1u << leds) - 1));
+}
+
 std::string OTAManager::get_hardware_info() {
     // Return hardware identifier (you can customize this)
     esp_chip_info_t chip_info;
@@ -238,111 +264,22 @@ std::string OTAManager::get_hardware_info() {
     return hw_info.str();
 }
 
-std::string OTAManager::http_post_json(const std::string& url, const std::string& json_data) {
-    ESP_LOGI(TAG, "Starting HTTP POST to: %s", url.c_str());
+std::string OTAManager::http_post_json(const std::string& path, const std::string& json_data) {
+    ESP_LOGI(TAG, "Starting HTTP POST to: %s", path.c_str());
     ESP_LOGI(TAG, "POST body: %s", json_data.c_str());
     
-    esp_http_client_config_t config = {};
-    config.url = url.c_str();
-    config.crt_bundle_attach = esp_crt_bundle_attach;
-    config.timeout_ms = OTA_RECV_TIMEOUT_MS;
-    config.buffer_size = 1024;
-    config.buffer_size_tx = 1024;
-    
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (!client) {
-        ESP_LOGE(TAG, "Failed to initialize HTTP client");
-        return "";
-    }
-    
-    esp_http_client_set_method(client, HTTP_METHOD_POST);
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    esp_http_client_set_header(client, "User-Agent", "ESP32-BusDisplay/1.0");
-    esp_http_client_set_header(client, "Accept", "application/json");
-    esp_http_client_set_header(client, "Connection", "close");
-    esp_http_client_set_post_field(client, json_data.c_str(), json_data.length());
-    
-    ESP_LOGI(TAG, "Opening HTTP connection...");
-    esp_err_t err = esp_http_client_open(client, json_data.length());
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
-        esp_http_client_cleanup(client);
-        return "";
-    }
-    
-    ESP_LOGI(TAG, "Writing POST data...");
-    int wlen = esp_http_client_write(client, json_data.c_str(), json_data.length());
-    if (wlen < 0) {
-        ESP_LOGE(TAG, "Failed to write POST data");
-        esp_http_client_close(client);
-        esp_http_client_cleanup(client);
-        return "";
-    }
-    ESP_LOGI(TAG, "Wrote %d bytes", wlen);
-    
-    ESP_LOGI(TAG, "Fetching headers...");
-    int content_length = esp_http_client_fetch_headers(client);
-    int status_code = esp_http_client_get_status_code(client);
+    // Same host as the LED poll: reuses its connection and TLS session
+    std::string response;
+    int status_code = HttpsClient::for_host(OTA_SERVER_BASE_URL)
+        .post(path, "application/json", json_data, response, OTA_MAX_RESPONSE);
     
-    ESP_LOGI(TAG, "HTTP POST Status = %d, content_length = %d", status_code, content_length);
+    ESP_LOGI(TAG, "HTTP POST Status = %d", status_code);
     
-    std::string response;
-    response.reserve(1024);
-    
-    if (status_code == 200) {
-        if (content_length > 0) {
-            ESP_LOGI(TAG, "Reading response with known length: %d", content_length);
-            char* buffer = (char*)malloc(content_length + 1);
-            if (buffer) {
-                int total_read = 0;
-                while (total_read < content_length) {
-                    int read = esp_http_client_read_response(client, buffer + total_read, content_length - total_read);
-                    if (read <= 0) {
-                        ESP_LOGW(TAG, "Read returned %d, breaking", read);
-                        break;
-                    }
-                    total_read += read;
-                    ESP_LOGI(TAG, "Read %d bytes, total: %d/%d", read, total_read, content_length);
-                }
-                buffer[total_read] = '\0';
-                response.assign(buffer, total_read);
-                free(buffer);
-                ESP_LOGI(TAG, "Successfully read %d bytes", total_read);
-            } else {
-                ESP_LOGE(TAG, "Failed to allocate buffer for response");
-            }
-        } else {
-            ESP_LOGI(TAG, "Reading chunked response...");
-            char* chunk_buffer = (char*)malloc(512);
-            if (chunk_buffer) {
-                int total_read = 0;
-                while (true) {
-                    int read = esp_http_client_read_response(client, chunk_buffer, 511);
-                    if (read <= 0) {
-                        ESP_LOGI(TAG, "No more data (read=%d)", read);
-                        break;
-                    }
-                    chunk_buffer[read] = '\0';
-                    response.append(chunk_buffer, read);
-                    total_read += read;
-                    ESP_LOGI(TAG, "Read chunk: %d bytes, total: %d", read, total_read);
-                    if (total_read >= 2048) {
-                        ESP_LOGW(TAG, "Response too large, truncating");
-                        break;
-                    }
-                }
-                free(chunk_buffer);
-            } else {
-                ESP_LOGE(TAG, "Failed to allocate chunk buffer");
-            }
-        }
-    } else {
+    if (status_code != 200) {
         ESP_LOGE(TAG, "HTTP request failed with status: %d", status_code);
+        return "";
     }
     
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
-    
     ESP_LOGI(TAG, "HTTP POST completed, response length: %zu", response.length());
     ESP_LOGI(TAG, "Response content: '%s'", response.c_str());
     
@@ -417,6 +354,7 @@ void OTAManager::ota_timer_callback(TimerHandle_t timer) {
 esp_err_t OTAManager::ota_http_event_handler(esp_http_client_event_t *evt) {
     static int last_progress_log = 0;
     static int bytes_downloaded = 0;
+    OTAManager* ota_manager = static_cast<OTAManager*>(evt->user_data);
     
     switch (evt->event_id) {
         case HTTP_EVENT_ERROR:
@@ -426,6 +364,10 @@ esp_err_t OTAManager::ota_http_event_handler(esp_http_client_event_t *evt) {
             ESP_LOGI(TAG, "HTTP_EVENT_ON_CONNECTED - OTA download starting");
             bytes_downloaded = 0;
             last_progress_log = 0;
+            if (ota_manager) {
+                ota_manager->ota_total_bytes_ = 0;
+                ota_manager->ota_progress_leds_ = -1;
+            }
             break;
         case HTTP_EVENT_HEADER_SENT:
             ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
@@ -433,6 +375,9 @@ esp_err_t OTAManager::ota_http_event_handler(esp_http_client_event_t *evt) {
         case HTTP_EVENT_ON_HEADER:
             if (strcmp(evt->header_key, "Content-Length") == 0) {
                 ESP_LOGI(TAG, "OTA file size: %s bytes", evt->header_value);
+                if (ota_manager) {
+                    ota_manager->ota_total_bytes_ = atoi(evt->header_value);
+                }
             }
             ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", 
                      evt->header_key, evt->header_value);
@@ -444,6 +389,9 @@ esp_err_t OTAManager::ota_http_event_handler(esp_http_client_event_t *evt) {
                 ESP_LOGI(TAG, "OTA Progress: %d bytes downloaded", bytes_downloaded);
                 last_progress_log = bytes_downloaded;
             }
+            if (ota_manager) {
+                ota_manager->show_progress(bytes_downloaded);
+            }
             ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d, total=%d", evt->data_len, bytes_downloaded);
             break;
         case HTTP_EVENT_ON_FINISH:
@@ -14,16 +14,18 @@
 #include "freertos/timers.h"
 #include "cJSON.h"
 #include "wifi_manager.h"
-#include "led_controller.h"
+#include "display_task.h"
 #include <string>
 
 #define OTA_CHECK_INTERVAL_MS (60 * 60 * 1000) // 1 hour
 #define OTA_RECV_TIMEOUT_MS (5000)
 #define OTA_BUFFER_SIZE (1024)
+#define OTA_SERVER_BASE_URL "https://transport.trillet.be"
+#define OTA_MAX_RESPONSE (2048)
 
 class OTAManager {
 public:
-    OTAManager(WiFiManager& wifi_manager, LEDController& led_controller);
+    OTAManager(WiFiManager& wifi_manager, DisplayTask& display);
     ~OTAManager();
     
     bool initialize();
@@ -41,7 +43,13 @@ public:
 
 private:
     WiFiManager& wifi_manager_;
-    LEDController& led_controller_;
+    DisplayTask& display_;
+
+    // Download progress shown on the first row of the display
+    int ota_total_bytes_;
+    int ota_progress_leds_;
+    void show_progress(int bytes_downloaded);
+    void show_pattern(uint16_t row_mask);
     
     bool initialized_;
     bool update_in_progress_;
@@ -58,7 +66,8 @@ private:
     
     // Helper methods
     std::string get_hardware_info();
-    std::string http_post_json(const std::string& url, const std::string& json_data);
+    // POST to OTA_SERVER_BASE_URL over the connection shared with the LED poll
+    std::string http_post_json(const std::string& path, const std::string& json_data);
     bool parse_version_response(const std::string& json_response, VersionInfo& version_info);
     bool version_is_newer(const std::string& server_version, const std::string& current_version);
     esp_err_t validate_update_partition();
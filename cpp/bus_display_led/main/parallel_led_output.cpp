@@ -0,0 +1,106 @@
+// parallel_led_output.cpp
+#include "parallel_led_output.h"
+#include "esp_log.h"
+
+const char* ParallelGpioLEDOutput::TAG = "LED_PAR";
+
+ParallelGpioLEDOutput::ParallelGpioLEDOutput(GpioHal& hal, const LEDPinConfig& pins)
+    : hal_(hal), pins_(pins), data_mask_(0), clock_mask_(0), latch_mask_(0), initialized_(false) {
+}
+
+ParallelGpioLEDOutput::~ParallelGpioLEDOutput() {
+    if (initialized_) {
+        hal_.reset_pin(pins_.clock);
+        hal_.reset_pin(pins_.latch);
+        for (uint8_t c = 0; c < pins_.chain_count; c++) {
+            hal_.reset_pin(pins_.data[c]);
+        }
+    }
+}
+
+bool ParallelGpioLEDOutput::initialize() {
+    if (pins_.chain_count == 0 || pins_.chain_count > LED_MAX_CHAINS) {
+        ESP_LOGE(TAG, "Invalid chain count: %d", pins_.chain_count);
+        return false;
+    }
+    if (pins_.clock < 0 || pins_.clock >= 32 || pins_.latch < 0 || pins_.latch >= 32) {
+        ESP_LOGE(TAG, "Clock and latch must be below GPIO 32");
+        return false;
+    }
+
+    clock_mask_ = 1u << pins_.clock;
+    latch_mask_ = 1u << pins_.latch;
+    data_mask_ = 0;
+    for (uint8_t c = 0; c < pins_.chain_count; c++) {
+        if (pins_.data[c] < 0 || pins_.data[c] >= 32) {
+            ESP_LOGE(TAG, "Data pin %d of chain %d must be below GPIO 32", pins_.data[c], c);
+            return false;
+        }
+        data_mask_ |= 1u << pins_.data[c];
+    }
+
+    const uint32_t pin_mask = data_mask_ | clock_mask_ | latch_mask_;
+    for (int pin = 0; pin < 32; pin++) {
+        if ((pin_mask >> pin) & 1 && !hal_.configure_output(pin)) {
+            return false;
+        }
+    }
+
+    hal_.write_mask(0, pin_mask);
+
+    initialized_ = true;
+    ESP_LOGI(TAG, "Parallel output ready (%d chains)", pins_.chain_count);
+    return true;
+}
+
+size_t ParallelGpioLEDOutput::transpose(const uint16_t* words, size_t count) {
+    // Chain c holds chain positions [c * per_chain, (c + 1) * per_chain).
+    // Shorter chains are padded at the front so their data lands last.
+    const size_t chains = pins_.chain_count;
+    const size_t per_chain = (count + chains - 1) / chains;
+
+    size_t cycle = 0;
+    for (size_t j = 0; j < per_chain; j++) {
+        for (int bit = 0; bit < 16; bit++) {
+            uint32_t set_mask = 0;
+            for (size_t c = 0; c < chains; c++) {
+                size_t first = c * per_chain;
+                size_t length = first < count ? (count - first < per_chain ? count - first : per_chain) : 0;
+                size_t padding = per_chain - length;
+                if (j < padding) {
+                    continue;
+                }
+                if ((words[first + j - padding] >> bit) & 1) {
+                    set_mask |= 1u << pins_.data[c];
+                }
+            }
+            cycles_[cycle++] = set_mask;
+        }
+    }
+    return cycle;
+}
+
+bool ParallelGpioLEDOutput::write_frame(const uint16_t* words, size_t count) {
+    if (!initialized_ || count == 0) {
+        return false;
+    }
+    if (count > LED_OUTPUT_MAX_WORDS) {
+        count = LED_OUTPUT_MAX_WORDS;
+    }
+
+    size_t cycles = transpose(words, count);
+
+    for (size_t i = 0; i < cycles; i++) {
+        hal_.write_mask(cycles_[i], data_mask_ & ~cycles_[i]);
+        hal_.delay_us(PARALLEL_HALF_PERIOD_US);
+        hal_.write_mask(clock_mask_, 0);
+        hal_.delay_us(PARALLEL_HALF_PERIOD_US);
+        hal_.write_mask(0, clock_mask_);
+    }
+    hal_.write_mask(0, data_mask_);  // data idles low
+
+    hal_.write_mask(latch_mask_, 0);
+    hal_.delay_us(PARALLEL_HALF_PERIOD_US);
+    hal_.write_mask(0, latch_mask_);
+    return true;
+}
@@ -0,0 +1,38 @@
+// parallel_led_output.h
+#pragma once
+
+#include "led_output.h"
+#include "board_pins.h"
+#include "gpio_hal.h"
+
+#define PARALLEL_HALF_PERIOD_US 1
+
+// Drives several register chains at once: one data pin per chain with a
+// shared clock and latch. The frame is transposed into one GPIO set-mask
+// per clock cycle, so every clock edge updates all data pins with a single
+// register write and update time depends on the longest chain only.
+// All pins must be below GPIO 32 (single W1TS/W1TC register).
+class ParallelGpioLEDOutput : public LEDOutput {
+public:
+    ParallelGpioLEDOutput(GpioHal& hal, const LEDPinConfig& pins);
+    ~ParallelGpioLEDOutput() override;
+
+    bool initialize() override;
+    bool write_frame(const uint16_t* words, size_t count) override;
+    const char* name() const override { return "parallel"; }
+
+private:
+    size_t transpose(const uint16_t* words, size_t count);
+
+    GpioHal& hal_;
+    LEDPinConfig pins_;
+    uint32_t data_mask_;
+    uint32_t clock_mask_;
+    uint32_t latch_mask_;
+    bool initialized_;
+
+    // One set-mask of data pins per clock cycle, longest chain first bit first
+    uint32_t cycles_[LED_OUTPUT_MAX_WORDS * 16];
+
+    static const char* TAG;
+};
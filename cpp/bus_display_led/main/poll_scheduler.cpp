@@ -0,0 +1,166 @@
+// poll_scheduler.cpp
+#include "poll_scheduler.h"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+uint32_t PollScheduler::next_delay_ms(const PollOutcome& outcome, int32_t second_of_day, uint32_t random) {
+    const bool clock_set = second_of_day >= 0 && second_of_day < 86400;
+    const int hour = clock_set ? second_of_day / 3600 : -1;
+    const uint32_t interval_s = clock_set ? profile_.hourly_s[hour] : profile_.default_s;
+    const uint32_t interval_ms = interval_s * 1000;
+    const bool ok = (outcome.status >= 200 && outcome.status < 300) || outcome.status == 304;
+
+    uint32_t delay_ms;
+    if (ok) {
+        failures_ = 0;
+        const uint32_t spread = interval_ms / 1000 * POLL_SCHEDULER_JITTER_PERMILLE;
+        delay_ms = interval_ms - random % (spread + 1);
+
+        // Do not sleep through the start of service: wake at the next hour
+        // when it polls faster, spread over its interval
+        if (clock_set) {
+            const uint32_t to_next_hour_ms = (3600 - second_of_day % 3600) * 1000;
+            const uint32_t next_interval_ms = profile_.hourly_s[(hour + 1) % 24] * 1000;
+            if (delay_ms > to_next_hour_ms && next_interval_ms < interval_ms) {
+                delay_ms = to_next_hour_ms + random % next_interval_ms;
+            }
+        }
+
+        // Fresh until max-age: poll just after it expires, jitter only later
+        const uint64_t max_age_ms = outcome.max_age_s > 0 ? (uint64_t)outcome.max_age_s * 1000 : 0;
+        if (max_age_ms > delay_ms) {
+            delay_ms = (uint32_t)(max_age_ms < POLL_SCHEDULER_MAX_DELAY_MS ? max_age_ms : POLL_SCHEDULER_MAX_DELAY_MS);
+            delay_ms += random % (delay_ms / 1000 * POLL_SCHEDULER_JITTER_PERMILLE + 1);
+        }
+    } else {
+        if (failures_ < 16) {
+            failures_++;
+        }
+        // "Equal jitter": at least half the backoff, so never sooner than
+        // a regular poll and retries stay spaced
+        const uint64_t cap_ms = 2ull * interval_ms > POLL_SCHEDULER_BACKOFF_MAX_MS ? 2ull * interval_ms
+                                                                                 : POLL_SCHEDULER_BACKOFF_MAX_MS;
+        uint64_t backoff_ms = (uint64_t)interval_ms << failures_;
+        if (backoff_ms > cap_ms) {
+            backoff_ms = cap_ms;
+        }
+        delay_ms = (uint32_t)(backoff_ms / 2 + random % (backoff_ms / 2 + 1));
+    }
+
+    if (outcome.retry_after_s >= 0 && (uint64_t)outcome.retry_after_s * 1000 > delay_ms) {
+        delay_ms = (uint32_t)((uint64_t)outcome.retry_after_s * 1000 < POLL_SCHEDULER_MAX_DELAY_MS
+                                  ? outcome.retry_after_s * 1000 : POLL_SCHEDULER_MAX_DELAY_MS);
+    }
+    return delay_ms < POLL_SCHEDULER_MAX_DELAY_MS ? delay_ms : POLL_SCHEDULER_MAX_DELAY_MS;
+}
+
+static int32_t parse_seconds(const char* p, const char** end) {
+    if (!isdigit((unsigned char)*p)) {
+        return -1;
+    }
+    int64_t value = 0;
+    while (isdigit((unsigned char)*p)) {
+        value = value * 10 + (*p++ - '0');
+        if (value > INT32_MAX) {
+            value = INT32_MAX;
+        }
+    }
+    *end = p;
+    return (int32_t)value;
+}
+
+int32_t PollScheduler::parse_max_age(const char* cache_control) {
+    if (!cache_control) {
+        return -1;
+    }
+
+    // Comma separated directives, names case-insensitive
+    int32_t max_age = -1;
+    const char* p = cache_control;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        const char* name = p;
+        while (*p && *p != '=' && *p != ',' && *p != ' ') {
+            p++;
+        }
+        const size_t length = p - name;
+
+        if (length == 7 && strncasecmp(name, "max-age", 7) == 0 && *p == '=') {
+            const char* value = p + 1;
+            const bool quoted = *value == '"';
+            int32_t seconds = parse_seconds(value + quoted, &p);
+            if (seconds < 0) {
+                p = value;
+            } else {
+                if (max_age != 0) {
+                    max_age = seconds;
+                }
+                if (quoted && *p == '"') {
+                    p++;
+                }
+            }
+        } else if ((length == 8 && strncasecmp(name, "no-cache", 8) == 0) ||
+                   (length == 8 && strncasecmp(name, "no-store", 8) == 0)) {
+            max_age = 0;
+        }
+
+        // Skip the rest of the directive, quoted values included
+        bool quoted = false;
+        while (*p && (quoted || *p != ',')) {
+            if (*p == '"') {
+                quoted = !quoted;
+            }
+            p++;
+        }
+    }
+    return max_age;
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = (unsigned)(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+int32_t PollScheduler::parse_retry_after(const char* value, int64_t now_s) {
+    if (!value) {
+        return -1;
+    }
+    while (*value == ' ') {
+        value++;
+    }
+
+    const char* end;
+    int32_t seconds = parse_seconds(value, &end);
+    if (seconds >= 0) {
+        return *end == '\0' || *end == ' ' ? seconds : -1;
+    }
+
+    // IMF-fixdate: "Sun, 06 Nov 1994 08:49:37 GMT"
+    static const char MONTHS[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month[4];
+    int day, year, hh, mm, ss;
+    if (now_s <= 0 || sscanf(value, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT", &day, month, &year, &hh, &mm, &ss) != 6) {
+        return -1;
+    }
+    const char* found = strstr(MONTHS, month);
+    if (!found || (found - MONTHS) % 3 || day < 1 || day > 31 || hh > 23 || mm > 59 || ss > 60) {
+        return -1;
+    }
+
+    const int64_t at = days_from_civil(year, (unsigned)((found - MONTHS) / 3 + 1), (unsigned)day) * 86400 +
+                       hh * 3600 + mm * 60 + ss;
+    if (at <= now_s) {
+        return 0;
+    }
+    return at - now_s > INT32_MAX ? INT32_MAX : (int32_t)(at - now_s);
+}
@@ -0,0 +1,98 @@
+// poll_scheduler.h
+#pragma once
+
+#include <cstdint>
+
+#define POLL_PROFILE_VERSION 1
+#define POLL_PROFILE_MIN_S 2
+#define POLL_PROFILE_MAX_S 3600
+#define POLL_PROFILE_SERVICE_S 5        // matches the former fixed poll
+#define POLL_PROFILE_NIGHT_S 300
+
+#define POLL_SCHEDULER_BACKOFF_MAX_MS 300000
+#define POLL_SCHEDULER_MAX_DELAY_MS 900000      // whatever the server hints say
+#define POLL_SCHEDULER_JITTER_PERMILLE 100      // up to 10% early
+#define POLL_SCHEDULER_STALE_MS 180000          // see is_stale()
+
+// Poll interval by local hour, stored in NVS. Service hours poll at the
+// usual rate, the hours without buses only often enough to notice an
+// unexpected change.
+struct PollProfile {
+    uint8_t version;
+    uint16_t hourly_s[24];
+    uint16_t default_s;                 // until SNTP has set the clock
+
+    // Service 05:00-01:00 (STIB night gap 01:00-05:00)
+    static PollProfile defaults() {
+        PollProfile profile;
+        profile.version = POLL_PROFILE_VERSION;
+        for (int hour = 0; hour < 24; hour++) {
+            profile.hourly_s[hour] = hour >= 1 && hour < 5 ? POLL_PROFILE_NIGHT_S : POLL_PROFILE_SERVICE_S;
+        }
+        profile.default_s = POLL_PROFILE_SERVICE_S;
+        return profile;
+    }
+
+    bool is_valid() const {
+        if (version != POLL_PROFILE_VERSION || default_s < POLL_PROFILE_MIN_S || default_s > POLL_PROFILE_MAX_S) {
+            return false;
+        }
+        for (int hour = 0; hour < 24; hour++) {
+            if (hourly_s[hour] < POLL_PROFILE_MIN_S || hourly_s[hour] > POLL_PROFILE_MAX_S) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Result of one poll as far as scheduling is concerned
+struct PollOutcome {
+    int status;                 // HTTP status, -1 on a transport failure
+    int32_t max_age_s;          // Cache-Control max-age, -1 when absent
+    int32_t retry_after_s;      // Retry-After, -1 when absent
+};
+
+// Decides when to poll next:
+//  - the profile interval for the current hour, up to 10% early so a fleet
+//    that booted together spreads out without any display getting staler,
+//    cut short when a faster hour starts;
+//  - no earlier than the response's max-age, the server saying the state
+//    can not change before then;
+//  - on errors, exponential backoff from the interval with jitter, up to
+//    POLL_SCHEDULER_BACKOFF_MAX_MS;
+//  - never before Retry-After.
+// Portable (no ESP-IDF), also built by the host tools.
+class PollScheduler {
+public:
+    PollScheduler() : profile_(PollProfile::defaults()), failures_(0) {}
+
+    void set_profile(const PollProfile& profile) { profile_ = profile; }
+    const PollProfile& profile() const { return profile_; }
+
+    // second_of_day is local time, -1 while the clock is not set. random is
+    // any uniformly distributed value (esp_random()).
+    uint32_t next_delay_ms(const PollOutcome& outcome, int32_t second_of_day, uint32_t random);
+
+    uint32_t consecutive_failures() const { return failures_; }
+
+    // Whether the live state, received at live_at_ms, is stale at now_ms,
+    // the next poll being due at next_poll_ms (all on one clock). Only once
+    // it is POLL_SCHEDULER_STALE_MS old and the poll expected to refresh it
+    // failed or is that late: long night intervals and max-age hints alone
+    // never make it stale.
+    bool is_stale(int64_t now_ms, int64_t live_at_ms, int64_t next_poll_ms) const {
+        return now_ms - live_at_ms >= POLL_SCHEDULER_STALE_MS &&
+               (failures_ || now_ms - next_poll_ms >= POLL_SCHEDULER_STALE_MS);
+    }
+
+    // Header values, -1 when absent or unusable. no-cache/no-store count as
+    // max-age 0. Retry-After takes delta-seconds or an IMF-fixdate, the
+    // latter needing now_s (Unix time, 0 when unknown).
+    static int32_t parse_max_age(const char* cache_control);
+    static int32_t parse_retry_after(const char* value, int64_t now_s);
+
+private:
+    PollProfile profile_;
+    uint32_t failures_;
+};
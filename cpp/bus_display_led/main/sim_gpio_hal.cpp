@@ -0,0 +1,121 @@
+// sim_gpio_hal.cpp
+#include "sim_gpio_hal.h"
+#include <algorithm>
+
+SimGpioHal::SimGpioHal(int clock_pin, int data_pin, int latch_pin, int reset_pin, int oe_pin,
+                       size_t registers, uint32_t write_ns)
+    : SimGpioHal(clock_pin, std::vector<int>{data_pin}, latch_pin, reset_pin, oe_pin, registers, write_ns) {
+}
+
+SimGpioHal::SimGpioHal(int clock_pin, const std::vector<int>& data_pins, int latch_pin, int reset_pin,
+                       int oe_pin, size_t registers, uint32_t write_ns)
+    : clock_pin_(clock_pin), data_pins_(data_pins), latch_pin_(latch_pin),
+      reset_pin_(reset_pin), oe_pin_(oe_pin), registers_(registers), write_ns_(write_ns),
+      now_ns_(0), shift_stages_(data_pins.size(), std::vector<uint8_t>(registers * 16, 0)),
+      storage_stages_(data_pins.size(), std::vector<uint8_t>(registers * 16, 0)),
+      clock_edges_(0), latch_edges_(0) {
+    std::fill(levels_, levels_ + 64, 0);
+    levels_[oe_pin_ & 63] = 1;     // outputs disabled until driven low
+    levels_[reset_pin_ & 63] = 1;  // not in reset
+}
+
+bool SimGpioHal::configure_output(int pin) {
+    return pin >= 0 && pin < 64;
+}
+
+int SimGpioHal::level(int pin) const {
+    return pin >= 0 && pin < 64 ? levels_[pin] : 0;
+}
+
+bool SimGpioHal::change(int pin, int level) {
+    if (pin < 0 || pin >= 64 || levels_[pin] == level) {
+        return false;
+    }
+    levels_[pin] = level;
+    transitions_.push_back({now_ns_, pin, level});
+    return true;
+}
+
+void SimGpioHal::edge(int pin, int level) {
+    bool rising = level == 1;
+    if (pin == clock_pin_ && rising) {
+        // Shift everything one stage down each chain, DATA enters at stage 0
+        for (size_t c = 0; c < data_pins_.size(); c++) {
+            std::vector<uint8_t>& stage = shift_stages_[c];
+            std::copy_backward(stage.begin(), stage.end() - 1, stage.end());
+            stage[0] = (uint8_t)levels_[data_pins_[c] & 63];
+        }
+        clock_edges_++;
+    } else if (pin == latch_pin_ && rising) {
+        storage_stages_ = shift_stages_;
+        latch_edges_++;
+    } else if (pin == reset_pin_ && !rising) {
+        for (std::vector<uint8_t>& stage : shift_stages_) {
+            std::fill(stage.begin(), stage.end(), 0);
+        }
+    }
+}
+
+void SimGpioHal::set_level(int pin, int level) {
+    now_ns_ += write_ns_;
+    level = level ? 1 : 0;
+    if (change(pin, level)) {
+        edge(pin, level);
+    }
+}
+
+void SimGpioHal::write_mask(uint32_t set_mask, uint32_t clear_mask) {
+    // Two register writes, each pin of a write changing at the same time
+    for (int level = 1; level >= 0; level--) {
+        const uint32_t mask = level ? set_mask : clear_mask;
+        if (!mask) {
+            continue;
+        }
+        now_ns_ += write_ns_;
+        uint32_t changed = 0;
+        for (int pin = 0; pin < 32; pin++) {
+            if ((mask >> pin) & 1 && change(pin, level)) {
+                changed |= 1u << pin;
+            }
+        }
+        for (int pin = 0; pin < 32; pin++) {
+            if ((changed >> pin) & 1) {
+                edge(pin, level);
+            }
+        }
+    }
+}
+
+void SimGpioHal::delay_us(uint32_t us) {
+    now_ns_ += (uint64_t)us * 1000;
+}
+
+void SimGpioHal::reset_pin(int pin) {
+    set_level(pin, 0);
+}
+
+std::vector<uint16_t> SimGpioHal::latched_words(size_t chain) const {
+    // After shifting N words LSB first, bit b of word p sits at stage 16N-1-16p-b
+    std::vector<uint16_t> words(registers_, 0);
+    if (chain >= storage_stages_.size()) {
+        return words;
+    }
+    const std::vector<uint8_t>& stage = storage_stages_[chain];
+    const size_t total = registers_ * 16;
+    for (size_t p = 0; p < registers_; p++) {
+        uint16_t word = 0;
+        for (int b = 0; b < 16; b++) {
+            if (stage[total - 1 - 16 * p - b]) {
+                word |= (uint16_t)(1u << b);
+            }
+        }
+        words[p] = word;
+    }
+    return words;
+}
+
+void SimGpioHal::clear_trace() {
+    transitions_.clear();
+    clock_edges_ = 0;
+    latch_edges_ = 0;
+}
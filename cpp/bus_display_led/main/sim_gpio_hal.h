@@ -0,0 +1,72 @@
+// sim_gpio_hal.h
+#pragma once
+
+#include "gpio_hal.h"
+#include <cstddef>
+#include <vector>
+
+// Host-side GPIO simulator with a 74HC595 chain model.
+// Every pin change is recorded with a simulated timestamp; delays advance
+// the simulated clock instead of sleeping. CLOCK rising edges shift DATA
+// into the chain, LATCH rising edges copy it to the outputs, RESET low
+// clears the shift stage and OE low enables the outputs. With several data
+// pins, each feeds a chain of its own on the shared CLOCK and LATCH, as
+// ParallelGpioLEDOutput drives them.
+class SimGpioHal : public GpioHal {
+public:
+    struct Transition {
+        uint64_t time_ns;
+        int pin;
+        int level;
+    };
+
+    SimGpioHal(int clock_pin, int data_pin, int latch_pin, int reset_pin, int oe_pin,
+               size_t registers, uint32_t write_ns = 50);
+    // registers per chain, one chain per data pin
+    SimGpioHal(int clock_pin, const std::vector<int>& data_pins, int latch_pin, int reset_pin, int oe_pin,
+               size_t registers, uint32_t write_ns = 50);
+
+    bool configure_output(int pin) override;
+    void set_level(int pin, int level) override;
+    void write_mask(uint32_t set_mask, uint32_t clear_mask) override;
+    void delay_us(uint32_t us) override;
+    void reset_pin(int pin) override;
+    int64_t now_us() override { return (int64_t)(now_ns_ / 1000); }
+
+    // Latched register words of a chain in chain order: index 0 is the
+    // first word shifted, i.e. the register furthest from the ESP32
+    std::vector<uint16_t> latched_words(size_t chain = 0) const;
+    bool outputs_enabled() const { return level(oe_pin_) == 0; }
+
+    const std::vector<Transition>& transitions() const { return transitions_; }
+    uint64_t now_ns() const { return now_ns_; }
+    uint32_t clock_edges() const { return clock_edges_; }
+    uint32_t latch_edges() const { return latch_edges_; }
+    void clear_trace();
+
+private:
+    int level(int pin) const;
+    // Records a level change, false when the pin already had that level
+    bool change(int pin, int level);
+    // Acts on an edge once every pin of the write has its new level
+    void edge(int pin, int level);
+
+    int clock_pin_;
+    std::vector<int> data_pins_;
+    int latch_pin_;
+    int reset_pin_;
+    int oe_pin_;
+    size_t registers_;
+    uint32_t write_ns_;
+
+    int levels_[64];
+    uint64_t now_ns_;
+    std::vector<Transition> transitions_;
+
+    // Per chain, bit 0 is the stage next to the ESP32, higher indices are
+    // further down the chain
+    std::vector<std::vector<uint8_t>> shift_stages_;
+    std::vector<std::vector<uint8_t>> storage_stages_;
+    uint32_t clock_edges_;
+    uint32_t latch_edges_;
+};
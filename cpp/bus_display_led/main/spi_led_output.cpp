@@ -0,0 +1,116 @@
+// spi_led_output.cpp
+#include "spi_led_output.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include <cstring>
+
+const char* SpiLEDOutput::TAG = "LED_SPI";
+
+SpiLEDOutput::SpiLEDOutput(gpio_num_t clock_pin, gpio_num_t data_pin, gpio_num_t latch_pin)
+    : clock_pin_(clock_pin), data_pin_(data_pin), latch_pin_(latch_pin),
+      bus_initialized_(false), device_(nullptr), dma_buffer_(nullptr),
+      transaction_pending_(false) {
+    memset(&transaction_, 0, sizeof(transaction_));
+}
+
+SpiLEDOutput::~SpiLEDOutput() {
+    wait_pending();
+    if (device_) {
+        spi_bus_remove_device(device_);
+        device_ = nullptr;
+    }
+    if (bus_initialized_) {
+        spi_bus_free(LED_SPI_HOST);
+        bus_initialized_ = false;
+    }
+    if (dma_buffer_) {
+        heap_caps_free(dma_buffer_);
+        dma_buffer_ = nullptr;
+    }
+}
+
+bool SpiLEDOutput::initialize() {
+    dma_buffer_ = (uint8_t*)heap_caps_malloc(LED_OUTPUT_MAX_WORDS * sizeof(uint16_t), MALLOC_CAP_DMA);
+    if (!dma_buffer_) {
+        ESP_LOGE(TAG, "Failed to allocate DMA buffer");
+        return false;
+    }
+
+    spi_bus_config_t bus_conf = {};
+    bus_conf.mosi_io_num = data_pin_;
+    bus_conf.miso_io_num = -1;
+    bus_conf.sclk_io_num = clock_pin_;
+    bus_conf.quadwp_io_num = -1;
+    bus_conf.quadhd_io_num = -1;
+    bus_conf.max_transfer_sz = LED_OUTPUT_MAX_WORDS * sizeof(uint16_t);
+
+    esp_err_t ret = spi_bus_initialize(LED_SPI_HOST, &bus_conf, SPI_DMA_CH_AUTO);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "SPI bus init failed: %s", esp_err_to_name(ret));
+        return false;
+    }
+    bus_initialized_ = true;
+
+    spi_device_interface_config_t dev_conf = {};
+    dev_conf.mode = 0;                              // 74HC595 samples on the rising clock edge
+    dev_conf.clock_speed_hz = LED_SPI_CLOCK_HZ;
+    dev_conf.spics_io_num = latch_pin_;             // CS rising edge = latch
+    dev_conf.cs_ena_posttrans = 2;                  // keep CS low a little after the last clock
+    dev_conf.flags = SPI_DEVICE_TXBIT_LSBFIRST;     // LSB first, same order as the GPIO backend
+    dev_conf.queue_size = 1;
+
+    ret = spi_bus_add_device(LED_SPI_HOST, &dev_conf, &device_);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "SPI add device failed: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    ESP_LOGI(TAG, "SPI output ready (%d Hz)", LED_SPI_CLOCK_HZ);
+    return true;
+}
+
+bool SpiLEDOutput::wait_pending() {
+    if (!transaction_pending_) {
+        return true;
+    }
+
+    spi_transaction_t* done = nullptr;
+    esp_err_t ret = spi_device_get_trans_result(device_, &done, portMAX_DELAY);
+    transaction_pending_ = false;
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "SPI transaction failed: %s", esp_err_to_name(ret));
+        return false;
+    }
+    return true;
+}
+
+bool SpiLEDOutput::write_frame(const uint16_t* words, size_t count) {
+    if (!device_ || count == 0) {
+        return false;
+    }
+    if (count > LED_OUTPUT_MAX_WORDS) {
+        ESP_LOGW(TAG, "Frame of %d words truncated to %d", (int)count, LED_OUTPUT_MAX_WORDS);
+        count = LED_OUTPUT_MAX_WORDS;
+    }
+
+    // The previous frame may still be clocking out of the buffer
+    wait_pending();
+
+    // Low byte first, each byte sent LSB first -> bits 0..15 in order
+    for (size_t i = 0; i < count; i++) {
+        dma_buffer_[2 * i] = words[i] & 0xFF;
+        dma_buffer_[2 * i + 1] = words[i] >> 8;
+    }
+
+    memset(&transaction_, 0, sizeof(transaction_));
+    transaction_.length = count * 16;
+    transaction_.tx_buffer = dma_buffer_;
+
+    esp_err_t ret = spi_device_queue_trans(device_, &transaction_, 0);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "SPI queue failed: %s", esp_err_to_name(ret));
+        return false;
+    }
+    transaction_pending_ = true;
+    return true;
+}
@@ -0,0 +1,39 @@
+// spi_led_output.h
+#pragma once
+
+#include "led_output.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+
+#define LED_SPI_HOST SPI3_HOST
+#define LED_SPI_CLOCK_HZ (1 * 1000 * 1000)
+
+// SPI backend: the frame is clocked out of a DMA buffer by the SPI peripheral.
+// DATA is wired to MOSI, CLOCK to SCLK and LATCH is driven as the chip select,
+// so the rising CS edge at the end of the transaction latches the registers
+// without any CPU involvement.
+class SpiLEDOutput : public LEDOutput {
+public:
+    SpiLEDOutput(gpio_num_t clock_pin, gpio_num_t data_pin, gpio_num_t latch_pin);
+    ~SpiLEDOutput() override;
+
+    bool initialize() override;
+    bool write_frame(const uint16_t* words, size_t count) override;
+    const char* name() const override { return "spi"; }
+
+private:
+    bool wait_pending();
+
+    gpio_num_t clock_pin_;
+    gpio_num_t data_pin_;
+    gpio_num_t latch_pin_;
+    bool bus_initialized_;
+    spi_device_handle_t device_;
+
+    // DMA-capable transmit buffer, reused for every frame
+    uint8_t* dma_buffer_;
+    spi_transaction_t transaction_;
+    bool transaction_pending_;
+
+    static const char* TAG;
+};
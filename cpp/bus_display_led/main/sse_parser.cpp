@@ -0,0 +1,133 @@
+// sse_parser.cpp
+#include "sse_parser.h"
+#include <cstring>
+
+void SseParser::reset() {
+    line_length_ = 0;
+    line_overflow_ = false;
+    after_cr_ = false;
+    name_[0] = '\0';
+    data_length_ = 0;
+    has_data_ = false;
+    event_overflow_ = false;
+    retry_ms_ = 0;
+    events_ = 0;
+    heartbeats_ = 0;
+    dropped_ = 0;
+}
+
+void SseParser::feed(const char* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        const char c = data[i];
+        if (after_cr_) {
+            after_cr_ = false;
+            if (c == '\n') {
+                continue;
+            }
+        }
+        if (c == '\r' || c == '\n') {
+            after_cr_ = c == '\r';
+            end_line();
+            continue;
+        }
+        if (line_length_ < sizeof(line_)) {
+            line_[line_length_++] = c;
+        } else {
+            line_overflow_ = true;
+        }
+    }
+}
+
+void SseParser::end_line() {
+    const size_t length = line_length_;
+    const bool overflow = line_overflow_;
+    line_length_ = 0;
+    line_overflow_ = false;
+
+    if (overflow) {
+        // Whatever field it was, the event can no longer be trusted
+        event_overflow_ = true;
+        return;
+    }
+    if (length == 0) {
+        dispatch();
+        return;
+    }
+    if (line_[0] == ':') {
+        heartbeats_++;
+        return;
+    }
+
+    // "name: value", "name:value" or a bare "name"
+    const char* colon = (const char*)memchr(line_, ':', length);
+    if (!colon) {
+        process_field(line_, length, "", 0);
+        return;
+    }
+    const char* value = colon + 1;
+    if (value < line_ + length && *value == ' ') {
+        value++;
+    }
+    process_field(line_, colon - line_, value, line_ + length - value);
+}
+
+void SseParser::process_field(const char* name, size_t name_length, const char* value, size_t value_length) {
+    if (name_length == 4 && memcmp(name, "data", 4) == 0) {
+        const size_t needed = value_length + (has_data_ ? 1 : 0);
+        if (data_length_ + needed > SSE_PARSER_MAX_DATA) {
+            event_overflow_ = true;
+            return;
+        }
+        if (has_data_) {
+            data_[data_length_++] = '\n';
+        }
+        memcpy(data_ + data_length_, value, value_length);
+        data_length_ += value_length;
+        has_data_ = true;
+    } else if (name_length == 5 && memcmp(name, "event", 5) == 0) {
+        if (value_length >= sizeof(name_)) {
+            event_overflow_ = true;
+            return;
+        }
+        memcpy(name_, value, value_length);
+        name_[value_length] = '\0';
+    } else if (name_length == 2 && memcmp(name, "id", 2) == 0) {
+        // Ids with NUL are ignored by the spec, overlong ones by us
+        if (value_length < sizeof(id_) && !memchr(value, '\0', value_length)) {
+            memcpy(id_, value, value_length);
+            id_[value_length] = '\0';
+        }
+    } else if (name_length == 5 && memcmp(name, "retry", 5) == 0) {
+        uint32_t ms = 0;
+        for (size_t i = 0; i < value_length; i++) {
+            if (value[i] < '0' || value[i] > '9' || ms > 100000000) {
+                return;
+            }
+            ms = ms * 10 + (value[i] - '0');
+        }
+        if (value_length) {
+            retry_ms_ = ms;
+        }
+    }
+    // Other fields are ignored
+}
+
+void SseParser::dispatch() {
+    if (event_overflow_) {
+        dropped_++;
+    } else if (has_data_) {
+        data_[data_length_] = '\0';
+        SseEvent event;
+        event.name = name_[0] ? name_ : "message";
+        event.data = data_;
+        event.data_length = data_length_;
+        event.id = id_;
+        events_++;
+        handler_(event);
+    }
+
+    name_[0] = '\0';
+    data_length_ = 0;
+    has_data_ = false;
+    event_overflow_ = false;
+}
@@ -0,0 +1,71 @@
+// sse_parser.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#define SSE_PARSER_MAX_DATA 1024
+#define SSE_PARSER_MAX_NAME 16
+#define SSE_PARSER_MAX_ID 40
+#define SSE_PARSER_MAX_LINE (SSE_PARSER_MAX_DATA + 8)
+
+// One dispatched event. data and id are NUL terminated and only valid for
+// the duration of the handler call.
+struct SseEvent {
+    const char* name;       // "message" when the stream gave none
+    const char* data;       // data lines joined with '\n'
+    size_t data_length;
+    const char* id;         // last event id seen on the stream, may be empty
+};
+
+// Incremental text/event-stream parser (the Server-Sent Events wire format).
+// Fed chunk by chunk as bytes come off the socket; each complete event is
+// handed to the handler as soon as its terminating blank line arrives.
+// Comment lines (": ...") are the server's heartbeat and only counted.
+// Lines and events beyond the fixed buffers are dropped, never truncated,
+// so a partial frame can not reach the decoder.
+class SseParser {
+public:
+    typedef std::function<void(const SseEvent& event)> Handler;
+
+    explicit SseParser(const Handler& handler) : handler_(handler) {
+        id_[0] = '\0';
+        reset();
+    }
+
+    // Start a new stream (the last event id is kept, as on a reconnect)
+    void reset();
+    void feed(const char* data, size_t length);
+
+    // Reconnection delay requested with "retry:", 0 when none
+    uint32_t retry_ms() const { return retry_ms_; }
+    const char* last_event_id() const { return id_; }
+    uint32_t events() const { return events_; }
+    uint32_t heartbeats() const { return heartbeats_; }
+    uint32_t dropped() const { return dropped_; }
+
+private:
+    void end_line();
+    void process_field(const char* name, size_t name_length, const char* value, size_t value_length);
+    void dispatch();
+
+    Handler handler_;
+
+    char line_[SSE_PARSER_MAX_LINE];
+    size_t line_length_;
+    bool line_overflow_;
+    bool after_cr_;         // swallow the \n of a \r\n pair
+
+    char name_[SSE_PARSER_MAX_NAME];
+    char data_[SSE_PARSER_MAX_DATA + 1];
+    size_t data_length_;
+    bool has_data_;
+    bool event_overflow_;
+    char id_[SSE_PARSER_MAX_ID];
+    uint32_t retry_ms_;
+
+    uint32_t events_;
+    uint32_t heartbeats_;
+    uint32_t dropped_;
+};
@@ -0,0 +1,129 @@
+// stib_config.h
+#pragma once
+
+#include "frame.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define STIB_CONFIG_VERSION 1
+#define STIB_MAX_POINTS 96
+#define STIB_API_KEY_SIZE 80
+#define STIB_MAX_LINES 16
+
+// Direct mode: the device polls the STIB open-data vehicle positions itself
+// instead of the LED server. Each stop of the display is the pointId a
+// vehicle of a line reports as the last one it passed, mapped to an LED.
+//
+// The stop table is stored in NVS with the API key and kept sorted by
+// (point_id, line) in parallel arrays, 8 bytes a stop, so a lookup is a
+// bisection over point_ids: a response holds hundreds of positions against
+// a table of a few dozen stops.
+struct StibConfig {
+    uint8_t version;
+    uint8_t enabled;
+    uint8_t point_count;
+    char api_key[STIB_API_KEY_SIZE];
+    uint32_t point_ids[STIB_MAX_POINTS];
+    uint16_t lines[STIB_MAX_POINTS];
+    uint16_t slots[STIB_MAX_POINTS];    // row * LEDS_PER_ROW + led
+
+    static StibConfig defaults() {
+        StibConfig config;
+        memset(&config, 0, sizeof(config));
+        config.version = STIB_CONFIG_VERSION;
+        return config;
+    }
+
+    bool is_valid() const {
+        if (version != STIB_CONFIG_VERSION || point_count > STIB_MAX_POINTS ||
+            memchr(api_key, '\0', sizeof(api_key)) == nullptr) {
+            return false;
+        }
+        if (enabled && (api_key[0] == '\0' || point_count == 0)) {
+            return false;
+        }
+        for (size_t i = 0; i < point_count; i++) {
+            if (slots[i] >= LED_MAX_ROWS * LEDS_PER_ROW || lines[i] == 0) {
+                return false;
+            }
+            if (i && !(point_ids[i - 1] < point_ids[i] ||
+                       (point_ids[i - 1] == point_ids[i] && lines[i - 1] < lines[i]))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Inserts a stop in order. False when the table is full, the LED is
+    // out of range or the stop is already mapped.
+    bool add_point(uint16_t line, uint32_t point_id, uint8_t row, uint8_t led) {
+        if (point_count >= STIB_MAX_POINTS || line == 0 || row >= LED_MAX_ROWS || led >= LEDS_PER_ROW) {
+            return false;
+        }
+        size_t i = first_point(point_id);
+        while (i < point_count && point_ids[i] == point_id && lines[i] < line) {
+            i++;
+        }
+        if (i < point_count && point_ids[i] == point_id && lines[i] == line) {
+            return false;
+        }
+        const size_t tail = point_count - i;
+        memmove(point_ids + i + 1, point_ids + i, tail * sizeof(point_ids[0]));
+        memmove(lines + i + 1, lines + i, tail * sizeof(lines[0]));
+        memmove(slots + i + 1, slots + i, tail * sizeof(slots[0]));
+        point_ids[i] = point_id;
+        lines[i] = line;
+        slots[i] = (uint16_t)(row * LEDS_PER_ROW + led);
+        point_count++;
+        return true;
+    }
+
+    // Index of the first stop with point_id, or where it would go
+    size_t first_point(uint32_t point_id) const {
+        return std::lower_bound(point_ids, point_ids + point_count, point_id) - point_ids;
+    }
+
+    bool has_point(uint32_t point_id) const {
+        size_t i = first_point(point_id);
+        return i < point_count && point_ids[i] == point_id;
+    }
+
+    // Slot (row * LEDS_PER_ROW + led) of a line's stop, -1 when not on the display
+    int find(uint16_t line, uint32_t point_id) const {
+        for (size_t i = first_point(point_id); i < point_count && point_ids[i] == point_id; i++) {
+            if (lines[i] == line) {
+                return slots[i];
+            }
+        }
+        return -1;
+    }
+
+    // Rows the table spans
+    uint8_t row_count() const {
+        uint8_t rows = 0;
+        for (size_t i = 0; i < point_count; i++) {
+            if (slots[i] / LEDS_PER_ROW + 1 > rows) {
+                rows = (uint8_t)(slots[i] / LEDS_PER_ROW + 1);
+            }
+        }
+        return rows;
+    }
+
+    // Distinct lines of the table in ascending order, at most capacity
+    size_t line_list(uint16_t* out, size_t capacity) const {
+        size_t count = 0;
+        for (size_t i = 0; i < point_count; i++) {
+            uint16_t* end = out + count;
+            uint16_t* at = std::lower_bound(out, end, lines[i]);
+            if ((at != end && *at == lines[i]) || count >= capacity) {
+                continue;
+            }
+            std::copy_backward(at, end, end + 1);
+            *at = lines[i];
+            count++;
+        }
+        return count;
+    }
+};
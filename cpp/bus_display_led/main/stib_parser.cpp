@@ -0,0 +1,158 @@
+// stib_parser.cpp
+#include "stib_parser.h"
+#include <cstring>
+
+StibParser::StibParser() : outer_(*this), inner_(*this), config_(nullptr) {
+    static const StibConfig EMPTY = StibConfig::defaults();
+    reset(EMPTY);
+}
+
+void StibParser::reset(const StibConfig& config) {
+    outer_.reset();
+    inner_.reset();
+    config_ = &config;
+    results_seen_ = results_open_ = in_result_ = nested_ = false;
+    line_ = 0;
+    pending_count_ = 0;
+    point_id_ = 0;
+    point_valid_ = false;
+    frame_.clear();
+    results_ = positions_ = matched_ = invalid_ = dropped_ = 0;
+}
+
+bool StibParser::feed(const char* data, size_t length) {
+    return outer_.feed(data, length);
+}
+
+bool StibParser::finish(Animation& out) {
+    if (!outer_.done() || !results_seen_) {
+        return false;
+    }
+    out = Animation(frame_);
+    const uint8_t rows = config_->row_count();
+    if (out.base.row_count < rows) {
+        out.base.row_count = rows;
+    }
+    return true;
+}
+
+void StibParser::on_open(const JsonScanner& scanner, bool is_object) {
+    if (&scanner == &inner_) {
+        // [{"pointId":...}, ...]
+        if (scanner.depth() == 1 && is_object) {
+            point_id_ = 0;
+            point_valid_ = false;
+        }
+        return;
+    }
+
+    if (scanner.depth() == 1 && !is_object && !results_seen_ && strcmp(scanner.key(), "results") == 0) {
+        results_seen_ = results_open_ = true;
+    } else if (scanner.depth() == 2 && is_object && results_open_) {
+        in_result_ = true;
+        line_ = 0;
+        pending_count_ = 0;
+        results_++;
+    }
+}
+
+void StibParser::on_close(const JsonScanner& scanner, bool is_object) {
+    if (&scanner == &inner_) {
+        if (scanner.depth() == 1 && is_object) {
+            positions_++;
+            if (!point_valid_) {
+                return;
+            }
+            if (line_) {
+                add_position(point_id_);
+            } else if (sink_ || config_->has_point(point_id_)) {
+                if (pending_count_ < STIB_PARSER_PENDING) {
+                    pending_[pending_count_++] = point_id_;
+                } else {
+                    dropped_++;
+                }
+            }
+        }
+        return;
+    }
+
+    if (scanner.depth() == 2 && is_object && in_result_) {
+        commit_result();
+        in_result_ = false;
+    } else if (scanner.depth() == 1 && !is_object && results_open_) {
+        results_open_ = false;
+    }
+}
+
+void StibParser::on_string_char(const JsonScanner& scanner, char c) {
+    if (&scanner == &inner_) {
+        return;
+    }
+    if (!nested_ && in_result_ && scanner.depth() == 3 && strcmp(scanner.key(), "vehiclepositions") == 0) {
+        nested_ = true;
+        inner_.reset();
+    }
+    if (nested_) {
+        inner_.step(c);     // a failure shows in inner_ when the string ends
+    }
+}
+
+void StibParser::on_value(const JsonScanner& scanner, JsonScanner::Scalar type, const char* text) {
+    if (&scanner == &inner_) {
+        uint32_t point_id;
+        if (scanner.depth() == 2 && strcmp(scanner.key(), "pointId") == 0 && type != JsonScanner::SCALAR_LITERAL &&
+            !scanner.text_overflow() && parse_id(text, point_id)) {
+            point_id_ = point_id;
+            point_valid_ = true;
+        }
+        return;
+    }
+
+    if (nested_) {
+        nested_ = false;
+        if (!inner_.done()) {
+            invalid_++;
+        }
+        return;
+    }
+
+    uint32_t line;
+    if (in_result_ && scanner.depth() == 3 && strcmp(scanner.key(), "lineid") == 0 &&
+        type != JsonScanner::SCALAR_LITERAL && !scanner.text_overflow() && parse_id(text, line) &&
+        line <= UINT16_MAX) {
+        line_ = (uint16_t)line;
+    }
+}
+
+void StibParser::add_position(uint32_t point_id) {
+    if (sink_) {
+        sink_(line_, point_id);
+    }
+    int slot = config_->find(line_, point_id);
+    if (slot >= 0) {
+        frame_.set_led(slot / LEDS_PER_ROW, slot % LEDS_PER_ROW, true);
+        matched_++;
+    }
+}
+
+void StibParser::commit_result() {
+    if (line_) {
+        for (size_t i = 0; i < pending_count_; i++) {
+            add_position(pending_[i]);
+        }
+    }
+    pending_count_ = 0;
+}
+
+// Decimal id as a string or a number, e.g. "3558" or 3558
+bool StibParser::parse_id(const char* text, uint32_t& value) {
+    value = 0;
+    size_t n = 0;
+    for (; text[n]; n++) {
+        if (text[n] < '0' || text[n] > '9' || n >= 9) {
+            return false;
+        }
+        value = value * 10 + (uint32_t)(text[n] - '0');
+    }
+    return n > 0;
+}
@@ -0,0 +1,90 @@
+// stib_parser.h
+#pragma once
+
+#include "animation.h"
+#include "json_scanner.h"
+#include "stib_config.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#define STIB_PARSER_PENDING 32
+
+// Streaming parser for the STIB open-data vehicle positions
+// (dataset vehicle-position-rt-production, records endpoint):
+//   {"total_count":2,"results":[{"lineid":"8","vehiclepositions":
+//    "[{\"directionId\":\"3510\",\"distanceFromPoint\":0,\"pointId\":\"3558\"},...]"},...]}
+// "vehiclepositions" is JSON escaped into a string. An outer JsonScanner
+// walks the response and hands every unescaped character of that string to
+// an inner one, so both levels are parsed in one pass over the socket
+// chunks: no DOM, no copy of the string, no heap.
+//
+// Each vehicle lights the LED the StibConfig maps its line and pointId (the
+// stop it passed last) to. The API sends a result's "lineid" before its
+// positions; should it come after, the pointIds to look up are held until
+// the result closes, up to STIB_PARSER_PENDING per line. Portable, also
+// built by the host tools.
+class StibParser : private JsonScanner::Listener {
+public:
+    // Sees every vehicle with a numeric line and pointId, on the display or not
+    typedef std::function<void(uint16_t line, uint32_t point_id)> PositionSink;
+
+    StibParser();
+
+    void set_position_sink(const PositionSink& sink) { sink_ = sink; }
+
+    // Start a new document, mapped with config (kept by reference until finish())
+    void reset(const StibConfig& config);
+
+    // Consume the next chunk. Returns false once the response is malformed.
+    // A "vehiclepositions" string that does not parse only counts as invalid.
+    bool feed(const char* data, size_t length);
+
+    // After the last chunk: the lit stops as a frame spanning the table's
+    // rows. False when the response is incomplete, malformed or holds no
+    // "results" array.
+    bool finish(Animation& out);
+
+    bool failed() const { return outer_.failed(); }
+    uint32_t results() const { return results_; }          // lines in the response
+    uint32_t positions() const { return positions_; }      // vehicles
+    uint32_t matched() const { return matched_; }          // vehicles at a stop of the display
+    uint32_t invalid() const { return invalid_; }          // position lists that did not parse
+    uint32_t dropped() const { return dropped_; }          // beyond STIB_PARSER_PENDING
+
+private:
+    void on_open(const JsonScanner& scanner, bool is_object) override;
+    void on_close(const JsonScanner& scanner, bool is_object) override;
+    void on_string_char(const JsonScanner& scanner, char c) override;
+    void on_value(const JsonScanner& scanner, JsonScanner::Scalar type, const char* text) override;
+
+    void add_position(uint32_t point_id);
+    void commit_result();
+    static bool parse_id(const char* text, uint32_t& value);
+
+    JsonScanner outer_;
+    JsonScanner inner_;         // the current "vehiclepositions" string
+    const StibConfig* config_;
+    PositionSink sink_;
+
+    bool results_seen_;
+    bool results_open_;
+    bool in_result_;
+    bool nested_;               // inside a "vehiclepositions" string
+
+    // Result being parsed
+    uint16_t line_;             // 0 until a numeric "lineid"
+    uint32_t pending_[STIB_PARSER_PENDING];    // positions seen before the line
+    uint8_t pending_count_;
+
+    // Position being parsed
+    uint32_t point_id_;
+    bool point_valid_;
+
+    Frame frame_;
+    uint32_t results_;
+    uint32_t positions_;
+    uint32_t matched_;
+    uint32_t invalid_;
+    uint32_t dropped_;
+};
@@ -144,4 +144,223 @@ bool StorageManager::clear_wifi_credentials() {
     
     ESP_LOGI(TAG, "WiFi credentials cleared");
     return true;
-}
\ No newline at end of file
+}
+
+bool StorageManager::save_topology(const DisplayTopology& topology) {
+    if (!initialized_) {
+        ESP_LOGE(TAG, "Storage manager not initialized");
+        return false;
+    }
+
+    esp_err_t ret = nvs_set_blob(nvs_handle_, NVS_TOPOLOGY, &topology, sizeof(topology));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error saving topology: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    ret = nvs_commit(nvs_handle_);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing topology: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Topology saved (%d registers)", topology.register_count);
+    return true;
+}
+
+bool StorageManager::load_topology(DisplayTopology& topology) {
+    topology = DisplayTopology::defaults();
+    if (!initialized_) {
+        ESP_LOGE(TAG, "Storage manager not initialized");
+        return false;
+    }
+
+    DisplayTopology stored;
+    size_t size = sizeof(stored);
+    esp_err_t ret = nvs_get_blob(nvs_handle_, NVS_TOPOLOGY, &stored, &size);
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGD(TAG, "No topology in NVS, using defaults");
+        return false;
+    } else if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error reading topology: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    if (size != sizeof(stored) || !stored.is_valid()) {
+        ESP_LOGW(TAG, "Stored topology invalid, using defaults");
+        return false;
+    }
+
+    topology = stored;
+    return true;
+}
+
+bool StorageManager::save_poll_profile(const PollProfile& profile) {
+    if (!initialized_) {
+        ESP_LOGE(TAG, "Storage manager not initialized");
+        return false;
+    }
+
+    esp_err_t ret = nvs_set_blob(nvs_handle_, NVS_POLL_PROFILE, &profile, sizeof(profile));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error saving poll profile: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    ret = nvs_commit(nvs_handle_);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing poll profile: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Poll profile saved");
+    return true;
+}
+
+bool StorageManager::load_poll_profile(PollProfile& profile) {
+    profile = PollProfile::defaults();
+    if (!initialized_) {
+        ESP_LOGE(TAG, "Storage manager not initialized");
+        return false;
+    }
+
+    PollProfile stored;
+    size_t size = sizeof(stored);
+    esp_err_t ret = nvs_get_blob(nvs_handle_, NVS_POLL_PROFILE, &stored, &size);
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGD(TAG, "No poll profile in NVS, using defaults");
+        return false;
+    } else if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error reading poll profile: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    if (size != sizeof(stored) || !stored.is_valid()) {
+        ESP_LOGW(TAG, "Stored poll profile invalid, using defaults");
+        return false;
+    }
+
+    profile = stored;
+    return true;
+}
+
+bool StorageManager::save_stib_config(const StibConfig& config) {
+    if (!initialized_) {
+        ESP_LOGE(TAG, "Storage manager not initialized");
+        return false;
+    }
+
+    esp_err_t ret = nvs_set_blob(nvs_handle_, NVS_STIB_CONFIG, &config, sizeof(config));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error saving STIB config: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    ret = nvs_commit(nvs_handle_);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing STIB config: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    ESP_LOGI(TAG, "STIB config saved (%d stops, direct mode %s)", config.point_count,
+             config.enabled ? "on" : "off");
+    return true;
+}
+
+bool StorageManager::load_stib_config(StibConfig& config) {
+    config = StibConfig::defaults();
+    if (!initialized_) {
+        ESP_LOGE(TAG, "Storage manager not initialized");
+        return false;
+    }
+
+    // Read in place: the blob is too large for the caller's stack twice
+    size_t size = sizeof(config);
+    esp_err_t ret = nvs_get_blob(nvs_handle_, NVS_STIB_CONFIG, &config, &size);
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGD(TAG, "No STIB config in NVS, direct mode off");
+        config = StibConfig::defaults();
+        return false;
+    } else if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error reading STIB config: %s", esp_err_to_name(ret));
+        config = StibConfig::defaults();
+        return false;
+    }
+
+    if (size != sizeof(config) || !config.is_valid()) {
+        ESP_LOGW(TAG, "Stored STIB config invalid, direct mode off");
+        config = StibConfig::defaults();
+        return false;
+    }
+    return true;
+}
+
+bool StorageManager::save_layout_id(const char* id) {
+    if (!initialized_) {
+        ESP_LOGE(TAG, "Storage manager not initialized");
+        return false;
+    }
+
+    esp_err_t ret = nvs_set_str(nvs_handle_, NVS_LAYOUT_ID, id);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error saving layout ID: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    ret = nvs_commit(nvs_handle_);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing layout ID: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Layout ID saved: %s", id);
+    return true;
+}
+
+bool StorageManager::load_layout_id(char* id) {
+    id[0] = '\0';
+    if (!initialized_) {
+        ESP_LOGE(TAG, "Storage manager not initialized");
+        return false;
+    }
+
+    size_t size = LAYOUT_ID_SIZE;
+    esp_err_t ret = nvs_get_str(nvs_handle_, NVS_LAYOUT_ID, id, &size);
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGD(TAG, "No layout ID in NVS");
+        return false;
+    } else if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error reading layout ID: %s", esp_err_to_name(ret));
+        id[0] = '\0';
+        return false;
+    }
+
+    if (!layout_id_is_valid(id)) {
+        ESP_LOGW(TAG, "Stored layout ID invalid, registering again");
+        id[0] = '\0';
+        return false;
+    }
+    return true;
+}
+
+bool StorageManager::clear_layout_id() {
+    if (!initialized_) {
+        ESP_LOGE(TAG, "Storage manager not initialized");
+        return false;
+    }
+
+    esp_err_t ret = nvs_erase_key(nvs_handle_, NVS_LAYOUT_ID);
+    if (ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Error erasing layout ID: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    ret = nvs_commit(nvs_handle_);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing erase: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Layout ID cleared");
+    return true;
+}
@@ -4,11 +4,19 @@
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "esp_log.h"
+#include "display_topology.h"
+#include "poll_scheduler.h"
+#include "stib_config.h"
+#include "layout_id.h"
 #include <string>
 
 #define NVS_NAMESPACE "bus_display"
 #define NVS_WIFI_SSID "wifi_ssid"
 #define NVS_WIFI_PASSWORD "wifi_password"
+#define NVS_TOPOLOGY "topology"
+#define NVS_POLL_PROFILE "poll_profile"
+#define NVS_STIB_CONFIG "stib_config"
+#define NVS_LAYOUT_ID "layout_id"
 
 class StorageManager {
 public:
@@ -20,6 +28,23 @@ public:
     bool load_wifi_credentials(std::string& ssid, std::string& password);
     bool clear_wifi_credentials();
     bool has_wifi_credentials();
+
+    // Display chain layout, falls back to DisplayTopology::defaults() when absent
+    bool save_topology(const DisplayTopology& topology);
+    bool load_topology(DisplayTopology& topology);
+
+    // Poll interval by hour, falls back to PollProfile::defaults() when absent
+    bool save_poll_profile(const PollProfile& profile);
+    bool load_poll_profile(PollProfile& profile);
+
+    // Direct STIB mode (API key and stop table), disabled when absent
+    bool save_stib_config(const StibConfig& config);
+    bool load_stib_config(StibConfig& config);
+
+    // Layout ID the server assigned (LAYOUT_ID_SIZE bytes), empty when absent
+    bool save_layout_id(const char* id);
+    bool load_layout_id(char* id);
+    bool clear_layout_id();
     
 private:
     nvs_handle_t nvs_handle_;
@@ -0,0 +1,514 @@
+// strips_parser.cpp
+#include "strips_parser.h"
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <strings.h>
+
+void StripsParser::reset() {
+    state_ = ST_VALUE;
+    literal_next_ = ST_AFTER_VALUE;
+    depth_ = 0;
+    key_ = KEY_OTHER;
+    string_is_key_ = false;
+    key_len_ = 0;
+    key_overflow_ = false;
+    unicode_left_ = 0;
+    number_len_ = 0;
+    literal_ = nullptr;
+    literal_pos_ = 0;
+    strips_seen_ = false;
+    h_seen_ = h_valid_ = v_seen_ = v_valid_ = fx_seen_ = false;
+    h_ = 0;
+    mask_ = 0;
+    value_index_ = 0;
+    effects_start_ = 0;
+    i_seen_ = p_seen_ = on_seen_ = o_seen_ = false;
+    i_valid_ = p_valid_ = on_valid_ = o_valid_ = false;
+    i_ = p_ = on_ = o_ = 0;
+    strip_count_ = 0;
+    effect_count_ = 0;
+    strips_dropped_ = 0;
+    effects_dropped_ = 0;
+}
+
+bool StripsParser::feed(const char* data, size_t length) {
+    for (size_t n = 0; n < length; n++) {
+        if (state_ == ST_DONE) {
+            return true;
+        }
+        if (!step(data[n])) {
+            state_ = ST_ERROR;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool StripsParser::step(char c) {
+    const unsigned char uc = (unsigned char)c;
+
+    switch (state_) {
+        case ST_STRING:
+            if (c == '"') {
+                if (string_is_key_) {
+                    end_key();
+                    state_ = ST_COLON;
+                } else {
+                    scalar_value(SCALAR_OTHER, 0);
+                }
+            } else if (c == '\\') {
+                state_ = ST_STRING_ESCAPE;
+            } else if (c == '\0') {
+                return false;
+            } else if (string_is_key_) {
+                if (key_len_ < STRIPS_PARSER_KEY_SIZE - 1) {
+                    key_buf_[key_len_++] = c;
+                } else {
+                    key_overflow_ = true;
+                }
+            }
+            return true;
+
+        case ST_STRING_ESCAPE:
+            switch (c) {
+                case '"': case '\\': case '/':
+                case 'b': case 'f': case 'n': case 'r': case 't':
+                    key_overflow_ = true;   // none of the schema keys is escaped
+                    state_ = ST_STRING;
+                    return true;
+                case 'u':
+                    key_overflow_ = true;
+                    unicode_left_ = 4;
+                    state_ = ST_STRING_UNICODE;
+                    return true;
+                default:
+                    return false;
+            }
+
+        case ST_STRING_UNICODE:
+            if (!isxdigit(uc)) {
+                return false;
+            }
+            if (--unicode_left_ == 0) {
+                state_ = ST_STRING;
+            }
+            return true;
+
+        case ST_NUMBER:
+            if (isdigit(uc) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') {
+                if (number_len_ >= STRIPS_PARSER_NUMBER_SIZE - 1) {
+                    return false;
+                }
+                number_buf_[number_len_++] = c;
+                return true;
+            }
+            if (!end_number()) {
+                return false;
+            }
+            return step(c);     // the delimiter belongs to the enclosing container
+
+        case ST_LITERAL:
+            if (c != literal_[literal_pos_]) {
+                return false;
+            }
+            if (literal_[++literal_pos_] == '\0') {
+                scalar_value(literal_[0] == 't' ? SCALAR_TRUE : SCALAR_OTHER, 0);
+            }
+            return true;
+
+        case ST_DONE:
+            return true;
+
+        case ST_ERROR:
+            return false;
+
+        default:
+            break;
+    }
+
+    // Structural states: everything up to the space is whitespace, like cJSON
+    if (uc <= ' ') {
+        return uc != 0;
+    }
+
+    switch (state_) {
+        case ST_VALUE:
+            return begin_value(c);
+
+        case ST_VALUE_OR_END:
+            return c == ']' ? close_container(false) : begin_value(c);
+
+        case ST_KEY_OR_END:
+            if (c == '}') {
+                return close_container(true);
+            }
+            // fall through
+        case ST_KEY:
+            if (c != '"') {
+                return false;
+            }
+            string_is_key_ = true;
+            key_len_ = 0;
+            key_overflow_ = false;
+            state_ = ST_STRING;
+            return true;
+
+        case ST_COLON:
+            if (c != ':') {
+                return false;
+            }
+            state_ = ST_VALUE;
+            return true;
+
+        case ST_AFTER_VALUE:
+            if (c == ',') {
+                state_ = stack_[depth_ - 1].is_object ? ST_KEY : ST_VALUE;
+                return true;
+            }
+            if (c == '}' || c == ']') {
+                return close_container(c == '}');
+            }
+            return false;
+
+        default:
+            return false;
+    }
+}
+
+bool StripsParser::begin_value(char c) {
+    if (depth_ == 0 && c != '{') {
+        return false;   // the payload is always an object
+    }
+
+    switch (c) {
+        case '{':
+            return open_container(true);
+        case '[':
+            return open_container(false);
+        case '"':
+            string_is_key_ = false;
+            state_ = ST_STRING;
+            return true;
+        case 't':
+            literal_ = "true";
+            break;
+        case 'f':
+            literal_ = "false";
+            break;
+        case 'n':
+            literal_ = "null";
+            break;
+        default:
+            if (c == '-' || isdigit((unsigned char)c)) {
+                number_buf_[0] = c;
+                number_len_ = 1;
+                state_ = ST_NUMBER;
+                return true;
+            }
+            return false;
+    }
+
+    literal_pos_ = 1;
+    state_ = ST_LITERAL;
+    return true;
+}
+
+bool StripsParser::open_container(bool is_object) {
+    if (depth_ >= STRIPS_PARSER_MAX_DEPTH) {
+        return false;
+    }
+
+    Context context = CTX_OTHER;
+    switch (parent_context()) {
+        case CTX_OTHER:
+            if (depth_ == 0) {
+                context = CTX_ROOT;
+            }
+            break;
+
+        case CTX_ROOT:
+            if (key_ == KEY_STRIPS && !strips_seen_) {
+                strips_seen_ = true;
+                context = is_object ? CTX_OTHER : CTX_STRIPS;
+            }
+            break;
+
+        case CTX_STRIPS:
+            if (is_object) {
+                context = CTX_STRIP;
+                h_seen_ = h_valid_ = v_seen_ = v_valid_ = fx_seen_ = false;
+                mask_ = 0;
+                value_index_ = 0;
+                effects_start_ = effect_count_;
+            }
+            break;
+
+        case CTX_STRIP:
+            if (key_ == KEY_H) {
+                h_seen_ = true;     // not a number
+            } else if (key_ == KEY_V && !v_seen_) {
+                v_seen_ = true;
+                v_valid_ = !is_object;
+                context = is_object ? CTX_OTHER : CTX_VALUES;
+            } else if (key_ == KEY_FX && !fx_seen_) {
+                fx_seen_ = true;
+                context = is_object ? CTX_OTHER : CTX_FX;
+            }
+            break;
+
+        case CTX_VALUES:
+            if (value_index_ < UINT16_MAX) {
+                value_index_++;     // an unlit element
+            }
+            break;
+
+        case CTX_FX:
+            if (is_object) {
+                context = CTX_EFFECT;
+                i_seen_ = p_seen_ = on_seen_ = o_seen_ = false;
+                i_valid_ = p_valid_ = on_valid_ = o_valid_ = false;
+            }
+            break;
+
+        case CTX_EFFECT:
+            scalar_value(SCALAR_OTHER, 0);  // marks the key as seen, not numeric
+            break;
+    }
+
+    stack_[depth_].context = context;
+    stack_[depth_].is_object = is_object;
+    depth_++;
+    state_ = is_object ? ST_KEY_OR_END : ST_VALUE_OR_END;
+    return true;
+}
+
+bool StripsParser::close_container(bool is_object) {
+    if (depth_ == 0 || stack_[depth_ - 1].is_object != is_object) {
+        return false;
+    }
+
+    const Context context = stack_[--depth_].context;
+    if (context == CTX_STRIP) {
+        commit_strip();
+    } else if (context == CTX_EFFECT) {
+        commit_effect();
+    }
+
+    if (depth_ == 0) {
+        state_ = ST_DONE;
+    } else {
+        end_value();
+    }
+    return true;
+}
+
+void StripsParser::end_key() {
+    key_buf_[key_len_] = '\0';
+    key_ = KEY_OTHER;
+    if (key_overflow_) {
+        return;
+    }
+
+    static const struct { const char* name; Key key; } KEYS[] = {
+        {"strips", KEY_STRIPS}, {"h", KEY_H}, {"v", KEY_V}, {"fx", KEY_FX},
+        {"i", KEY_I}, {"p", KEY_P}, {"on", KEY_ON}, {"o", KEY_O},
+    };
+    for (const auto& k : KEYS) {
+        if (strcasecmp(key_buf_, k.name) == 0) {
+            key_ = k.key;
+            return;
+        }
+    }
+}
+
+bool StripsParser::end_number() {
+    number_buf_[number_len_] = '\0';
+    char* end = nullptr;
+    double number = strtod(number_buf_, &end);
+    if (end != number_buf_ + number_len_) {
+        return false;
+    }
+    scalar_value(SCALAR_NUMBER, to_valueint(number));
+    return true;
+}
+
+void StripsParser::scalar_value(Scalar type, int value) {
+    const bool number = type == SCALAR_NUMBER;
+
+    switch (parent_context()) {
+        case CTX_ROOT:
+            if (key_ == KEY_STRIPS) {
+                strips_seen_ = true;
+            }
+            break;
+
+        case CTX_STRIP:
+            if (key_ == KEY_H && !h_seen_) {
+                h_seen_ = true;
+                h_valid_ = number;
+                h_ = value;
+            } else if (key_ == KEY_V) {
+                v_seen_ = true;
+            } else if (key_ == KEY_FX) {
+                fx_seen_ = true;
+            }
+            break;
+
+        case CTX_VALUES:
+            if (value_index_ < LEDS_PER_ROW && (type == SCALAR_TRUE || (number && value != 0))) {
+                mask_ |= (uint16_t)(1u << value_index_);
+            }
+            if (value_index_ < UINT16_MAX) {
+                value_index_++;
+            }
+            break;
+
+        case CTX_EFFECT:
+            if (key_ == KEY_I && !i_seen_) {
+                i_seen_ = true;
+                i_valid_ = number;
+                i_ = value;
+            } else if (key_ == KEY_P && !p_seen_) {
+                p_seen_ = true;
+                p_valid_ = number;
+                p_ = value;
+            } else if (key_ == KEY_ON && !on_seen_) {
+                on_seen_ = true;
+                on_valid_ = number;
+                on_ = value;
+            } else if (key_ == KEY_O && !o_seen_) {
+                o_seen_ = true;
+                o_valid_ = number;
+                o_ = value;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    // Containers call this only to record the key, they are still open
+    if (state_ == ST_STRING || state_ == ST_NUMBER || state_ == ST_LITERAL) {
+        end_value();
+    }
+}
+
+void StripsParser::end_value() {
+    state_ = ST_AFTER_VALUE;
+}
+
+void StripsParser::commit_strip() {
+    if (!h_valid_ || !v_valid_) {
+        drop_effects(SLOT_CURRENT);
+        return;
+    }
+
+    uint8_t slot;
+    if (strip_count_ < LED_MAX_ROWS) {
+        slot = strip_count_++;
+    } else {
+        // Full: keep the LED_MAX_ROWS lowest "h", like sorting everything first
+        uint8_t victim = 0;
+        for (uint8_t s = 1; s < strip_count_; s++) {
+            if (strips_[s].h > strips_[victim].h) {
+                victim = s;
+            }
+        }
+        strips_dropped_++;
+        if (h_ >= strips_[victim].h) {
+            drop_effects(SLOT_CURRENT);
+            return;
+        }
+        drop_effects(victim);
+        slot = victim;
+    }
+
+    strips_[slot].h = h_;
+    strips_[slot].mask = mask_;
+    for (uint8_t e = 0; e < effect_count_; e++) {
+        if (effects_[e].slot == SLOT_CURRENT) {
+            effects_[e].slot = slot;
+        }
+    }
+}
+
+void StripsParser::commit_effect() {
+    if (!i_valid_ || !p_valid_ || i_ < 0 || p_ <= 0) {
+        return;
+    }
+
+    // Same conversions as the cJSON path; LEDs past the row are never rendered
+    const uint8_t led = (uint8_t)i_;
+    if (led >= LEDS_PER_ROW) {
+        return;
+    }
+    if (effect_count_ >= STRIPS_PARSER_MAX_EFFECTS) {
+        effects_dropped_++;
+        return;
+    }
+
+    PendingEffect& effect = effects_[effect_count_++];
+    effect.slot = SLOT_CURRENT;
+    effect.led = led;
+    effect.period_ms = (uint16_t)(p_ < 0xFFFF ? p_ : 0xFFFF);
+    effect.on_ms = on_valid_ ? (uint16_t)(on_ < 0 ? 0 : on_ > 0xFFFF ? 0xFFFF : on_) : effect.period_ms / 2;
+    effect.phase_ms = o_valid_ ? (uint16_t)((o_ < 0 ? 0 : o_) % effect.period_ms) : 0;
+}
+
+void StripsParser::drop_effects(uint8_t slot) {
+    uint8_t kept = 0;
+    for (uint8_t e = 0; e < effect_count_; e++) {
+        if (effects_[e].slot != slot) {
+            effects_[kept++] = effects_[e];
+        }
+    }
+    effect_count_ = kept;
+}
+
+bool StripsParser::finish(Animation& out) {
+    if (state_ != ST_DONE || strip_count_ == 0) {
+        return false;
+    }
+
+    // Stable insertion sort of the slots by "h", at most LED_MAX_ROWS entries
+    uint8_t order[LED_MAX_ROWS];
+    for (uint8_t s = 0; s < strip_count_; s++) {
+        uint8_t pos = s;
+        while (pos > 0 && strips_[order[pos - 1]].h > strips_[s].h) {
+            order[pos] = order[pos - 1];
+            pos--;
+        }
+        order[pos] = s;
+    }
+
+    out.base.clear();
+    out.effect_count = 0;
+    out.vehicle_count = 0;
+    for (uint8_t r = 0; r < strip_count_; r++) {
+        out.base.rows[r] = strips_[order[r]].mask;
+    }
+    out.base.row_count = strip_count_;
+
+    for (uint8_t r = 0; r < strip_count_; r++) {
+        for (uint8_t e = 0; e < effect_count_; e++) {
+            const PendingEffect& effect = effects_[e];
+            if (effect.slot == order[r] &&
+                !out.add_effect(r, effect.led, effect.period_ms, effect.on_ms, effect.phase_ms)) {
+                effects_dropped_++;
+            }
+        }
+    }
+    return true;
+}
+
+int StripsParser::to_valueint(double number) {
+    // cJSON's valueint saturation
+    if (number >= INT_MAX) {
+        return INT_MAX;
+    }
+    if (number <= (double)INT_MIN) {
+        return INT_MIN;
+    }
+    return (int)number;
+}
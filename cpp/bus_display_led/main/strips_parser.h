@@ -0,0 +1,160 @@
+// strips_parser.h
+#pragma once
+
+#include "animation.h"
+#include "frame.h"
+#include <cstddef>
+#include <cstdint>
+
+#define STRIPS_PARSER_MAX_DEPTH 16
+#define STRIPS_PARSER_MAX_EFFECTS (ANIMATION_MAX_EFFECTS * 2)
+#define STRIPS_PARSER_KEY_SIZE 8
+#define STRIPS_PARSER_NUMBER_SIZE 32
+
+// Streaming parser for the ledstrips payload:
+//   {"strips":[{"h":0,"v":[1,0,...],"fx":[{"i":3,"p":500,"on":250,"o":0}]},...]}
+// The body is fed chunk by chunk as it comes off the socket and goes straight
+// into packed row masks: no DOM, no heap, no limit on the body size. Unknown
+// keys and values of any shape are skipped.
+//
+// Semantics follow the former cJSON path: keys match case-insensitively and
+// the first occurrence wins, strips without a numeric "h" or a "v" array are
+// skipped, rows are sorted by "h" and only the LED_MAX_ROWS lowest are kept.
+// Up to STRIPS_PARSER_MAX_EFFECTS valid effects are buffered before sorting.
+class StripsParser {
+public:
+    StripsParser() { reset(); }
+
+    // Start a new document
+    void reset();
+
+    // Consume the next chunk. Returns false once the input is malformed,
+    // further chunks are then ignored.
+    bool feed(const char* data, size_t length);
+
+    // After the last chunk: sorts the rows by "h" and writes the frame and
+    // effects to out. False when the document is incomplete, malformed or
+    // holds no usable strip.
+    bool finish(Animation& out);
+
+    bool failed() const { return state_ == ST_ERROR; }
+    size_t strip_count() const { return strip_count_; }
+    uint32_t strips_dropped() const { return strips_dropped_; }     // beyond LED_MAX_ROWS
+    uint32_t effects_dropped() const { return effects_dropped_; }   // beyond the effect buffer
+
+private:
+    enum State : uint8_t {
+        ST_VALUE,               // a value is expected
+        ST_VALUE_OR_END,        // after '['
+        ST_KEY_OR_END,          // after '{'
+        ST_KEY,                 // after ',' in an object
+        ST_COLON,
+        ST_AFTER_VALUE,         // ',' or the closing bracket
+        ST_STRING,
+        ST_STRING_ESCAPE,
+        ST_STRING_UNICODE,
+        ST_NUMBER,
+        ST_LITERAL,
+        ST_DONE,                // root closed, trailing bytes are ignored
+        ST_ERROR,
+    };
+
+    // What the container being parsed means in the schema
+    enum Context : uint8_t {
+        CTX_OTHER,              // skipped
+        CTX_ROOT,
+        CTX_STRIPS,
+        CTX_STRIP,
+        CTX_VALUES,
+        CTX_FX,
+        CTX_EFFECT,
+    };
+
+    enum Key : uint8_t {
+        KEY_OTHER,
+        KEY_STRIPS,
+        KEY_H,
+        KEY_V,
+        KEY_FX,
+        KEY_I,
+        KEY_P,
+        KEY_ON,
+        KEY_O,
+    };
+
+    enum Scalar : uint8_t { SCALAR_NUMBER, SCALAR_TRUE, SCALAR_OTHER };
+
+    struct Level {
+        Context context;
+        bool is_object;
+    };
+
+    struct Strip {
+        int h;
+        uint16_t mask;
+    };
+
+    struct PendingEffect {
+        uint8_t slot;           // index into strips_, SLOT_CURRENT while the strip is open
+        uint8_t led;
+        uint16_t period_ms;
+        uint16_t on_ms;
+        uint16_t phase_ms;
+    };
+
+    static const uint8_t SLOT_CURRENT = 0xFF;
+
+    bool step(char c);
+    bool begin_value(char c);
+    bool open_container(bool is_object);
+    bool close_container(bool is_object);
+    void end_key();
+    bool end_number();
+    void scalar_value(Scalar type, int value);
+    void end_value();
+    void commit_strip();
+    void commit_effect();
+    void drop_effects(uint8_t slot);
+    Context parent_context() const { return depth_ ? stack_[depth_ - 1].context : CTX_OTHER; }
+    static int to_valueint(double number);
+
+    State state_;
+    State literal_next_;
+    Level stack_[STRIPS_PARSER_MAX_DEPTH];
+    uint8_t depth_;
+    Key key_;
+
+    // Token scratch
+    bool string_is_key_;
+    char key_buf_[STRIPS_PARSER_KEY_SIZE];
+    uint8_t key_len_;
+    bool key_overflow_;
+    uint8_t unicode_left_;
+    char number_buf_[STRIPS_PARSER_NUMBER_SIZE];
+    uint8_t number_len_;
+    const char* literal_;
+    uint8_t literal_pos_;
+
+    // Document
+    bool strips_seen_;
+
+    // Strip being parsed
+    bool h_seen_, h_valid_, v_seen_, v_valid_, fx_seen_;
+    int h_;
+    uint16_t mask_;
+    uint16_t value_index_;
+    uint8_t effects_start_;
+
+    // Effect being parsed: first occurrence of each key, valid when numeric
+    bool i_seen_, p_seen_, on_seen_, o_seen_;
+    bool i_valid_, p_valid_, on_valid_, o_valid_;
+    int i_, p_, on_, o_;
+
+    // Result
+    Strip strips_[LED_MAX_ROWS];
+    uint8_t strip_count_;
+    PendingEffect effects_[STRIPS_PARSER_MAX_EFFECTS];
+    uint8_t effect_count_;
+    uint32_t strips_dropped_;
+    uint32_t effects_dropped_;
+};
@@ -0,0 +1,251 @@
+// timetable.cpp
+#include "timetable.h"
+#include <cstdio>
+#include <cstring>
+
+static void put_u16(uint8_t* p, uint16_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static uint16_t get_u16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static void put_u32(uint8_t* p, uint32_t value) {
+    put_u16(p, (uint16_t)value);
+    put_u16(p + 2, (uint16_t)(value >> 16));
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static size_t align4(size_t size) {
+    return (size + 3) & ~(size_t)3;
+}
+
+static size_t trips_size(size_t trip_count) {
+    return 4 + 2 * (trip_count - 1);
+}
+
+uint32_t timetable_crc32(const uint8_t* data, size_t length) {
+    // Bitwise: a timetable is checked once when it is mapped
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+void timetable_etag(uint32_t crc32, char* out) {
+    snprintf(out, TIMETABLE_ETAG_SIZE, "\"%08lx\"", (unsigned long)crc32);
+}
+
+size_t timetable_encoded_size(const TimetablePattern* patterns, size_t count) {
+    if (count > 0xFFFF) {
+        return 0;
+    }
+    size_t size = TIMETABLE_HEADER_SIZE + count * TIMETABLE_PATTERN_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        const TimetablePattern& pattern = patterns[i];
+        if (pattern.stop_count < 2 || pattern.trip_count == 0) {
+            return 0;
+        }
+        uint32_t span_s = 0;
+        for (size_t s = 1; s < pattern.stop_count; s++) {
+            span_s += pattern.stops[s].run_s;
+        }
+        if (span_s > 0xFFFF) {
+            return 0;
+        }
+        for (size_t t = 1; t < pattern.trip_count; t++) {
+            if (pattern.departures[t] < pattern.departures[t - 1] ||
+                pattern.departures[t] - pattern.departures[t - 1] > 0xFFFF) {
+                return 0;
+            }
+        }
+        size += pattern.stop_count * TIMETABLE_STOP_SIZE + align4(trips_size(pattern.trip_count));
+    }
+    return size;
+}
+
+size_t timetable_encode(const TimetablePattern* patterns, size_t count, uint32_t built_s, uint32_t valid_until_s,
+                        uint8_t row_count, uint8_t* out, size_t capacity) {
+    const size_t size = timetable_encoded_size(patterns, count);
+    if (size == 0 || size > capacity) {
+        return 0;
+    }
+    memset(out, 0, size);
+    put_u32(out, TIMETABLE_MAGIC);
+    put_u32(out + 8, (uint32_t)size);
+    out[12] = TIMETABLE_VERSION;
+    out[13] = row_count;
+    put_u16(out + 14, (uint16_t)count);
+    put_u32(out + 16, built_s);
+    put_u32(out + 20, valid_until_s);
+
+    size_t offset = TIMETABLE_HEADER_SIZE + count * TIMETABLE_PATTERN_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        const TimetablePattern& pattern = patterns[i];
+        uint8_t* entry = out + TIMETABLE_HEADER_SIZE + i * TIMETABLE_PATTERN_SIZE;
+        uint32_t span_s = 0;
+        for (size_t s = 0; s < pattern.stop_count; s++) {
+            uint8_t* stop = out + offset + s * TIMETABLE_STOP_SIZE;
+            const uint16_t run_s = s ? pattern.stops[s].run_s : 0;
+            put_u32(stop, pattern.stops[s].point_id);
+            put_u16(stop + 4, pattern.stops[s].slot);
+            put_u16(stop + 6, run_s);
+            span_s += run_s;
+        }
+        put_u16(entry, pattern.line);
+        entry[2] = pattern.days & TIMETABLE_ALL_DAYS;
+        entry[3] = pattern.stop_count;
+        put_u16(entry + 4, pattern.trip_count);
+        put_u16(entry + 6, (uint16_t)span_s);
+        put_u32(entry + 8, (uint32_t)offset);
+        offset += pattern.stop_count * TIMETABLE_STOP_SIZE;
+
+        put_u32(entry + 12, (uint32_t)offset);
+        put_u32(out + offset, pattern.departures[0]);
+        for (size_t t = 1; t < pattern.trip_count; t++) {
+            put_u16(out + offset + 4 + 2 * (t - 1), (uint16_t)(pattern.departures[t] - pattern.departures[t - 1]));
+        }
+        offset += align4(trips_size(pattern.trip_count));
+    }
+    put_u32(out + 4, timetable_crc32(out + 8, size - 8));
+    return size;
+}
+
+size_t Timetable::message_size(const uint8_t* data, size_t length) {
+    if (length < TIMETABLE_HEADER_SIZE || get_u32(data) != TIMETABLE_MAGIC || data[12] != TIMETABLE_VERSION) {
+        return 0;
+    }
+    const size_t size = get_u32(data + 8);
+    return size >= TIMETABLE_HEADER_SIZE ? size : 0;
+}
+
+bool Timetable::attach(const uint8_t* data, size_t capacity) {
+    detach();
+    const size_t size = message_size(data, capacity);
+    if (size == 0 || size > capacity || timetable_crc32(data + 8, size - 8) != get_u32(data + 4)) {
+        return false;
+    }
+
+    // Past this check predict() reads without bounds checks
+    const size_t count = get_u16(data + 14);
+    if (data[13] > LED_MAX_ROWS || TIMETABLE_HEADER_SIZE + count * TIMETABLE_PATTERN_SIZE > size) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* entry = data + TIMETABLE_HEADER_SIZE + i * TIMETABLE_PATTERN_SIZE;
+        const size_t stop_count = entry[3];
+        const size_t trip_count = get_u16(entry + 4);
+        const size_t stops = get_u32(entry + 8);
+        const size_t trips = get_u32(entry + 12);
+        if (stop_count < 2 || trip_count == 0 || (stops | trips) & 3 ||
+            stops > size || stop_count * TIMETABLE_STOP_SIZE > size - stops ||
+            trips > size || trips_size(trip_count) > size - trips) {
+            return false;
+        }
+        uint32_t span_s = 0;
+        for (size_t s = 1; s < stop_count; s++) {
+            span_s += get_u16(data + stops + s * TIMETABLE_STOP_SIZE + 6);
+        }
+        if (span_s != get_u16(entry + 6)) {
+            return false;
+        }
+    }
+
+    data_ = data;
+    size_ = size;
+    return true;
+}
+
+uint32_t Timetable::built_s() const {
+    return data_ ? get_u32(data_ + 16) : 0;
+}
+
+uint32_t Timetable::valid_until_s() const {
+    return data_ ? get_u32(data_ + 20) : 0;
+}
+
+uint8_t Timetable::row_count() const {
+    return data_ ? data_[13] : 0;
+}
+
+uint16_t Timetable::pattern_count() const {
+    return data_ ? get_u16(data_ + 14) : 0;
+}
+
+uint32_t Timetable::crc32() const {
+    return data_ ? get_u32(data_ + 4) : 0;
+}
+
+uint32_t Timetable::trip_count() const {
+    uint32_t trips = 0;
+    for (size_t i = 0; i < pattern_count(); i++) {
+        trips += get_u16(data_ + TIMETABLE_HEADER_SIZE + i * TIMETABLE_PATTERN_SIZE + 4);
+    }
+    return trips;
+}
+
+size_t Timetable::predict(int weekday, int32_t second_of_day, const StibConfig* config, Frame& out) const {
+    out.clear();
+    if (!data_) {
+        return 0;
+    }
+    out.row_count = config ? config->row_count() : row_count();
+
+    size_t lit = 0;
+    for (size_t i = 0; i < pattern_count(); i++) {
+        const uint8_t* entry = data_ + TIMETABLE_HEADER_SIZE + i * TIMETABLE_PATTERN_SIZE;
+        const uint16_t line = get_u16(entry);
+        const uint8_t days = entry[2];
+        const size_t stop_count = entry[3];
+        const size_t trip_count = get_u16(entry + 4);
+        const uint32_t span_s = get_u16(entry + 6);
+        const uint8_t* stops = data_ + get_u32(entry + 8);
+        const uint8_t* trips = data_ + get_u32(entry + 12);
+
+        // Today's service, then yesterday's past midnight
+        for (int back = 0; back < 2; back++) {
+            if (!(days & (1 << ((weekday + 7 - back) % 7)))) {
+                continue;
+            }
+            const int32_t now_s = second_of_day + back * 86400;
+            int32_t departure = (int32_t)get_u32(trips);
+            for (size_t t = 0; t < trip_count; t++) {
+                if (t) {
+                    departure += get_u16(trips + 4 + 2 * (t - 1));
+                }
+                if (departure > now_s) {
+                    break;
+                }
+                const uint32_t elapsed_s = (uint32_t)(now_s - departure);
+                if (elapsed_s > span_s) {
+                    continue;   // arrived
+                }
+
+                // Last stop passed
+                size_t s = 0;
+                uint32_t at_s = 0;
+                while (s + 1 < stop_count && at_s + get_u16(stops + (s + 1) * TIMETABLE_STOP_SIZE + 6) <= elapsed_s) {
+                    s++;
+                    at_s += get_u16(stops + s * TIMETABLE_STOP_SIZE + 6);
+                }
+                const uint8_t* stop = stops + s * TIMETABLE_STOP_SIZE;
+                const int slot = config ? config->find(line, get_u32(stop)) :
+                                 get_u16(stop + 4) == TIMETABLE_NO_SLOT ? -1 : get_u16(stop + 4);
+                if (slot >= 0 && slot / LEDS_PER_ROW < out.row_count) {
+                    out.set_led(slot / LEDS_PER_ROW, slot % LEDS_PER_ROW, true);
+                    lit++;
+                }
+            }
+        }
+    }
+    return lit;
+}
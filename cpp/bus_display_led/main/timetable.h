@@ -0,0 +1,123 @@
+// timetable.h
+#pragma once
+
+#include "frame.h"
+#include "stib_config.h"
+#include <cstddef>
+#include <cstdint>
+
+// Scheduled service of the display's lines, shown when live data is too old
+// (Wi-Fi or server down). Built on the server from the GTFS feed for one
+// display, stored as is in flash and read in place through a memory map, so
+// it is never copied to RAM. Shared with the host tools (cpp/host), so keep
+// it free of ESP-IDF dependencies.
+//
+// A pattern is a run of trips of one line that stop at the same stops with
+// the same running times on the same days, e.g. a direction's off-peak
+// trips on weekdays. Peak trips with longer running times are another
+// pattern.
+//
+//   u32 magic              TIMETABLE_MAGIC
+//   u32 crc32              of every byte after this field, up to size
+//   u32 size               of the whole message
+//   u8  version            TIMETABLE_VERSION
+//   u8  row_count          rows the slots span
+//   u16 pattern_count
+//   u32 built_s            server clock when built, seconds since the epoch
+//   u32 valid_until_s      end of the feed's calendar, 0 when open ended
+//   pattern table          TIMETABLE_PATTERN_SIZE bytes per pattern:
+//                          u16 line, u8 days (bit 0 Monday ... bit 6
+//                          Sunday), u8 stop_count (>= 2), u16 trip_count
+//                          (>= 1), u16 span_s (first to last stop),
+//                          u32 stops_offset, u32 trips_offset
+//   stops                  at stops_offset, per stop: u32 point_id,
+//                          u16 slot (row * LEDS_PER_ROW + led, or
+//                          TIMETABLE_NO_SLOT), u16 run_s from the stop before
+//                          (0 for the first)
+//   trips                  at trips_offset: u32 first departure from the
+//                          first stop in seconds after midnight of the
+//                          service day (past 24 h for trips after midnight),
+//                          then a u16 gap in seconds to each next departure
+//
+// Offsets are from the start of the message and 4-byte aligned.
+// Multi-byte fields are little endian.
+//
+// Servers tag a timetable with its crc32 (timetable_etag()), so a device
+// asks with If-None-Match for what it holds in flash, also after a reboot.
+#define TIMETABLE_CONTENT_TYPE "application/vnd.trillet.timetable"
+#define TIMETABLE_MAGIC 0x31425454      // "TTB1"
+#define TIMETABLE_VERSION 1
+#define TIMETABLE_HEADER_SIZE 24
+#define TIMETABLE_PATTERN_SIZE 16
+#define TIMETABLE_STOP_SIZE 8
+#define TIMETABLE_NO_SLOT 0xFFFF
+#define TIMETABLE_ALL_DAYS 0x7F
+#define TIMETABLE_ETAG_SIZE 11          // quoted 8 hex digits and the terminator
+
+// One stop of a pattern, for encoding
+struct TimetableStop {
+    uint32_t point_id;
+    uint16_t slot;          // TIMETABLE_NO_SLOT when not on the display
+    uint16_t run_s;         // from the previous stop, 0 for the first
+};
+
+struct TimetablePattern {
+    uint16_t line;
+    uint8_t days;           // bit 0 Monday ... bit 6 Sunday
+    uint8_t stop_count;
+    const TimetableStop* stops;
+    uint16_t trip_count;
+    const uint32_t* departures;     // ascending, seconds after service-day midnight
+};
+
+// Encoded size of the patterns, 0 when one cannot be encoded (fewer than
+// two stops, no trips, departures out of order or more than a u16 gap apart)
+size_t timetable_encoded_size(const TimetablePattern* patterns, size_t count);
+
+// Encodes a timetable message. Returns its size, 0 when capacity is too
+// small or a pattern cannot be encoded.
+size_t timetable_encode(const TimetablePattern* patterns, size_t count, uint32_t built_s, uint32_t valid_until_s,
+                        uint8_t row_count, uint8_t* out, size_t capacity);
+
+// Standard CRC-32 (IEEE, reflected), as zlib computes it
+uint32_t timetable_crc32(const uint8_t* data, size_t length);
+
+// Quoted ETag of a timetable with that crc32
+void timetable_etag(uint32_t crc32, char* out);
+
+// Read-only view of a message in place, e.g. in memory-mapped flash
+class Timetable {
+public:
+    Timetable() : data_(nullptr), size_(0) {}
+
+    // Size in a message header, 0 when length bytes are not the start of a
+    // message. Tells how much to map before attach().
+    static size_t message_size(const uint8_t* data, size_t length);
+
+    // Checks the whole message (CRC, every offset and count) and keeps a
+    // pointer to it: data must stay valid while attached. False, detached,
+    // when it is not a valid message of at most capacity bytes.
+    bool attach(const uint8_t* data, size_t capacity);
+    void detach() { data_ = nullptr; size_ = 0; }
+    bool is_valid() const { return data_ != nullptr; }
+
+    size_t size() const { return size_; }
+    uint32_t built_s() const;
+    uint32_t valid_until_s() const;
+    uint8_t row_count() const;
+    uint16_t pattern_count() const;
+    uint32_t trip_count() const;
+    uint32_t crc32() const;
+
+    // Lights in out the LED of the last stop each vehicle passed by the
+    // schedule, local time weekday (0 Monday) and second_of_day. Trips of
+    // the previous service day still running after midnight are included.
+    // With config the stops are looked up by line and point ID as in direct
+    // mode, otherwise the slots the server resolved are used. Returns the
+    // number of vehicles lit.
+    size_t predict(int weekday, int32_t second_of_day, const StibConfig* config, Frame& out) const;
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+};
@@ -0,0 +1,146 @@
+// timetable_store.cpp
+#include "timetable_store.h"
+
+const char* TimetableStore::TAG = "TIMETABLE";
+
+TimetableStore::TimetableStore()
+    : partition_(nullptr), slot_size_(0), slot_(-1), handle_(0), data_(nullptr),
+      writing_(false), written_(0), erased_(0) {
+}
+
+TimetableStore::~TimetableStore() {
+    unmap();
+}
+
+bool TimetableStore::mount() {
+    partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS,
+                                          TIMETABLE_PARTITION_LABEL);
+    if (!partition_) {
+        ESP_LOGW(TAG, "No %s partition, no offline timetable", TIMETABLE_PARTITION_LABEL);
+        return false;
+    }
+    slot_size_ = partition_->size / TIMETABLE_SLOT_COUNT / TIMETABLE_SLOT_ALIGN * TIMETABLE_SLOT_ALIGN;
+
+    for (int slot = 0; slot < TIMETABLE_SLOT_COUNT; slot++) {
+        const void* data;
+        esp_partition_mmap_handle_t handle;
+        Timetable timetable;
+        if (!map_slot(slot, &data, &handle, timetable)) {
+            continue;
+        }
+        if (timetable_.is_valid() && timetable.built_s() <= timetable_.built_s()) {
+            esp_partition_munmap(handle);
+            continue;
+        }
+        unmap();
+        slot_ = slot;
+        handle_ = handle;
+        data_ = data;
+        timetable_ = timetable;
+    }
+
+    if (timetable_.is_valid()) {
+        ESP_LOGI(TAG, "Timetable in slot %d: %lu bytes, %d patterns, %lu trips", slot_,
+                 (unsigned long)timetable_.size(), timetable_.pattern_count(), (unsigned long)timetable_.trip_count());
+    } else {
+        ESP_LOGI(TAG, "No timetable stored yet (%lu KB per slot)", (unsigned long)(slot_size_ / 1024));
+    }
+    return true;
+}
+
+bool TimetableStore::map_slot(int slot, const void** data, esp_partition_mmap_handle_t* handle,
+                              Timetable& timetable) {
+    uint8_t header[TIMETABLE_HEADER_SIZE];
+    if (esp_partition_read(partition_, slot * slot_size_, header, sizeof(header)) != ESP_OK) {
+        return false;
+    }
+    const size_t size = Timetable::message_size(header, sizeof(header));
+    if (size == 0 || size > slot_size_) {
+        return false;
+    }
+    if (esp_partition_mmap(partition_, slot * slot_size_, size, ESP_PARTITION_MMAP_DATA, data, handle) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to map slot %d", slot);
+        return false;
+    }
+    if (!timetable.attach(static_cast<const uint8_t*>(*data), size)) {
+        ESP_LOGW(TAG, "Timetable in slot %d is corrupt", slot);
+        esp_partition_munmap(*handle);
+        return false;
+    }
+    return true;
+}
+
+void TimetableStore::unmap() {
+    timetable_.detach();
+    if (data_) {
+        esp_partition_munmap(handle_);
+        data_ = nullptr;
+    }
+    slot_ = -1;
+}
+
+bool TimetableStore::begin() {
+    if (!partition_) {
+        return false;
+    }
+    writing_ = true;
+    written_ = 0;
+    erased_ = 0;
+    return true;
+}
+
+bool TimetableStore::write(const char* data, size_t length) {
+    if (!writing_) {
+        return false;
+    }
+    if (written_ + length > slot_size_) {
+        ESP_LOGW(TAG, "Timetable larger than %lu KB", (unsigned long)(slot_size_ / 1024));
+        writing_ = false;
+        return false;
+    }
+
+    const size_t base = (slot_ == 0 ? 1 : 0) * slot_size_;
+    while (erased_ < written_ + length) {
+        if (esp_partition_erase_range(partition_, base + erased_, TIMETABLE_SECTOR_SIZE) != ESP_OK) {
+            writing_ = false;
+            return false;
+        }
+        erased_ += TIMETABLE_SECTOR_SIZE;
+    }
+    if (esp_partition_write(partition_, base + written_, data, length) != ESP_OK) {
+        ESP_LOGE(TAG, "Flash write failed at %lu", (unsigned long)written_);
+        writing_ = false;
+        return false;
+    }
+    written_ += length;
+    return true;
+}
+
+bool TimetableStore::commit() {
+    if (!writing_) {
+        return false;
+    }
+    writing_ = false;
+
+    const int slot = slot_ == 0 ? 1 : 0;
+    const void* data;
+    esp_partition_mmap_handle_t handle;
+    Timetable timetable;
+    const bool mapped = map_slot(slot, &data, &handle, timetable);
+    if (!mapped || timetable.size() != written_) {
+        if (mapped) {
+            esp_partition_munmap(handle);
+        }
+        ESP_LOGW(TAG, "Downloaded timetable invalid (%lu bytes), keeping the current one", (unsigned long)written_);
+        return false;
+    }
+
+    unmap();
+    slot_ = slot;
+    handle_ = handle;
+    data_ = data;
+    timetable_ = timetable;
+    ESP_LOGI(TAG, "Timetable updated in slot %d: %lu bytes, %d patterns, %lu trips", slot_,
+             (unsigned long)timetable_.size(), timetable_.pattern_count(), (unsigned long)timetable_.trip_count());
+    return true;
+}
@@ -0,0 +1,61 @@
+// timetable_store.h
+#pragma once
+
+#include "timetable.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+
+// The "spiffs" data partition of partitions.csv, used raw: no file system
+// is mounted on it
+#define TIMETABLE_PARTITION_LABEL "spiffs"
+#define TIMETABLE_SLOT_COUNT 2
+#define TIMETABLE_SLOT_ALIGN 0x10000    // MMU page, each slot maps on its own pages
+#define TIMETABLE_SECTOR_SIZE 4096
+
+// Keeps the timetable in flash and maps it into the address space, so the
+// update task reads it in place. The partition holds two slots: a download
+// goes to the slot not in use and only replaces the current timetable once
+// it checked out whole, so a failed download or a power cut leaves the
+// previous one in use. At mount the valid slot built last wins.
+//
+// Flash erases and writes stall the cache of both cores for a few ms per
+// sector, as during an OTA update. Update task only.
+class TimetableStore {
+public:
+    TimetableStore();
+    ~TimetableStore();
+
+    // Finds the partition and maps the newest valid slot. False when the
+    // partition is missing; no timetable yet is not an error.
+    bool mount();
+
+    // Empty (is_valid() false) until a timetable is stored
+    const Timetable& timetable() const { return timetable_; }
+
+    // Download into the free slot: begin(), write() as the body arrives,
+    // then commit() to switch to it, or abort(). Sectors are erased as the
+    // writes reach them.
+    bool begin();
+    bool write(const char* data, size_t length);
+    bool commit();
+    void abort() { writing_ = false; }
+    bool is_writing() const { return writing_; }
+
+private:
+    // Maps the message in slot, false (nothing mapped) when it is not valid
+    bool map_slot(int slot, const void** data, esp_partition_mmap_handle_t* handle, Timetable& timetable);
+    void unmap();
+
+    const esp_partition_t* partition_;
+    size_t slot_size_;
+    int slot_;                  // mapped slot, -1 when none
+    esp_partition_mmap_handle_t handle_;
+    const void* data_;
+    Timetable timetable_;
+
+    bool writing_;
+    size_t written_;
+    size_t erased_;             // bytes of the free slot erased so far
+
+    static const char* TAG;
+};
@@ -1,5 +1,6 @@
 // web_server.cpp
 #include "web_server.h"
+#include <cstdlib>
 #include <cstring>
 #include <sstream>
 
@@ -99,7 +100,8 @@ form {
 )";
 
 WebServer::WebServer(WiFiManager& wifi_manager) 
-    : wifi_manager_(wifi_manager), ota_manager_(nullptr), server_(nullptr) {
+    : wifi_manager_(wifi_manager), ota_manager_(nullptr), display_task_(nullptr),
+      storage_manager_(nullptr), led_controller_(nullptr), led_updater_(nullptr), server_(nullptr) {
 }
 
 WebServer::~WebServer() {
@@ -167,6 +169,38 @@ bool WebServer::start() {
     };
     httpd_register_uri_handler(server_, &ota_check_uri);
     
+    httpd_uri_t topology_uri = {
+        .uri = "/topology",
+        .method = HTTP_POST,
+        .handler = topology_handler,
+        .user_ctx = this
+    };
+    httpd_register_uri_handler(server_, &topology_uri);
+
+    httpd_uri_t stats_uri = {
+        .uri = "/stats",
+        .method = HTTP_GET,
+        .handler = stats_handler,
+        .user_ctx = this
+    };
+    httpd_register_uri_handler(server_, &stats_uri);
+
+    httpd_uri_t poll_profile_uri = {
+        .uri = "/poll_profile",
+        .method = HTTP_POST,
+        .handler = poll_profile_handler,
+        .user_ctx = this
+    };
+    httpd_register_uri_handler(server_, &poll_profile_uri);
+
+    httpd_uri_t stib_uri = {
+        .uri = "/stib",
+        .method = HTTP_POST,
+        .handler = stib_handler,
+        .user_ctx = this
+    };
+    httpd_register_uri_handler(server_, &stib_uri);
+    
     ESP_LOGI(TAG, "HTTP server started successfully");
     return true;
 }
@@ -305,6 +339,144 @@ esp_err_t WebServer::ota_check_handler(httpd_req_t *req) {
     return ESP_OK;
 }
 
+esp_err_t WebServer::stats_handler(httpd_req_t *req) {
+    WebServer* server = static_cast<WebServer*>(req->user_ctx);
+
+    if (!server->led_controller_) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "LED controller not available");
+        return ESP_FAIL;
+    }
+
+    std::string response = server->generate_stats_json();
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, response.c_str(), response.length());
+    return ESP_OK;
+}
+
+esp_err_t WebServer::topology_handler(httpd_req_t *req) {
+    WebServer* server = static_cast<WebServer*>(req->user_ctx);
+    
+    if (!server->display_task_ || !server->storage_manager_) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Display not available");
+        return ESP_FAIL;
+    }
+    
+    char buf[512];
+    int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
+    if (ret <= 0) {
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+            httpd_resp_send_408(req);
+        }
+        return ESP_FAIL;
+    }
+    buf[ret] = '\0';
+    
+    ESP_LOGI(WebServer::TAG, "Received topology: %s", buf);
+    
+    DisplayTopology topology;
+    if (!server->parse_topology(std::string(buf), topology)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid topology");
+        return ESP_FAIL;
+    }
+    
+    server->storage_manager_->save_topology(topology);
+    server->display_task_->set_topology(topology);
+    
+    // Redirect back to main page
+    httpd_resp_set_status(req, "302 Found");
+    httpd_resp_set_hdr(req, "Location", "/");
+    httpd_resp_send(req, nullptr, 0);
+    
+    return ESP_OK;
+}
+
+esp_err_t WebServer::poll_profile_handler(httpd_req_t *req) {
+    WebServer* server = static_cast<WebServer*>(req->user_ctx);
+    
+    if (!server->led_updater_ || !server->storage_manager_) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Updater not available");
+        return ESP_FAIL;
+    }
+    
+    char buf[512];
+    int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
+    if (ret <= 0) {
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+            httpd_resp_send_408(req);
+        }
+        return ESP_FAIL;
+    }
+    buf[ret] = '\0';
+    
+    ESP_LOGI(WebServer::TAG, "Received poll profile: %s", buf);
+    
+    PollProfile profile;
+    if (!server->parse_poll_profile(std::string(buf), profile)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid poll profile");
+        return ESP_FAIL;
+    }
+    
+    server->storage_manager_->save_poll_profile(profile);
+    server->led_updater_->set_poll_profile(profile);
+    
+    // Redirect back to main page
+    httpd_resp_set_status(req, "302 Found");
+    httpd_resp_set_hdr(req, "Location", "/");
+    httpd_resp_send(req, nullptr, 0);
+    
+    return ESP_OK;
+}
+
+esp_err_t WebServer::stib_handler(httpd_req_t *req) {
+    WebServer* server = static_cast<WebServer*>(req->user_ctx);
+    
+    if (!server->led_updater_ || !server->storage_manager_) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Updater not available");
+        return ESP_FAIL;
+    }
+    
+    // A full stop table is a few KB of form data
+    if (req->content_len > STIB_FORM_MAX) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Form too large");
+        return ESP_FAIL;
+    }
+    std::string data(req->content_len, '\0');
+    size_t received = 0;
+    while (received < req->content_len) {
+        int ret = httpd_req_recv(req, &data[received], req->content_len - received);
+        if (ret <= 0) {
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+                httpd_resp_send_408(req);
+            }
+            return ESP_FAIL;
+        }
+        received += ret;
+    }
+    
+    // The API key is not logged
+    ESP_LOGI(WebServer::TAG, "Received STIB config (%d bytes)", (int)received);
+    
+    // Starts from the stored config, which keeps the key when none is entered
+    StibConfig* config = new StibConfig();
+    server->storage_manager_->load_stib_config(*config);
+    if (!server->parse_stib_config(data, *config)) {
+        delete config;
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid STIB config");
+        return ESP_FAIL;
+    }
+    
+    server->storage_manager_->save_stib_config(*config);
+    server->led_updater_->set_stib_config(*config);
+    delete config;
+    
+    // Redirect back to main page
+    httpd_resp_set_status(req, "302 Found");
+    httpd_resp_set_hdr(req, "Location", "/");
+    httpd_resp_send(req, nullptr, 0);
+    
+    return ESP_OK;
+}
+
 std::string WebServer::generate_main_page() {
     std::string mac = wifi_manager_.get_mac_address();
     std::string status_html = generate_status_html();
@@ -412,7 +584,7 @@ std::string WebServer::generate_main_page() {
     
     html << R"(
     </div>
-    
+    )" << generate_topology_html() << generate_poll_profile_html() << generate_stib_html() << R"(
     <div class="register-section">
         <h2>Register this device online</h2>
         <p><b>Important:</b> Because this Wi-Fi has no internet, your phone may block the link below.</p>
@@ -442,10 +614,40 @@ std::string WebServer::generate_status_html() {
             status << "<p><strong>Last OTA Check:</strong> " << ota_status << "</p>";
         }
     }
+
+    if (led_controller_) {
+        LEDController::LEDStats stats = led_controller_->get_stats();
+        status << "<p><strong>Display:</strong> " << led_controller_->output_name() << " output, "
+               << stats.frames_pushed << " frames pushed, " << stats.frames_skipped << " skipped</p>";
+        status << "<p><strong>Push time:</strong> " << stats.push_min_us << " / " << stats.push_avg_us
+               << " / " << stats.push_max_us << " us (min/avg/max), CPU "
+               << stats.busy_permille / 10 << "." << stats.busy_permille % 10 << "%</p>";
+    }
     
     return status.str();
 }
 
+std::string WebServer::generate_stats_json() {
+    LEDController::LEDStats stats = led_controller_->get_stats();
+    std::ostringstream json;
+
+    json << "{\"output\":\"" << led_controller_->output_name() << "\""
+         << ",\"frames_pushed\":" << stats.frames_pushed
+         << ",\"frames_skipped\":" << stats.frames_skipped
+         << ",\"pushes\":" << stats.pushes
+         << ",\"push_min_us\":" << stats.push_min_us
+         << ",\"push_avg_us\":" << stats.push_avg_us
+         << ",\"push_max_us\":" << stats.push_max_us
+         << ",\"last_push_us\":" << stats.last_push_us;
+    if (stats.since_latch_ms != UINT32_MAX) {
+        json << ",\"since_latch_ms\":" << stats.since_latch_ms;
+    } else {
+        json << ",\"since_latch_ms\":null";
+    }
+    json << ",\"busy_permille\":" << stats.busy_permille << "}";
+    return json.str();
+}
+
 std::string WebServer::url_decode(const std::string& str) {
     std::string decoded;
     for (size_t i = 0; i < str.length(); ++i) {
@@ -491,4 +693,224 @@ bool WebServer::parse_post_data(const std::string& data, std::string& ssid, std:
     }
     
     return !ssid.empty();
-}
\ No newline at end of file
+}
+
+std::string WebServer::get_form_value(const std::string& data, const std::string& key) {
+    // Form data: key1=value1&key2=value2, match whole keys only
+    std::string prefix = key + "=";
+    size_t pos = 0;
+    while (pos < data.length()) {
+        size_t end = data.find('&', pos);
+        if (end == std::string::npos) {
+            end = data.length();
+        }
+        if (data.compare(pos, prefix.length(), prefix) == 0) {
+            return url_decode(data.substr(pos + prefix.length(), end - pos - prefix.length()));
+        }
+        pos = end + 1;
+    }
+    return "";
+}
+
+bool WebServer::parse_topology(const std::string& data, DisplayTopology& topology) {
+    topology = DisplayTopology::defaults();
+    
+    int registers = atoi(get_form_value(data, "regs").c_str());
+    if (registers < 1 || registers > LED_MAX_ROWS) {
+        return false;
+    }
+    topology.register_count = registers;
+    
+    std::string bits = get_form_value(data, "bits");
+    if (!bits.empty()) {
+        topology.populated_mask = (uint16_t)strtoul(bits.c_str(), nullptr, 16);
+    }
+    
+    // Row order: comma separated chain positions, identity when empty
+    std::string order = get_form_value(data, "order");
+    if (!order.empty()) {
+        std::istringstream stream(order);
+        std::string item;
+        int row = 0;
+        while (std::getline(stream, item, ',')) {
+            if (row >= registers) {
+                return false;
+            }
+            topology.row_order[row++] = (uint8_t)atoi(item.c_str());
+        }
+        if (row != registers) {
+            return false;
+        }
+    }
+    
+    return topology.is_valid();
+}
+
+std::string WebServer::generate_topology_html() {
+    if (!storage_manager_) {
+        return "";
+    }
+    
+    DisplayTopology topology;
+    storage_manager_->load_topology(topology);
+    
+    char bits[8];
+    snprintf(bits, sizeof(bits), "%04X", topology.populated_mask);
+    
+    std::ostringstream order;
+    for (int r = 0; r < topology.register_count; r++) {
+        order << (r ? "," : "") << (int)topology.row_order[r];
+    }
+    
+    std::ostringstream html;
+    html << R"(
+    <div class="ota-section">
+        <h2>Display Layout</h2>
+        <form action="/topology" method="post">
+            <label for="regs">Chained registers:</label><br>
+            <input type="text" id="regs" name="regs" value=")" << (int)topology.register_count << R"("><br><br>
+            
+            <label for="bits">Populated register bits (hex):</label><br>
+            <input type="text" id="bits" name="bits" value=")" << bits << R"("><br><br>
+            
+            <label for="order">Chain position of each row (comma separated):</label><br>
+            <input type="text" id="order" name="order" value=")" << order.str() << R"("><br><br>
+            
+            <input type="submit" value="Save layout">
+        </form>
+    </div>
+    )";
+    
+    return html.str();
+}
+
+bool WebServer::parse_poll_profile(const std::string& data, PollProfile& profile) {
+    profile = PollProfile::defaults();
+    
+    std::string fallback = get_form_value(data, "default");
+    if (!fallback.empty()) {
+        profile.default_s = (uint16_t)atoi(fallback.c_str());
+    }
+    
+    // Seconds between polls for each hour 0-23, comma separated
+    std::istringstream stream(get_form_value(data, "hours"));
+    std::string item;
+    int hour = 0;
+    while (std::getline(stream, item, ',')) {
+        if (hour >= 24) {
+            return false;
+        }
+        profile.hourly_s[hour++] = (uint16_t)atoi(item.c_str());
+    }
+    if (hour != 24) {
+        return false;
+    }
+    
+    return profile.is_valid();
+}
+
+std::string WebServer::generate_poll_profile_html() {
+    if (!storage_manager_ || !led_updater_) {
+        return "";
+    }
+    
+    PollProfile profile;
+    storage_manager_->load_poll_profile(profile);
+    
+    std::ostringstream hours;
+    for (int hour = 0; hour < 24; hour++) {
+        hours << (hour ? "," : "") << profile.hourly_s[hour];
+    }
+    
+    std::ostringstream html;
+    html << R"(
+    <div class="ota-section">
+        <h2>Service Hours</h2>
+        <form action="/poll_profile" method="post">
+            <label for="hours">Seconds between updates for each hour 0-23 (comma separated):</label><br>
+            <input type="text" id="hours" name="hours" value=")" << hours.str() << R"("><br><br>
+            
+            <label for="default">Seconds between updates until the clock is set:</label><br>
+            <input type="text" id="default" name="default" value=")" << profile.default_s << R"("><br><br>
+            
+            <input type="submit" value="Save service hours">
+        </form>
+    </div>
+    )";
+    
+    return html.str();
+}
+
+bool WebServer::parse_stib_config(const std::string& data, StibConfig& config) {
+    config.enabled = get_form_value(data, "enabled") == "on";
+    
+    std::string key = get_form_value(data, "key");
+    if (key.length() >= STIB_API_KEY_SIZE) {
+        return false;
+    }
+    if (!key.empty()) {
+        memset(config.api_key, 0, sizeof(config.api_key));
+        memcpy(config.api_key, key.c_str(), key.length());
+    }
+    
+    // One stop per line: line pointId row led
+    config.point_count = 0;
+    std::istringstream stream(get_form_value(data, "points"));
+    std::string item;
+    while (std::getline(stream, item)) {
+        unsigned line, point_id, row, led;
+        char extra;
+        if (item.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        if (sscanf(item.c_str(), "%u %u %u %u %c", &line, &point_id, &row, &led, &extra) != 4 ||
+            line > UINT16_MAX || row > UINT8_MAX || led > UINT8_MAX ||
+            !config.add_point((uint16_t)line, point_id, (uint8_t)row, (uint8_t)led)) {
+            ESP_LOGW(TAG, "Invalid stop: %s", item.c_str());
+            return false;
+        }
+    }
+    
+    return config.is_valid();
+}
+
+std::string WebServer::generate_stib_html() {
+    if (!storage_manager_ || !led_updater_) {
+        return "";
+    }
+    
+    StibConfig* config = new StibConfig();
+    storage_manager_->load_stib_config(*config);
+    
+    std::ostringstream points;
+    for (size_t i = 0; i < config->point_count; i++) {
+        points << config->lines[i] << " " << config->point_ids[i] << " "
+               << config->slots[i] / LEDS_PER_ROW << " " << config->slots[i] % LEDS_PER_ROW << "\n";
+    }
+    const bool enabled = config->enabled;
+    const bool has_key = config->api_key[0] != '\0';
+    delete config;
+    
+    std::ostringstream html;
+    html << R"(
+    <div class="ota-section">
+        <h2>Direct STIB Mode</h2>
+        <p>Polls the STIB open-data vehicle positions instead of the LED server.</p>
+        <form action="/stib" method="post">
+            <input type="checkbox" id="enabled" name="enabled")" << (enabled ? " checked" : "") << R"(>
+            <label for="enabled">Enabled</label><br><br>
+            
+            <label for="key">API key:</label><br>
+            <input type="password" id="key" name="key" placeholder=")"
+         << (has_key ? "unchanged" : "data.stib-mivb.brussels key") << R"("><br><br>
+            
+            <label for="points">Stops, one per line: line pointId row LED (rows and LEDs from 0):</label><br>
+            <textarea id="points" name="points" rows="8" cols="30">)" << points.str() << R"(</textarea><br><br>
+            
+            <input type="submit" value="Save STIB mode">
+        </form>
+    </div>
+    )";
+    
+    return html.str();
+}
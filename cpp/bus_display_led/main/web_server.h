@@ -5,9 +5,14 @@
 #include "esp_log.h"
 #include "wifi_manager.h"
 #include "ota_manager.h"
+#include "display_task.h"
+#include "storage_manager.h"
+#include "led_updater.h"
 #include <string>
 #include <functional>
 
+#define STIB_FORM_MAX 4096
+
 class WebServer {
 public:
     WebServer(WiFiManager& wifi_manager);
@@ -19,6 +24,16 @@ public:
     
     // Set OTA manager reference
     void set_ota_manager(OTAManager& ota_manager) { ota_manager_ = &ota_manager; }
+
+    // Set display references (topology configuration)
+    void set_display_task(DisplayTask& display_task) { display_task_ = &display_task; }
+    void set_storage_manager(StorageManager& storage_manager) { storage_manager_ = &storage_manager; }
+
+    // Output counters shown on the status page and served at /stats
+    void set_led_controller(const LEDController& led_controller) { led_controller_ = &led_controller; }
+
+    // Poll profile (service hours) and direct STIB mode configuration
+    void set_led_updater(LEDUpdater& led_updater) { led_updater_ = &led_updater; }
     
     // Callback for WiFi configuration
     void set_wifi_config_callback(std::function<void(const std::string&, const std::string&)> callback) {
@@ -28,6 +43,10 @@ public:
 private:
     WiFiManager& wifi_manager_;
     OTAManager* ota_manager_;
+    DisplayTask* display_task_;
+    StorageManager* storage_manager_;
+    const LEDController* led_controller_;
+    LEDUpdater* led_updater_;
     httpd_handle_t server_;
     std::function<void(const std::string&, const std::string&)> wifi_config_callback_;
     
@@ -37,12 +56,24 @@ private:
     static esp_err_t status_handler(httpd_req_t *req);
     static esp_err_t style_handler(httpd_req_t *req);
     static esp_err_t ota_check_handler(httpd_req_t *req);
+    static esp_err_t topology_handler(httpd_req_t *req);
+    static esp_err_t stats_handler(httpd_req_t *req);
+    static esp_err_t poll_profile_handler(httpd_req_t *req);
+    static esp_err_t stib_handler(httpd_req_t *req);
     
     // Helper functions
     std::string generate_main_page();
     std::string generate_status_html();
     std::string url_decode(const std::string& str);
     bool parse_post_data(const std::string& data, std::string& ssid, std::string& password);
+    std::string get_form_value(const std::string& data, const std::string& key);
+    bool parse_topology(const std::string& data, DisplayTopology& topology);
+    std::string generate_topology_html();
+    bool parse_poll_profile(const std::string& data, PollProfile& profile);
+    std::string generate_poll_profile_html();
+    bool parse_stib_config(const std::string& data, StibConfig& config);
+    std::string generate_stib_html();
+    std::string generate_stats_json();
     
     static const char* TAG;
     static const char* CSS_STYLE;
@@ -0,0 +1,132 @@
+// dead_reckoning_sim.cpp
+// Replays vehicles running along one display row (12 stops) and compares the
+// LED the display shows with the stop each vehicle actually passed last,
+// sampled every second, for several poll intervals with and without the
+// firmware's dead reckoning (Animation::vehicle_led).
+//
+// Vehicles take SIM_RUN_MIN_S..SIM_RUN_MAX_S between stops and dwell
+// SIM_DWELL_MIN_S..SIM_DWELL_MAX_S at each. The feed observes them every
+// SIM_FEED_S (like the STIB pointId / distanceFromPoint records); the server
+// sends the last observation, its age and the average speed over the last
+// SIM_SPEED_WINDOW_S. Without dead reckoning the speed is sent as 0.
+// Exits non-zero when dead reckoning at 30 s polls is less accurate than
+// plain 5 s polling, or makes any poll interval worse.
+#include "animation.h"
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#define SIM_DURATION_S (4 * 3600)
+#define SIM_VEHICLES 40
+#define SIM_RUN_MIN_S 40
+#define SIM_RUN_MAX_S 100
+#define SIM_DWELL_MIN_S 10
+#define SIM_DWELL_MAX_S 40
+#define SIM_FEED_S 20
+#define SIM_SPEED_WINDOW_S 120
+
+// Position over time of one vehicle, ANIMATION_POSITION_ONE per stop
+class Trip {
+public:
+    Trip(std::mt19937& rng, int start_s) : start_s_(start_s) {
+        int t = start_s;
+        for (int stop = 0; stop < LEDS_PER_ROW - 1; stop++) {
+            t += SIM_DWELL_MIN_S + rng() % (SIM_DWELL_MAX_S - SIM_DWELL_MIN_S + 1);
+            departures_.push_back(t);
+            t += SIM_RUN_MIN_S + rng() % (SIM_RUN_MAX_S - SIM_RUN_MIN_S + 1);
+            arrivals_.push_back(t);
+        }
+    }
+
+    bool running(int t) const { return t >= start_s_ && t < arrivals_.back(); }
+
+    uint16_t position(double t) const {
+        for (size_t stop = 0; stop < departures_.size(); stop++) {
+            if (t < departures_[stop]) {
+                return (uint16_t)(stop * ANIMATION_POSITION_ONE);
+            }
+            if (t < arrivals_[stop]) {
+                double fraction = (t - departures_[stop]) / (arrivals_[stop] - departures_[stop]);
+                return (uint16_t)((stop + fraction) * ANIMATION_POSITION_ONE);
+            }
+        }
+        return (uint16_t)((LEDS_PER_ROW - 1) * ANIMATION_POSITION_ONE);
+    }
+
+private:
+    int start_s_;
+    std::vector<int> departures_;
+    std::vector<int> arrivals_;
+};
+
+// Share of samples showing another LED than the true one
+static double simulate(const std::vector<Trip>& trips, int poll_s, bool dead_reckoning) {
+    long samples = 0, wrong = 0;
+    for (const Trip& trip : trips) {
+        Animation animation;
+        bool any = false;
+        for (int t = 0; t < SIM_DURATION_S; t++) {
+            if (!trip.running(t)) {
+                continue;
+            }
+            if (t % poll_s == 0 || !any) {
+                // Server answer: last feed observation, its age, average speed
+                const int observed = t / SIM_FEED_S * SIM_FEED_S;
+                const int window_start = observed - SIM_SPEED_WINDOW_S;
+                int speed = 0;
+                if (dead_reckoning && trip.running(window_start)) {
+                    speed = (trip.position(observed) - trip.position(window_start)) * 60 / SIM_SPEED_WINDOW_S;
+                }
+                animation = Animation();
+                animation.produced_ms = (uint32_t)t * 1000;
+                animation.add_vehicle(0, trip.position(observed), (uint16_t)speed, (uint16_t)((t - observed) * 1000));
+                any = true;
+            }
+
+            const int led = animation.vehicle_led(animation.vehicles[0], (uint32_t)t * 1000);
+            const int truth = trip.position(t) / ANIMATION_POSITION_ONE;
+            samples++;
+            wrong += led != truth;
+        }
+    }
+    return samples ? (double)wrong / samples : 0;
+}
+
+int main() {
+    std::mt19937 rng(7);
+    std::vector<Trip> trips;
+    for (int v = 0; v < SIM_VEHICLES; v++) {
+        trips.emplace_back(rng, (int)(rng() % (SIM_DURATION_S / 2)));
+    }
+
+    const int intervals[] = {5, 15, 30, 60};
+    int failures = 0;
+    double plain_5s = 0, reckoned_30s = 0;
+
+    printf("%d vehicles, %d s feed, share of time the wrong LED is lit:\n", SIM_VEHICLES, SIM_FEED_S);
+    printf("%-8s %10s %16s %14s\n", "poll", "plain", "dead reckoning", "polls/hour");
+    for (int poll_s : intervals) {
+        const double plain = simulate(trips, poll_s, false);
+        const double reckoned = simulate(trips, poll_s, true);
+        printf("%5d s  %9.1f%% %15.1f%% %14d\n", poll_s, plain * 100, reckoned * 100, 3600 / poll_s);
+        if (poll_s == 5) {
+            plain_5s = plain;
+        }
+        if (poll_s == 30) {
+            reckoned_30s = reckoned;
+        }
+        if (reckoned > plain) {
+            printf("FAIL  %d s: dead reckoning less accurate than the plain position\n", poll_s);
+            failures++;
+        }
+    }
+
+    if (reckoned_30s > plain_5s) {
+        printf("FAIL  dead reckoning at 30 s less accurate than plain 5 s polling\n");
+        failures++;
+    }
+
+    printf(failures ? "FAILED: %d checks\n" : "OK\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
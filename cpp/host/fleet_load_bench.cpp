@@ -0,0 +1,1138 @@
+// fleet_load_bench.cpp
+// Load generator for the ledstrips backend: N simulated displays, each
+// making the requests LEDUpdater makes, against any server that speaks the
+// display API (ledstrips_server, stib_aggregator, a staging backend behind
+// a TLS-terminating proxy). Reports throughput, latency percentiles, status
+// and error rates, and traffic per display and hour.
+//
+// Per display, as the firmware does:
+//  - registration with /api/esp/layout?mac=, then polls of the layout URL,
+//    by MAC when the server assigns no layout (--by-mac skips registering);
+//  - the same headers (User-Agent, Accept with binary frames and timelines
+//    preferred, If-None-Match with the ETag of the held state) and since=
+//    with the sequence of the held frame; a delta onto another frame is
+//    asked again without since=;
+//  - the firmware's PollScheduler for the next poll: profile interval by
+//    local hour (--interval S for a flat one), 10% jitter, max-age,
+//    Retry-After, backoff on errors;
+//  - one keep-alive connection, reopened after Connection: close, a read
+//    timeout or a reset, a request on a stale socket retried once;
+//  - with --stream, the push stream first, polls only while it is down, and
+//    the stream retried with the firmware's exponential backoff.
+// Displays boot spread over --ramp seconds. One epoll loop drives them all.
+//
+//   fleet_load_bench --url http://HOST:PORT [--devices N] [--duration S]
+//                    [--ramp S] [--interval S] [--by-mac] [--stream]
+//   fleet_load_bench --self-check
+//
+// --self-check runs small fleets against an in-process stand-in that
+// closes some connections, assigns layouts to half of the displays and
+// sends deltas, and checks what the displays did.
+#include "frame_codec.h"
+#include "host_http.h"
+#include "layout_id.h"
+#include "poll_scheduler.h"
+#include "sse_parser.h"
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <queue>
+#include <random>
+#include <thread>
+
+// As in led_updater.h and https_client.h
+#define LOAD_USER_AGENT "ESP32-BusDisplay/1.0"
+#define LOAD_ACCEPT FRAME_CODEC_TIMELINE_ACCEPT(FRAME_CODEC_TIMELINE_MAX_ENTRIES) ", application/json;q=0.5"
+#define LOAD_READ_TIMEOUT_MS 3000
+#define LOAD_STREAM_TIMEOUT_MS 45000
+#define LOAD_STREAM_STABLE_MS 60000
+#define LOAD_BACKOFF_MIN_MS 5000
+#define LOAD_BACKOFF_MAX_MS 300000
+#define LOAD_REGISTER_RETRY_MS 3600000
+#define LOAD_REGISTER_REFRESH_MS 86400000
+#define LOAD_BINARY_SIZE 2048
+
+#define LOAD_DEFAULT_DEVICES 100
+#define LOAD_DEFAULT_DURATION_S 60
+#define LOAD_DEFAULT_RAMP_S 5
+#define LOAD_REPORT_EVERY_S 10
+#define LOAD_MAX_HEAD 8192
+
+static int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Local time of day for the poll profile
+static int32_t local_second_of_day() {
+    time_t now = time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+    return local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec;
+}
+
+struct Options {
+    std::string host = "127.0.0.1";
+    std::string port = "8080";
+    std::string base;           // path prefix of the URL, usually empty
+    int devices = LOAD_DEFAULT_DEVICES;
+    int duration_s = LOAD_DEFAULT_DURATION_S;
+    int ramp_s = LOAD_DEFAULT_RAMP_S;
+    int interval_s = 0;         // 0: PollProfile::defaults()
+    bool by_mac = false;
+    bool stream = false;
+    bool progress = true;
+};
+
+enum Kind { KIND_REGISTER, KIND_POLL, KIND_STREAM, KIND_COUNT };
+static const char* const KIND_NAMES[KIND_COUNT] = {"register", "poll", "stream"};
+
+struct Stats {
+    uint64_t responses[KIND_COUNT] = {};
+    uint64_t ok = 0;                    // 2xx
+    uint64_t not_modified = 0;
+    uint64_t client_errors = 0;         // 4xx
+    uint64_t server_errors = 0;         // 5xx and others
+    uint64_t transport_errors = 0;      // connect failures, resets, timeouts, bad responses
+    uint64_t timeouts = 0;
+    uint64_t connections = 0;
+    uint64_t stale_retries = 0;         // a reused socket the server had closed
+    uint64_t full_frames = 0;
+    uint64_t deltas = 0;
+    uint64_t timelines = 0;
+    uint64_t json = 0;
+    uint64_t resyncs = 0;               // delta onto another frame, asked again
+    uint64_t by_layout = 0;             // polls of a layout URL
+    uint64_t stream_events = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    std::vector<uint32_t> latency_us;   // polls, connect included when there was one
+};
+
+// One simulated display
+struct Device {
+    char mac[13];
+    std::string layout;                 // empty: polls by MAC
+    int64_t next_registration_us = 0;
+    std::string etag;
+    uint32_t sequence = 0;
+    PollScheduler scheduler;
+
+    // Push stream
+    std::unique_ptr<SseParser> sse;
+    uint32_t backoff_ms = LOAD_BACKOFF_MIN_MS;
+    int64_t next_stream_us = 0;
+    int64_t stream_started_us = 0;
+    uint32_t stream_frames = 0;
+
+    // Current request, one at a time like the update task
+    int fd = -1;
+    bool connecting = false;
+    bool reused = false;                // sent on a kept-alive connection
+    bool in_flight = false;
+    Kind kind = KIND_POLL;
+    int attempt = 0;
+    std::string out;
+    size_t out_pos = 0;
+    std::string in;
+    int64_t started_us = 0;
+    uint32_t generation = 0;            // invalidates older timers
+
+    // Response being read
+    bool head_done = false;
+    int status = 0;
+    long long content_length = -1;
+    bool chunked = false;
+    bool close_after = false;
+    bool received = false;              // any byte of this response
+    std::string content_type;
+    std::string resp_etag;
+    std::string cache_control;
+    std::string retry_after;
+    std::string body;
+};
+
+class LoadRunner {
+public:
+    explicit LoadRunner(const Options& options)
+        : options_(options), devices_(options.devices), epoll_fd_(epoll_create1(0)), rng_(12345) {
+        for (int i = 0; i < options_.devices; i++) {
+            snprintf(devices_[i].mac, sizeof(devices_[i].mac), "24dcc3%06x", (unsigned)i & 0xFFFFFF);
+            if (options_.interval_s) {
+                PollProfile profile = PollProfile::defaults();
+                for (uint16_t& hour : profile.hourly_s) {
+                    hour = (uint16_t)options_.interval_s;
+                }
+                profile.default_s = (uint16_t)options_.interval_s;
+                devices_[i].scheduler.set_profile(profile);
+            }
+            if (options_.stream) {
+                Device& device = devices_[i];
+                device.sse.reset(new SseParser([&device, this](const SseEvent& event) {
+                    if (!strcmp(event.name, "frame")) {
+                        device.stream_frames++;
+                        stats_.stream_events++;
+                    }
+                }));
+            }
+            if (options_.by_mac) {
+                devices_[i].next_registration_us = INT64_MAX;
+            }
+        }
+    }
+
+    ~LoadRunner() {
+        for (Device& device : devices_) {
+            if (device.fd >= 0) {
+                close(device.fd);
+            }
+        }
+        close(epoll_fd_);
+    }
+
+    bool resolve() {
+        addrinfo hints{}, *result = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(options_.host.c_str(), options_.port.c_str(), &hints, &result) != 0 || !result) {
+            fprintf(stderr, "Cannot resolve %s\n", options_.host.c_str());
+            return false;
+        }
+        memcpy(&address_, result->ai_addr, result->ai_addrlen);
+        address_length_ = result->ai_addrlen;
+        family_ = result->ai_family;
+        freeaddrinfo(result);
+        return true;
+    }
+
+    void run() {
+        started_us_ = now_us();
+        const int64_t end_us = started_us_ + options_.duration_s * 1000000LL;
+        for (size_t i = 0; i < devices_.size(); i++) {
+            const int64_t boot_us = options_.ramp_s > 0 ? (int64_t)(rng_() % (options_.ramp_s * 1000000ULL)) : 0;
+            wake_at(devices_[i], started_us_ + boot_us);
+        }
+
+        int64_t next_report_us = started_us_ + LOAD_REPORT_EVERY_S * 1000000LL;
+        epoll_event events[256];
+        while (true) {
+            const int64_t now = now_us();
+            if (now >= end_us) {
+                break;
+            }
+            if (options_.progress && now >= next_report_us) {
+                progress(now);
+                next_report_us += LOAD_REPORT_EVERY_S * 1000000LL;
+            }
+            run_timers(now);
+
+            int64_t until_us = end_us - now;
+            if (!timers_.empty()) {
+                until_us = std::min(until_us, timers_.top().due_us - now);
+            }
+            until_us = std::min(until_us, next_report_us - now);
+            const int timeout_ms = until_us > 0 ? (int)((until_us + 999) / 1000) : 0;
+            const int count = epoll_wait(epoll_fd_, events, 256, timeout_ms);
+            for (int i = 0; i < count; i++) {
+                on_ready(devices_[events[i].data.u32], events[i].events);
+            }
+        }
+        elapsed_us_ = now_us() - started_us_;
+    }
+
+    const Stats& stats() const { return stats_; }
+    const std::vector<Device>& devices() const { return devices_; }
+
+    // Totals, latency percentiles and traffic per display and hour
+    void report() {
+        const double seconds = elapsed_us_ / 1e6;
+        uint64_t responses = 0;
+        for (uint64_t count : stats_.responses) {
+            responses += count;
+        }
+        const uint64_t attempts = responses + stats_.transport_errors;
+        printf("\n%d displays for %.1f s%s%s\n", options_.devices, seconds, options_.stream ? ", push stream" : "",
+               options_.by_mac ? ", by MAC" : "");
+        printf("  responses     %8llu  %.1f/s (register %llu, poll %llu, stream %llu)\n",
+               (unsigned long long)responses, responses / seconds,
+               (unsigned long long)stats_.responses[KIND_REGISTER], (unsigned long long)stats_.responses[KIND_POLL],
+               (unsigned long long)stats_.responses[KIND_STREAM]);
+        printf("  status        200 %llu, 304 %llu (%.1f%% of polls), 4xx %llu, 5xx %llu\n",
+               (unsigned long long)stats_.ok, (unsigned long long)stats_.not_modified,
+               stats_.responses[KIND_POLL] ? 100.0 * stats_.not_modified / stats_.responses[KIND_POLL] : 0.0,
+               (unsigned long long)stats_.client_errors, (unsigned long long)stats_.server_errors);
+        printf("  errors        %llu transport (%.2f%%), %llu timeouts, %llu stale connections retried\n",
+               (unsigned long long)stats_.transport_errors,
+               attempts ? 100.0 * stats_.transport_errors / attempts : 0.0, (unsigned long long)stats_.timeouts,
+               (unsigned long long)stats_.stale_retries);
+        printf("  connections   %llu opened (%.2f per display)\n", (unsigned long long)stats_.connections,
+               (double)stats_.connections / options_.devices);
+        printf("  bodies        %llu full, %llu deltas (%llu asked again), %llu timelines, %llu JSON\n",
+               (unsigned long long)stats_.full_frames, (unsigned long long)stats_.deltas,
+               (unsigned long long)stats_.resyncs, (unsigned long long)stats_.timelines,
+               (unsigned long long)stats_.json);
+        if (options_.stream) {
+            size_t open = 0;
+            for (const Device& device : devices_) {
+                open += device.in_flight && device.kind == KIND_STREAM;
+            }
+            printf("  stream        %llu frame events, %zu streams open at the end\n",
+                   (unsigned long long)stats_.stream_events, open);
+        }
+        std::vector<uint32_t> latency = stats_.latency_us;
+        std::sort(latency.begin(), latency.end());
+        printf("  poll latency  p50 %s  p90 %s  p99 %s  max %s\n", percentile(latency, 0.50).c_str(),
+               percentile(latency, 0.90).c_str(), percentile(latency, 0.99).c_str(),
+               percentile(latency, 1.0).c_str());
+        const double device_hours = options_.devices * seconds / 3600;
+        printf("  per display   %.0f requests/h, %.1f KB/h in, %.1f KB/h out\n",
+               attempts / device_hours, stats_.bytes_in / 1024.0 / device_hours,
+               stats_.bytes_out / 1024.0 / device_hours);
+    }
+
+private:
+    struct Timer {
+        int64_t due_us;
+        uint32_t device;
+        uint32_t generation;
+        bool operator>(const Timer& other) const { return due_us > other.due_us; }
+    };
+
+    static std::string percentile(const std::vector<uint32_t>& sorted, double p) {
+        if (sorted.empty()) {
+            return "-";
+        }
+        const size_t i = std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5));
+        char text[32];
+        snprintf(text, sizeof(text), sorted[i] >= 10000 ? "%.0f ms" : "%.2f ms", sorted[i] / 1000.0);
+        return text;
+    }
+
+    void progress(int64_t now) {
+        uint64_t responses = 0;
+        for (uint64_t count : stats_.responses) {
+            responses += count;
+        }
+        const double seconds = (now - started_us_) / 1e6;
+        printf("%5.0f s  %8llu responses  %7.1f/s  %llu errors\n", seconds, (unsigned long long)responses,
+               (responses - last_responses_) / (double)LOAD_REPORT_EVERY_S,
+               (unsigned long long)stats_.transport_errors);
+        fflush(stdout);
+        last_responses_ = responses;
+    }
+
+    uint32_t index_of(const Device& device) const { return (uint32_t)(&device - devices_.data()); }
+
+    void wake_at(Device& device, int64_t due_us) {
+        timers_.push({due_us, index_of(device), ++device.generation});
+    }
+
+    void run_timers(int64_t now) {
+        while (!timers_.empty() && timers_.top().due_us <= now) {
+            const Timer timer = timers_.top();
+            timers_.pop();
+            Device& device = devices_[timer.device];
+            if (timer.generation != device.generation) {
+                continue;
+            }
+            if (device.in_flight) {
+                stats_.timeouts++;
+                transport_error(device);
+            } else {
+                step(device);
+            }
+        }
+    }
+
+    // One pass of LEDUpdater::run(): registration when due, the stream when
+    // due, a poll otherwise
+    void step(Device& device) {
+        const int64_t now = now_us();
+        if (now >= device.next_registration_us) {
+            start(device, KIND_REGISTER);
+        } else if (options_.stream && now >= device.next_stream_us) {
+            start(device, KIND_STREAM);
+        } else {
+            device.attempt = 0;
+            start(device, KIND_POLL);
+        }
+    }
+
+    std::string path_for(const Device& device, Kind kind) const {
+        switch (kind) {
+            case KIND_REGISTER:
+                return options_.base + LAYOUT_REGISTER_PATH "?mac=" + device.mac;
+            case KIND_STREAM:
+                return options_.base + (device.layout.empty() ? std::string(LEDSTRIPS_STREAM_PATH "?mac=") + device.mac
+                                        : LEDSTRIPS_LAYOUT_PATH + device.layout + "/stream");
+            default: {
+                std::string path = options_.base + (device.layout.empty() ? std::string(LEDSTRIPS_PATH "?mac=") + device.mac
+                                                    : LEDSTRIPS_LAYOUT_PATH + device.layout);
+                if (device.sequence) {
+                    path += (path.find('?') == std::string::npos ? "?since=" : "&since=") +
+                            std::to_string(device.sequence);
+                }
+                return path;
+            }
+        }
+    }
+
+    void start(Device& device, Kind kind) {
+        device.kind = kind;
+        const char* accept = kind == KIND_POLL ? LOAD_ACCEPT : kind == KIND_STREAM ? "text/event-stream" :
+                             "application/json";
+        device.out = "GET " + path_for(device, kind) + " HTTP/1.1\r\nUser-Agent: " LOAD_USER_AGENT "\r\nHost: " +
+                     options_.host + "\r\nAccept: " + accept + "\r\n";
+        if (kind == KIND_POLL && !device.etag.empty()) {
+            device.out += "If-None-Match: " + device.etag + "\r\n";
+        }
+        device.out += "\r\n";
+        if (kind == KIND_POLL && !device.layout.empty()) {
+            stats_.by_layout++;
+        }
+        if (kind == KIND_STREAM) {
+            // The stream has its own connection, the poll one is dropped
+            close_connection(device);
+            device.sse->reset();
+            device.stream_frames = 0;
+            device.stream_started_us = now_us();
+        }
+        device.started_us = now_us();
+        send_request(device);
+    }
+
+    void send_request(Device& device) {
+        device.out_pos = 0;
+        device.in.clear();
+        device.body.clear();
+        device.head_done = false;
+        device.received = false;
+        device.in_flight = true;
+        device.reused = device.fd >= 0;
+        if (device.fd < 0 && !open_connection(device)) {
+            transport_error(device);
+            return;
+        }
+        watch(device, EPOLLIN | EPOLLOUT, device.reused ? EPOLL_CTL_ADD : EPOLL_CTL_MOD);
+        arm_timeout(device);
+    }
+
+    bool open_connection(Device& device) {
+        device.fd = socket(family_, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (device.fd < 0) {
+            return false;
+        }
+        int one = 1;
+        setsockopt(device.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        stats_.connections++;
+        device.connecting = true;
+        if (connect(device.fd, (sockaddr*)&address_, address_length_) != 0 && errno != EINPROGRESS) {
+            close(device.fd);
+            device.fd = -1;
+            return false;
+        }
+        epoll_event event{};
+        event.events = EPOLLOUT;
+        event.data.u32 = index_of(device);
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, device.fd, &event);
+        return true;
+    }
+
+    void watch(Device& device, uint32_t events, int op) {
+        epoll_event event{};
+        event.events = events;
+        event.data.u32 = index_of(device);
+        epoll_ctl(epoll_fd_, op, device.fd, &event);
+    }
+
+    void arm_timeout(Device& device) {
+        const int timeout_ms = device.kind == KIND_STREAM && device.head_done ? LOAD_STREAM_TIMEOUT_MS
+                                                                              : LOAD_READ_TIMEOUT_MS;
+        wake_at(device, now_us() + timeout_ms * 1000LL);
+    }
+
+    void close_connection(Device& device) {
+        if (device.fd >= 0) {
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, device.fd, nullptr);
+            close(device.fd);
+            device.fd = -1;
+        }
+        device.connecting = false;
+    }
+
+    void on_ready(Device& device, uint32_t events) {
+        if (!device.in_flight || device.fd < 0) {
+            return;
+        }
+        if (device.connecting) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(device.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error || (events & (EPOLLERR | EPOLLHUP))) {
+                transport_error(device);
+                return;
+            }
+            device.connecting = false;
+        }
+        if ((events & EPOLLOUT) && device.out_pos < device.out.size()) {
+            ssize_t n = send(device.fd, device.out.data() + device.out_pos, device.out.size() - device.out_pos,
+                             MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN) {
+                transport_error(device);
+                return;
+            }
+            if (n > 0) {
+                device.out_pos += n;
+                stats_.bytes_out += n;
+            }
+            if (device.out_pos == device.out.size()) {
+                watch(device, EPOLLIN, EPOLL_CTL_MOD);
+            }
+        }
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            read_response(device);
+        }
+    }
+
+    void read_response(Device& device) {
+        char chunk[4096];
+        while (true) {
+            ssize_t n = recv(device.fd, chunk, sizeof(chunk), 0);
+            if (n > 0) {
+                stats_.bytes_in += n;
+                device.received = true;
+                device.in.append(chunk, n);
+                arm_timeout(device);
+                if (!parse(device, false)) {
+                    return;
+                }
+                continue;
+            }
+            if (n == 0) {
+                // End of the connection: ends a body without a length,
+                // anything else was cut short
+                if (!parse(device, true) || !device.in_flight) {
+                    return;
+                }
+                transport_error(device);
+                return;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                transport_error(device);
+            }
+            return;
+        }
+    }
+
+    // Consumes device.in. Returns false once the response is complete or
+    // failed (the device moved on), true while more is needed.
+    bool parse(Device& device, bool eof) {
+        if (!device.head_done) {
+            const size_t head_end = device.in.find("\r\n\r\n");
+            if (head_end == std::string::npos) {
+                if (device.in.size() > LOAD_MAX_HEAD) {
+                    transport_error(device);
+                    return false;
+                }
+                return true;
+            }
+            parse_head(device, device.in.substr(0, head_end));
+            device.in.erase(0, head_end + 4);
+            device.head_done = true;
+            if (device.status <= 0) {
+                transport_error(device);
+                return false;
+            }
+            if (device.status == 304 || device.status == 204) {
+                complete(device);
+                return false;
+            }
+            if (device.kind == KIND_STREAM && device.status == 200) {
+                arm_timeout(device);
+            }
+        }
+
+        if (device.chunked) {
+            while (true) {
+                const size_t line_end = device.in.find("\r\n");
+                if (line_end == std::string::npos) {
+                    return true;
+                }
+                const size_t size = strtoul(device.in.c_str(), nullptr, 16);
+                if (device.in.size() < line_end + 2 + size + 2) {
+                    return true;
+                }
+                if (size == 0) {
+                    device.in.clear();
+                    complete(device);
+                    return false;
+                }
+                body_data(device, device.in.data() + line_end + 2, size);
+                device.in.erase(0, line_end + 2 + size + 2);
+            }
+        }
+        if (device.content_length >= 0) {
+            const size_t missing = (size_t)device.content_length - device.body.size();
+            const size_t take = std::min(missing, device.in.size());
+            body_data(device, device.in.data(), take);
+            device.in.erase(0, take);
+            if ((long long)device.body.size() == device.content_length) {
+                complete(device);
+                return false;
+            }
+            return true;
+        }
+        body_data(device, device.in.data(), device.in.size());
+        device.in.clear();
+        if (eof) {
+            device.close_after = true;
+            complete(device);
+            return false;
+        }
+        return true;
+    }
+
+    void body_data(Device& device, const char* data, size_t length) {
+        if (device.kind == KIND_STREAM && device.status == 200) {
+            device.sse->feed(data, length);
+        } else if (device.body.size() + length <= LOAD_BINARY_SIZE * 4) {
+            device.body.append(data, length);
+        }
+    }
+
+    void parse_head(Device& device, const std::string& head) {
+        const size_t space = head.find(' ');
+        device.status = space == std::string::npos ? -1 : atoi(head.c_str() + space + 1);
+        device.content_length = -1;
+        device.chunked = false;
+        device.close_after = false;
+        device.content_type.clear();
+        device.resp_etag.clear();
+        device.cache_control.clear();
+        device.retry_after.clear();
+        for (size_t pos = head.find("\r\n"); pos != std::string::npos;) {
+            const size_t end = head.find("\r\n", pos + 2);
+            const std::string line = head.substr(pos + 2, (end == std::string::npos ? head.size() : end) - pos - 2);
+            const size_t colon = line.find(':');
+            if (colon != std::string::npos) {
+                const std::string key = line.substr(0, colon);
+                std::string value = line.substr(colon + 1);
+                value.erase(0, value.find_first_not_of(" \t"));
+                if (strcasecmp(key.c_str(), "Content-Length") == 0) {
+                    device.content_length = atoll(value.c_str());
+                } else if (strcasecmp(key.c_str(), "Transfer-Encoding") == 0) {
+                    device.chunked = strcasestr(value.c_str(), "chunked") != nullptr;
+                } else if (strcasecmp(key.c_str(), "Connection") == 0) {
+                    device.close_after = strcasecmp(value.c_str(), "close") == 0;
+                } else if (strcasecmp(key.c_str(), "Content-Type") == 0) {
+                    device.content_type = value;
+                } else if (strcasecmp(key.c_str(), "ETag") == 0) {
+                    device.resp_etag = value;
+                } else if (strcasecmp(key.c_str(), "Cache-Control") == 0) {
+                    device.cache_control = value;
+                } else if (strcasecmp(key.c_str(), "Retry-After") == 0) {
+                    device.retry_after = value;
+                }
+            }
+            pos = end;
+        }
+        if (device.chunked) {
+            device.content_length = -1;
+        }
+    }
+
+    void count_status(int status) {
+        if (status == 304) {
+            stats_.not_modified++;
+        } else if (status >= 200 && status < 300) {
+            stats_.ok++;
+        } else if (status >= 400 && status < 500) {
+            stats_.client_errors++;
+        } else {
+            stats_.server_errors++;
+        }
+    }
+
+    // Failure before a complete response: a stale kept-alive socket is
+    // retried once on a new connection, as HttpsClient does
+    void transport_error(Device& device) {
+        const bool stale = device.reused && !device.received && device.kind != KIND_STREAM;
+        close_connection(device);
+        if (stale) {
+            stats_.stale_retries++;
+            send_request(device);
+            return;
+        }
+        stats_.transport_errors++;
+        device.in_flight = false;
+        device.status = -1;
+        finished(device, -1);
+    }
+
+    void complete(Device& device) {
+        device.in_flight = false;
+        device.generation++;    // drops the read timeout
+        stats_.responses[device.kind]++;
+        count_status(device.status);
+        if (device.kind == KIND_POLL) {
+            stats_.latency_us.push_back((uint32_t)std::min<int64_t>(now_us() - device.started_us, UINT32_MAX));
+        }
+        if (device.close_after || device.kind == KIND_STREAM) {
+            close_connection(device);
+        } else if (device.fd >= 0) {
+            // Idle until the next request, a close by the server shows then
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, device.fd, nullptr);
+        }
+        finished(device, device.status);
+    }
+
+    // What the update task does with the result, then the next step
+    void finished(Device& device, int status) {
+        const int64_t now = now_us();
+        switch (device.kind) {
+            case KIND_REGISTER: {
+                char id[LAYOUT_ID_SIZE];
+                LayoutIdParser parser;
+                if (status == 200 && parser.feed(device.body.data(), device.body.size()) && parser.finish(id)) {
+                    device.next_registration_us = now + LOAD_REGISTER_REFRESH_MS * 1000LL;
+                    if (device.layout != id) {
+                        device.layout = id;
+                        device.sequence = 0;
+                        device.etag.clear();
+                    }
+                } else {
+                    if (status == 404 && !device.layout.empty()) {
+                        forget_layout(device);
+                    }
+                    device.next_registration_us = now + LOAD_REGISTER_RETRY_MS * 1000LL;
+                }
+                step(device);
+                return;
+            }
+
+            case KIND_STREAM: {
+                const int64_t up_ms = (now - device.stream_started_us) / 1000;
+                if (status == 404 && !device.layout.empty()) {
+                    forget_layout(device);
+                }
+                if (device.stream_frames > 0 && up_ms >= LOAD_STREAM_STABLE_MS) {
+                    device.backoff_ms = LOAD_BACKOFF_MIN_MS;
+                }
+                uint32_t delay_ms = std::max(device.backoff_ms, device.sse->retry_ms());
+                delay_ms -= rng_() % (delay_ms / 4 + 1);
+                device.next_stream_us = now + delay_ms * 1000LL;
+                device.backoff_ms = std::min(device.backoff_ms * 2, (uint32_t)LOAD_BACKOFF_MAX_MS);
+                // Pushed frames do not carry the poll ETag
+                if (device.stream_frames) {
+                    device.etag.clear();
+                }
+                device.attempt = 0;
+                start(device, KIND_POLL);
+                return;
+            }
+
+            default:
+                break;
+        }
+
+        // Poll: LEDUpdater::fetch_and_update() and apply_response()
+        bool retry = false;
+        bool decoded = status != 200;
+        if (status == 404 && !device.layout.empty()) {
+            forget_layout(device);
+            retry = true;
+        } else if (status == 200) {
+            decoded = apply_body(device, retry);
+            if (decoded) {
+                device.etag = device.resp_etag;
+            }
+        }
+        if (retry && ++device.attempt < 2) {
+            start(device, KIND_POLL);
+            return;
+        }
+
+        PollOutcome outcome;
+        outcome.status = status == 200 && !decoded ? -1 : status;
+        outcome.max_age_s = PollScheduler::parse_max_age(device.cache_control.c_str());
+        outcome.retry_after_s = PollScheduler::parse_retry_after(device.retry_after.c_str(), time(nullptr));
+        if (status < 0) {
+            outcome.max_age_s = outcome.retry_after_s = -1;
+        }
+        uint32_t delay_ms = device.scheduler.next_delay_ms(outcome, local_second_of_day(), rng_());
+        if (options_.stream) {
+            const int64_t until_stream_ms = (device.next_stream_us - now) / 1000;
+            if (until_stream_ms < (int64_t)delay_ms) {
+                delay_ms = until_stream_ms > 0 ? (uint32_t)until_stream_ms : 0;
+            }
+        }
+        wake_at(device, now + delay_ms * 1000LL);
+    }
+
+    void forget_layout(Device& device) {
+        device.layout.clear();
+        device.next_registration_us = now_us() + LOAD_REGISTER_RETRY_MS * 1000LL;
+        device.sequence = 0;
+        device.etag.clear();
+    }
+
+    // Binary frame, delta or timeline by its header, JSON as is. False when
+    // the body does not decode; retry when a delta was not onto the held frame.
+    bool apply_body(Device& device, bool& retry) {
+        if (!frame_codec_is_content_type(device.content_type.c_str())) {
+            stats_.json++;
+            device.sequence = 0;
+            return device.body.size() > 0 && (device.body[0] == '{' || device.body[0] == '[');
+        }
+        const uint8_t* data = (const uint8_t*)device.body.data();
+        FrameCodecHeader header;
+        if (device.body.size() > LOAD_BINARY_SIZE || !frame_codec_read_header(data, device.body.size(), header)) {
+            return false;
+        }
+        FrameCodecHeader first = header;
+        if (header.flags & FRAME_CODEC_FLAG_TIMELINE) {
+            FrameCodecTimelineEntry entries[FRAME_CODEC_TIMELINE_MAX_ENTRIES];
+            if (!frame_codec_read_timeline(data, device.body.size(), header, entries, FRAME_CODEC_TIMELINE_MAX_ENTRIES) ||
+                !frame_codec_read_header(entries[0].data, entries[0].length, first)) {
+                return false;
+            }
+            stats_.timelines++;
+        }
+        if ((first.flags & FRAME_CODEC_FLAG_DELTA) && first.base_sequence != device.sequence) {
+            stats_.resyncs++;
+            device.sequence = 0;
+            device.etag.clear();
+            retry = true;
+            return false;
+        }
+        if (!(header.flags & FRAME_CODEC_FLAG_TIMELINE)) {
+            (first.flags & FRAME_CODEC_FLAG_DELTA) ? stats_.deltas++ : stats_.full_frames++;
+        }
+        device.sequence = first.sequence;
+        return true;
+    }
+
+    Options options_;
+    std::vector<Device> devices_;
+    int epoll_fd_;
+    sockaddr_storage address_{};
+    socklen_t address_length_ = 0;
+    int family_ = AF_INET;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+    std::mt19937 rng_;
+    Stats stats_;
+    int64_t started_us_ = 0;
+    int64_t elapsed_us_ = 0;
+    uint64_t last_responses_ = 0;
+};
+
+// Self-check
+
+// Serves the display API with a state that changes every STAND_IN_STEP_S:
+// binary frames with deltas onto the previous state, layouts for even MACs
+// only. Connections end after three responses, every other one without
+// Connection: close so the display finds out on its next request.
+#define STAND_IN_STEP_S 3
+
+class StandIn {
+public:
+    int start() {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd_, 512) < 0) {
+            return -1;
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(listen_fd_, (sockaddr*)&addr, &len);
+        started_ = std::chrono::steady_clock::now();
+        std::thread([this]() {
+            while (true) {
+                int fd = accept(listen_fd_, nullptr, nullptr);
+                if (fd >= 0) {
+                    std::thread(&StandIn::serve, this, fd).detach();
+                }
+            }
+        }).detach();
+        return ntohs(addr.sin_port);
+    }
+
+    std::atomic<uint32_t> registrations{0};
+    std::atomic<uint32_t> by_layout{0};
+    std::atomic<uint32_t> by_mac{0};
+    std::atomic<uint32_t> with_since{0};
+    std::atomic<uint32_t> conditional{0};
+    std::atomic<uint32_t> streams{0};
+    std::atomic<uint32_t> closed{0};
+    std::atomic<uint32_t> dropped{0};
+
+private:
+    uint32_t sequence() const {
+        return 1 + (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(
+                       std::chrono::steady_clock::now() - started_).count() / STAND_IN_STEP_S;
+    }
+
+    static std::string frame(uint32_t sequence, uint32_t since) {
+        Frame rows;
+        rows.row_count = 4;
+        rows.set_led(sequence % 4, sequence % LEDS_PER_ROW, true);
+        Animation animation(rows);
+        uint8_t out[FRAME_CODEC_MAX_SIZE];
+        size_t length;
+        if (since && since + 1 == sequence) {
+            Frame before;
+            before.row_count = 4;
+            before.set_led(since % 4, since % LEDS_PER_ROW, true);
+            const FrameCodecHeader header{FRAME_CODEC_FLAG_SEQUENCE | FRAME_CODEC_FLAG_DELTA, sequence, since, 0};
+            length = frame_codec_encode_delta(Animation(before), animation, header, out, sizeof(out));
+        } else {
+            const FrameCodecHeader header{FRAME_CODEC_FLAG_SEQUENCE, sequence, 0, 0};
+            length = frame_codec_encode(animation, header, out, sizeof(out));
+        }
+        return std::string((const char*)out, length);
+    }
+
+    void serve(int fd) {
+        std::string buffer;
+        HttpRequest request;
+        int served = 0;
+        const bool silent = connections_++ % 2;
+        while (read_request(fd, buffer, request)) {
+            const std::string route = request.path.substr(0, request.path.find('?'));
+            const std::string mac = query_param(request.path, "mac");
+            bool stream = false;
+            const std::string layout = layout_route(request.path, stream);
+            const bool last = ++served % 3 == 0;
+            const bool close_now = last && !silent;
+            const bool drop = last && silent;
+            std::string headers = close_now ? "Connection: close\r\n" : "";
+            std::string body, type = "application/json";
+            int status = 200;
+
+            if (stream || route == LEDSTRIPS_STREAM_PATH) {
+                streams++;
+                serve_stream(fd);
+                break;
+            } else if (route == LAYOUT_REGISTER_PATH) {
+                registrations++;
+                const bool even = !mac.empty() && strtoul(mac.c_str() + mac.size() - 1, nullptr, 16) % 2 == 0;
+                status = even ? 200 : 404;
+                body = even ? layout_json("even") : "";
+            } else if ((!layout.empty() && layout == "even") || (route == LEDSTRIPS_PATH && !mac.empty())) {
+                (layout.empty() ? by_mac : by_layout)++;
+                with_since += request.since != 0;
+                conditional += !request.if_none_match.empty();
+                const uint32_t now = sequence();
+                const std::string etag = "\"s" + std::to_string(now) + "\"";
+                headers += "ETag: " + etag + "\r\nCache-Control: max-age=1\r\n";
+                if (etag_matches(request.if_none_match, etag)) {
+                    status = 304;
+                } else {
+                    body = frame(now, request.since);
+                    type = FRAME_CODEC_CONTENT_TYPE;
+                }
+            } else {
+                status = 404;
+            }
+
+            std::string response = "HTTP/1.1 " + std::to_string(status) + (status == 200 ? " OK" :
+                                   status == 304 ? " Not Modified" : " Not Found") + "\r\n" + headers;
+            if (status != 304) {
+                response += "Content-Type: " + type + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n";
+            }
+            if (!send_all(fd, response + "\r\n" + body) || close_now || drop) {
+                closed += close_now;
+                dropped += drop;
+                break;
+            }
+        }
+        close(fd);
+    }
+
+    void serve_stream(int fd) {
+        std::string head = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nTransfer-Encoding: chunked\r\n\r\n";
+        uint32_t sent = 0;
+        while (send_all(fd, head)) {
+            uint8_t binary[FRAME_CODEC_MAX_SIZE];
+            const std::string message = frame(sequence(), 0);
+            memcpy(binary, message.data(), message.size());
+            char text[FRAME_CODEC_BASE64_SIZE(FRAME_CODEC_MAX_SIZE) + 1];
+            size_t length = frame_codec_base64_encode(binary, message.size(), text, sizeof(text));
+            const std::string event = "event: frame\ndata: " + std::string(text, length) + "\n\n";
+            char size[16];
+            snprintf(size, sizeof(size), "%zx\r\n", event.size());
+            head = size + event + "\r\n";
+            // Three events, then the stream ends and the display reconnects
+            if (++sent > 3) {
+                send_all(fd, "0\r\n\r\n");
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        }
+    }
+
+    int listen_fd_ = -1;
+    std::atomic<uint32_t> connections_{0};
+    std::chrono::steady_clock::time_point started_;
+};
+
+static int self_check() {
+    StandIn server;
+    const int port = server.start();
+    expect(port > 0, "stand-in up");
+
+    // Polling fleet, half of it on a layout
+    Options options;
+    options.port = std::to_string(port);
+    options.devices = 200;
+    options.duration_s = 6;
+    options.ramp_s = 1;
+    options.interval_s = POLL_PROFILE_MIN_S;
+    options.progress = false;
+    {
+        LoadRunner runner(options);
+        expect(runner.resolve(), "address");
+        runner.run();
+        runner.report();
+        const Stats& stats = runner.stats();
+        size_t on_layout = 0;
+        for (const Device& device : runner.devices()) {
+            on_layout += device.layout == "even";
+        }
+        expect(server.registrations == 200 && on_layout == 100, "every display registered, even MACs got the layout");
+        expect(server.by_layout > 0 && server.by_mac > 0 && stats.by_layout == server.by_layout,
+               "  layout URL polled once registered, MAC URL otherwise");
+        expect(stats.responses[KIND_POLL] >= 200 * 2, "  every display polled at least twice");
+        expect(stats.transport_errors == 0, "  no transport errors");
+        expect(server.closed > 0 && stats.connections > 200, "  reconnected after Connection: close");
+    expect(server.dropped > 0 && stats.stale_retries > 0, "  request on a connection the server dropped retried");
+        expect(stats.not_modified > 0 && server.conditional > 0, "  conditional GETs answered 304");
+        expect(stats.deltas > 0 && server.with_since > 0, "  since= sent, deltas applied");
+        expect(stats.latency_us.size() == stats.responses[KIND_POLL], "  latency per poll");
+    }
+
+    // Connection refused: errors and backoff, no spinning
+    options.port = "1";
+    options.devices = 20;
+    options.duration_s = 2;
+    {
+        LoadRunner runner(options);
+        runner.resolve();
+        runner.run();
+        const Stats& stats = runner.stats();
+        expect(stats.transport_errors > 0 && stats.transport_errors <= 20 * 4,
+               "refused connections counted, retried with backoff");
+    }
+
+    // Push stream: polls only when it ends, reconnects with backoff
+    options.port = std::to_string(port);
+    options.devices = 20;
+    options.duration_s = 3;
+    options.stream = true;
+    options.by_mac = true;
+    const uint32_t streams_before = server.streams;
+    {
+        LoadRunner runner(options);
+        runner.resolve();
+        runner.run();
+        runner.report();
+        const Stats& stats = runner.stats();
+        expect(server.streams - streams_before == 20 && stats.responses[KIND_STREAM] == 20,
+               "push stream: one per display, then backoff");
+        expect(stats.stream_events >= 20 * 3, "  frame events read");
+        expect(stats.responses[KIND_POLL] >= 20 && stats.responses[KIND_REGISTER] == 0,
+               "  polled once the stream ended, no registration by MAC");
+    }
+
+    return self_check_result();
+}
+
+// http://host[:port][/prefix]
+static bool parse_url(const std::string& url, Options& options) {
+    if (url.compare(0, 7, "http://") != 0) {
+        fprintf(stderr, "Only http:// URLs, put a TLS-terminating proxy in front of https servers\n");
+        return false;
+    }
+    const size_t slash = url.find('/', 7);
+    std::string host = url.substr(7, slash == std::string::npos ? std::string::npos : slash - 7);
+    options.base = slash == std::string::npos ? "" : url.substr(slash);
+    if (!options.base.empty() && options.base.back() == '/') {
+        options.base.pop_back();
+    }
+    options.port = "80";
+    const size_t colon = host.find(':');
+    if (colon != std::string::npos) {
+        options.port = host.substr(colon + 1);
+        host.erase(colon);
+    }
+    options.host = host;
+    return !host.empty();
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    bool have_url = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--url") && i + 1 < argc) {
+            if (!parse_url(argv[++i], options)) {
+                return EXIT_FAILURE;
+            }
+            have_url = true;
+        } else if (!strcmp(argv[i], "--devices") && i + 1 < argc) {
+            options.devices = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--duration") && i + 1 < argc) {
+            options.duration_s = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--ramp") && i + 1 < argc) {
+            options.ramp_s = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--interval") && i + 1 < argc) {
+            options.interval_s = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--by-mac")) {
+            options.by_mac = true;
+        } else if (!strcmp(argv[i], "--stream")) {
+            options.stream = true;
+        } else if (!strcmp(argv[i], "--self-check")) {
+            return self_check();
+        } else {
+            have_url = false;
+            break;
+        }
+    }
+    if (!have_url || options.devices <= 0 || options.duration_s <= 0 ||
+        (options.interval_s && (options.interval_s < POLL_PROFILE_MIN_S || options.interval_s > POLL_PROFILE_MAX_S))) {
+        fprintf(stderr, "usage: %s --url http://HOST:PORT [--devices N] [--duration S] [--ramp S] [--interval S] "
+                "[--by-mac] [--stream] | --self-check\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // A socket per display
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)options.devices + 64) {
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, options.devices + 64);
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur < (rlim_t)options.devices + 64) {
+            fprintf(stderr, "Open file limit %llu is too low for %d displays\n",
+                    (unsigned long long)limit.rlim_cur, options.devices);
+            return EXIT_FAILURE;
+        }
+    }
+
+    LoadRunner runner(options);
+    if (!runner.resolve()) {
+        return EXIT_FAILURE;
+    }
+    printf("%d displays against %s:%s%s for %d s\n", options.devices, options.host.c_str(), options.port.c_str(),
+           options.base.c_str(), options.duration_s);
+    runner.run();
+    runner.report();
+    return EXIT_SUCCESS;
+}
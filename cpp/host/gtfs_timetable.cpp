@@ -0,0 +1,499 @@
+// gtfs_timetable.cpp
+// Builds the offline timetable of one display (timetable.h) from a GTFS
+// feed and the display's stop table in the direct mode format (line pointId
+// row led, see host_http.h load_stops). This is what a server runs per
+// layout when the feed changes; ledstrips_server --timetable serves the
+// result.
+//
+// Only routes whose route_short_name is a line of the table are kept. Each
+// trip is cut to the stops from the first one on the display to the one
+// after the last (a vehicle stays lit at a stop until it passes the next).
+// Times are arrival times. GTFS stop_ids are matched to the dataset's
+// pointIds by their leading digits. Service days come from calendar.txt;
+// calendar_dates.txt exceptions are not applied, the display falls back to
+// the schedule for minutes at a time, not for planning a journey.
+//
+//   gtfs_timetable --gtfs DIR --stops FILE --out FILE [--built S]
+//   gtfs_timetable --self-check
+//
+// --self-check builds fixtures/gtfs against fixtures/stib/stops.txt and
+// checks patterns and predicted positions (peak and off-peak trips, weekend
+// service, a trip past midnight), then encodes a timetable the size of a
+// busy display and times predict().
+#include "host_http.h"
+#include "timetable.h"
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <unordered_map>
+
+#define GTFS_MAX_STOPS 255      // per pattern, TimetablePattern::stop_count
+#define GTFS_MAX_GAP_S 0xFFFF   // between departures of a pattern
+// Slot size of TimetableStore on the stock partitions.csv: the spiffs
+// partition (0xF0000) halved, rounded down to 64 KB
+#define GTFS_SLOT_SIZE 0x70000
+
+// One CSV file of the feed: header, then rows, read line by line so a
+// national stop_times.txt is not held in memory
+class CsvReader {
+public:
+    bool open(const std::string& path) {
+        file_.open(path, std::ios::binary);
+        std::string line;
+        if (!file_ || !std::getline(file_, line)) {
+            return false;
+        }
+        if (line.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+            line.erase(0, 3);
+        }
+        split(line, header_);
+        return true;
+    }
+
+    // Index of a column, -1 when absent
+    int column(const char* name) const {
+        for (size_t i = 0; i < header_.size(); i++) {
+            if (header_[i] == name) {
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+
+    bool next(std::vector<std::string>& row) {
+        std::string line;
+        while (std::getline(file_, line)) {
+            if (!line.empty() && line != "\r") {
+                split(line, row);
+                row.resize(header_.size());
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    // Fields may be quoted, with "" for a quote inside
+    static void split(const std::string& line, std::vector<std::string>& fields) {
+        fields.clear();
+        std::string field;
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); i++) {
+            const char c = line[i];
+            if (quoted) {
+                if (c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+                    field += '"';
+                    i++;
+                } else if (c == '"') {
+                    quoted = false;
+                } else {
+                    field += c;
+                }
+            } else if (c == '"') {
+                quoted = true;
+            } else if (c == ',') {
+                fields.push_back(field);
+                field.clear();
+            } else if (c != '\r') {
+                field += c;
+            }
+        }
+        fields.push_back(field);
+    }
+
+    std::ifstream file_;
+    std::vector<std::string> header_;
+};
+
+// H:MM:SS, hours past 24 for trips after midnight. -1 when malformed.
+static int32_t parse_time(const std::string& text) {
+    int h, m, s;
+    if (sscanf(text.c_str(), "%d:%d:%d", &h, &m, &s) != 3 || h < 0 || m < 0 || m > 59 || s < 0 || s > 59) {
+        return -1;
+    }
+    return h * 3600 + m * 60 + s;
+}
+
+static uint32_t parse_point(const std::string& stop_id) {
+    return (uint32_t)strtoul(stop_id.c_str(), nullptr, 10);
+}
+
+struct BuildStats {
+    size_t trips = 0;           // kept
+    size_t off_display = 0;     // on a kept route but at no stop of the display
+    size_t no_calendar = 0;     // service not in calendar.txt
+    size_t stop_times = 0;      // rows read for kept trips
+    size_t patterns = 0;
+};
+
+// A pattern being collected
+struct PatternGroup {
+    uint16_t line;
+    uint8_t days;
+    std::vector<TimetableStop> stops;
+    std::vector<uint32_t> departures;
+};
+
+// Reads the feed and encodes the timetable of config's display into out
+static bool build_timetable(const std::string& dir, const StibConfig& config, uint32_t built_s, std::string& out,
+                            BuildStats& stats) {
+    std::vector<std::string> row;
+
+    // Service days and the end of the calendar
+    CsvReader calendar;
+    std::unordered_map<std::string, uint8_t> services;
+    uint32_t valid_until_s = 0;
+    static const char* const DAY_NAMES[7] = {"monday", "tuesday", "wednesday", "thursday", "friday", "saturday",
+                                             "sunday"};
+    if (!calendar.open(dir + "/calendar.txt")) {
+        fprintf(stderr, "No calendar.txt in %s\n", dir.c_str());
+        return false;
+    }
+    int day_columns[7];
+    for (int d = 0; d < 7; d++) {
+        day_columns[d] = calendar.column(DAY_NAMES[d]);
+    }
+    const int service_column = calendar.column("service_id");
+    const int end_column = calendar.column("end_date");
+    while (calendar.next(row)) {
+        uint8_t days = 0;
+        for (int d = 0; d < 7; d++) {
+            if (day_columns[d] >= 0 && row[day_columns[d]] == "1") {
+                days |= 1 << d;
+            }
+        }
+        services[row[service_column]] = days;
+        struct tm end{};
+        if (end_column >= 0 && sscanf(row[end_column].c_str(), "%4d%2d%2d", &end.tm_year, &end.tm_mon,
+                                      &end.tm_mday) == 3) {
+            end.tm_year -= 1900;
+            end.tm_mon -= 1;
+            end.tm_mday += 1;   // through the end date
+            valid_until_s = std::max(valid_until_s, (uint32_t)timegm(&end));
+        }
+    }
+
+    // Routes of the display's lines
+    uint16_t lines[STIB_MAX_LINES];
+    const size_t line_count = config.line_list(lines, STIB_MAX_LINES);
+    CsvReader routes;
+    std::unordered_map<std::string, uint16_t> route_lines;
+    if (!routes.open(dir + "/routes.txt")) {
+        fprintf(stderr, "No routes.txt in %s\n", dir.c_str());
+        return false;
+    }
+    const int route_column = routes.column("route_id");
+    const int name_column = routes.column("route_short_name");
+    while (routes.next(row)) {
+        const long line = strtol(row[name_column].c_str(), nullptr, 10);
+        if (line > 0 && std::binary_search(lines, lines + line_count, (uint16_t)line)) {
+            route_lines[row[route_column]] = (uint16_t)line;
+        }
+    }
+
+    // Trips of those routes
+    struct Trip {
+        uint16_t line;
+        uint8_t days;
+        std::vector<std::pair<uint32_t, std::pair<int32_t, uint32_t>>> stops;  // sequence, (arrival, point)
+    };
+    std::unordered_map<std::string, Trip> trips;
+    CsvReader trip_file;
+    if (!trip_file.open(dir + "/trips.txt")) {
+        fprintf(stderr, "No trips.txt in %s\n", dir.c_str());
+        return false;
+    }
+    const int trip_route = trip_file.column("route_id");
+    const int trip_service = trip_file.column("service_id");
+    const int trip_id = trip_file.column("trip_id");
+    while (trip_file.next(row)) {
+        auto route = route_lines.find(row[trip_route]);
+        if (route == route_lines.end()) {
+            continue;
+        }
+        auto service = services.find(row[trip_service]);
+        if (service == services.end()) {
+            stats.no_calendar++;
+            continue;
+        }
+        trips[row[trip_id]] = Trip{route->second, service->second, {}};
+    }
+
+    CsvReader stop_times;
+    if (!stop_times.open(dir + "/stop_times.txt")) {
+        fprintf(stderr, "No stop_times.txt in %s\n", dir.c_str());
+        return false;
+    }
+    const int st_trip = stop_times.column("trip_id");
+    const int st_arrival = stop_times.column("arrival_time");
+    const int st_stop = stop_times.column("stop_id");
+    const int st_sequence = stop_times.column("stop_sequence");
+    while (stop_times.next(row)) {
+        auto trip = trips.find(row[st_trip]);
+        if (trip == trips.end()) {
+            continue;
+        }
+        trip->second.stops.push_back({(uint32_t)strtoul(row[st_sequence].c_str(), nullptr, 10),
+                                      {parse_time(row[st_arrival]), parse_point(row[st_stop])}});
+        stats.stop_times++;
+    }
+
+    // Group the trips into patterns
+    std::map<std::string, PatternGroup> groups;
+    for (auto& entry : trips) {
+        Trip& trip = entry.second;
+        std::sort(trip.stops.begin(), trip.stops.end());
+        int first = -1, last = -1;
+        for (size_t i = 0; i < trip.stops.size(); i++) {
+            if (trip.stops[i].second.first < 0) {
+                first = -1;
+                break;      // no arrival time: not usable
+            }
+            if (config.find(trip.line, trip.stops[i].second.second) >= 0) {
+                last = (int)i;
+                first = first < 0 ? (int)i : first;
+            }
+        }
+        if (first < 0 || trip.stops.size() < 2) {
+            stats.off_display++;
+            continue;
+        }
+        last = std::min(last + 1, (int)trip.stops.size() - 1);
+        first = first == last ? first - 1 : first;
+        if (last - first + 1 > GTFS_MAX_STOPS) {
+            stats.off_display++;
+            continue;
+        }
+
+        PatternGroup group{trip.line, trip.days, {}, {}};
+        const int32_t departure = trip.stops[first].second.first;
+        int32_t previous = departure;
+        bool ordered = true;
+        for (int i = first; i <= last; i++) {
+            const int32_t arrival = trip.stops[i].second.first;
+            const uint32_t point = trip.stops[i].second.second;
+            const int slot = config.find(trip.line, point);
+            ordered = ordered && arrival >= previous && arrival - previous <= 0xFFFF;
+            group.stops.push_back({point, (uint16_t)(slot >= 0 ? slot : TIMETABLE_NO_SLOT),
+                                   (uint16_t)(i == first ? 0 : arrival - previous)});
+            previous = arrival;
+        }
+        if (!ordered || previous - departure > 0xFFFF) {
+            stats.off_display++;
+            continue;
+        }
+
+        std::string key((const char*)&group.line, sizeof(group.line));
+        key.append((const char*)&group.days, 1);
+        key.append((const char*)group.stops.data(), group.stops.size() * sizeof(TimetableStop));
+        PatternGroup& existing = groups.emplace(key, group).first->second;
+        existing.departures.push_back((uint32_t)departure);
+        stats.trips++;
+    }
+
+    // Departures in order, a pattern split where two are too far apart
+    std::vector<PatternGroup> patterns;
+    for (auto& entry : groups) {
+        PatternGroup& group = entry.second;
+        std::sort(group.departures.begin(), group.departures.end());
+        PatternGroup part{group.line, group.days, group.stops, {}};
+        for (uint32_t departure : group.departures) {
+            if (!part.departures.empty() && (departure - part.departures.back() > GTFS_MAX_GAP_S ||
+                                             part.departures.size() == 0xFFFF)) {
+                patterns.push_back(part);
+                part.departures.clear();
+            }
+            part.departures.push_back(departure);
+        }
+        patterns.push_back(part);
+    }
+
+    std::vector<TimetablePattern> table;
+    for (const PatternGroup& pattern : patterns) {
+        table.push_back({pattern.line, pattern.days, (uint8_t)pattern.stops.size(), pattern.stops.data(),
+                         (uint16_t)pattern.departures.size(), pattern.departures.data()});
+    }
+    stats.patterns = table.size();
+    const size_t size = timetable_encoded_size(table.data(), table.size());
+    out.assign(size, '\0');
+    return size > 0 && timetable_encode(table.data(), table.size(), built_s, valid_until_s, config.row_count(),
+                                        (uint8_t*)&out[0], out.size()) == size;
+}
+
+// Self-check
+
+static bool lit_only(const Frame& frame, int row, int led) {
+    Frame expected;
+    expected.row_count = frame.row_count;
+    if (row >= 0) {
+        expected.set_led(row, led, true);
+    }
+    return frame == expected;
+}
+
+// A busy display: 16 lines, 2 directions, 30 stops, a trip every 6 min from
+// 05:00 to 01:00, peak and off-peak running times, weekdays and weekends
+static std::string busy_timetable(StibConfig& config) {
+    config = StibConfig::defaults();
+    std::vector<std::vector<TimetableStop>> stops;
+    std::vector<std::vector<uint32_t>> departures;
+    std::vector<TimetablePattern> patterns;
+    for (uint16_t line = 1; line <= 16; line++) {
+        for (int direction = 0; direction < 2; direction++) {
+            for (int variant = 0; variant < 4; variant++) {
+                std::vector<TimetableStop> pattern_stops;
+                for (int s = 0; s < 30; s++) {
+                    const uint32_t point = line * 1000 + (direction ? 29 - s : s);
+                    int slot = -1;
+                    if (s < 6 && variant == 0 && line <= LED_MAX_ROWS) {
+                        config.add_point(line, point, (uint8_t)(line - 1), (uint8_t)(direction * 6 + s));
+                    }
+                    slot = s < 6 && line <= LED_MAX_ROWS ? (line - 1) * LEDS_PER_ROW + direction * 6 + s : -1;
+                    pattern_stops.push_back({point, (uint16_t)(slot >= 0 ? slot : TIMETABLE_NO_SLOT),
+                                             (uint16_t)(s ? 90 + 30 * (variant & 1) : 0)});
+                }
+                std::vector<uint32_t> times;
+                for (uint32_t t = 5 * 3600 + line * 17; t < 25 * 3600; t += 360) {
+                    const bool peak = (t >= 7 * 3600 && t < 9 * 3600) || (t >= 16 * 3600 && t < 19 * 3600);
+                    if (peak == (bool)(variant & 1)) {
+                        times.push_back(t);
+                    }
+                }
+                stops.push_back(pattern_stops);
+                departures.push_back(times);
+                patterns.push_back({line, (uint8_t)(variant & 2 ? 0x60 : 0x1F), 30, nullptr, (uint16_t)times.size(),
+                                    nullptr});
+            }
+        }
+    }
+    for (size_t i = 0; i < patterns.size(); i++) {
+        patterns[i].stops = stops[i].data();
+        patterns[i].departures = departures[i].data();
+    }
+    std::string out(timetable_encoded_size(patterns.data(), patterns.size()), '\0');
+    timetable_encode(patterns.data(), patterns.size(), 0, 0, config.row_count(), (uint8_t*)&out[0], out.size());
+    return out;
+}
+
+static int self_check() {
+    StibConfig config = StibConfig::defaults();
+    expect(load_stops(STIB_RECORDINGS_DIR "/stops.txt", config), "stop table loads");
+
+    std::string body;
+    BuildStats stats;
+    expect(build_timetable(GTFS_FIXTURE_DIR, config, 1767225600, body, stats), "fixture feed builds");
+    Timetable timetable;
+    expect(timetable.attach((const uint8_t*)body.data(), body.size()) && timetable.size() == body.size(),
+           "  valid timetable");
+    expect(stats.patterns == 4 && timetable.pattern_count() == 4 && timetable.trip_count() == 9,
+           "  4 patterns: off-peak, peak and weekend trips of 8, weekday trips of 25");
+    expect(stats.stop_times == 7 * 7 + 2 * 6, "  line 99 left out");
+    expect(timetable.row_count() == 3 && timetable.built_s() == 1767225600 &&
+               timetable.valid_until_s() == 1798761600, "  rows, build time, calendar end");
+    printf("      %zu bytes for %zu trips (%zu stop_times rows)\n", body.size(), stats.trips, stats.stop_times);
+
+    Frame frame;
+    const int MONDAY = 0, FRIDAY = 4, SATURDAY = 5;
+    timetable.predict(MONDAY, 6 * 3600 + 120, nullptr, frame);
+    expect(lit_only(frame, 0, 0), "06:02 Monday: first trip of 8 passed its first stop of the display");
+    timetable.predict(MONDAY, 6 * 3600 + 510, nullptr, frame);
+    expect(lit_only(frame, 0, 3), "  06:08:30, at the last stop of the display");
+    expect(timetable.predict(MONDAY, 6 * 3600 + 570, nullptr, frame) == 0, "  06:09:30, past the next stop: gone");
+    timetable.predict(MONDAY, 7 * 3600 + 1800 + 90 + 400, nullptr, frame);
+    expect(lit_only(frame, 0, 2), "  07:36:40, peak trip with its longer running times");
+    expect(timetable.predict(SATURDAY, 6 * 3600 + 120, nullptr, frame) == 0, "Saturday 06:02: no weekday trips");
+    timetable.predict(SATURDAY, 9 * 3600 + 180, nullptr, frame);
+    expect(lit_only(frame, 0, 1), "  09:03, weekend trip");
+    timetable.predict(SATURDAY, 15 * 60, nullptr, frame);
+    expect(lit_only(frame, 1, 2), "  00:15, Friday's trip past midnight");
+    expect(timetable.predict(MONDAY, 15 * 60, nullptr, frame) == 0, "  not after a Sunday");
+    timetable.predict(FRIDAY, 23 * 3600 + 3000 + 490, nullptr, frame);
+    expect(lit_only(frame, 2, 1), "  23:58:10 Friday, on row 2");
+
+    bool same = true;
+    Frame by_slot, by_config;
+    for (int day = 0; day < 7; day++) {
+        for (int32_t t = 0; t < 86400; t += 30) {
+            timetable.predict(day, t, nullptr, by_slot);
+            timetable.predict(day, t, &config, by_config);
+            same = same && by_slot == by_config;
+        }
+    }
+    expect(same, "direct mode lookup by pointId matches the stored slots, whole week");
+
+    std::string corrupt = body;
+    corrupt[corrupt.size() / 2] ^= 0x40;
+    expect(!timetable.attach((const uint8_t*)corrupt.data(), corrupt.size()) &&
+               !timetable.attach((const uint8_t*)body.data(), body.size() - 1) &&
+               Timetable::message_size((const uint8_t*)body.data(), 8) == 0,
+           "flipped bit, truncated message and short header refused");
+
+    // Size and predict() time of a busy display
+    StibConfig busy_config;
+    const std::string busy = busy_timetable(busy_config);
+    expect(timetable.attach((const uint8_t*)busy.data(), busy.size()), "busy display timetable");
+    const size_t runs = 7 * 24 * 60;
+    size_t lit = 0;
+    const auto started = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < runs; i++) {
+        lit += timetable.predict((int)(i / 1440), (int32_t)(i % 1440) * 60, nullptr, frame);
+    }
+    const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - started).count();
+    printf("      %d patterns, %lu trips: %zu bytes (%.1f per trip), predict %.1f us, %.1f vehicles lit\n",
+           timetable.pattern_count(), (unsigned long)timetable.trip_count(), busy.size(),
+           (double)busy.size() / timetable.trip_count(), us / runs, (double)lit / runs);
+    expect(busy.size() * 2 <= GTFS_SLOT_SIZE, "  fits a flash slot with room to spare");
+    expect(lit > 0, "  vehicles on the display");
+
+    return self_check_result();
+}
+
+int main(int argc, char** argv) {
+    std::string gtfs, stops, out;
+    uint32_t built_s = (uint32_t)time(nullptr);
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--gtfs") && i + 1 < argc) {
+            gtfs = argv[++i];
+        } else if (!strcmp(argv[i], "--stops") && i + 1 < argc) {
+            stops = argv[++i];
+        } else if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+            out = argv[++i];
+        } else if (!strcmp(argv[i], "--built") && i + 1 < argc) {
+            built_s = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--self-check")) {
+            return self_check();
+        } else {
+            gtfs.clear();
+            break;
+        }
+    }
+    if (gtfs.empty() || stops.empty() || out.empty()) {
+        fprintf(stderr, "usage: %s --gtfs DIR --stops FILE --out FILE [--built S] | --self-check\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    StibConfig config = StibConfig::defaults();
+    if (!load_stops(stops, config)) {
+        fprintf(stderr, "Invalid stop table %s\n", stops.c_str());
+        return EXIT_FAILURE;
+    }
+    std::string body;
+    BuildStats stats;
+    if (!build_timetable(gtfs, config, built_s, body, stats)) {
+        fprintf(stderr, "No timetable built (%zu trips kept)\n", stats.trips);
+        return EXIT_FAILURE;
+    }
+    std::ofstream file(out, std::ios::binary);
+    file.write(body.data(), body.size());
+    if (!file) {
+        fprintf(stderr, "Cannot write %s\n", out.c_str());
+        return EXIT_FAILURE;
+    }
+    printf("%s: %zu bytes, %zu patterns, %zu trips (%zu off the display, %zu without calendar)\n", out.c_str(),
+           body.size(), stats.patterns, stats.trips, stats.off_display, stats.no_calendar);
+    if (body.size() > GTFS_SLOT_SIZE) {
+        fprintf(stderr, "Larger than a flash slot (%d KB)\n", GTFS_SLOT_SIZE / 1024);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
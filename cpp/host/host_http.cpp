@@ -0,0 +1,210 @@
+// host_http.cpp
+#include "host_http.h"
+
+std::string content_etag(const std::string& body, const char* prefix) {
+    // Strong validator derived from the content (FNV-1a), one per representation
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : body) {
+        hash = (hash ^ c) * 16777619u;
+    }
+    char tag[24];
+    snprintf(tag, sizeof(tag), "\"%s%08x\"", prefix, hash);
+    return tag;
+}
+
+std::string strips_json(const Animation& animation) {
+    const Frame& frame = animation.base;
+    std::string json = "{\"strips\":[";
+    for (size_t r = 0; r < frame.row_count; r++) {
+        json += r ? ",{\"h\":" : "{\"h\":";
+        json += std::to_string(r) + ",\"v\":[";
+        for (int i = 0; i < LEDS_PER_ROW; i++) {
+            json += i ? "," : "";
+            json += frame.get_led(r, i) ? "1" : "0";
+        }
+        json += "]";
+
+        bool first = true;
+        for (uint8_t e = 0; e < animation.effect_count; e++) {
+            const LEDEffect& effect = animation.effects[e];
+            if (effect.row != r) {
+                continue;
+            }
+            json += first ? ",\"fx\":[" : ",";
+            json += "{\"i\":" + std::to_string(effect.led) + ",\"p\":" + std::to_string(effect.period_ms) +
+                    ",\"on\":" + std::to_string(effect.on_ms) + ",\"o\":" + std::to_string(effect.phase_ms) + "}";
+            first = false;
+        }
+        json += first ? "}" : "]}";
+    }
+    json += "]}";
+    return json;
+}
+
+bool etag_matches(const std::string& header, const std::string& etag) {
+    if (header.empty()) {
+        return false;
+    }
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t end = header.find(',', pos);
+        if (end == std::string::npos) {
+            end = header.size();
+        }
+        std::string tag = header.substr(pos, end - pos);
+        tag.erase(0, tag.find_first_not_of(" \t"));
+        tag.erase(tag.find_last_not_of(" \t") + 1);
+        if (tag.compare(0, 2, "W/") == 0) {
+            tag.erase(0, 2);
+        }
+        if (tag == "*" || tag == etag) {
+            return true;
+        }
+        pos = end + 1;
+    }
+    return false;
+}
+
+bool read_request(int fd, std::string& buffer, HttpRequest& request) {
+    int taken;
+    while ((taken = take_request(buffer, request)) == 0) {
+        char chunk[1024];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, n);
+    }
+    return taken > 0;
+}
+
+int take_request(std::string& buffer, HttpRequest& request) {
+    const size_t head_end = buffer.find("\r\n\r\n");
+    if (head_end == std::string::npos) {
+        return buffer.size() > SERVER_MAX_REQUEST ? -1 : 0;
+    }
+
+    std::string head = buffer.substr(0, head_end);
+    buffer.erase(0, head_end + 4);
+
+    size_t line_end = head.find("\r\n");
+    std::string request_line = head.substr(0, line_end);
+    size_t sp1 = request_line.find(' ');
+    size_t sp2 = request_line.find(' ', sp1 + 1);
+    if (sp1 == std::string::npos || sp2 == std::string::npos) {
+        return -1;
+    }
+    request = HttpRequest();
+    request.method = request_line.substr(0, sp1);
+    request.path = request_line.substr(sp1 + 1, sp2 - sp1 - 1);
+    request.keep_alive = request_line.compare(sp2 + 1, std::string::npos, "HTTP/1.0") != 0;
+    size_t since = request.path.find("since=");
+    if (since != std::string::npos && (request.path[since - 1] == '?' || request.path[since - 1] == '&')) {
+        request.since = (uint32_t)strtoul(request.path.c_str() + since + 6, nullptr, 10);
+    }
+
+    size_t pos = line_end == std::string::npos ? head.size() : line_end + 2;
+    while (pos < head.size()) {
+        size_t end = head.find("\r\n", pos);
+        if (end == std::string::npos) {
+            end = head.size();
+        }
+        std::string line = head.substr(pos, end - pos);
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) {
+            std::string key = line.substr(0, colon);
+            std::string value = line.substr(colon + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            if (strcasecmp(key.c_str(), "If-None-Match") == 0) {
+                request.if_none_match = value;
+            } else if (strcasecmp(key.c_str(), "Accept") == 0) {
+                request.accept = value;
+            } else if (strcasecmp(key.c_str(), "Authorization") == 0) {
+                request.authorization = value;
+            } else if (strcasecmp(key.c_str(), "Connection") == 0) {
+                request.keep_alive = strcasecmp(value.c_str(), "close") != 0;
+            }
+        }
+        pos = end + 2;
+    }
+    return 1;
+}
+
+bool send_all(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+std::string query_param(const std::string& path, const char* name) {
+    const std::string prefix = std::string(name) + "=";
+    size_t pos = path.find('?');
+    while (pos != std::string::npos) {
+        pos++;
+        if (path.compare(pos, prefix.size(), prefix) == 0) {
+            std::string value = path.substr(pos + prefix.size(), path.find('&', pos) - pos - prefix.size());
+            for (size_t at; (at = value.find("%3A")) != std::string::npos || (at = value.find("%3a")) != std::string::npos;) {
+                value.replace(at, 3, ":");
+            }
+            return value;
+        }
+        pos = path.find('&', pos);
+    }
+    return "";
+}
+
+std::string layout_route(const std::string& path, bool& stream) {
+    static const size_t prefix = strlen(LEDSTRIPS_LAYOUT_PATH);
+    stream = false;
+    if (path.compare(0, prefix, LEDSTRIPS_LAYOUT_PATH) != 0) {
+        return "";
+    }
+    std::string id = path.substr(prefix, path.find('?') - prefix);
+    const size_t slash = id.find('/');
+    if (slash != std::string::npos) {
+        stream = id.compare(slash, std::string::npos, "/stream") == 0;
+        if (!stream) {
+            return "";
+        }
+        id.erase(slash);
+    }
+    return id;
+}
+
+std::string layout_json(const std::string& id) {
+    return "{\"layout\":\"" + id + "\"}";
+}
+
+bool load_stops(const std::string& path, StibConfig& config) {
+    config = StibConfig::defaults();
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        unsigned line_id, point_id, row, led;
+        if (sscanf(line.c_str(), "%u %u %u %u", &line_id, &point_id, &row, &led) == 4 &&
+            !config.add_point((uint16_t)line_id, point_id, (uint8_t)row, (uint8_t)led)) {
+            return false;
+        }
+    }
+    return config.point_count > 0 && config.is_valid();
+}
+
+static int failures = 0;
+
+void expect(bool condition, const char* what) {
+    printf("%s  %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) {
+        failures++;
+    }
+}
+
+int self_check_result() {
+    printf(failures ? "FAILED: %d checks\n" : "OK\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
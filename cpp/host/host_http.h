@@ -0,0 +1,281 @@
+// host_http.h
+// HTTP/1.1 pieces shared by the host servers: request parsing, ETags, the
+// JSON strips representation, the replay of recorded STIB responses, and a
+// minimal keep-alive client and check reporting for the self-checks.
+#pragma once
+
+#include "animation.h"
+#include "sse_parser.h"
+#include "stib_config.h"
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <strings.h>
+#include <vector>
+
+#define SERVER_MAX_REQUEST 8192
+#define LEDSTRIPS_PATH "/api/esp/ledstrips"
+#define LEDSTRIPS_STREAM_PATH "/api/esp/ledstrips/stream"
+// Layout URLs: the device registers its MAC once, then polls the layout
+#define LAYOUT_REGISTER_PATH "/api/esp/layout"
+#define LEDSTRIPS_LAYOUT_PATH "/api/esp/ledstrips/layout/"
+// Offline timetable of a display (timetable.h), by MAC or by layout
+#define TIMETABLE_PATH "/api/esp/timetable"
+#define TIMETABLE_LAYOUT_PATH "/api/esp/timetable/layout/"
+#define STIB_RECORDS_PATH "/api/explore/v2.1/catalog/datasets/vehicle-position-rt-production/records"
+
+struct HttpRequest {
+    std::string method;
+    std::string path;
+    std::string if_none_match;
+    std::string accept;
+    std::string authorization;
+    uint32_t since = 0;         // "since" query parameter, 0 when absent
+    bool keep_alive = true;
+};
+
+struct HttpResponse {
+    int status = 0;
+    std::string etag;
+    std::string content_type;
+    std::string cache_control;
+    std::string body;
+};
+
+// One representation of the current state
+struct Representation {
+    std::string body;
+    std::string etag;
+    const char* content_type;
+};
+
+// Quoted ETag for body, prefix tells representations apart
+std::string content_etag(const std::string& body, const char* prefix);
+
+// {"strips":[{"h":0,"v":[...],"fx":[...]},...]}, as the production server sends
+std::string strips_json(const Animation& animation);
+
+// If-None-Match: "*" or a comma separated list of (possibly weak) tags
+bool etag_matches(const std::string& header, const std::string& etag);
+
+// Reads one request head from fd. buffer keeps bytes of the next pipelined request.
+bool read_request(int fd, std::string& buffer, HttpRequest& request);
+// Same for bytes already received: takes one request head off buffer.
+// Returns 1 when it did, 0 while the head is incomplete, -1 when malformed.
+int take_request(std::string& buffer, HttpRequest& request);
+
+bool send_all(int fd, const std::string& data);
+
+// Value of a query parameter, undecoded but for %3A (MAC separators)
+std::string query_param(const std::string& path, const char* name);
+
+// Layout ID of LEDSTRIPS_LAYOUT_PATH "<id>[/stream][?...]", empty for other
+// paths. stream tells the event stream form.
+std::string layout_route(const std::string& path, bool& stream);
+
+// Registration response: {"layout":"<id>"}
+std::string layout_json(const std::string& id);
+
+// Stop table in the format of the firmware's web form: line pointId row led
+bool load_stops(const std::string& path, StibConfig& config);
+
+// --self-check output: one line per check, failures counted
+void expect(bool condition, const char* what);
+// Prints OK or the failure count, returns the exit status
+int self_check_result();
+
+// Recorded STIB responses, served one at a time in name order
+class StibReplay {
+public:
+    // Loads every *.json of dir, returns the count
+    size_t load(const std::string& dir) {
+        std::vector<std::string> names;
+        if (DIR* d = opendir(dir.c_str())) {
+            while (dirent* entry = readdir(d)) {
+                std::string name = entry->d_name;
+                if (name.size() > 5 && name.compare(name.size() - 5, 5, ".json") == 0) {
+                    names.push_back(name);
+                }
+            }
+            closedir(d);
+        }
+        std::sort(names.begin(), names.end());
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const std::string& name : names) {
+            std::ifstream file(dir + "/" + name, std::ios::binary);
+            std::ostringstream body;
+            body << file.rdbuf();
+            names_.push_back(name);
+            bodies_.push_back(body.str());
+        }
+        return bodies_.size();
+    }
+
+    size_t size() const { return bodies_.size(); }
+    const std::string& name(size_t i) const { return names_[i]; }
+    const std::string& body(size_t i) const { return bodies_[i]; }
+
+    // Next recording, wrapping around
+    void advance() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!bodies_.empty()) {
+            current_ = (current_ + 1) % bodies_.size();
+        }
+    }
+
+    void snapshot(Representation& out) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out.body = bodies_[current_];
+        out.etag = content_etag(out.body, "stib-");
+        out.content_type = "application/json; charset=utf-8";
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::string> names_;
+    std::vector<std::string> bodies_;
+    size_t current_ = 0;
+};
+
+// Minimal keep-alive client for --self-check
+class TestClient {
+public:
+    bool connect_to(int port) {
+        fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        timeval timeout{5, 0};
+        setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        return connect(fd_, (sockaddr*)&addr, sizeof(addr)) == 0;
+    }
+
+    ~TestClient() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    bool get(const std::string& path, const std::string& if_none_match, HttpResponse& response,
+             const char* accept = nullptr, const char* authorization = nullptr) {
+        std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n";
+        if (accept) {
+            request += "Accept: " + std::string(accept) + "\r\n";
+        }
+        if (authorization) {
+            request += "Authorization: " + std::string(authorization) + "\r\n";
+        }
+        if (!if_none_match.empty()) {
+            request += "If-None-Match: " + if_none_match + "\r\n";
+        }
+        request += "\r\n";
+        size_t content_length = 0;
+        if (!send_all(fd_, request) || !read_head(response, content_length)) {
+            return false;
+        }
+
+        while (buffer_.size() < content_length) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        response.body = buffer_.substr(0, content_length);
+        buffer_.erase(0, content_length);
+        return true;
+    }
+
+    // Requests an event stream and reads the response head
+    bool open_stream(const std::string& path, HttpResponse& response) {
+        std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\nAccept: text/event-stream\r\n\r\n";
+        size_t content_length = 0;
+        return send_all(fd_, request) && read_head(response, content_length);
+    }
+
+    // Feeds the de-chunked stream body to parser until done() holds
+    bool read_stream(SseParser& parser, const std::function<bool()>& done) {
+        while (!done()) {
+            size_t line_end;
+            while ((line_end = buffer_.find("\r\n")) == std::string::npos) {
+                if (!fill()) {
+                    return false;
+                }
+            }
+            size_t size = strtoul(buffer_.c_str(), nullptr, 16);
+            if (size == 0) {
+                return false;   // last chunk: the server ended the stream
+            }
+            while (buffer_.size() < line_end + 2 + size + 2) {
+                if (!fill()) {
+                    return false;
+                }
+            }
+            parser.feed(buffer_.data() + line_end + 2, size);
+            buffer_.erase(0, line_end + 2 + size + 2);
+        }
+        return true;
+    }
+
+private:
+    bool read_head(HttpResponse& response, size_t& content_length) {
+        size_t head_end;
+        while ((head_end = buffer_.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        std::string head = buffer_.substr(0, head_end);
+        buffer_.erase(0, head_end + 4);
+
+        response = HttpResponse();
+        response.status = atoi(head.c_str() + head.find(' ') + 1);
+        content_length = 0;
+        size_t pos = head.find("\r\n");
+        while (pos != std::string::npos && pos < head.size()) {
+            size_t end = head.find("\r\n", pos + 2);
+            std::string line = head.substr(pos + 2, (end == std::string::npos ? head.size() : end) - pos - 2);
+            size_t colon = line.find(':');
+            if (colon != std::string::npos) {
+                std::string key = line.substr(0, colon);
+                std::string value = line.substr(colon + 2);
+                if (strcasecmp(key.c_str(), "ETag") == 0) {
+                    response.etag = value;
+                } else if (strcasecmp(key.c_str(), "Content-Type") == 0) {
+                    response.content_type = value;
+                } else if (strcasecmp(key.c_str(), "Cache-Control") == 0) {
+                    response.cache_control = value;
+                } else if (strcasecmp(key.c_str(), "Content-Length") == 0) {
+                    content_length = strtoul(value.c_str(), nullptr, 10);
+                }
+            }
+            pos = end;
+        }
+        return true;
+    }
+
+    bool fill() {
+        char chunk[1024];
+        ssize_t n = recv(fd_, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            return false;
+        }
+        buffer_.append(chunk, n);
+        return true;
+    }
+
+    int fd_ = -1;
+    std::string buffer_;
+};
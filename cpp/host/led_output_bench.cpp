@@ -0,0 +1,298 @@
+// led_output_bench.cpp
+// Drives the firmware's frame path (Frame -> DisplayTopology::encode -> backend)
+// against the GPIO simulator, decodes the latched 74HC595 state back into
+// rows and reports push time per chain length, for the bit-banged and the
+// parallel backend. LEDController itself runs on the simulator too: reset
+// and OE sequencing at start, set_rows()/set_frame() and dirty-frame
+// suppression. Exits non-zero when the decoded state, the edge count or OE
+// does not match what was sent.
+#include "display_topology.h"
+#include "frame.h"
+#include "gpio_led_output.h"
+#include "led_controller.h"
+#include "led_mapping.h"
+#include "mock_led_output.h"
+#include "parallel_led_output.h"
+#include "sim_gpio_hal.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#define BENCH_CLOCK_PIN 18
+#define BENCH_DATA_PIN 15
+#define BENCH_LATCH_PIN 5
+#define BENCH_RESET_PIN 19
+#define BENCH_OE_PIN 2
+#define BENCH_FRAMES 50
+#define BENCH_CHAINS 4
+
+// Shared clock, latch, reset and OE, one data pin per chain
+static LEDPinConfig bench_pins(uint8_t chains) {
+    return LEDPinConfig{BENCH_CLOCK_PIN, BENCH_LATCH_PIN, BENCH_RESET_PIN, BENCH_OE_PIN, chains,
+                        {BENCH_DATA_PIN, 4, 16, 17, 21, 22, 23, 25}};
+}
+
+static SimGpioHal bench_sim(uint8_t chains, size_t registers) {
+    const LEDPinConfig pins = bench_pins(chains);
+    const size_t per_chain = (registers + chains - 1) / chains;
+    return SimGpioHal(pins.clock, std::vector<int>(pins.data, pins.data + chains), pins.latch, pins.reset, pins.oe,
+                      per_chain);
+}
+
+static int failures = 0;
+
+static Frame random_frame(std::mt19937& rng, size_t rows) {
+    Frame frame;
+    for (size_t r = 0; r < rows; r++) {
+        frame.rows[r] = rng() & FRAME_ROW_MASK;
+    }
+    frame.row_count = (uint8_t)rows;
+    return frame;
+}
+
+// Latched words in chain positions. With several chains, chain c holds
+// positions [c * per_chain, (c + 1) * per_chain) and a shorter last chain
+// gets its words last (ParallelGpioLEDOutput pads it at the front).
+static std::vector<uint16_t> chain_words(const SimGpioHal& sim, size_t count, size_t chains) {
+    std::vector<uint16_t> words(count, 0);
+    const size_t per_chain = (count + chains - 1) / chains;
+    for (size_t c = 0; c < chains; c++) {
+        const size_t first = c * per_chain;
+        const size_t length = first < count ? std::min(count - first, per_chain) : 0;
+        const std::vector<uint16_t> latched = sim.latched_words(c);
+        for (size_t j = per_chain - length; j < per_chain; j++) {
+            words[first + j - (per_chain - length)] = latched[j];
+        }
+    }
+    return words;
+}
+
+static bool check_latched(const SimGpioHal& sim, const DisplayTopology& topology, const Frame& frame,
+                          size_t chains = 1) {
+    std::vector<uint16_t> latched = chain_words(sim, topology.register_count, chains);
+    for (size_t r = 0; r < topology.register_count; r++) {
+        uint16_t expected = r < frame.row_count ? frame.rows[r] : 0;
+        uint16_t decoded = led_register_to_row(latched[topology.row_order[r]]);
+        if (decoded != expected) {
+            printf("  row %zu: expected 0x%03X, decoded 0x%03X\n", r, expected, decoded);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void bench_gpio(const DisplayTopology& topology, uint32_t pulse_delay_us, std::mt19937& rng) {
+    SimGpioHal sim(BENCH_CLOCK_PIN, BENCH_DATA_PIN, BENCH_LATCH_PIN, BENCH_RESET_PIN, BENCH_OE_PIN,
+                   topology.register_count);
+    GpioLEDOutput output(sim, BENCH_CLOCK_PIN, BENCH_DATA_PIN, BENCH_LATCH_PIN, pulse_delay_us);
+    output.initialize();
+
+    uint16_t words[LED_OUTPUT_MAX_WORDS];
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+
+    for (int i = 0; i < BENCH_FRAMES; i++) {
+        Frame frame = random_frame(rng, topology.register_count - (i % 2));  // short frames too
+        size_t count = topology.encode(frame, words);
+
+        sim.clear_trace();
+        uint64_t start = sim.now_ns();
+        output.write_frame(words, count);
+        uint64_t elapsed = sim.now_ns() - start;
+        total_ns += elapsed;
+        max_ns = elapsed > max_ns ? elapsed : max_ns;
+
+        if (sim.clock_edges() != count * 16 || sim.latch_edges() != 1) {
+            printf("  frame %d: %u clock / %u latch edges, expected %zu / 1\n",
+                   i, sim.clock_edges(), sim.latch_edges(), count * 16);
+            failures++;
+        }
+        if (!check_latched(sim, topology, frame)) {
+            printf("  frame %d: decoded state mismatch\n", i);
+            failures++;
+        }
+    }
+
+    printf("gpio  %2d regs  pulse %3u us  push avg %9.1f us  max %9.1f us\n",
+           topology.register_count, pulse_delay_us,
+           total_ns / 1000.0 / BENCH_FRAMES, max_ns / 1000.0);
+}
+
+static void bench_mock(const DisplayTopology& topology, uint32_t clock_hz, std::mt19937& rng) {
+    MockLEDOutput output(clock_hz);
+    output.initialize();
+
+    uint16_t words[LED_OUTPUT_MAX_WORDS];
+    uint64_t bus_ns = 0;
+    uint64_t push_ns = 0;
+
+    for (int i = 0; i < BENCH_FRAMES; i++) {
+        Frame frame = random_frame(rng, topology.register_count);
+        size_t count = topology.encode(frame, words);
+
+        auto start = std::chrono::steady_clock::now();
+        output.write_frame(words, count);
+        push_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        bus_ns += output.last_bus_ns();
+
+        for (size_t r = 0; r < count; r++) {
+            if (led_register_to_row(output.latched()[topology.row_order[r]]) != frame.rows[r]) {
+                printf("  mock frame %d row %zu mismatch\n", i, r);
+                failures++;
+                break;
+            }
+        }
+    }
+
+    printf("mock  %2d regs  %4u kHz    bus  avg %9.1f us  encode+push avg %6.2f us\n",
+           topology.register_count, clock_hz / 1000,
+           bus_ns / 1000.0 / BENCH_FRAMES, push_ns / 1000.0 / BENCH_FRAMES);
+}
+
+static void bench_parallel(const DisplayTopology& topology, uint8_t chains, std::mt19937& rng) {
+    SimGpioHal sim = bench_sim(chains, topology.register_count);
+    ParallelGpioLEDOutput output(sim, bench_pins(chains));
+    if (!output.initialize()) {
+        printf("  parallel output failed to initialize\n");
+        failures++;
+        return;
+    }
+
+    uint16_t words[LED_OUTPUT_MAX_WORDS];
+    const size_t per_chain = (topology.register_count + chains - 1) / chains;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+
+    for (int i = 0; i < BENCH_FRAMES; i++) {
+        Frame frame = random_frame(rng, topology.register_count - (i % 2));
+        size_t count = topology.encode(frame, words);
+
+        sim.clear_trace();
+        uint64_t start = sim.now_ns();
+        output.write_frame(words, count);
+        uint64_t elapsed = sim.now_ns() - start;
+        total_ns += elapsed;
+        max_ns = elapsed > max_ns ? elapsed : max_ns;
+
+        // Every clock edge moves all chains: the longest one sets the time
+        if (sim.clock_edges() != per_chain * 16 || sim.latch_edges() != 1) {
+            printf("  parallel frame %d: %u clock / %u latch edges, expected %zu / 1\n",
+                   i, sim.clock_edges(), sim.latch_edges(), per_chain * 16);
+            failures++;
+        }
+        if (!check_latched(sim, topology, frame, chains)) {
+            printf("  parallel frame %d: decoded state mismatch\n", i);
+            failures++;
+        }
+    }
+
+    printf("par   %2d regs  %d chains    push avg %9.1f us  max %9.1f us\n",
+           topology.register_count, chains, total_ns / 1000.0 / BENCH_FRAMES, max_ns / 1000.0);
+}
+
+static size_t oe_transitions(const SimGpioHal& sim) {
+    size_t count = 0;
+    for (const SimGpioHal::Transition& t : sim.transitions()) {
+        count += t.pin == BENCH_OE_PIN;
+    }
+    return count;
+}
+
+static void expect_controller(bool condition, uint8_t chains, const char* what) {
+    if (!condition) {
+        printf("  controller, %d chain(s): %s\n", chains, what);
+        failures++;
+    }
+}
+
+// LEDController on the simulator: OE only enabled once the registers were
+// reset and latched with zeros, frames through set_rows() and set_frame()
+// decoded back, identical frames not shifted out again
+static void check_controller(uint8_t chains, std::mt19937& rng) {
+    DisplayTopology topology = DisplayTopology::defaults();
+    topology.register_count = 10;
+    for (uint8_t r = 0; r < topology.register_count; r++) {
+        topology.row_order[r] = topology.register_count - 1 - r;
+    }
+    SimGpioHal sim = bench_sim(chains, topology.register_count);
+    LEDController controller(sim, bench_pins(chains));
+
+    expect_controller(controller.initialize(), chains, "initialize() failed");
+    expect_controller(!strcmp(controller.output_name(), chains > 1 ? "parallel" : "gpio"), chains, "wrong backend");
+    uint64_t reset_ns = 0, latch_ns = 0, enable_ns = 0;
+    for (const SimGpioHal::Transition& t : sim.transitions()) {
+        if (t.pin == BENCH_RESET_PIN && t.level == 0 && !reset_ns) {
+            reset_ns = t.time_ns;
+        } else if (t.pin == BENCH_LATCH_PIN && t.level == 1 && !latch_ns) {
+            latch_ns = t.time_ns;
+        } else if (t.pin == BENCH_OE_PIN && t.level == 0) {
+            enable_ns = t.time_ns;
+        }
+    }
+    expect_controller(sim.outputs_enabled() && oe_transitions(sim) == 1, chains, "OE not enabled exactly once");
+    expect_controller(reset_ns && reset_ns < latch_ns && latch_ns < enable_ns, chains,
+                      "OE enabled before the registers were reset and latched");
+
+    expect_controller(controller.set_topology(topology), chains, "topology rejected");
+    sim.clear_trace();
+    Frame frame = random_frame(rng, topology.register_count);
+    expect_controller(controller.set_frame(frame) && check_latched(sim, topology, frame, chains), chains,
+                      "set_frame() state mismatch");
+    const uint32_t clock_edges = sim.clock_edges();
+    expect_controller(!controller.set_frame(frame) && sim.clock_edges() == clock_edges, chains,
+                      "identical frame shifted out again");
+
+    // set_rows() converts through Frame::from_rows before set_frame()
+    bool rows[LED_MAX_ROWS][LEDS_PER_ROW] = {};
+    frame = random_frame(rng, 7);
+    for (size_t r = 0; r < frame.row_count; r++) {
+        for (size_t i = 0; i < LEDS_PER_ROW; i++) {
+            rows[r][i] = frame.get_led(r, i);
+        }
+    }
+    controller.set_rows(rows, frame.row_count);
+    expect_controller(check_latched(sim, topology, frame, chains), chains, "set_rows() state mismatch");
+    expect_controller(sim.latch_edges() == 2, chains, "unexpected latch count");
+    expect_controller(sim.outputs_enabled() && oe_transitions(sim) == 0, chains, "OE changed while pushing frames");
+
+    const LEDController::LEDStats stats = controller.get_stats();
+    expect_controller(stats.frames_pushed == 2 && stats.frames_skipped == 1, chains, "frame counters");
+    expect_controller(stats.pushes == 2 && stats.push_min_us <= stats.push_avg_us &&
+                          stats.push_avg_us <= stats.push_max_us && stats.since_latch_ms == 0 &&
+                          stats.busy_permille <= 1000, chains, "push timing stats");
+}
+
+int main() {
+    std::mt19937 rng(12345);
+
+    check_controller(1, rng);
+    check_controller(BENCH_CHAINS, rng);
+
+    const uint8_t chain_lengths[] = {4, 10, 32, 64};
+    for (uint8_t registers : chain_lengths) {
+        DisplayTopology topology = DisplayTopology::defaults();
+        topology.register_count = registers;
+
+        bench_gpio(topology, PULSE_DELAY_US, rng);
+        bench_gpio(topology, 1, rng);
+        bench_parallel(topology, BENCH_CHAINS, rng);
+        bench_mock(topology, 1000000, rng);
+
+        // Reversed physical row order
+        for (uint8_t r = 0; r < registers; r++) {
+            topology.row_order[r] = registers - 1 - r;
+        }
+        bench_gpio(topology, 1, rng);
+        bench_parallel(topology, 3, rng);
+    }
+
+    if (failures) {
+        printf("FAILED: %d mismatches\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("OK\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1140 @@
+// ledstrips_server.cpp
+// Local stand-in for the /api/esp/ledstrips endpoint. Serves a generated LED
+// state over plain HTTP/1.1 keep-alive with an ETag and answers matching
+// If-None-Match requests with 304 Not Modified, like the production server.
+// Requests that list FRAME_CODEC_CONTENT_TYPE in Accept get the binary
+// frame (frame_codec, shared with the firmware), others the JSON strips.
+// A binary request with "since=<sequence>" in the query gets a delta onto
+// that state while it is among the last SERVER_HISTORY ones, and --vehicles
+// adds dead-reckoned vehicles (binary only). With --timeline N, clients that
+// accept timelines get the current state and the next N-1 changes, which
+// the server works out ahead so the predictions always come true.
+// /api/esp/ledstrips/stream pushes every state change as a Server-Sent
+// Events "frame" event (base64 frame_codec, deltas after the first), with a
+// comment heartbeat.
+//
+// Every display is given the same layout (--layout ID): /api/esp/layout?mac=
+// answers {"layout":"<id>"} and /api/esp/ledstrips/layout/<id>[/stream]
+// serves the state as the per-MAC URLs do, but with Cache-Control: public
+// so shared caches may keep it. --layout "" answers 404 to registrations,
+// like a server without layouts.
+//
+// --timetable FILE serves a timetable built by gtfs_timetable at
+// /api/esp/timetable?mac= and /api/esp/timetable/layout/<id>, tagged with
+// its crc32 so a display asks with what it holds in flash.
+//
+// With --stib DIR it also stands in for the STIB open-data records endpoint
+// of the firmware's direct mode: the *.json responses in DIR are replayed in
+// name order, moving on with each state change, to requests carrying
+// "Authorization: Apikey <--stib-key>" (401 otherwise), with ETag / 304.
+//
+//   ledstrips_server [--port N] [--rows N] [--change-every S] [--flips N]
+//                    [--vehicles N] [--timeline N] [--packed12] [--heartbeat S]
+//                    [--max-age S] [--layout ID] [--timetable FILE]
+//                    [--stib DIR] [--stib-key KEY]
+//   ledstrips_server --self-check
+//
+// A firmware build pointed at it (-DLED_UPDATER_BASE_URL="http://<host>:<port>",
+// and -DLED_UPDATER_STIB_URL for direct mode) streams or polls it like the
+// real servers. --self-check starts it on a free port and verifies the 200
+// and 304 paths of both formats over a single connection, the event stream,
+// then the STIB replay of fixtures/stib through the firmware's StibParser.
+#include "frame_codec.h"
+#include "host_http.h"
+#include "layout_id.h"
+#include "sse_parser.h"
+#include "stib_parser.h"
+#include "strips_parser.h"
+#include "timetable.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <strings.h>
+#include <thread>
+#include <vector>
+
+#define SERVER_DEFAULT_PORT 8080
+#define SERVER_DEFAULT_ROWS 10
+#define SERVER_DEFAULT_CHANGE_S 30
+#define SERVER_DEFAULT_FLIPS 2          // LEDs toggled per state change
+#define SERVER_HISTORY 16               // states a delta can start from
+#define SERVER_VEHICLE_SPEED 192        // position units per minute, a stop every 80 s
+#define SERVER_LEDS_PER_ROW 12
+#define SERVER_DEFAULT_HEARTBEAT_S 15
+#define SERVER_STREAM_RETRY_MS 2000
+#define SERVER_DEFAULT_STIB_KEY "local-test-key"
+#define SERVER_DEFAULT_LAYOUT "default"
+#define SERVER_TIMETABLE_MAX_AGE_S 3600
+
+// Current LED state. Each change toggles a few LEDs, like a vehicle moving
+// on, so consecutive states differ in a handful of rows. Vehicles, one per
+// row from the first, are reported where they would be by now.
+class LedState {
+public:
+    LedState(int rows, bool packed12, int flips = SERVER_DEFAULT_FLIPS, int vehicles = 0)
+        : rows_(rows), packed12_(packed12), flips_(flips), version_(1), rng_(1),
+          timeline_entries_(0), timeline_step_ms_(0), changed_ms_(now_ms()) {
+        for (int r = 0; r < rows_ && r < LED_MAX_ROWS; r++) {
+            for (int i = 0; i < LEDS_PER_ROW; i++) {
+                animation_.base.set_led(r, i, rng_() % 3 == 0);
+            }
+        }
+        animation_.base.row_count = rows_ < LED_MAX_ROWS ? rows_ : LED_MAX_ROWS;
+        for (int v = 0; v < vehicles && v < animation_.base.row_count && v < ANIMATION_MAX_VEHICLES; v++) {
+            vehicles_.push_back({(uint8_t)v, (uint16_t)(rng_() % (LEDS_PER_ROW * ANIMATION_POSITION_ONE)),
+                                 now_ms()});
+        }
+        rebuild();
+    }
+
+    void advance() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        history_.emplace_back(version_, animation_);
+        if (history_.size() > SERVER_HISTORY) {
+            history_.pop_front();
+        }
+        version_++;
+        const uint64_t now = now_ms();
+        changed_ms_ = now;
+        for (TrackedVehicle& vehicle : vehicles_) {
+            // Wraps around to the first stop: the next trip
+            const uint64_t moved = SERVER_VEHICLE_SPEED * (now - vehicle.reported_ms) / 60000;
+            vehicle.position = (uint16_t)((vehicle.position + moved) % (LEDS_PER_ROW * ANIMATION_POSITION_ONE));
+            vehicle.reported_ms = now - rng_() % 10000;
+        }
+        if (future_.empty()) {
+            future_.push_back(successor(animation_, version_));
+        }
+        animation_ = future_.front();
+        future_.pop_front();
+        rebuild();
+        changed_.notify_all();
+    }
+
+    // Timelines of entries frames, one per expected change every step_ms
+    void set_timeline(int entries, int step_ms) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        timeline_entries_ = entries < FRAME_CODEC_TIMELINE_MAX_ENTRIES ? entries : FRAME_CODEC_TIMELINE_MAX_ENTRIES;
+        timeline_step_ms_ = step_ms;
+    }
+
+    // Waits up to timeout for a version other than seen. On a change, event
+    // receives the binary frame as an SSE event, a delta onto seen when it
+    // is still known, and seen is updated.
+    bool wait_for_change(uint32_t& seen, std::chrono::milliseconds timeout, std::string& event) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!changed_.wait_for(lock, timeout, [&] { return version_ != seen; })) {
+            return false;
+        }
+        std::string body = binary_since(seen);
+        seen = version_;
+        std::string text(FRAME_CODEC_BASE64_SIZE(body.size()), '\0');
+        frame_codec_base64_encode((const uint8_t*)body.data(), body.size(), &text[0], text.size());
+        event = "event: frame\nid: " + binary_.etag + "\ndata: " + text + "\n\n";
+        return true;
+    }
+
+    // The binary representation is a delta when since names a known state,
+    // and a timeline of at most timeline_limit entries when the client takes
+    // them. It keeps the ETag of the full frame: all describe the same
+    // current state.
+    void snapshot(bool binary, uint32_t since, size_t timeline_limit, Representation& out) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out = binary ? binary_ : json_;
+        const int entries = std::min(timeline_entries_, (int)timeline_limit);
+        if (binary && entries > 1) {
+            out.body = timeline_since(since, entries);
+        } else if (binary && since) {
+            out.body = binary_since(since);
+        }
+    }
+
+    Animation animation() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return animation_;
+    }
+
+    uint32_t version() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return version_;
+    }
+
+private:
+    struct TrackedVehicle {
+        uint8_t row;
+        uint16_t position;
+        uint64_t reported_ms;
+    };
+
+    static uint64_t now_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // The state after from at version: flips_ LEDs toggled, effects on even versions
+    Animation successor(const Animation& from, uint32_t version) {
+        Animation next = from;
+        for (int f = 0; f < flips_ && next.base.row_count; f++) {
+            const size_t row = rng_() % next.base.row_count;
+            const size_t led = rng_() % LEDS_PER_ROW;
+            next.base.set_led(row, led, !next.base.get_led(row, led));
+        }
+        next.effect_count = 0;
+        if (version % 2 == 0) {
+            // A vehicle between two stops: anti-phase blink
+            next.add_effect(0, 4, 1000, 500, 0);
+            next.add_effect(0, 5, 1000, 500, 500);
+        }
+        return next;
+    }
+
+    // Current state (as for binary_since), then a delta per upcoming change
+    std::string timeline_since(uint32_t since, int count) {
+        while (future_.size() + 1 < (size_t)count) {
+            future_.push_back(successor(future_.empty() ? animation_ : future_.back(),
+                                        version_ + (uint32_t)future_.size() + 1));
+        }
+
+        const uint64_t now = now_ms();
+        std::vector<std::string> bodies;
+        bodies.push_back(binary_since(since));
+        Animation previous = animation_;
+        for (int k = 1; k < count; k++) {
+            // Vehicles as reported now, the display moves them on
+            Animation predicted = future_[k - 1];
+            memcpy(predicted.vehicles, animation_.vehicles, sizeof(predicted.vehicles));
+            predicted.vehicle_count = animation_.vehicle_count;
+
+            uint8_t buffer[FRAME_CODEC_MAX_SIZE];
+            FrameCodecHeader fields = header();
+            fields.sequence = version_ + k;
+            fields.base_sequence = version_ + k - 1;
+            size_t length = frame_codec_encode_delta(previous, predicted, fields, buffer, sizeof(buffer));
+            bodies.emplace_back((const char*)buffer, length);
+            previous = predicted;
+        }
+
+        FrameCodecTimelineEntry entries[FRAME_CODEC_TIMELINE_MAX_ENTRIES];
+        size_t total = 0;
+        for (size_t k = 0; k < bodies.size(); k++) {
+            const uint64_t apply_ms = k ? changed_ms_ + k * timeline_step_ms_ : now;
+            entries[k].offset_ms = apply_ms > now ? (uint32_t)(apply_ms - now) : 0;
+            entries[k].data = (const uint8_t*)bodies[k].data();
+            entries[k].length = bodies[k].size();
+            total += bodies[k].size();
+        }
+        std::string out(total + bodies.size() * FRAME_CODEC_TIMELINE_ENTRY_SIZE + 16, '\0');
+        out.resize(frame_codec_encode_timeline(now, entries, bodies.size(), (uint8_t*)&out[0], out.size()));
+        return out;
+    }
+
+    FrameCodecHeader header() const {
+        FrameCodecHeader header{};
+        header.flags = FRAME_CODEC_FLAG_SEQUENCE | FRAME_CODEC_FLAG_TIMESTAMP |
+                       (packed12_ ? FRAME_CODEC_FLAG_PACKED12 : 0);
+        header.sequence = version_;
+        header.emitted_ms = emitted_ms_;
+        return header;
+    }
+
+    // Delta from since when it is in the history and smaller, else the full frame
+    std::string binary_since(uint32_t since) const {
+        for (const auto& entry : history_) {
+            if (entry.first != since) {
+                continue;
+            }
+            uint8_t buffer[FRAME_CODEC_MAX_SIZE];
+            FrameCodecHeader fields = header();
+            fields.base_sequence = since;
+            size_t length = frame_codec_encode_delta(entry.second, animation_, fields, buffer, sizeof(buffer));
+            if (length && length < binary_.body.size()) {
+                return std::string((const char*)buffer, length);
+            }
+            break;
+        }
+        return binary_.body;
+    }
+
+    void rebuild() {
+        emitted_ms_ = now_ms();
+        animation_.vehicle_count = 0;
+        for (const TrackedVehicle& vehicle : vehicles_) {
+            const uint64_t age_ms = emitted_ms_ - vehicle.reported_ms;
+            animation_.add_vehicle(vehicle.row, vehicle.position, SERVER_VEHICLE_SPEED,
+                                   (uint16_t)(age_ms < 0xFFFF ? age_ms : 0xFFFF));
+        }
+
+        json_.body = strips_json(animation_);
+        json_.etag = content_etag(json_.body, "j");
+        json_.content_type = "application/json";
+
+        uint8_t buffer[FRAME_CODEC_MAX_SIZE];
+        size_t length = frame_codec_encode(animation_, header(), buffer, sizeof(buffer));
+        binary_.body.assign((const char*)buffer, length);
+        binary_.etag = content_etag(binary_.body, "b");
+        binary_.content_type = FRAME_CODEC_CONTENT_TYPE;
+    }
+
+    int rows_;
+    bool packed12_;
+    int flips_;
+    uint32_t version_;          // frame sequence, never 0
+    uint64_t emitted_ms_;
+    std::mt19937 rng_;
+    Animation animation_;
+    std::deque<std::pair<uint32_t, Animation>> history_;
+    std::deque<Animation> future_;      // upcoming states, worked out ahead
+    int timeline_entries_;
+    int timeline_step_ms_;
+    uint64_t changed_ms_;
+    std::vector<TrackedVehicle> vehicles_;
+    Representation json_;
+    Representation binary_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+};
+
+class LedstripsServer {
+public:
+    LedstripsServer(LedState& state, bool verbose, int heartbeat_s)
+        : state_(state), verbose_(verbose), heartbeat_s_(heartbeat_s), max_age_s_(-1), listen_fd_(-1),
+          layout_(SERVER_DEFAULT_LAYOUT), timetable_{"", "", TIMETABLE_CONTENT_TYPE}, stib_(nullptr) {}
+
+    // Cache-Control: max-age sent with the state, -1 for none
+    void set_max_age(int max_age_s) { max_age_s_ = max_age_s; }
+
+    // Layout every display registers to, empty for none
+    void set_layout(const std::string& layout) { layout_ = layout; }
+
+    // Timetable served to every display, false when body is not one
+    bool set_timetable(const std::string& body) {
+        Timetable timetable;
+        char etag[TIMETABLE_ETAG_SIZE];
+        if (!timetable.attach((const uint8_t*)body.data(), body.size()) || timetable.size() != body.size()) {
+            return false;
+        }
+        timetable_etag(timetable.crc32(), etag);
+        timetable_.body = body;
+        timetable_.etag = etag;
+        return true;
+    }
+
+    // Serves STIB_RECORDS_PATH from replay to requests with the API key
+    void set_stib_replay(StibReplay* replay, const std::string& key) {
+        stib_ = replay;
+        stib_authorization_ = "Apikey " + key;
+    }
+
+    // Binds to port (0 = any free port), returns the bound port or -1
+    int listen_on(int port) {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd_, 16) < 0) {
+            perror("bind/listen");
+            return -1;
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(listen_fd_, (sockaddr*)&addr, &len);
+        return ntohs(addr.sin_port);
+    }
+
+    void run() {
+        while (true) {
+            int fd = accept(listen_fd_, nullptr, nullptr);
+            if (fd < 0) {
+                continue;
+            }
+            std::thread(&LedstripsServer::serve_connection, this, fd).detach();
+        }
+    }
+
+private:
+    void serve_connection(int fd) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        std::string buffer;
+        HttpRequest request;
+        while (read_request(fd, buffer, request)) {
+            bool layout_stream;
+            const std::string layout = layout_route(request.path, layout_stream);
+            if (request.method == "GET" &&
+                (request.path.compare(0, strlen(LEDSTRIPS_STREAM_PATH), LEDSTRIPS_STREAM_PATH) == 0 ||
+                 (layout_stream && !layout_.empty() && layout == layout_))) {
+                serve_stream(fd, request);
+                break;
+            }
+            std::string response = handle(request);
+            if (!send_all(fd, response) || !request.keep_alive) {
+                break;
+            }
+        }
+        close(fd);
+    }
+
+    static bool send_chunk(int fd, const std::string& data) {
+        char size[16];
+        snprintf(size, sizeof(size), "%zx\r\n", data.size());
+        return send_all(fd, size + data + "\r\n");
+    }
+
+    // Chunked text/event-stream until the client goes away: the current
+    // state right away, then one event per change, heartbeats in between
+    void serve_stream(int fd, const HttpRequest& request) {
+        if (verbose_) {
+            printf("GET %s -> event stream\n", request.path.c_str());
+            fflush(stdout);
+        }
+        std::string head = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                           "Cache-Control: no-cache\r\nTransfer-Encoding: chunked\r\n\r\n";
+        if (!send_all(fd, head) || !send_chunk(fd, "retry: " + std::to_string(SERVER_STREAM_RETRY_MS) + "\n\n")) {
+            return;
+        }
+
+        uint32_t seen = UINT32_MAX;
+        std::string event;
+        while (true) {
+            bool ok;
+            if (state_.wait_for_change(seen, std::chrono::seconds(heartbeat_s_), event)) {
+                ok = send_chunk(fd, event);
+                if (verbose_) {
+                    printf("  stream: frame %u\n", seen);
+                    fflush(stdout);
+                }
+            } else {
+                ok = send_chunk(fd, ": heartbeat\n\n");
+            }
+            if (!ok) {
+                break;
+            }
+        }
+    }
+
+    std::string handle(const HttpRequest& request) {
+        Representation rep{"not found", "", "text/plain"};
+        int status;
+        bool layout_stream;
+        const std::string layout = layout_route(request.path, layout_stream);
+        const std::string route = request.path.substr(0, request.path.find('?'));
+        const bool timetable_by_layout = route.compare(0, strlen(TIMETABLE_LAYOUT_PATH), TIMETABLE_LAYOUT_PATH) == 0;
+        const bool timetable = route == TIMETABLE_PATH || timetable_by_layout;
+
+        if (request.method == "GET" && stib_ && stib_->size() &&
+            request.path.compare(0, strlen(STIB_RECORDS_PATH), STIB_RECORDS_PATH) == 0) {
+            if (request.authorization != stib_authorization_) {
+                rep = {"{\"error_code\": \"InvalidAPIKey\"}", "", "application/json"};
+                status = 401;
+            } else {
+                stib_->snapshot(rep);
+                status = etag_matches(request.if_none_match, rep.etag) ? 304 : 200;
+            }
+        } else if (request.method == "GET" && route == LAYOUT_REGISTER_PATH) {
+            const bool known = !layout_.empty() && !query_param(request.path, "mac").empty();
+            rep = known ? Representation{layout_json(layout_), "", "application/json"} : rep;
+            status = known ? 200 : 404;
+        } else if (request.method == "GET" && timetable) {
+            const bool known = !timetable_.body.empty() &&
+                               (timetable_by_layout ? !layout_.empty() &&
+                                                      route.substr(strlen(TIMETABLE_LAYOUT_PATH)) == layout_
+                                                    : !query_param(request.path, "mac").empty());
+            rep = known ? timetable_ : rep;
+            status = !known ? 404 : etag_matches(request.if_none_match, rep.etag) ? 304 : 200;
+        } else if (request.method != "GET" || (route != LEDSTRIPS_PATH && layout.empty()) ||
+                   (!layout.empty() && (layout_stream || layout != layout_))) {
+            status = 404;
+        } else {
+            const bool binary = request.accept.find(FRAME_CODEC_CONTENT_TYPE) != std::string::npos;
+            state_.snapshot(binary, request.since, frame_codec_timeline_limit(request.accept.c_str()), rep);
+            status = etag_matches(request.if_none_match, rep.etag) ? 304 : 200;
+        }
+
+        std::string body = rep.body;
+        std::string head = "HTTP/1.1 " + std::to_string(status) +
+                           (status == 200 ? " OK" : status == 304 ? " Not Modified" :
+                            status == 401 ? " Unauthorized" : " Not Found") + "\r\n";
+        if (!rep.etag.empty()) {
+            head += "ETag: " + rep.etag + "\r\nVary: Accept\r\n";
+            if (route == STIB_RECORDS_PATH) {
+                if (max_age_s_ >= 0) {
+                    head += "Cache-Control: max-age=" + std::to_string(max_age_s_) + "\r\n";
+                }
+            } else if (timetable) {
+                head += std::string("Cache-Control: ") + (timetable_by_layout ? "public" : "private") +
+                        ", max-age=" + std::to_string(SERVER_TIMETABLE_MAX_AGE_S) + "\r\n";
+            } else {
+                // A layout is the same for every display showing it, a MAC
+                // URL for one display only. Without max-age, caches revalidate.
+                head += std::string("Cache-Control: ") + (layout.empty() ? "private" : "public") +
+                        (max_age_s_ >= 0 ? ", max-age=" + std::to_string(max_age_s_) : ", no-cache") + "\r\n";
+            }
+        }
+        if (!request.keep_alive) {
+            head += "Connection: close\r\n";
+        }
+        if (status == 304) {
+            body.clear();   // no body, and no Content-Length for the omitted one
+        } else {
+            head += "Content-Type: " + std::string(rep.content_type) + "\r\n";
+            head += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+        }
+        head += "\r\n";
+
+        if (verbose_) {
+            const uint8_t flags = frame_codec_is_content_type(rep.content_type) && body.size() > 1 ? body[1] : 0;
+            printf("%s %s -> %d %s%s, %zu bytes%s\n", request.method.c_str(), request.path.c_str(), status,
+                   rep.content_type, (flags & FRAME_CODEC_FLAG_TIMELINE) ? " timeline" :
+                   (flags & FRAME_CODEC_FLAG_DELTA) ? " delta" : "", body.size(),
+                   request.if_none_match.empty() ? "" : " (conditional)");
+            fflush(stdout);
+        }
+        return head + body;
+    }
+
+    LedState& state_;
+    bool verbose_;
+    int heartbeat_s_;
+    int max_age_s_;
+    int listen_fd_;
+    std::string layout_;
+    Representation timetable_;
+    StibReplay* stib_;
+    std::string stib_authorization_;
+};
+
+static bool same_animation(const Animation& a, const Animation& b) {
+    if (!(a.base == b.base) || a.effect_count != b.effect_count) {
+        return false;
+    }
+    for (uint8_t e = 0; e < a.effect_count; e++) {
+        const LEDEffect& x = a.effects[e];
+        const LEDEffect& y = b.effects[e];
+        if (x.row != y.row || x.led != y.led || x.period_ms != y.period_ms || x.on_ms != y.on_ms ||
+            x.phase_ms != y.phase_ms) {
+            return false;
+        }
+    }
+    if (a.vehicle_count != b.vehicle_count) {
+        return false;
+    }
+    for (uint8_t v = 0; v < a.vehicle_count; v++) {
+        const Vehicle& x = a.vehicles[v];
+        const Vehicle& y = b.vehicles[v];
+        if (x.row != y.row || x.position != y.position || x.speed != y.speed || x.age_ms != y.age_ms) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void check_codec(const Animation& animation) {
+    uint8_t buffer[FRAME_CODEC_MAX_SIZE];
+    Animation decoded;
+    FrameCodecHeader header{}, fields{};
+
+    header.flags = FRAME_CODEC_FLAG_SEQUENCE | FRAME_CODEC_FLAG_TIMESTAMP;
+    header.sequence = 0x12345678;
+    header.emitted_ms = 0x0123456789ABull;
+    size_t length = frame_codec_encode(animation, header, buffer, sizeof(buffer));
+    expect(length > 0 && frame_codec_decode(buffer, length, decoded, &fields), "codec: 16-bit round trip");
+    expect(same_animation(decoded, animation) && fields.sequence == header.sequence &&
+               fields.emitted_ms == header.emitted_ms, "  same frame, effects, sequence and timestamp");
+
+    char text[FRAME_CODEC_BASE64_SIZE(FRAME_CODEC_MAX_SIZE)];
+    uint8_t round_trip[FRAME_CODEC_MAX_SIZE];
+    size_t text_length = frame_codec_base64_encode(buffer, length, text, sizeof(text));
+    expect(text_length > 0 &&
+               frame_codec_base64_decode(text, text_length, round_trip, sizeof(round_trip)) == length &&
+               memcmp(round_trip, buffer, length) == 0, "  base64 round trip");
+    expect(frame_codec_base64_decode(text, text_length - 1, round_trip, sizeof(round_trip)) == 0,
+           "  truncated base64 rejected");
+
+    expect(!frame_codec_decode(buffer, length - 1, decoded), "  truncated message rejected");
+    buffer[1] |= 0x80;
+    expect(!frame_codec_decode(buffer, length, decoded), "  unknown flag rejected");
+
+    header = FrameCodecHeader{};
+    header.flags = FRAME_CODEC_FLAG_PACKED12;
+    length = frame_codec_encode(animation, header, buffer, sizeof(buffer));
+    expect(length > 0 && frame_codec_decode(buffer, length, decoded, &fields), "codec: packed12 round trip");
+    expect(same_animation(decoded, animation) && fields.sequence == 0 && fields.emitted_ms == 0,
+           "  same frame and effects, no sequence or timestamp");
+    expect(frame_codec_encode(animation, header, buffer, FRAME_CODEC_HEADER_SIZE) == 0, "  short buffer refused");
+
+    Animation moving = animation;
+    moving.add_vehicle(0, 2 * ANIMATION_POSITION_ONE + 10, SERVER_VEHICLE_SPEED, 1500);
+    moving.add_vehicle(1, 7 * ANIMATION_POSITION_ONE, 0, 0);
+    length = frame_codec_encode(moving, header, buffer, sizeof(buffer));
+    expect(length > 0 && frame_codec_decode(buffer, length, decoded, &fields) &&
+               (fields.flags & FRAME_CODEC_FLAG_VEHICLES) && same_animation(decoded, moving),
+           "codec: vehicles round trip");
+    header.flags = FRAME_CODEC_FLAG_SEQUENCE;
+    length = frame_codec_encode_delta(moving, moving, header, buffer, sizeof(buffer));
+    Animation applied = moving;
+    applied.vehicle_count = 0;
+    expect(length > 0 && frame_codec_decode(buffer, length, applied) && same_animation(applied, moving),
+           "  sent in full with an empty delta");
+    length = frame_codec_encode_delta(moving, animation, header, buffer, sizeof(buffer));
+    expect(length > 0 && frame_codec_decode(buffer, length, applied) && applied.vehicle_count == 0,
+           "  removed by a delta without them");
+
+    // Timeline of a full frame and the empty delta onto it
+    uint8_t timeline[FRAME_CODEC_MAX_SIZE * 2];
+    FrameCodecTimelineEntry entries[2], read[FRAME_CODEC_TIMELINE_MAX_ENTRIES];
+    header.flags = FRAME_CODEC_FLAG_SEQUENCE;
+    header.sequence = 5;
+    uint8_t first[FRAME_CODEC_MAX_SIZE];
+    entries[0] = {0, first, frame_codec_encode(animation, header, first, sizeof(first))};
+    header.base_sequence = 5;
+    header.sequence = 6;
+    entries[1] = {5000, buffer, frame_codec_encode_delta(animation, animation, header, buffer, sizeof(buffer))};
+    length = frame_codec_encode_timeline(0x0123456789ABull, entries, 2, timeline, sizeof(timeline));
+    expect(length > 0 && frame_codec_read_timeline(timeline, length, fields, read, 2) == 2 &&
+               fields.emitted_ms == 0x0123456789ABull && read[1].offset_ms == 5000 &&
+               read[1].length == entries[1].length, "codec: timeline round trip");
+    expect(!frame_codec_decode(timeline, length, decoded), "  not decoded as a frame");
+    expect(frame_codec_read_timeline(timeline, length, fields, read, 1) == 1 && read[0].length == entries[0].length,
+           "  the leading entries that fit kept");
+    expect(frame_codec_read_timeline(timeline, length - 1, fields, read, 2) == 1, "  cut short: the complete ones kept");
+    expect(frame_codec_read_timeline(timeline, 1 + FRAME_CODEC_TIMELINE_ENTRY_SIZE + 5, fields, read, 2) == 0,
+           "  no complete entry rejected");
+    expect(frame_codec_timeline_limit(FRAME_CODEC_TIMELINE_ACCEPT(4) ", application/json;q=0.5") == 4 &&
+               frame_codec_timeline_limit(FRAME_CODEC_TIMELINE_PARAM "99") == FRAME_CODEC_TIMELINE_MAX_ENTRIES &&
+               frame_codec_timeline_limit(FRAME_CODEC_CONTENT_TYPE) == 0, "  entry limit from Accept");
+    entries[1].offset_ms = 0;
+    entries[0].offset_ms = 1;
+    length = frame_codec_encode_timeline(1, entries, 2, timeline, sizeof(timeline));
+    expect(frame_codec_read_timeline(timeline, length, fields, read, 2) == 0, "  offsets out of order rejected");
+}
+
+// Dead reckoning as rendered on the display tick
+static void check_vehicles() {
+    Animation animation;
+    animation.base.row_count = 2;
+    animation.produced_ms = 10000;
+    animation.add_vehicle(1, 2 * ANIMATION_POSITION_ONE, ANIMATION_POSITION_ONE, 30000);  // a stop a minute
+    const Vehicle& vehicle = animation.vehicles[0];
+    Frame frame;
+    animation.render(10000, frame);
+    expect(animation.vehicle_led(vehicle, 10000) == 2 && frame.get_led(1, 2), "vehicles: drawn at the reported stop");
+    expect(animation.vehicle_led(vehicle, 10000 + 30000) == 3, "  advanced by speed times age");
+    expect(animation.vehicle_led(vehicle, 10000 + 3600000) == 2 + ANIMATION_MAX_EXTRAPOLATION_MS / 60000,
+           "  extrapolation bounded");
+    expect(animation.vehicle_led(vehicle, 0) == 2, "  not moved back by a server clock ahead");
+    animation.vehicles[0].position = (LEDS_PER_ROW - 1) * ANIMATION_POSITION_ONE - 1;
+    expect(animation.vehicle_led(vehicle, 10000 + 60000) == LEDS_PER_ROW - 1, "  stops at the last stop");
+    expect(!animation.add_vehicle(0, LEDS_PER_ROW * ANIMATION_POSITION_ONE, 0, 0), "  off-row position refused");
+}
+
+// Deltas on the largest display: one LED changes, then effects and rows go
+static void check_delta() {
+    std::mt19937 rng(3);
+    Animation base;
+    for (int r = 0; r < LED_MAX_ROWS; r++) {
+        for (int i = 0; i < LEDS_PER_ROW; i++) {
+            base.base.set_led(r, i, rng() % 3 == 0);
+        }
+    }
+    base.add_effect(7, 4, 1000, 500, 0);
+    Animation target = base;
+    target.base.set_led(42, 3, !target.base.get_led(42, 3));
+
+    uint8_t full[FRAME_CODEC_MAX_SIZE], delta[FRAME_CODEC_MAX_SIZE];
+    FrameCodecHeader header{}, fields{};
+    header.flags = FRAME_CODEC_FLAG_SEQUENCE;
+    header.sequence = 101;
+    header.base_sequence = 100;
+    const size_t full_length = frame_codec_encode(target, header, full, sizeof(full));
+    const size_t length = frame_codec_encode_delta(base, target, header, delta, sizeof(delta));
+    expect(length == FRAME_CODEC_HEADER_SIZE + 8 + 1 + FRAME_CODEC_DELTA_ROW_SIZE, "codec: one-LED delta is one row");
+    expect(frame_codec_read_header(delta, length, fields) && (fields.flags & FRAME_CODEC_FLAG_DELTA) &&
+               fields.sequence == 101 && fields.base_sequence == 100, "  header names both sequences");
+
+    Animation applied = base;
+    expect(frame_codec_decode(delta, length, applied) && same_animation(applied, target),
+           "  applied onto the base gives the target, effects kept");
+
+    // Time the decode of both: the delta touches one row instead of all
+    Animation scratch = base;
+    const int rounds = 200000;
+    auto time_us = [&](const uint8_t* data, size_t n) {
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            frame_codec_decode(data, n, scratch);
+        }
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / rounds;
+    };
+    const double full_us = time_us(full, full_length);
+    const double delta_us = time_us(delta, length);
+    printf("      %d rows, one LED changed: full %zu bytes %.3f us, delta %zu bytes %.3f us\n",
+           LED_MAX_ROWS, full_length, full_us, length, delta_us);
+
+    Animation shrunk = target;
+    shrunk.effect_count = 0;
+    shrunk.base.row_count = 10;
+    memset(shrunk.base.rows + 10, 0, (LED_MAX_ROWS - 10) * sizeof(shrunk.base.rows[0]));
+    size_t shrink_length = frame_codec_encode_delta(target, shrunk, header, delta, sizeof(delta));
+    applied = target;
+    expect(shrink_length > 0 && frame_codec_decode(delta, shrink_length, applied) && same_animation(applied, shrunk),
+           "  fewer rows and no effects: rows cleared, effects removed");
+    Animation grown = base;
+    applied = shrunk;
+    shrink_length = frame_codec_encode_delta(shrunk, grown, header, delta, sizeof(delta));
+    expect(shrink_length > 0 && frame_codec_decode(delta, shrink_length, applied) && same_animation(applied, grown),
+           "  rows added back");
+
+    header.sequence = 102;
+    size_t bad = frame_codec_encode_delta(base, target, header, delta, sizeof(delta));
+    delta[FRAME_CODEC_HEADER_SIZE + 8 + 1] = LED_MAX_ROWS;  // row index past row_count
+    applied = base;
+    expect(!frame_codec_decode(delta, bad, applied) && same_animation(applied, base),
+           "  bad row index rejected, frame untouched");
+    delta[1] &= ~FRAME_CODEC_FLAG_SEQUENCE;
+    expect(!frame_codec_read_header(delta, bad, fields), "  delta without a sequence rejected");
+}
+
+static uint64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Event stream: first event is the current state, then one per change
+static void check_stream(LedState& state, int port) {
+    TestClient client;
+    HttpResponse response;
+    expect(client.connect_to(port) && client.open_stream(LEDSTRIPS_STREAM_PATH "?mac=00:00:00:00:00:00", response),
+           "event stream");
+    expect(response.status == 200 && response.content_type == "text/event-stream", "  200 text/event-stream");
+
+    std::string last_data;
+    uint32_t frames = 0;
+    SseParser parser([&](const SseEvent& event) {
+        if (!strcmp(event.name, "frame")) {
+            last_data.assign(event.data, event.data_length);
+            frames++;
+        }
+    });
+
+    auto decode_last = [&](Animation& animation, FrameCodecHeader& header) {
+        uint8_t binary[FRAME_CODEC_MAX_SIZE];
+        size_t length = frame_codec_base64_decode(last_data.data(), last_data.size(), binary, sizeof(binary));
+        return length && frame_codec_decode(binary, length, animation, &header);
+    };
+
+    Animation animation;
+    FrameCodecHeader header{};
+    expect(client.read_stream(parser, [&] { return frames == 1; }), "  current state sent first");
+    expect(parser.retry_ms() == SERVER_STREAM_RETRY_MS, "  retry advertised");
+    expect(decode_last(animation, header) && same_animation(animation, state.animation()), "  decodes to the state");
+    expect((header.flags & FRAME_CODEC_FLAG_TIMESTAMP) && header.emitted_ms, "  carries the emit time");
+
+    const auto changed_at = std::chrono::steady_clock::now();
+    state.advance();
+    expect(client.read_stream(parser, [&] { return frames == 2; }), "  pushed on change");
+    const long push_us = (long)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - changed_at).count();
+    expect(decode_last(animation, header) && same_animation(animation, state.animation()), "  new state");
+    expect((header.flags & FRAME_CODEC_FLAG_DELTA) && header.base_sequence + 1 == header.sequence,
+           "  as a delta onto the first");
+    printf("      change to client: %ld us (emit to client %lld ms)\n", push_us,
+           (long long)(now_ms() - header.emitted_ms));
+
+    expect(client.read_stream(parser, [&] { return parser.heartbeats() > 0; }), "  heartbeat while idle");
+    expect(frames == 2 && parser.dropped() == 0, "  no extra or dropped events");
+}
+
+// Parses body in chunks of chunk bytes (0: at once)
+static bool parse_stib(const StibConfig& config, const std::string& body, size_t chunk, StibParser& parser,
+                       Animation& out) {
+    parser.reset(config);
+    const size_t step = chunk ? chunk : body.size();
+    for (size_t pos = 0; pos < body.size(); pos += step) {
+        parser.feed(body.data() + pos, std::min(step, body.size() - pos));
+    }
+    return parser.finish(out);
+}
+
+static void check_stib(StibReplay& replay, int port) {
+    printf("STIB replay (direct mode)\n");
+    StibConfig config;
+    expect(load_stops(STIB_RECORDINGS_DIR "/stops.txt", config), "  stop table loads");
+    expect(config.row_count() == 3 && config.find(8, 2351) == 3 && config.find(25, 2351) == LEDS_PER_ROW &&
+               config.find(71, 3558) < 0 && config.find(8, 1) < 0, "  lookups by line and pointId");
+
+    // Rows lit by each recording, in name order
+    static const uint16_t EXPECTED[][3] = {
+        {0x000D, 0x0003, 0x0000},   // 01-morning: line 8 at 3558, 3525, 2351; line 25 at 2351, 3517
+        {0x0006, 0x0000, 0x0003},   // 02-escapes: 3559, 3525 (numeric); 3510, 2397; line 71 not shown
+        {0x0000, 0x0000, 0x0000},   // 03-night: no vehicles, still three dark rows
+    };
+    expect(replay.size() == sizeof(EXPECTED) / sizeof(EXPECTED[0]), "  recordings found");
+
+    TestClient client;
+    expect(client.connect_to(port), "  connect");
+    const std::string path = STIB_RECORDS_PATH "?select=lineid%2Cvehiclepositions&limit=100"
+                             "&where=lineid%3D%278%27%20OR%20lineid%3D%2725%27";
+    const std::string key = "Apikey " SERVER_DEFAULT_STIB_KEY;
+    HttpResponse response;
+    expect(client.get(path, "", response) && response.status == 401, "  401 without an API key");
+    expect(client.get(path, "", response, nullptr, "Apikey wrong") && response.status == 401,
+           "  401 with another key");
+
+    StibParser parser;
+    for (size_t i = 0; i < replay.size() && i < sizeof(EXPECTED) / sizeof(EXPECTED[0]); i++) {
+        printf("  %s\n", replay.name(i).c_str());
+        HttpResponse first;
+        expect(client.get(path, "", first, nullptr, key.c_str()) && first.status == 200 &&
+                   first.body == replay.body(i), "    200 with the recording");
+        expect(client.get(path, first.etag, response, nullptr, key.c_str()) && response.status == 304,
+               "    304 with its ETag");
+
+        Animation whole, bytewise, chunked;
+        bool ok = parse_stib(config, first.body, 0, parser, whole);
+        ok = parse_stib(config, first.body, 1, parser, bytewise) && ok;
+        ok = parse_stib(config, first.body, 7, parser, chunked) && ok;
+        expect(ok && same_animation(whole, bytewise) && same_animation(whole, chunked),
+               "    same frame whole, byte by byte and in 7-byte chunks");
+        expect(whole.base.row_count == 3 && whole.base.rows[0] == EXPECTED[i][0] &&
+                   whole.base.rows[1] == EXPECTED[i][1] && whole.base.rows[2] == EXPECTED[i][2],
+               "    expected stops lit");
+        expect(parser.invalid() == 0 && parser.dropped() == 0, "    every position list parsed");
+        printf("      %u lines, %u vehicles, %u at a stop of the display, %zu bytes\n", parser.results(),
+               parser.positions(), parser.matched(), first.body.size());
+        replay.advance();
+    }
+
+    // A broken position list only loses that line, a cut response everything
+    Animation out;
+    const std::string broken = "{\"results\": [{\"lineid\": \"8\", \"vehiclepositions\": \"[{\\\"pointId\\\": \"},"
+                               " {\"lineid\": \"25\", \"vehiclepositions\": \"[{\\\"pointId\\\": 3517}]\"}]}";
+    expect(parse_stib(config, broken, 0, parser, out) && parser.invalid() == 1 && out.base.rows[1] == 0x0002 &&
+               out.base.rows[0] == 0, "  broken position list skipped");
+    const std::string& morning = replay.body(0);
+    expect(!parse_stib(config, morning.substr(0, morning.size() / 2), 0, parser, out), "  truncated response refused");
+    expect(!parse_stib(config, "{\"total_count\": 0}", 0, parser, out), "  response without results refused");
+    expect(!parse_stib(config, "[\"results\"", 0, parser, out), "  malformed response refused");
+}
+
+// Layout URLs: registration, then the same state as the MAC URL, cacheable
+static void check_layouts(int port) {
+    TestClient client;
+    HttpResponse response, by_mac, by_layout;
+    char id[LAYOUT_ID_SIZE];
+    LayoutIdParser parser;
+    expect(client.connect_to(port) && client.get(LAYOUT_REGISTER_PATH "?mac=24:dc:c3:00:00:01", "", response) &&
+               response.status == 200 && parser.feed(response.body.data(), response.body.size()) &&
+               parser.finish(id) && !strcmp(id, SERVER_DEFAULT_LAYOUT), "layout registration");
+    expect(client.get(LAYOUT_REGISTER_PATH, "", response) && response.status == 404, "  404 without a MAC");
+
+    const char* accept = FRAME_CODEC_CONTENT_TYPE ", application/json;q=0.5";
+    const std::string path = std::string(LEDSTRIPS_LAYOUT_PATH) + id;
+    expect(client.get(LEDSTRIPS_PATH "?mac=24:dc:c3:00:00:01", "", by_mac, accept) &&
+               client.get(path, "", by_layout, accept) && by_layout.status == 200 &&
+               by_layout.body == by_mac.body && by_layout.etag == by_mac.etag, "  layout GET, same frame as by MAC");
+    expect(by_layout.cache_control.compare(0, 6, "public") == 0 && by_mac.cache_control.compare(0, 7, "private") == 0,
+           "  public for the layout, private by MAC");
+    expect(client.get(path + "?since=1", by_layout.etag, response, accept) && response.status == 304,
+           "  304 with the ETag, since= as the first parameter");
+    expect(client.get(LEDSTRIPS_LAYOUT_PATH "other", "", response) && response.status == 404,
+           "  404 for an unknown layout");
+
+    TestClient stream;
+    expect(stream.connect_to(port) && stream.open_stream(path + "/stream", response) &&
+               response.status == 200 && response.content_type == "text/event-stream", "  layout event stream");
+}
+
+// Line 8 over three stops of fixtures/stib/stops.txt, two weekday trips
+static std::string sample_timetable() {
+    const TimetableStop stops[] = {{3558, 0, 0}, {3559, 1, 120}, {3525, 2, 90}};
+    const uint32_t departures[] = {6 * 3600, 6 * 3600 + 600};
+    const TimetablePattern pattern{8, 0x1F, 3, stops, 2, departures};
+    uint8_t out[256];
+    const size_t length = timetable_encode(&pattern, 1, 1700000000, 0, 1, out, sizeof(out));
+    return std::string((const char*)out, length);
+}
+
+// Timetable by MAC and by layout, tagged with its crc32
+static void check_timetable(int port, const std::string& body) {
+    TestClient client;
+    HttpResponse response;
+    Timetable timetable;
+    char etag[TIMETABLE_ETAG_SIZE];
+    expect(!body.empty() && timetable.attach((const uint8_t*)body.data(), body.size()), "timetable encodes");
+    timetable_etag(timetable.crc32(), etag);
+    expect(client.connect_to(port) &&
+               client.get(TIMETABLE_PATH "?mac=24dcc3000001", "", response, TIMETABLE_CONTENT_TYPE) &&
+               response.status == 200 && response.body == body && response.content_type == TIMETABLE_CONTENT_TYPE &&
+               response.etag == etag && response.cache_control.compare(0, 7, "private") == 0,
+           "  GET by MAC, tagged with its crc32");
+    expect(client.get(TIMETABLE_PATH "?mac=24dcc3000001", etag, response) && response.status == 304,
+           "  304 for the timetable held in flash");
+    expect(client.get(TIMETABLE_LAYOUT_PATH SERVER_DEFAULT_LAYOUT, "", response) && response.status == 200 &&
+               response.body == body && response.cache_control.compare(0, 6, "public") == 0,
+           "  GET by layout, public");
+    expect(client.get(TIMETABLE_LAYOUT_PATH "other", "", response) && response.status == 404 &&
+               client.get(TIMETABLE_PATH, "", response) && response.status == 404,
+           "  404 for another layout or without a MAC");
+
+    Frame frame;
+    expect(timetable.predict(0, 6 * 3600 + 150, nullptr, frame) == 1 && frame.get_led(0, 1) &&
+               timetable.predict(0, 6 * 3600 + 690, nullptr, frame) == 1 && frame.get_led(0, 0) &&
+               timetable.predict(5, 6 * 3600 + 150, nullptr, frame) == 0,
+           "  scheduled positions, weekdays only");
+}
+
+static int self_check(int rows) {
+    LedState state(rows, false);
+    LedstripsServer server(state, false, 1);
+    StibReplay replay;
+    replay.load(STIB_RECORDINGS_DIR);
+    server.set_stib_replay(&replay, SERVER_DEFAULT_STIB_KEY);
+    const std::string timetable = sample_timetable();
+    server.set_timetable(timetable);
+    int port = server.listen_on(0);
+    if (port < 0) {
+        return EXIT_FAILURE;
+    }
+    std::thread(&LedstripsServer::run, &server).detach();
+
+    TestClient client;
+    if (!client.connect_to(port)) {
+        perror("connect");
+        return EXIT_FAILURE;
+    }
+
+    const std::string path = LEDSTRIPS_PATH "?mac=00:00:00:00:00:00";
+    HttpResponse first, response;
+
+    expect(client.get(path, "", first), "unconditional GET");
+    expect(first.status == 200, "  200 OK");
+    expect(!first.etag.empty(), "  carries an ETag");
+    expect(first.body.find("\"strips\"") != std::string::npos, "  body holds the strips");
+
+    expect(client.get(path, first.etag, response), "GET with the current ETag");
+    expect(response.status == 304, "  304 Not Modified");
+    expect(response.body.empty(), "  no body");
+    expect(response.etag == first.etag, "  same ETag");
+
+    expect(client.get(path, "\"stale\", " + first.etag, response), "GET with a tag list");
+    expect(response.status == 304, "  304 when any tag matches");
+
+    state.advance();
+    expect(client.get(path, first.etag, response), "GET with the old ETag after a state change");
+    expect(response.status == 200, "  200 OK");
+    expect(response.etag != first.etag, "  new ETag");
+    expect(response.body != first.body, "  new body");
+
+    expect(client.get(path, response.etag, response), "GET with the new ETag, same connection");
+    expect(response.status == 304, "  304 Not Modified");
+
+    // Binary representation, negotiated like the firmware does
+    const char* accept = FRAME_CODEC_CONTENT_TYPE ", application/json;q=0.5";
+    HttpResponse json, binary;
+    expect(client.get(path, "", json), "JSON GET");
+    expect(client.get(path, "", binary, accept), "binary GET");
+    expect(binary.status == 200 && frame_codec_is_content_type(binary.content_type.c_str()),
+           "  200 with the frame content type");
+    expect(binary.etag != json.etag, "  ETag differs from the JSON one");
+
+    StripsParser parser;
+    Animation from_json, from_binary;
+    parser.feed(json.body.data(), json.body.size());
+    FrameCodecHeader header{};
+    expect(parser.finish(from_json) &&
+               frame_codec_decode((const uint8_t*)binary.body.data(), binary.body.size(), from_binary, &header),
+           "  both representations decode");
+    expect(same_animation(from_json, from_binary), "  same frame and effects");
+    expect(from_binary.effect_count > 0, "  effects carried");
+    printf("      %zu rows: JSON %zu bytes, binary %zu bytes\n", (size_t)from_binary.base.row_count,
+           json.body.size(), binary.body.size());
+
+    expect(client.get(path, binary.etag, response, accept), "binary GET with its ETag");
+    expect(response.status == 304, "  304 Not Modified");
+    expect(client.get(path, binary.etag, response), "JSON GET with the binary ETag");
+    expect(response.status == 200 && response.content_type == "application/json", "  200 with JSON");
+
+    // Deltas onto the state the client holds (from_binary)
+    const uint32_t held = header.sequence;
+    state.advance();
+    HttpResponse delta, full;
+    expect(client.get(path + "&since=" + std::to_string(held), "", delta, accept), "binary GET since the held state");
+    expect(client.get(path, "", full, accept), "  and without");
+    FrameCodecHeader fields{};
+    expect(delta.status == 200 && frame_codec_read_header((const uint8_t*)delta.body.data(), delta.body.size(), fields) &&
+               (fields.flags & FRAME_CODEC_FLAG_DELTA) && fields.base_sequence == held,
+           "  a delta onto the held sequence");
+    expect(delta.etag == full.etag, "  same ETag as the full frame");
+    expect(frame_codec_decode((const uint8_t*)delta.body.data(), delta.body.size(), from_binary) &&
+               same_animation(from_binary, state.animation()), "  applied gives the new state");
+    printf("      %zu rows, %d LEDs changed: full %zu bytes, delta %zu bytes\n", (size_t)from_binary.base.row_count,
+           SERVER_DEFAULT_FLIPS, full.body.size(), delta.body.size());
+    expect(client.get(path + "&since=999999", "", response, accept) &&
+               frame_codec_read_header((const uint8_t*)response.body.data(), response.body.size(), fields) &&
+               !(fields.flags & FRAME_CODEC_FLAG_DELTA), "  full frame since an unknown state");
+    expect(client.get(path + "&since=" + std::to_string(held), full.etag, response, accept) && response.status == 304,
+           "  304 when the ETag matches");
+
+    // Timeline: the current state and the next changes, as the firmware asks
+    state.set_timeline(4, 1000);
+    const char* timeline_accept = FRAME_CODEC_TIMELINE_ACCEPT(FRAME_CODEC_TIMELINE_MAX_ENTRIES) ", application/json;q=0.5";
+    const uint32_t now_held = fields.sequence;
+    expect(client.get(path + "&since=" + std::to_string(now_held), "", response, timeline_accept),
+           "binary GET accepting timelines");
+    FrameCodecTimelineEntry entries[FRAME_CODEC_TIMELINE_MAX_ENTRIES];
+    FrameCodecHeader outer{};
+    size_t count = frame_codec_read_timeline((const uint8_t*)response.body.data(), response.body.size(), outer,
+                                             entries, FRAME_CODEC_TIMELINE_MAX_ENTRIES);
+    expect(response.status == 200 && count == 4 && outer.emitted_ms, "  a timeline of 4 frames");
+    expect(response.etag == full.etag, "  same ETag as the full frame");
+    std::vector<Animation> frames(count);
+    bool chained = count > 0;
+    for (size_t i = 0; i < count && chained; i++) {
+        frames[i] = i ? frames[i - 1] : from_binary;
+        chained = frame_codec_decode(entries[i].data, entries[i].length, frames[i]) &&
+                  (!i || entries[i].offset_ms > entries[i - 1].offset_ms);
+    }
+    expect(chained && same_animation(frames[0], state.animation()), "  first frame is the state, offsets increase");
+    state.advance();
+    expect(count > 1 && same_animation(frames[1], state.animation()), "  second frame is the next state");
+    printf("      timeline of %zu frames: %zu bytes, %u ms ahead\n", count, response.body.size(),
+           count ? entries[count - 1].offset_ms : 0);
+    expect(client.get(path, "", response, accept) &&
+               !(((const uint8_t*)response.body.data())[1] & FRAME_CODEC_FLAG_TIMELINE),
+           "  none for clients that do not ask");
+    expect(client.get(path, "", response, FRAME_CODEC_TIMELINE_ACCEPT(2)) &&
+               frame_codec_read_timeline((const uint8_t*)response.body.data(), response.body.size(), outer,
+                                         entries, FRAME_CODEC_TIMELINE_MAX_ENTRIES) == 2,
+           "  no more entries than the client keeps");
+
+    check_codec(state.animation());
+    check_delta();
+    check_vehicles();
+    check_stream(state, port);
+    check_layouts(port);
+    check_timetable(port, timetable);
+    check_stib(replay, port);
+
+    return self_check_result();
+}
+
+int main(int argc, char** argv) {
+    int port = SERVER_DEFAULT_PORT;
+    int rows = SERVER_DEFAULT_ROWS;
+    int change_every_s = SERVER_DEFAULT_CHANGE_S;
+    int heartbeat_s = SERVER_DEFAULT_HEARTBEAT_S;
+    int max_age_s = -1;
+    int flips = SERVER_DEFAULT_FLIPS;
+    int vehicles = 0;
+    int timeline = 0;
+    bool packed12 = false;
+    bool check = false;
+    std::string stib_dir;
+    std::string stib_key = SERVER_DEFAULT_STIB_KEY;
+    std::string layout = SERVER_DEFAULT_LAYOUT;
+    std::string timetable;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--rows") && i + 1 < argc) {
+            rows = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--change-every") && i + 1 < argc) {
+            change_every_s = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--heartbeat") && i + 1 < argc) {
+            heartbeat_s = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--max-age") && i + 1 < argc) {
+            max_age_s = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--flips") && i + 1 < argc) {
+            flips = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--vehicles") && i + 1 < argc) {
+            vehicles = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--timeline") && i + 1 < argc) {
+            timeline = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--layout") && i + 1 < argc) {
+            layout = argv[++i];
+        } else if (!strcmp(argv[i], "--timetable") && i + 1 < argc) {
+            timetable = argv[++i];
+        } else if (!strcmp(argv[i], "--stib") && i + 1 < argc) {
+            stib_dir = argv[++i];
+        } else if (!strcmp(argv[i], "--stib-key") && i + 1 < argc) {
+            stib_key = argv[++i];
+        } else if (!strcmp(argv[i], "--packed12")) {
+            packed12 = true;
+        } else if (!strcmp(argv[i], "--self-check")) {
+            check = true;
+        } else {
+            fprintf(stderr, "usage: %s [--port N] [--rows N] [--change-every S] [--flips N] [--vehicles N] "
+                    "[--timeline N] [--packed12] [--heartbeat S] [--max-age S] [--layout ID] [--timetable FILE] [--stib DIR] "
+                    "[--stib-key KEY] "
+                    "[--self-check]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (check) {
+        return self_check(rows);
+    }
+
+    LedState state(rows, packed12, flips, vehicles);
+    state.set_timeline(timeline, change_every_s * 1000);
+    LedstripsServer server(state, true, heartbeat_s > 0 ? heartbeat_s : SERVER_DEFAULT_HEARTBEAT_S);
+    server.set_max_age(max_age_s);
+    if (!layout.empty() && !layout_id_is_valid(layout.c_str())) {
+        fprintf(stderr, "Invalid layout ID %s\n", layout.c_str());
+        return EXIT_FAILURE;
+    }
+    server.set_layout(layout);
+    if (!timetable.empty()) {
+        std::ifstream file(timetable, std::ios::binary);
+        std::ostringstream body;
+        body << file.rdbuf();
+        if (!server.set_timetable(body.str())) {
+            fprintf(stderr, "%s is not a timetable\n", timetable.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    StibReplay replay;
+    if (!stib_dir.empty()) {
+        if (!replay.load(stib_dir)) {
+            fprintf(stderr, "No *.json responses in %s\n", stib_dir.c_str());
+            return EXIT_FAILURE;
+        }
+        server.set_stib_replay(&replay, stib_key);
+    }
+    if (server.listen_on(port) < 0) {
+        return EXIT_FAILURE;
+    }
+    printf("Serving /api/esp/ledstrips on port %d, state changes every %d s\n", port, change_every_s);
+    if (replay.size()) {
+        printf("Replaying %zu STIB responses from %s at %s\n", replay.size(), stib_dir.c_str(), STIB_RECORDS_PATH);
+    }
+
+    std::thread([&state, &replay, change_every_s]() {
+        while (change_every_s > 0) {
+            std::this_thread::sleep_for(std::chrono::seconds(change_every_s));
+            state.advance();
+            replay.advance();
+        }
+    }).detach();
+
+    server.run();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,228 @@
+// poll_scheduler_sim.cpp
+// Replays one day of polling against a modelled server and compares the
+// former fixed 5 s loop with the firmware's PollScheduler: requests per
+// device and day, and how long a server-side change takes to be fetched
+// during service hours. Exits non-zero when the scheduler makes the display
+// staler during service or ignores a server hint.
+//
+// A fleet of SIM_DEVICES boots at random times in the first minute. The
+// server refreshes its data every SIM_REFRESH_S during service and answers
+// 503 during a SIM_OUTAGE_S outage; each scenario toggles the hints it sends
+// (Cache-Control: max-age up to the next refresh, Retry-After).
+//
+// A last run checks when the display would fall back to its timetable
+// (PollScheduler::is_stale()) against a server sending a long max-age:
+// never between healthy polls, night ones included, and soon after the
+// outage starts.
+#include "poll_scheduler.h"
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#define SIM_DAY_MS (24 * 3600 * 1000LL)
+#define SIM_REFRESH_S 20
+#define SIM_OUTAGE_START_H 8
+#define SIM_OUTAGE_S 1800
+#define SIM_RETRY_AFTER_S 120
+#define SIM_FIXED_MS 5000
+#define SIM_DEVICES 50
+#define SIM_LONG_MAX_AGE_S 900
+#define SIM_SCHEDULE_TICK_MS 15000      // LED_UPDATER_SCHEDULE_TICK_MS
+
+struct Scenario {
+    const char* name;
+    bool scheduler;
+    bool max_age;
+    bool outage;
+    bool retry_after;
+};
+
+// Per device averages
+struct Result {
+    double requests;
+    double failed;
+    double mean_lag_s;          // refresh to fetch during service, outside the outage
+    double max_lag_s;
+    bool retry_after_honoured;
+};
+
+static int failures = 0;
+
+static bool in_service(long long t_ms) {
+    const int hour = (int)(t_ms / 3600000) % 24;
+    return !(hour >= 1 && hour < 5);
+}
+
+static bool in_outage(const Scenario& scenario, long long t_ms) {
+    const long long start = SIM_OUTAGE_START_H * 3600000LL;
+    return scenario.outage && t_ms >= start && t_ms < start + SIM_OUTAGE_S * 1000LL;
+}
+
+static void simulate_device(const Scenario& scenario, std::mt19937& rng, Result& result,
+                            double& lag_total, long& lag_count) {
+    PollScheduler scheduler;
+
+    // Boot at a random time in the first minute
+    long long t = rng() % 60000;
+    const long long boot = t;
+    std::vector<long long> fetched;     // times of successful polls
+    while (t < SIM_DAY_MS) {
+        PollOutcome outcome{200, -1, -1};
+        result.requests++;
+        if (in_outage(scenario, t)) {
+            outcome.status = 503;
+            outcome.retry_after_s = scenario.retry_after ? SIM_RETRY_AFTER_S : -1;
+            result.failed++;
+        } else {
+            fetched.push_back(t);
+            if (scenario.max_age && in_service(t)) {
+                outcome.max_age_s = SIM_REFRESH_S - (int32_t)(t / 1000 % SIM_REFRESH_S);
+            }
+        }
+
+        long long delay;
+        if (scenario.scheduler) {
+            delay = scheduler.next_delay_ms(outcome, (int32_t)(t / 1000 % 86400), rng());
+        } else {
+            delay = SIM_FIXED_MS;
+        }
+        if (outcome.retry_after_s > 0 && delay < outcome.retry_after_s * 1000LL && scenario.scheduler) {
+            result.retry_after_honoured = false;
+        }
+        t += delay;
+    }
+
+    // Lag of each refresh during service after boot, the outage excluded
+    // (its recovery is not: that is what the backoff costs)
+    size_t next = 0;
+    for (long long refresh = 0; refresh < SIM_DAY_MS; refresh += SIM_REFRESH_S * 1000) {
+        if (refresh < boot || !in_service(refresh) || in_outage(scenario, refresh)) {
+            continue;
+        }
+        while (next < fetched.size() && fetched[next] < refresh) {
+            next++;
+        }
+        if (next == fetched.size()) {
+            break;
+        }
+        const double lag_s = (fetched[next] - refresh) / 1000.0;
+        lag_total += lag_s;
+        lag_count++;
+        if (lag_s > result.max_lag_s) {
+            result.max_lag_s = lag_s;
+        }
+    }
+}
+
+static Result simulate(const Scenario& scenario) {
+    std::mt19937 rng(1);
+    Result result{};
+    result.retry_after_honoured = true;
+    double lag_total = 0;
+    long lag_count = 0;
+    for (int device = 0; device < SIM_DEVICES; device++) {
+        simulate_device(scenario, rng, result, lag_total, lag_count);
+    }
+    result.requests /= SIM_DEVICES;
+    result.failed /= SIM_DEVICES;
+    result.mean_lag_s = lag_count ? lag_total / lag_count : 0;
+    return result;
+}
+
+// One device with the long max-age and the outage, staleness sampled on
+// the firmware's schedule tick
+static void check_staleness() {
+    const Scenario scenario{"", true, true, true, false};
+    PollScheduler scheduler;
+    std::mt19937 rng(2);
+    long long t = 0, live_at = 0;
+    long long healthy_stale_ms = 0, former_rule_ms = 0, first_stale = -1;
+    while (t < SIM_DAY_MS) {
+        PollOutcome outcome{200, SIM_LONG_MAX_AGE_S, -1};
+        if (in_outage(scenario, t)) {
+            outcome = PollOutcome{503, -1, -1};
+        } else {
+            live_at = t;
+        }
+        const long long next_poll = t + scheduler.next_delay_ms(outcome, (int32_t)(t / 1000 % 86400), rng());
+        for (long long tick = t + SIM_SCHEDULE_TICK_MS; tick < next_poll; tick += SIM_SCHEDULE_TICK_MS) {
+            const bool healthy = live_at == t;
+            if (healthy && tick - live_at >= POLL_SCHEDULER_STALE_MS) {
+                former_rule_ms += SIM_SCHEDULE_TICK_MS;
+            }
+            if (!scheduler.is_stale(tick, live_at, next_poll)) {
+                continue;
+            }
+            if (healthy) {
+                healthy_stale_ms += SIM_SCHEDULE_TICK_MS;
+            } else if (first_stale < 0) {
+                first_stale = tick;
+            }
+        }
+        t = next_poll;
+    }
+
+    const long long outage_start = SIM_OUTAGE_START_H * 3600000LL;
+    printf("Timetable fallback, max-age %d s: %.1f h between healthy polls (%.1f h with a fixed %d s limit), "
+           "%.0f s into the outage\n", SIM_LONG_MAX_AGE_S, healthy_stale_ms / 3600000.0, former_rule_ms / 3600000.0,
+           POLL_SCHEDULER_STALE_MS / 1000, first_stale >= 0 ? (first_stale - outage_start) / 1000.0 : -1.0);
+    if (healthy_stale_ms) {
+        printf("FAIL  stale between healthy polls\n");
+        failures++;
+    }
+    if (first_stale < outage_start ||
+        first_stale - outage_start > SIM_LONG_MAX_AGE_S * 1000LL + POLL_SCHEDULER_STALE_MS) {
+        printf("FAIL  outage not noticed after the first failed poll\n");
+        failures++;
+    }
+
+    // Wi-Fi down: no poll at all, stale once the expected one is that late
+    PollScheduler idle;
+    if (idle.is_stale(3600000, 0, 3600000 + 1) || !idle.is_stale(3600000 + POLL_SCHEDULER_STALE_MS, 0, 3600000)) {
+        printf("FAIL  missed poll not noticed\n");
+        failures++;
+    }
+}
+
+int main() {
+    const Scenario scenarios[] = {
+        {"fixed 5 s",                   false, false, false, false},
+        {"profile",                     true,  false, false, false},
+        {"profile + max-age",           true,  true,  false, false},
+        {"fixed 5 s, outage",           false, false, true,  false},
+        {"profile, outage",             true,  false, true,  false},
+        {"profile, outage + Retry-After", true, false, true,  true},
+    };
+
+    printf("%d devices, per device and day:\n", SIM_DEVICES);
+    printf("%-32s %9s %7s %10s %9s\n", "scenario", "requests", "failed", "mean lag", "max lag");
+    Result baseline{};
+    for (const Scenario& scenario : scenarios) {
+        Result result = simulate(scenario);
+        printf("%-32s %9.0f %7.1f %9.2fs %8.2fs\n", scenario.name, result.requests, result.failed,
+               result.mean_lag_s, result.max_lag_s);
+
+        if (!scenario.scheduler && !scenario.outage) {
+            baseline = result;
+            continue;
+        }
+        if (scenario.scheduler && !scenario.outage && result.mean_lag_s > baseline.mean_lag_s * 1.1) {
+            printf("FAIL  %s: staler than the fixed loop during service\n", scenario.name);
+            failures++;
+        }
+        if (scenario.scheduler && !result.retry_after_honoured) {
+            printf("FAIL  %s: polled before Retry-After\n", scenario.name);
+            failures++;
+        }
+        if (scenario.scheduler && scenario.outage && result.failed > 30) {
+            printf("FAIL  %s: %.0f failed requests, backoff not applied\n", scenario.name, result.failed);
+            failures++;
+        }
+    }
+
+    check_staleness();
+
+    printf(failures ? "FAILED: %d checks\n" : "OK\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,13 @@
+// esp_log.h
+// Host stand-in for ESP-IDF logging, for the firmware sources the host tools
+// build that log (LEDController, ParallelGpioLEDOutput): errors and warnings
+// go to stderr, the rest is dropped.
+#pragma once
+
+#include <cstdio>
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ((void)(tag))
+#define ESP_LOGD(tag, format, ...) ((void)(tag))
+#define ESP_LOGV(tag, format, ...) ((void)(tag))
@@ -0,0 +1,1187 @@
+// stib_aggregator.cpp
+// Fleet-side feed for the displays: polls the STIB vehicle positions once
+// per interval for the union of the lines all registered displays show,
+// precomputes the frame of every distinct stop table and serves
+// /api/esp/ledstrips?mac=... from that cache, as JSON strips or binary
+// frame_codec frames with an ETag, 304 Not Modified and a Cache-Control
+// max-age up to the next poll. A request is a MAC lookup and a prebuilt
+// response, whatever the fleet size; the poll costs one upstream request
+// plus a lookup per vehicle and stop table. One epoll loop serves all
+// keep-alive connections and closes those idle for AGGREGATOR_IDLE_S.
+//
+// Displays showing the same stop table share a layout, named after a hash
+// of the table. /api/esp/layout?mac=... tells a display its layout, which it
+// then polls at /api/esp/ledstrips/layout/<id> with Cache-Control: public,
+// so a shared cache or CDN in front can answer the fleet. The per-MAC URL
+// stays for displays that do not register, marked private.
+//
+// The devices file holds one display per line, "<mac> <stops file>", the
+// stops file in the firmware's direct mode format (line pointId row led,
+// see StibConfig) and relative to the devices file. Displays with identical
+// tables share one layout, computed once per poll. Parsing and encoding are
+// the firmware's own StibParser and frame_codec.
+//
+//   stib_aggregator --devices FILE [--port N] [--interval S] [--stib-url URL]
+//   stib_aggregator --self-check
+//
+// The API key comes from $STIB_API_KEY. --stib-url takes http:// (e.g.
+// ledstrips_server --stib) or https:// when built with OpenSSL, the server
+// certificate checked against the system CAs. --self-check polls an
+// in-process replay of fixtures/stib and checks the frames against the
+// firmware's direct mode, ETags, and the request cost for fleet sizes from
+// 100 to 100000 displays.
+#include "frame_codec.h"
+#include "host_http.h"
+#include "layout_id.h"
+#include "stib_parser.h"
+#include "strips_parser.h"
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#ifdef HAVE_OPENSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+#define AGGREGATOR_DEFAULT_PORT 8081
+#define AGGREGATOR_DEFAULT_INTERVAL_S 20        // the dataset refreshes about every 20 s
+#define AGGREGATOR_DEFAULT_URL "https://data.stib-mivb.brussels"
+#define AGGREGATOR_QUERY "?select=lineid%2Cvehiclepositions&limit=100"
+#define AGGREGATOR_PAGE_SIZE 100
+#define AGGREGATOR_MAX_PAGES 10
+#define AGGREGATOR_TIMEOUT_S 10
+// Keep-alive connections without a request for this long are closed, which
+// also reaps half-open ones of displays that went away
+#define AGGREGATOR_IDLE_S 120
+#define AGGREGATOR_MAX_EVENTS 256
+
+static uint64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Hex digits of a MAC in lower case, whatever the separators
+static std::string mac_key(const std::string& mac) {
+    std::string key;
+    for (char c : mac) {
+        if (isxdigit((unsigned char)c)) {
+            key += (char)tolower((unsigned char)c);
+        }
+    }
+    return key;
+}
+
+// Registered displays and their distinct stop tables, fixed once loaded
+class Fleet {
+public:
+    // Adds a display, sharing the layout of an identical table. False on a
+    // MAC registered twice.
+    bool add(const std::string& mac, const StibConfig& stops) {
+        const uint64_t hash = table_hash(stops);
+        int layout = -1;
+        for (int candidate : by_hash_[hash]) {
+            if (same_table(layouts_[candidate], stops)) {
+                layout = candidate;
+                break;
+            }
+        }
+        if (layout < 0) {
+            // The ID follows from the table, so it survives restarts and
+            // reordered devices files
+            char id[LAYOUT_ID_SIZE];
+            snprintf(id, sizeof(id), "%016llx", (unsigned long long)hash);
+            std::string name = id;
+            if (!by_hash_[hash].empty()) {
+                name += "-" + std::to_string(by_hash_[hash].size());
+            }
+            layout = (int)layouts_.size();
+            layouts_.push_back(stops);
+            layout_ids_.push_back(name);
+            by_id_.emplace(name, layout);
+            by_hash_[hash].push_back(layout);
+        }
+        return devices_.emplace(mac_key(mac), layout).second;
+    }
+
+    // Devices file: "<mac> <stops file>" per line, # starts a comment
+    bool load(const std::string& path) {
+        std::ifstream file(path);
+        if (!file) {
+            fprintf(stderr, "Cannot read %s\n", path.c_str());
+            return false;
+        }
+        const size_t slash = path.rfind('/');
+        const std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+        std::unordered_map<std::string, StibConfig> tables;
+        std::string line;
+        int number = 0;
+        while (std::getline(file, line)) {
+            number++;
+            std::istringstream fields(line.substr(0, line.find('#')));
+            std::string mac, stops;
+            if (!(fields >> mac)) {
+                continue;
+            }
+            if (!(fields >> stops) || mac_key(mac).size() != 12) {
+                fprintf(stderr, "%s:%d: expected <mac> <stops file>\n", path.c_str(), number);
+                return false;
+            }
+            const std::string stops_path = stops[0] == '/' ? stops : dir + "/" + stops;
+            auto table = tables.find(stops_path);
+            if (table == tables.end()) {
+                StibConfig config;
+                if (!load_stops(stops_path, config)) {
+                    fprintf(stderr, "%s:%d: invalid stop table %s\n", path.c_str(), number, stops_path.c_str());
+                    return false;
+                }
+                table = tables.emplace(stops_path, config).first;
+            }
+            if (!add(mac, table->second)) {
+                fprintf(stderr, "%s:%d: %s registered twice\n", path.c_str(), number, mac.c_str());
+                return false;
+            }
+        }
+        return !devices_.empty();
+    }
+
+    // Layout index of a display, -1 when unknown
+    int layout_of(const std::string& mac) const {
+        auto device = devices_.find(mac_key(mac));
+        return device == devices_.end() ? -1 : device->second;
+    }
+
+    // Layout index of a layout ID, -1 when unknown
+    int layout_named(const std::string& id) const {
+        auto layout = by_id_.find(id);
+        return layout == by_id_.end() ? -1 : layout->second;
+    }
+    const std::string& layout_id(int layout) const { return layout_ids_[layout]; }
+
+    size_t size() const { return devices_.size(); }
+    const std::vector<StibConfig>& layouts() const { return layouts_; }
+
+    // where= clause selecting every line some display shows
+    std::string lines_query() const {
+        std::vector<uint16_t> lines;
+        for (const StibConfig& layout : layouts_) {
+            uint16_t own[STIB_MAX_POINTS];
+            size_t count = layout.line_list(own, STIB_MAX_POINTS);
+            lines.insert(lines.end(), own, own + count);
+        }
+        std::sort(lines.begin(), lines.end());
+        lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+        std::string where;
+        for (size_t i = 0; i < lines.size(); i++) {
+            where += (i ? "%20OR%20" : "") + std::string("lineid%3D%27") + std::to_string(lines[i]) + "%27";
+        }
+        return where;
+    }
+
+private:
+    static uint64_t table_hash(const StibConfig& stops) {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const void* data, size_t length) {
+            for (size_t i = 0; i < length; i++) {
+                hash = (hash ^ ((const uint8_t*)data)[i]) * 1099511628211ull;
+            }
+        };
+        mix(stops.point_ids, stops.point_count * sizeof(stops.point_ids[0]));
+        mix(stops.lines, stops.point_count * sizeof(stops.lines[0]));
+        mix(stops.slots, stops.point_count * sizeof(stops.slots[0]));
+        return hash;
+    }
+
+    static bool same_table(const StibConfig& a, const StibConfig& b) {
+        return a.point_count == b.point_count &&
+               memcmp(a.point_ids, b.point_ids, a.point_count * sizeof(a.point_ids[0])) == 0 &&
+               memcmp(a.lines, b.lines, a.point_count * sizeof(a.lines[0])) == 0 &&
+               memcmp(a.slots, b.slots, a.point_count * sizeof(a.slots[0])) == 0;
+    }
+
+    std::unordered_map<std::string, int> devices_;
+    std::vector<StibConfig> layouts_;
+    std::vector<std::string> layout_ids_;
+    std::unordered_map<std::string, int> by_id_;
+    std::unordered_map<uint64_t, std::vector<int>> by_hash_;
+};
+
+// GET against the STIB API over a fresh connection, plain or TLS. The body
+// goes to the sink as it arrives, de-chunked.
+class Upstream {
+public:
+    typedef std::function<bool(const char* data, size_t length)> BodySink;
+
+    ~Upstream() {
+#ifdef HAVE_OPENSSL
+        if (ctx_) {
+            SSL_CTX_free(ctx_);
+        }
+#endif
+    }
+
+    // scheme://host[:port], false when the scheme is not supported
+    bool set_url(const std::string& url) {
+        size_t host_start;
+        if (url.compare(0, 7, "http://") == 0) {
+            tls_ = false;
+            host_start = 7;
+            port_ = "80";
+        } else if (url.compare(0, 8, "https://") == 0) {
+#ifdef HAVE_OPENSSL
+            tls_ = true;
+            host_start = 8;
+            port_ = "443";
+            if (!ctx_) {
+                ctx_ = SSL_CTX_new(TLS_client_method());
+                SSL_CTX_set_default_verify_paths(ctx_);
+                SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER, nullptr);
+            }
+#else
+            fprintf(stderr, "Built without OpenSSL: https:// is not available\n");
+            return false;
+#endif
+        } else {
+            return false;
+        }
+        host_ = url.substr(host_start, url.find('/', host_start) - host_start);
+        const size_t colon = host_.find(':');
+        if (colon != std::string::npos) {
+            port_ = host_.substr(colon + 1);
+            host_.erase(colon);
+        }
+        return !host_.empty();
+    }
+
+    // Returns the status code, -1 on a transport failure. etag receives the
+    // response's ETag.
+    int get(const std::string& path, const std::string& authorization, const std::string& if_none_match,
+            std::string& etag, const BodySink& sink) {
+        if (!open()) {
+            close_connection();
+            return -1;
+        }
+        std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host_ +
+                              "\r\nAccept: application/json\r\nUser-Agent: stib-aggregator\r\n"
+                              "Connection: close\r\n";
+        if (!authorization.empty()) {
+            request += "Authorization: " + authorization + "\r\n";
+        }
+        if (!if_none_match.empty()) {
+            request += "If-None-Match: " + if_none_match + "\r\n";
+        }
+        request += "\r\n";
+
+        int status = -1;
+        if (write_all(request)) {
+            status = read_response(etag, sink);
+        }
+        close_connection();
+        return status;
+    }
+
+    uint64_t bytes_read() const { return bytes_read_; }
+
+private:
+    bool open() {
+        addrinfo hints{}, *result = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host_.c_str(), port_.c_str(), &hints, &result) != 0) {
+            fprintf(stderr, "Cannot resolve %s\n", host_.c_str());
+            return false;
+        }
+        for (addrinfo* ai = result; ai && fd_ < 0; ai = ai->ai_next) {
+            fd_ = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd_ < 0) {
+                continue;
+            }
+            timeval timeout{AGGREGATOR_TIMEOUT_S, 0};
+            setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            if (connect(fd_, ai->ai_addr, ai->ai_addrlen) != 0) {
+                close(fd_);
+                fd_ = -1;
+            }
+        }
+        freeaddrinfo(result);
+        if (fd_ < 0) {
+            fprintf(stderr, "Cannot connect to %s:%s\n", host_.c_str(), port_.c_str());
+            return false;
+        }
+#ifdef HAVE_OPENSSL
+        if (tls_) {
+            ssl_ = SSL_new(ctx_);
+            SSL_set_fd(ssl_, fd_);
+            SSL_set_tlsext_host_name(ssl_, host_.c_str());
+            SSL_set1_host(ssl_, host_.c_str());
+            if (SSL_connect(ssl_) != 1) {
+                fprintf(stderr, "TLS handshake with %s failed: %s\n", host_.c_str(),
+                        ERR_error_string(ERR_get_error(), nullptr));
+                return false;
+            }
+        }
+#endif
+        return true;
+    }
+
+    void close_connection() {
+#ifdef HAVE_OPENSSL
+        if (ssl_) {
+            SSL_shutdown(ssl_);
+            SSL_free(ssl_);
+            ssl_ = nullptr;
+        }
+#endif
+        if (fd_ >= 0) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    bool write_all(const std::string& data) {
+#ifdef HAVE_OPENSSL
+        if (ssl_) {
+            return SSL_write(ssl_, data.data(), (int)data.size()) == (int)data.size();
+        }
+#endif
+        return send_all(fd_, data);
+    }
+
+    // Appends what the connection has to buffer_, false at its end
+    bool fill() {
+        char chunk[4096];
+        ssize_t n;
+#ifdef HAVE_OPENSSL
+        if (ssl_) {
+            n = SSL_read(ssl_, chunk, sizeof(chunk));
+        } else
+#endif
+        {
+            n = recv(fd_, chunk, sizeof(chunk), 0);
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes_read_ += n;
+        buffer_.append(chunk, n);
+        return true;
+    }
+
+    int read_response(std::string& etag, const BodySink& sink) {
+        buffer_.clear();
+        size_t head_end;
+        while ((head_end = buffer_.find("\r\n\r\n")) == std::string::npos) {
+            if (buffer_.size() > SERVER_MAX_REQUEST || !fill()) {
+                return -1;
+            }
+        }
+        const std::string head = buffer_.substr(0, head_end);
+        buffer_.erase(0, head_end + 4);
+
+        const size_t space = head.find(' ');
+        const int status = space == std::string::npos ? -1 : atoi(head.c_str() + space + 1);
+        bool chunked = false;
+        long long content_length = -1;
+        etag.clear();
+        for (size_t pos = head.find("\r\n"); pos != std::string::npos;) {
+            size_t end = head.find("\r\n", pos + 2);
+            std::string line = head.substr(pos + 2, (end == std::string::npos ? head.size() : end) - pos - 2);
+            size_t colon = line.find(':');
+            if (colon != std::string::npos) {
+                std::string key = line.substr(0, colon);
+                std::string value = line.substr(colon + 1);
+                value.erase(0, value.find_first_not_of(" \t"));
+                if (strcasecmp(key.c_str(), "ETag") == 0) {
+                    etag = value;
+                } else if (strcasecmp(key.c_str(), "Content-Length") == 0) {
+                    content_length = atoll(value.c_str());
+                } else if (strcasecmp(key.c_str(), "Transfer-Encoding") == 0) {
+                    chunked = strcasestr(value.c_str(), "chunked") != nullptr;
+                }
+            }
+            pos = end;
+        }
+
+        // Only a 200 body is worth parsing, others are drained with the connection
+        const BodySink none = [](const char*, size_t) { return true; };
+        const BodySink& out = status == 200 ? sink : none;
+        if (status == 304 || status == 204) {
+            return status;
+        }
+        bool complete = chunked ? read_chunked(out) : read_plain(out, content_length);
+        return complete ? status : -1;
+    }
+
+    bool read_plain(const BodySink& sink, long long content_length) {
+        long long left = content_length;
+        while (true) {
+            size_t take = left < 0 || (long long)buffer_.size() < left ? buffer_.size() : (size_t)left;
+            if (take && !sink(buffer_.data(), take)) {
+                return false;
+            }
+            buffer_.erase(0, take);
+            if (left >= 0 && (left -= take) == 0) {
+                return true;
+            }
+            if (!fill()) {
+                return left < 0;    // no length: the body ends with the connection
+            }
+        }
+    }
+
+    bool read_chunked(const BodySink& sink) {
+        while (true) {
+            size_t line_end;
+            while ((line_end = buffer_.find("\r\n")) == std::string::npos) {
+                if (!fill()) {
+                    return false;
+                }
+            }
+            size_t size = strtoul(buffer_.c_str(), nullptr, 16);
+            buffer_.erase(0, line_end + 2);
+            if (size == 0) {
+                return true;    // trailers are not used
+            }
+            while (size) {
+                if (buffer_.empty() && !fill()) {
+                    return false;
+                }
+                size_t take = std::min(size, buffer_.size());
+                if (!sink(buffer_.data(), take)) {
+                    return false;
+                }
+                buffer_.erase(0, take);
+                size -= take;
+            }
+            while (buffer_.size() < 2) {
+                if (!fill()) {
+                    return false;
+                }
+            }
+            buffer_.erase(0, 2);
+        }
+    }
+
+    bool tls_ = false;
+    std::string host_;
+    std::string port_;
+    int fd_ = -1;
+    std::string buffer_;
+    uint64_t bytes_read_ = 0;
+#ifdef HAVE_OPENSSL
+    SSL_CTX* ctx_ = nullptr;
+    SSL* ssl_ = nullptr;
+#endif
+};
+
+// What one layout shows, with its prebuilt responses
+struct LayoutState {
+    Frame frame;
+    uint32_t sequence;
+    Representation json;
+    Representation binary;
+};
+
+// Result of one poll, immutable once published
+struct Snapshot {
+    std::vector<LayoutState> layouts;
+    uint64_t next_poll_ms;      // when the following poll is due
+};
+
+class Aggregator {
+public:
+    Aggregator(const Fleet& fleet, Upstream& upstream, const std::string& api_key, int interval_s)
+        : fleet_(fleet), upstream_(upstream), interval_s_(interval_s), listen_fd_(-1), epoll_fd_(-1),
+          idle_ms_(AGGREGATOR_IDLE_S * 1000ull), open_connections_(0),
+          polls_(0), failed_polls_(0), requests_(0), not_modified_(0) {
+        if (!api_key.empty()) {
+            authorization_ = "Apikey " + api_key;
+        }
+        path_ = std::string(STIB_RECORDS_PATH AGGREGATOR_QUERY "&where=") + fleet_.lines_query();
+    }
+
+    // One upstream poll; publishes a new snapshot unless it failed. Layouts
+    // whose frame did not change keep their responses and ETags.
+    bool poll() {
+        std::shared_ptr<const Snapshot> previous = current();
+        std::vector<std::pair<uint16_t, uint32_t>> positions;
+        StibParser parser;
+        parser.set_position_sink([&positions](uint16_t line, uint32_t point_id) {
+            positions.emplace_back(line, point_id);
+        });
+        static const StibConfig NONE = StibConfig::defaults();
+
+        bool ok = true, unchanged = false;
+        Animation scratch;
+        for (int page = 0; page < AGGREGATOR_MAX_PAGES && ok; page++) {
+            std::string etag;
+            parser.reset(NONE);
+            const std::string path = path_ + (page ? "&offset=" + std::to_string(page * AGGREGATOR_PAGE_SIZE) : "");
+            int status = upstream_.get(path, authorization_, page ? "" : upstream_etag_, etag,
+                                       [&parser](const char* data, size_t length) {
+                                           return parser.feed(data, length);
+                                       });
+            if (status == 304 && page == 0 && previous) {
+                unchanged = true;
+                break;
+            }
+            ok = status == 200 && parser.finish(scratch);
+            if (!ok) {
+                fprintf(stderr, "STIB poll failed (status %d%s)\n", status,
+                        status == 200 ? ", unparseable response" : "");
+                break;
+            }
+            if (page == 0) {
+                upstream_etag_ = etag;
+            }
+            if (parser.results() < AGGREGATOR_PAGE_SIZE) {
+                break;
+            }
+        }
+
+        polls_++;
+        if (!ok) {
+            failed_polls_++;
+            upstream_etag_.clear();
+            return false;
+        }
+
+        auto snapshot = std::make_shared<Snapshot>();
+        snapshot->next_poll_ms = now_ms() + interval_s_ * 1000ull;
+        if (unchanged) {
+            snapshot->layouts = previous->layouts;
+        } else {
+            build_layouts(positions, previous.get(), *snapshot);
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        snapshot_ = snapshot;
+        last_positions_ = positions.size();
+        return true;
+    }
+
+    void run_polls() {
+        while (true) {
+            const uint64_t started = now_ms();
+            if (poll()) {
+                printf("Poll: %zu vehicles, %zu layouts for %zu displays, %llu KB read so far\n",
+                       last_positions_, fleet_.layouts().size(), fleet_.size(),
+                       (unsigned long long)(upstream_.bytes_read() / 1024));
+                fflush(stdout);
+            }
+            const uint64_t elapsed = now_ms() - started;
+            const uint64_t interval = interval_s_ * 1000ull;
+            std::this_thread::sleep_for(std::chrono::milliseconds(elapsed < interval ? interval - elapsed : 0));
+        }
+    }
+
+    // The complete response to one request
+    std::string handle(const HttpRequest& request) {
+        requests_.fetch_add(1, std::memory_order_relaxed);
+        const std::string route = request.path.substr(0, request.path.find('?'));
+        bool stream;
+        const std::string layout_id = layout_route(request.path, stream);
+        int layout = -1;
+        if (request.method != "GET" || stream) {
+            layout = -1;
+        } else if (route == LAYOUT_REGISTER_PATH) {
+            // Registration: the layout of a MAC, for the display to poll
+            layout = fleet_.layout_of(query_param(request.path, "mac"));
+            if (layout >= 0) {
+                const Representation rep{layout_json(fleet_.layout_id(layout)), "", "application/json"};
+                return response(request, 200, &rep, "Cache-Control: no-cache\r\n");
+            }
+        } else if (!layout_id.empty()) {
+            layout = fleet_.layout_named(layout_id);
+        } else if (route == LEDSTRIPS_PATH) {
+            layout = fleet_.layout_of(query_param(request.path, "mac"));
+        }
+        if (layout < 0) {
+            return response(request, 404, nullptr, "");
+        }
+        std::shared_ptr<const Snapshot> snapshot = current();
+        if (!snapshot) {
+            return response(request, 503, nullptr, "Retry-After: " + std::to_string(interval_s_) + "\r\n");
+        }
+
+        const LayoutState& state = snapshot->layouts[layout];
+        const bool binary = request.accept.find(FRAME_CODEC_CONTENT_TYPE) != std::string::npos;
+        const Representation& rep = binary ? state.binary : state.json;
+        const uint64_t now = now_ms();
+        const uint64_t fresh_s = snapshot->next_poll_ms > now ? (snapshot->next_poll_ms - now + 999) / 1000 : 0;
+        // A layout URL is the same for every display showing it: shared
+        // caches may keep it until the next poll
+        const std::string headers = "ETag: " + rep.etag + "\r\nVary: Accept\r\nCache-Control: " +
+                                    (layout_id.empty() ? "private" : "public") + ", max-age=" +
+                                    std::to_string(fresh_s) + "\r\n";
+        if (etag_matches(request.if_none_match, rep.etag)) {
+            not_modified_.fetch_add(1, std::memory_order_relaxed);
+            return response(request, 304, nullptr, headers);
+        }
+        return response(request, 200, &rep, headers);
+    }
+
+    int listen_on(int port) {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd_, 128) < 0) {
+            perror("bind/listen");
+            return -1;
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(listen_fd_, (sockaddr*)&addr, &len);
+        return ntohs(addr.sin_port);
+    }
+
+    // One thread serves every connection from an epoll loop: a display
+    // costs its socket and buffers, not a thread. Responses are prebuilt, so
+    // no request waits on another.
+    void run() {
+        epoll_fd_ = epoll_create1(0);
+        fcntl(listen_fd_, F_SETFL, fcntl(listen_fd_, F_GETFL) | O_NONBLOCK);
+        watch(listen_fd_, EPOLLIN, EPOLL_CTL_ADD);
+
+        const uint64_t sweep_ms = std::max<uint64_t>(idle_ms_ / 4, 1);
+        uint64_t next_sweep = now_ms() + sweep_ms;
+        epoll_event events[AGGREGATOR_MAX_EVENTS];
+        while (true) {
+            const uint64_t now = now_ms();
+            if (now >= next_sweep) {
+                close_idle(now);
+                next_sweep = now + sweep_ms;
+            }
+            const int count = epoll_wait(epoll_fd_, events, AGGREGATOR_MAX_EVENTS, (int)(next_sweep - now));
+            for (int i = 0; i < count; i++) {
+                if (events[i].data.fd == listen_fd_) {
+                    accept_all();
+                } else {
+                    on_ready(events[i].data.fd);
+                }
+            }
+        }
+    }
+
+    // Before run()
+    void set_idle_ms(uint64_t idle_ms) { idle_ms_ = idle_ms; }
+
+    std::shared_ptr<const Snapshot> current() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return snapshot_;
+    }
+
+    const std::string& upstream_path() const { return path_; }
+    uint32_t polls() const { return polls_; }
+    uint32_t failed_polls() const { return failed_polls_; }
+    uint64_t requests() const { return requests_.load(std::memory_order_relaxed); }
+    uint64_t not_modified() const { return not_modified_.load(std::memory_order_relaxed); }
+    size_t open_connections() const { return open_connections_.load(std::memory_order_relaxed); }
+
+private:
+    // A display's connection, event loop only. Reading pauses while a
+    // response is waiting to be sent, so neither buffer grows unbounded.
+    struct Connection {
+        std::string in;
+        std::string out;
+        uint64_t active_ms;     // last request or bytes sent
+        bool closing;           // after out: the client asked to close
+        bool writing;           // watched for EPOLLOUT instead of EPOLLIN
+    };
+
+    void build_layouts(const std::vector<std::pair<uint16_t, uint32_t>>& positions, const Snapshot* previous,
+                       Snapshot& out) {
+        const std::vector<StibConfig>& layouts = fleet_.layouts();
+        out.layouts.resize(layouts.size());
+        const uint64_t emitted_ms = now_ms();
+        for (size_t i = 0; i < layouts.size(); i++) {
+            Frame frame;
+            for (const auto& position : positions) {
+                int slot = layouts[i].find(position.first, position.second);
+                if (slot >= 0) {
+                    frame.set_led(slot / LEDS_PER_ROW, slot % LEDS_PER_ROW, true);
+                }
+            }
+            if (frame.row_count < layouts[i].row_count()) {
+                frame.row_count = layouts[i].row_count();
+            }
+
+            LayoutState& state = out.layouts[i];
+            if (previous && previous->layouts[i].frame == frame) {
+                state = previous->layouts[i];
+                continue;
+            }
+            state.frame = frame;
+            state.sequence = previous ? previous->layouts[i].sequence + 1 : 1;
+
+            const Animation animation(frame);
+            state.json.body = strips_json(animation);
+            state.json.etag = content_etag(state.json.body, "j");
+            state.json.content_type = "application/json";
+            uint8_t encoded[FRAME_CODEC_MAX_SIZE];
+            const FrameCodecHeader header{FRAME_CODEC_FLAG_SEQUENCE | FRAME_CODEC_FLAG_TIMESTAMP, state.sequence, 0,
+                                          emitted_ms};
+            size_t size = frame_codec_encode(animation, header, encoded, sizeof(encoded));
+            state.binary.body.assign((const char*)encoded, size);
+            state.binary.etag = content_etag(state.binary.body, "b");
+            state.binary.content_type = FRAME_CODEC_CONTENT_TYPE;
+        }
+    }
+
+    static std::string response(const HttpRequest& request, int status, const Representation* rep,
+                                const std::string& headers) {
+        std::string head = "HTTP/1.1 " + std::to_string(status) +
+                           (status == 200 ? " OK" : status == 304 ? " Not Modified" :
+                            status == 503 ? " Service Unavailable" : " Not Found") + "\r\n" + headers;
+        if (!request.keep_alive) {
+            head += "Connection: close\r\n";
+        }
+        if (status == 304) {
+            return head + "\r\n";
+        }
+        const std::string body = rep ? rep->body : "";
+        head += "Content-Type: " + std::string(rep ? rep->content_type : "text/plain") + "\r\n";
+        head += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+        return head + body;
+    }
+
+    void watch(int fd, uint32_t events, int op) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(epoll_fd_, op, fd, &event);
+    }
+
+    void accept_all() {
+        int fd;
+        while ((fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            connections_[fd] = Connection{"", "", now_ms(), false, false};
+            open_connections_.store(connections_.size(), std::memory_order_relaxed);
+            watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+        }
+    }
+
+    void on_ready(int fd) {
+        auto it = connections_.find(fd);
+        if (it == connections_.end()) {
+            return;
+        }
+        Connection& connection = it->second;
+        if (!connection.writing) {
+            char chunk[4096];
+            const ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            if (n <= 0) {
+                close_connection(fd);
+                return;
+            }
+            connection.in.append(chunk, n);
+
+            HttpRequest request;
+            int taken = 0;
+            while (!connection.closing && (taken = take_request(connection.in, request)) > 0) {
+                connection.out += handle(request);
+                connection.closing = !request.keep_alive;
+                connection.active_ms = now_ms();
+            }
+            if (taken < 0) {
+                close_connection(fd);
+                return;
+            }
+        }
+        flush(fd, connection);
+    }
+
+    // Sends what the socket takes, the rest once it is writable again
+    void flush(int fd, Connection& connection) {
+        while (!connection.out.empty()) {
+            const ssize_t n = send(fd, connection.out.data(), connection.out.size(), MSG_NOSIGNAL);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (n <= 0) {
+                close_connection(fd);
+                return;
+            }
+            connection.out.erase(0, n);
+            connection.active_ms = now_ms();
+        }
+        if (connection.out.empty() && connection.closing) {
+            close_connection(fd);
+            return;
+        }
+        const bool writing = !connection.out.empty();
+        if (writing != connection.writing) {
+            connection.writing = writing;
+            watch(fd, writing ? EPOLLOUT : EPOLLIN, EPOLL_CTL_MOD);
+        }
+    }
+
+    void close_idle(uint64_t now) {
+        std::vector<int> idle;
+        for (const auto& entry : connections_) {
+            if (now - entry.second.active_ms >= idle_ms_) {
+                idle.push_back(entry.first);
+            }
+        }
+        for (int fd : idle) {
+            close_connection(fd);
+        }
+    }
+
+    void close_connection(int fd) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        connections_.erase(fd);
+        open_connections_.store(connections_.size(), std::memory_order_relaxed);
+    }
+
+    const Fleet& fleet_;
+    Upstream& upstream_;
+    std::string authorization_;
+    std::string path_;
+    std::string upstream_etag_;
+    int interval_s_;
+    int listen_fd_;
+    int epoll_fd_;
+    uint64_t idle_ms_;
+    std::unordered_map<int, Connection> connections_;
+    std::atomic<size_t> open_connections_;
+
+    mutable std::mutex mutex_;
+    std::shared_ptr<const Snapshot> snapshot_;
+    size_t last_positions_ = 0;
+
+    uint32_t polls_;
+    uint32_t failed_polls_;
+    std::atomic<uint64_t> requests_;
+    std::atomic<uint64_t> not_modified_;
+};
+
+// Self-check
+
+// The STIB API as far as the aggregator sees it: replayed responses, sent
+// chunked, behind the API key, with ETag / 304
+class ReplayUpstream {
+public:
+    explicit ReplayUpstream(StibReplay& replay) : replay_(replay), requests_(0) {}
+
+    int start() {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd_, 16) < 0) {
+            return -1;
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(listen_fd_, (sockaddr*)&addr, &len);
+        std::thread([this]() {
+            while (true) {
+                int fd = accept(listen_fd_, nullptr, nullptr);
+                if (fd >= 0) {
+                    serve(fd);
+                    close(fd);
+                }
+            }
+        }).detach();
+        return ntohs(addr.sin_port);
+    }
+
+    std::string last_path() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return last_path_;
+    }
+    uint32_t requests() const { return requests_; }
+
+private:
+    void serve(int fd) {
+        std::string buffer;
+        HttpRequest request;
+        if (!read_request(fd, buffer, request)) {
+            return;
+        }
+        requests_++;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            last_path_ = request.path;
+        }
+        if (request.authorization != "Apikey " + std::string(SELF_CHECK_KEY)) {
+            send_all(fd, "HTTP/1.1 401 Unauthorized\r\nContent-Length: 2\r\nConnection: close\r\n\r\n{}");
+            return;
+        }
+        Representation rep;
+        replay_.snapshot(rep);
+        if (etag_matches(request.if_none_match, rep.etag)) {
+            send_all(fd, "HTTP/1.1 304 Not Modified\r\nETag: " + rep.etag + "\r\nConnection: close\r\n\r\n");
+            return;
+        }
+        std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nETag: " + rep.etag +
+                                "\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+        for (size_t pos = 0; pos < rep.body.size(); pos += 100) {
+            const std::string chunk = rep.body.substr(pos, 100);
+            char size[16];
+            snprintf(size, sizeof(size), "%zx\r\n", chunk.size());
+            response += size + chunk + "\r\n";
+        }
+        send_all(fd, response + "0\r\n\r\n");
+    }
+
+    static constexpr const char* SELF_CHECK_KEY = "self-check-key";
+    friend int self_check();
+
+    StibReplay& replay_;
+    int listen_fd_ = -1;
+    std::mutex mutex_;
+    std::string last_path_;
+    std::atomic<uint32_t> requests_;
+};
+
+static std::string fleet_mac(size_t i) {
+    char mac[16];
+    snprintf(mac, sizeof(mac), "24dcc3%06zx", i);
+    return mac;
+}
+
+// The display's own direct mode on the same response
+static Frame direct_frame(const StibConfig& stops, const std::string& body) {
+    StibParser parser;
+    Animation animation;
+    parser.reset(stops);
+    parser.feed(body.data(), body.size());
+    parser.finish(animation);
+    return animation.base;
+}
+
+// Average handle() time for a GET with a matching ETag, random displays
+static double request_ns(Aggregator& aggregator, const Fleet& fleet, size_t fleet_size) {
+    std::shared_ptr<const Snapshot> snapshot = aggregator.current();
+    std::vector<HttpRequest> requests(4096);
+    std::mt19937 rng(3);
+    for (HttpRequest& request : requests) {
+        const std::string mac = fleet_mac(rng() % fleet_size);
+        request.method = "GET";
+        request.path = LEDSTRIPS_PATH "?mac=" + mac + "&since=7";
+        request.accept = FRAME_CODEC_CONTENT_TYPE ", application/json;q=0.5";
+        request.if_none_match = snapshot->layouts[fleet.layout_of(mac)].binary.etag;
+    }
+    const int rounds = 50;
+    size_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        for (const HttpRequest& request : requests) {
+            bytes += aggregator.handle(request).size();
+        }
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return bytes ? (double)ns / (rounds * requests.size()) : 0;
+}
+
+int self_check() {
+    StibReplay replay;
+    replay.load(STIB_RECORDINGS_DIR);
+    ReplayUpstream stub(replay);
+    const int stub_port = stub.start();
+    expect(replay.size() >= 2 && stub_port > 0, "replayed STIB API up");
+
+    // Three tables, two of them identical: line 25 only on its own layout
+    StibConfig all, line25 = StibConfig::defaults();
+    expect(load_stops(STIB_RECORDINGS_DIR "/stops.txt", all), "stop table loads");
+    line25.add_point(25, 3517, 0, 5);
+    line25.add_point(25, 2351, 0, 6);
+    line25.add_point(25, 3510, 1, 5);
+    line25.add_point(25, 2397, 1, 6);
+
+    // From a devices file, like the daemon
+    char devices_path[] = "/tmp/stib_aggregator_XXXXXX";
+    int devices_fd = mkstemp(devices_path);
+    std::string devices = "# mac stops\n";
+    for (size_t i = 0; i < 300; i++) {
+        devices += fleet_mac(i) + " " STIB_RECORDINGS_DIR "/stops.txt\n";
+    }
+    expect(devices_fd >= 0 && write(devices_fd, devices.data(), devices.size()) == (ssize_t)devices.size(),
+           "devices file written");
+    close(devices_fd);
+    Fleet fleet;
+    expect(fleet.load(devices_path) && fleet.size() == 300, "devices file loads");
+    unlink(devices_path);
+    for (size_t i = 300; i < 3000; i++) {
+        fleet.add(fleet_mac(i), i % 3 == 2 ? line25 : all);
+    }
+    expect(fleet.size() == 3000 && fleet.layouts().size() == 2, "3000 displays share 2 layouts");
+    expect(!fleet.add(fleet_mac(5), all), "a MAC registers once");
+    expect(fleet.layout_of("24:DC:C3:00:00:05") == fleet.layout_of(fleet_mac(5)), "MAC separators and case ignored");
+
+    Upstream upstream;
+    expect(upstream.set_url("http://127.0.0.1:" + std::to_string(stub_port)), "upstream URL");
+    Aggregator unauthorized(fleet, upstream, "wrong", 20);
+    expect(!unauthorized.poll() && unauthorized.failed_polls() == 1, "poll refused without the right key");
+
+    Aggregator aggregator(fleet, upstream, ReplayUpstream::SELF_CHECK_KEY, 20);
+    HttpRequest request;
+    request.method = "GET";
+    request.path = LEDSTRIPS_PATH "?mac=" + fleet_mac(0);
+    expect(aggregator.handle(request).compare(0, 12, "HTTP/1.1 503") == 0, "503 before the first poll");
+
+    const uint32_t upstream_before = stub.requests();
+    expect(aggregator.poll(), "poll");
+    expect(stub.requests() == upstream_before + 1, "  one upstream request for the whole fleet");
+    const std::string upstream_path = stub.last_path();
+    expect(upstream_path.find("lineid%3D%278%27%20OR%20lineid%3D%2725%27") != std::string::npos,
+           "  for the union of the lines");
+
+    // Every layout matches what the display's direct mode would show
+    std::shared_ptr<const Snapshot> first = aggregator.current();
+    expect(first->layouts[fleet.layout_of(fleet_mac(0))].frame == direct_frame(all, replay.body(0)) &&
+               first->layouts[fleet.layout_of(fleet_mac(302))].frame == direct_frame(line25, replay.body(0)),
+           "  frames match the firmware's direct mode");
+
+    // Over a real connection, as the firmware asks
+    const int port = aggregator.listen_on(0);
+    aggregator.set_idle_ms(1000);
+    std::thread(&Aggregator::run, &aggregator).detach();
+    TestClient client;
+    expect(port > 0 && client.connect_to(port), "serving");
+    const std::string path = LEDSTRIPS_PATH "?mac=" + fleet_mac(302) + "&since=3";
+    const char* accept = FRAME_CODEC_TIMELINE_ACCEPT(FRAME_CODEC_TIMELINE_MAX_ENTRIES) ", application/json;q=0.5";
+    HttpResponse binary, json, response;
+    expect(client.get(path, "", binary, accept) && binary.status == 200 &&
+               frame_codec_is_content_type(binary.content_type.c_str()), "  binary frame");
+    Animation from_binary, from_json;
+    FrameCodecHeader header{};
+    expect(frame_codec_decode((const uint8_t*)binary.body.data(), binary.body.size(), from_binary, &header) &&
+               (header.flags & FRAME_CODEC_FLAG_SEQUENCE) && header.emitted_ms &&
+               from_binary.base == direct_frame(line25, replay.body(0)), "  decodes to the layout's frame");
+    expect(client.get(path, "", json) && json.status == 200 && json.content_type == "application/json",
+           "  JSON strips");
+    StripsParser strips;
+    strips.feed(json.body.data(), json.body.size());
+    expect(strips.finish(from_json) && from_json.base == from_binary.base, "  same frame");
+    expect(client.get(path, binary.etag, response, accept) && response.status == 304, "  304 with the ETag");
+    expect(client.get(LEDSTRIPS_PATH "?mac=ffffffffffff", "", response) && response.status == 404,
+           "  404 for an unknown display");
+
+    // Registration, then the shared layout URL
+    char id[LAYOUT_ID_SIZE];
+    LayoutIdParser layout_parser;
+    expect(client.get(LAYOUT_REGISTER_PATH "?mac=" + fleet_mac(302), "", response) && response.status == 200 &&
+               layout_parser.feed(response.body.data(), response.body.size()) && layout_parser.finish(id) &&
+               fleet.layout_named(id) == fleet.layout_of(fleet_mac(302)), "registration gives the layout");
+    expect(client.get(LAYOUT_REGISTER_PATH "?mac=ffffffffffff", "", response) && response.status == 404,
+           "  404 for an unknown display");
+    const std::string layout_path = std::string(LEDSTRIPS_LAYOUT_PATH) + id + "?since=3";
+    expect(client.get(layout_path, "", response, accept) && response.status == 200 && response.body == binary.body &&
+               response.cache_control.compare(0, 15, "public, max-age") == 0 &&
+               binary.cache_control.compare(0, 16, "private, max-age") == 0,
+           "  same frame as by MAC, public instead of private");
+    expect(client.get(LEDSTRIPS_LAYOUT_PATH "0000", "", response) && response.status == 404,
+           "  404 for an unknown layout");
+
+    // Same upstream state: answered 304 upstream, ETags stay
+    expect(aggregator.poll() && stub.requests() == upstream_before + 2, "poll again");
+    expect(client.get(path, binary.etag, response, accept) && response.status == 304, "  ETag unchanged");
+
+    // Next recording: changed layouts get a new sequence and ETag
+    replay.advance();
+    expect(aggregator.poll(), "poll after the feed changed");
+    std::shared_ptr<const Snapshot> second = aggregator.current();
+    const LayoutState& next = second->layouts[fleet.layout_of(fleet_mac(302))];
+    expect(next.frame == direct_frame(line25, replay.body(1)) && next.sequence == 2,
+           "  new frame, next sequence");
+    expect(client.get(path, binary.etag, response, accept) && response.status == 200 && response.etag == next.binary.etag,
+           "  200 with the new ETag");
+
+    // Every connection on the one event loop thread, idle ones closed
+    std::vector<std::unique_ptr<TestClient>> fleet_clients;
+    size_t answered = 0;
+    for (int i = 0; i < 200; i++) {
+        fleet_clients.emplace_back(new TestClient());
+        answered += fleet_clients.back()->connect_to(port);
+    }
+    for (auto& fleet_client : fleet_clients) {
+        answered += fleet_client->get(path, binary.etag, response, accept) && response.status == 200;
+    }
+    expect(answered == 400 && aggregator.open_connections() == 201, "200 more displays kept alive at once");
+    std::this_thread::sleep_for(std::chrono::milliseconds(1600));
+    expect(aggregator.open_connections() == 0 && !client.get(path, "", response, accept),
+           "  all closed after a second without a request");
+
+    // Request cost does not grow with the fleet
+    printf("Request cost (handle(), 304 path):\n");
+    double smallest = 0, largest = 0;
+    for (size_t size : {100, 10000, 100000}) {
+        Fleet sized;
+        for (size_t i = 0; i < size; i++) {
+            sized.add(fleet_mac(i), i % 3 == 2 ? line25 : all);
+        }
+        Aggregator sized_aggregator(sized, upstream, ReplayUpstream::SELF_CHECK_KEY, 20);
+        sized_aggregator.poll();
+        const double ns = request_ns(sized_aggregator, sized, size);
+        printf("  %6zu displays: %6.0f ns per request\n", size, ns);
+        (size == 100 ? smallest : largest) = ns;
+    }
+    expect(largest > 0 && largest < smallest * 4, "  100000 displays cost about what 100 do");
+
+    return self_check_result();
+}
+
+int main(int argc, char** argv) {
+    std::string devices_path;
+    std::string url = AGGREGATOR_DEFAULT_URL;
+    int port = AGGREGATOR_DEFAULT_PORT;
+    int interval_s = AGGREGATOR_DEFAULT_INTERVAL_S;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--devices") && i + 1 < argc) {
+            devices_path = argv[++i];
+        } else if (!strcmp(argv[i], "--stib-url") && i + 1 < argc) {
+            url = argv[++i];
+        } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--interval") && i + 1 < argc) {
+            interval_s = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--self-check")) {
+            return self_check();
+        } else {
+            devices_path.clear();
+            break;
+        }
+    }
+    if (devices_path.empty() || interval_s <= 0) {
+        fprintf(stderr, "usage: %s --devices FILE [--port N] [--interval S] [--stib-url URL] | --self-check\n"
+                "       API key in $STIB_API_KEY\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Fleet fleet;
+    Upstream upstream;
+    if (!fleet.load(devices_path) || !upstream.set_url(url)) {
+        return EXIT_FAILURE;
+    }
+    const char* key = getenv("STIB_API_KEY");
+    Aggregator aggregator(fleet, upstream, key ? key : "", interval_s);
+    if (aggregator.listen_on(port) < 0) {
+        return EXIT_FAILURE;
+    }
+    printf("%zu displays in %zu layouts, polling %s every %d s, serving %s on port %d\n", fleet.size(),
+           fleet.layouts().size(), url.c_str(), interval_s, LEDSTRIPS_PATH, port);
+
+    std::thread(&Aggregator::run_polls, &aggregator).detach();
+    aggregator.run();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,501 @@
+// strips_parser_bench.cpp
+// Correctness and speed of the streaming ledstrips parser (StripsParser).
+//  - corpus: fuzz/strips/ok_*.json must parse, bad_*.json must be rejected
+//  - generated payloads are checked against an independent model
+//  - every input, including mutated ones, must give the same result whether
+//    it is fed at once, byte by byte or in random chunks
+//  - with cJSON available (HAVE_CJSON) the former DOM path is the reference
+// Then times both parsers and counts their heap allocations per payload.
+// Exits non-zero on any mismatch.
+#include "animation.h"
+#include "strips_parser.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_CJSON
+#include "cJSON.h"
+#endif
+
+#ifndef STRIPS_CORPUS_DIR
+#define STRIPS_CORPUS_DIR "fuzz/strips"
+#endif
+
+#define BENCH_GENERATED 2000
+#define BENCH_MUTATIONS 20000
+#define BENCH_TIMING_ROUNDS 2000
+
+// Heap allocations made through operator new while counting is on
+static bool count_allocations = false;
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    if (count_allocations) {
+        allocations++;
+    }
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static int failures = 0;
+
+static bool same_animation(const Animation& a, const Animation& b) {
+    if (a.base != b.base || a.effect_count != b.effect_count) {
+        return false;
+    }
+    for (uint8_t e = 0; e < a.effect_count; e++) {
+        const LEDEffect& x = a.effects[e];
+        const LEDEffect& y = b.effects[e];
+        if (x.row != y.row || x.led != y.led || x.period_ms != y.period_ms ||
+            x.on_ms != y.on_ms || x.phase_ms != y.phase_ms) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool parse_chunked(const std::string& json, size_t chunk, Animation& out) {
+    static StripsParser parser;     // as in LEDUpdater, not on the stack
+    parser.reset();
+    for (size_t pos = 0; pos < json.size(); pos += chunk) {
+        if (!parser.feed(json.data() + pos, std::min(chunk, json.size() - pos))) {
+            return false;
+        }
+    }
+    return parser.finish(out);
+}
+
+static bool parse_random_chunks(const std::string& json, std::mt19937& rng, Animation& out) {
+    static StripsParser parser;
+    parser.reset();
+    size_t pos = 0;
+    while (pos < json.size()) {
+        size_t chunk = std::min<size_t>(1 + rng() % 700, json.size() - pos);
+        if (!parser.feed(json.data() + pos, chunk)) {
+            return false;
+        }
+        pos += chunk;
+    }
+    return parser.finish(out);
+}
+
+// Parses at once, per byte and in random chunks; all three must agree
+static bool parse_checked(const std::string& json, std::mt19937& rng, Animation& out, const char* name) {
+    Animation bytewise, chunked;
+    bool ok = parse_chunked(json, json.size() ? json.size() : 1, out);
+    bool ok_bytewise = parse_chunked(json, 1, bytewise);
+    bool ok_chunked = parse_random_chunks(json, rng, chunked);
+
+    if (ok != ok_bytewise || ok != ok_chunked ||
+        (ok && (!same_animation(out, bytewise) || !same_animation(out, chunked)))) {
+        printf("FAIL  %s: result depends on chunking\n", name);
+        failures++;
+    }
+    return ok;
+}
+
+#ifdef HAVE_CJSON
+static size_t cjson_allocations = 0;
+
+static void* counting_malloc(size_t size) {
+    cjson_allocations++;
+    return malloc(size);
+}
+
+// The DOM path LEDUpdater used before StripsParser, kept as the reference
+struct StripData {
+    int h;
+    std::vector<uint8_t> values;
+    std::vector<LEDEffect> effects;
+};
+
+static bool reference_parse(const char* json, Animation& animation) {
+    cJSON* root = cJSON_Parse(json);
+    if (!root) {
+        return false;
+    }
+
+    cJSON* strips = cJSON_GetObjectItem(root, "strips");
+    if (!cJSON_IsArray(strips)) {
+        cJSON_Delete(root);
+        return false;
+    }
+
+    std::vector<StripData> strips_out;
+    cJSON* strip = nullptr;
+    cJSON_ArrayForEach(strip, strips) {
+        StripData data{};
+
+        cJSON* h = cJSON_GetObjectItem(strip, "h");
+        if (!cJSON_IsNumber(h)) {
+            continue;
+        }
+        data.h = h->valueint;
+
+        cJSON* v = cJSON_GetObjectItem(strip, "v");
+        if (!cJSON_IsArray(v)) {
+            continue;
+        }
+
+        cJSON* val = nullptr;
+        cJSON_ArrayForEach(val, v) {
+            uint8_t state = (cJSON_IsTrue(val) || (cJSON_IsNumber(val) && val->valueint != 0)) ? 1 : 0;
+            data.values.push_back(state);
+        }
+
+        cJSON* fx = cJSON_GetObjectItem(strip, "fx");
+        if (cJSON_IsArray(fx)) {
+            cJSON* effect = nullptr;
+            cJSON_ArrayForEach(effect, fx) {
+                cJSON* i = cJSON_GetObjectItem(effect, "i");
+                cJSON* p = cJSON_GetObjectItem(effect, "p");
+                if (!cJSON_IsNumber(i) || !cJSON_IsNumber(p) || i->valueint < 0 || p->valueint <= 0) {
+                    continue;
+                }
+                cJSON* on = cJSON_GetObjectItem(effect, "on");
+                cJSON* o = cJSON_GetObjectItem(effect, "o");
+
+                LEDEffect e{};
+                e.led = (uint8_t)i->valueint;
+                e.period_ms = (uint16_t)std::min(p->valueint, 0xFFFF);
+                e.on_ms = cJSON_IsNumber(on) ? (uint16_t)std::min(std::max(on->valueint, 0), 0xFFFF) : e.period_ms / 2;
+                e.phase_ms = cJSON_IsNumber(o) ? (uint16_t)(std::max(o->valueint, 0) % e.period_ms) : 0;
+                data.effects.push_back(e);
+            }
+        }
+
+        strips_out.push_back(std::move(data));
+    }
+    cJSON_Delete(root);
+
+    std::stable_sort(strips_out.begin(), strips_out.end(),
+                     [](const StripData& a, const StripData& b) { return a.h < b.h; });
+    if (strips_out.empty()) {
+        return false;
+    }
+
+    animation.effect_count = 0;
+    Frame& frame = animation.base;
+    frame.clear();
+    size_t row_count = std::min(strips_out.size(), (size_t)LED_MAX_ROWS);
+    for (size_t r = 0; r < row_count; r++) {
+        for (size_t i = 0; i < strips_out[r].values.size() && i < LEDS_PER_ROW; i++) {
+            frame.set_led(r, i, strips_out[r].values[i] != 0);
+        }
+    }
+    frame.row_count = row_count;
+    for (size_t r = 0; r < row_count; r++) {
+        for (const auto& e : strips_out[r].effects) {
+            animation.add_effect(r, e.led, e.period_ms, e.on_ms, e.phase_ms);
+        }
+    }
+    return true;
+}
+
+static int reference_disagreements = 0;
+
+static void compare_reference(const std::string& json, bool ok, const Animation& streamed, const char* name) {
+    Animation reference;
+    bool reference_ok = reference_parse(json.c_str(), reference);
+    if (ok && reference_ok && !same_animation(streamed, reference)) {
+        printf("FAIL  %s: differs from the cJSON path\n", name);
+        failures++;
+    } else if (ok != reference_ok) {
+        // Malformed input on which the two tokenizers differ (e.g. nesting
+        // deeper than STRIPS_PARSER_MAX_DEPTH); reported, not fatal
+        reference_disagreements++;
+    }
+}
+#endif
+
+// Payload generator with its own model of the expected result
+struct GeneratedStrip {
+    int h;
+    uint16_t mask;
+    std::vector<LEDEffect> effects;     // valid ones, in document order
+};
+
+static std::string whitespace(std::mt19937& rng) {
+    static const char* SPACES[] = {"", "", "", " ", "\n  ", "\t", "\r\n"};
+    return SPACES[rng() % 7];
+}
+
+static std::string junk_value(std::mt19937& rng, int depth) {
+    switch (rng() % (depth > 2 ? 4 : 6)) {
+        case 0: return std::to_string((int)(rng() % 2000) - 1000);
+        case 1: return "\"s\\\"tr\\u00e9\\n\"";
+        case 2: return rng() % 2 ? "true" : "null";
+        case 3: return "-12.5e-1";
+        case 4: return "[" + junk_value(rng, depth + 1) + "," + whitespace(rng) + junk_value(rng, depth + 1) + "]";
+        default: return "{\"k\":" + junk_value(rng, depth + 1) + ",\"fx\":{}}";
+    }
+}
+
+static std::string generate_payload(std::mt19937& rng, Animation& expected) {
+    const int strip_count = rng() % 10 == 0 ? 64 + rng() % 40 : 1 + rng() % 20;
+    std::vector<int> hs(200);
+    for (int i = 0; i < 200; i++) {
+        hs[i] = i - 20;
+    }
+    std::shuffle(hs.begin(), hs.end(), rng);
+
+    std::vector<GeneratedStrip> model;
+    int effects_left = 40;  // stays under the parser's effect buffer
+    std::string json = "{" + whitespace(rng);
+    if (rng() % 3 == 0) {
+        json += "\"meta\":" + junk_value(rng, 0) + ",";
+    }
+    json += "\"strips\":" + whitespace(rng) + "[";
+
+    for (int s = 0; s < strip_count; s++) {
+        GeneratedStrip strip{hs[s], 0, {}};
+        std::vector<std::string> fields;
+        fields.push_back(std::string(rng() % 8 ? "\"h\":" : "\"H\":") + std::to_string(strip.h));
+
+        std::string values = "[";
+        int value_count = rng() % 16;
+        for (int i = 0; i < value_count; i++) {
+            bool on = rng() % 2;
+            static const char* ON[] = {"1", "true", "2", "1.5", "-3"};
+            static const char* OFF[] = {"0", "false", "null", "0.5", "\"1\"", "-0", "{}", "[1]"};
+            values += (i ? "," : "") + whitespace(rng) + (on ? ON[rng() % 5] : OFF[rng() % 8]);
+            if (on && i < LEDS_PER_ROW) {
+                strip.mask |= 1u << i;
+            }
+        }
+        fields.push_back("\"v\":" + values + "]");
+
+        if (effects_left > 0 && rng() % 3 == 0) {
+            std::string fx = "[";
+            int effect_count = 1 + rng() % 3;
+            for (int e = 0; e < effect_count && effects_left > 0; e++, effects_left--) {
+                int led = rng() % 14;
+                int period = rng() % 5 == 0 ? 0 : 40 + rng() % 2000;
+                bool has_on = rng() % 2, has_phase = rng() % 2;
+                int on = (int)(rng() % 2500) - 100;
+                int phase = (int)(rng() % 5000) - 100;
+                fx += std::string(e ? "," : "") + "{\"i\":" + std::to_string(led) + ",\"p\":" + std::to_string(period);
+                if (has_on) fx += ",\"on\":" + std::to_string(on);
+                if (has_phase) fx += ",\"o\":" + std::to_string(phase);
+                fx += "}";
+
+                if (period > 0 && led < LEDS_PER_ROW) {
+                    LEDEffect effect{};
+                    effect.led = led;
+                    effect.period_ms = period;
+                    effect.on_ms = has_on ? std::min(std::max(on, 0), 0xFFFF) : period / 2;
+                    effect.phase_ms = has_phase ? std::max(phase, 0) % period : 0;
+                    strip.effects.push_back(effect);
+                }
+            }
+            fields.push_back("\"fx\":" + fx + "]");
+        }
+        if (rng() % 4 == 0) {
+            fields.push_back("\"extra\":" + junk_value(rng, 0));
+        }
+
+        std::shuffle(fields.begin(), fields.end(), rng);
+        json += (s ? "," : "") + whitespace(rng) + "{";
+        for (size_t f = 0; f < fields.size(); f++) {
+            json += (f ? "," : "") + whitespace(rng) + fields[f];
+        }
+        json += "}";
+        model.push_back(strip);
+    }
+    json += whitespace(rng) + "]}" + whitespace(rng);
+
+    std::sort(model.begin(), model.end(), [](const GeneratedStrip& a, const GeneratedStrip& b) { return a.h < b.h; });
+    size_t rows = std::min(model.size(), (size_t)LED_MAX_ROWS);
+    expected = Animation();
+    for (size_t r = 0; r < rows; r++) {
+        expected.base.rows[r] = model[r].mask;
+    }
+    expected.base.row_count = rows;
+    for (size_t r = 0; r < rows; r++) {
+        for (const LEDEffect& e : model[r].effects) {
+            expected.add_effect(r, e.led, e.period_ms, e.on_ms, e.phase_ms);
+        }
+    }
+    return json;
+}
+
+static std::string mutate(const std::string& input, std::mt19937& rng) {
+    static const char STRUCTURAL[] = "{}[],:\"\\0123456789-.eEtrufalsn \n";
+    std::string out = input;
+    int edits = 1 + rng() % 4;
+    for (int e = 0; e < edits && !out.empty(); e++) {
+        size_t pos = rng() % out.size();
+        switch (rng() % 5) {
+            case 0: out[pos] = STRUCTURAL[rng() % (sizeof(STRUCTURAL) - 1)]; break;
+            case 1: out.erase(pos, 1 + rng() % 8); break;
+            case 2: out.insert(pos, 1, STRUCTURAL[rng() % (sizeof(STRUCTURAL) - 1)]); break;
+            case 3: out.resize(pos); break;
+            default: out.insert(pos, out.substr(rng() % out.size(), 1 + rng() % 16)); break;
+        }
+    }
+    return out;
+}
+
+static std::vector<std::pair<std::string, std::string>> load_corpus(const std::string& dir) {
+    std::vector<std::pair<std::string, std::string>> corpus;
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        printf("FAIL  corpus directory %s not found\n", dir.c_str());
+        failures++;
+        return corpus;
+    }
+    while (dirent* entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name.size() < 5 || name.compare(name.size() - 5, 5, ".json") != 0) {
+            continue;
+        }
+        std::ifstream file(dir + "/" + name, std::ios::binary);
+        std::stringstream content;
+        content << file.rdbuf();
+        corpus.emplace_back(name, content.str());
+    }
+    closedir(d);
+    std::sort(corpus.begin(), corpus.end());
+    return corpus;
+}
+
+static void time_parser(const char* label, const std::string& json) {
+    static StripsParser parser;
+    Animation out;
+
+    allocations = 0;
+    count_allocations = true;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < BENCH_TIMING_ROUNDS; round++) {
+        parser.reset();
+        for (size_t pos = 0; pos < json.size(); pos += 512) {    // HTTPS_CLIENT_CHUNK_SIZE
+            parser.feed(json.data() + pos, std::min<size_t>(512, json.size() - pos));
+        }
+        parser.finish(out);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    count_allocations = false;
+
+    printf("stream  %-10s %6zu bytes  %8.2f us/parse  %5.1f allocs/parse\n", label, json.size(),
+           std::chrono::duration<double, std::micro>(elapsed).count() / BENCH_TIMING_ROUNDS,
+           (double)allocations / BENCH_TIMING_ROUNDS);
+
+#ifdef HAVE_CJSON
+    cjson_allocations = 0;
+    allocations = 0;
+    count_allocations = true;
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < BENCH_TIMING_ROUNDS; round++) {
+        reference_parse(json.c_str(), out);
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+    count_allocations = false;
+
+    printf("cJSON   %-10s %6zu bytes  %8.2f us/parse  %5.1f allocs/parse\n", label, json.size(),
+           std::chrono::duration<double, std::micro>(elapsed).count() / BENCH_TIMING_ROUNDS,
+           (double)(allocations + cjson_allocations) / BENCH_TIMING_ROUNDS);
+#endif
+}
+
+int main(int argc, char** argv) {
+    std::mt19937 rng(2024);
+    const std::string corpus_dir = argc > 1 ? argv[1] : STRIPS_CORPUS_DIR;
+
+#ifdef HAVE_CJSON
+    cJSON_Hooks hooks = {counting_malloc, free};
+    cJSON_InitHooks(&hooks);
+#else
+    printf("cJSON not found, comparing against the generator model only\n");
+#endif
+
+    // 1. Corpus
+    auto corpus = load_corpus(corpus_dir);
+    for (const auto& entry : corpus) {
+        Animation out;
+        bool ok = parse_checked(entry.second, rng, out, entry.first.c_str());
+        bool expect_ok = entry.first.compare(0, 3, "ok_") == 0;
+        if (ok != expect_ok) {
+            printf("FAIL  %s: %s\n", entry.first.c_str(), ok ? "accepted" : "rejected");
+            failures++;
+        }
+#ifdef HAVE_CJSON
+        compare_reference(entry.second, ok, out, entry.first.c_str());
+#endif
+    }
+    printf("corpus      %zu files\n", corpus.size());
+
+    // 2. Generated payloads against the model
+    std::vector<std::string> seeds;
+    for (const auto& entry : corpus) {
+        seeds.push_back(entry.second);
+    }
+    for (int n = 0; n < BENCH_GENERATED; n++) {
+        Animation expected, out;
+        std::string json = generate_payload(rng, expected);
+        bool ok = parse_checked(json, rng, out, "generated");
+        if (!ok || !same_animation(out, expected)) {
+            printf("FAIL  generated payload %d %s\n%s\n", n, ok ? "differs from the model" : "rejected", json.c_str());
+            failures++;
+            break;
+        }
+#ifdef HAVE_CJSON
+        compare_reference(json, ok, out, "generated");
+#endif
+        if (n < 200) {
+            seeds.push_back(json);
+        }
+    }
+    printf("generated   %d payloads\n", BENCH_GENERATED);
+
+    // 3. Mutations: no crash, chunking invariance, reference agreement
+    int accepted = 0;
+    for (int n = 0; n < BENCH_MUTATIONS; n++) {
+        std::string json = mutate(seeds[rng() % seeds.size()], rng);
+        Animation out;
+        bool ok = parse_checked(json, rng, out, "mutation");
+        accepted += ok;
+#ifdef HAVE_CJSON
+        compare_reference(json, ok, out, "mutation");
+#endif
+    }
+    printf("mutations   %d inputs, %d still accepted\n", BENCH_MUTATIONS, accepted);
+#ifdef HAVE_CJSON
+    printf("reference   %d accept/reject disagreements on malformed input\n", reference_disagreements);
+#endif
+
+    // 4. Timing
+    Animation unused;
+    std::string small, large;
+    for (const auto& entry : corpus) {
+        if (entry.first == "ok_unsorted_fx.json") small = entry.second;
+        if (entry.first == "ok_large.json") large = entry.second;
+    }
+    std::string typical = generate_payload(rng, unused);
+    while (typical.size() < 3000 || typical.size() > 5000) {
+        typical = generate_payload(rng, unused);
+    }
+    if (!small.empty()) time_parser("small", small);
+    time_parser("typical", typical);
+    if (!large.empty()) time_parser("large", large);
+
+    if (failures) {
+        printf("FAILED: %d checks\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("OK\n");
+    return EXIT_SUCCESS;
+}